@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "constexpr_hashmap.hpp"
+
+// Build with optimizations, e.g.
+//   g++ -std=c++20 -O3 -march=native -DNDEBUG bench.cpp -o bench
+// The maps of up to 4096 keys are built by the compiler, the larger ones at
+// startup through the same constructor. Every table times random successful
+// lookups against std::unordered_map and, up to 4096 keys, the linear scan
+// hash_map used before.
+
+namespace {
+using key_type = std::uint64_t;
+using value_type = std::uint64_t;
+
+template <std::size_t N>
+using elements_type = std::array<std::pair<key_type, value_type>, N>;
+
+constexpr std::size_t lookups = std::size_t{1} << 22;
+constexpr std::size_t max_linear = 4096;
+
+// Distinct, unordered keys
+template <std::size_t N>
+constexpr void fill_elements(elements_type<N> &elements) noexcept {
+  for (std::size_t i = 0; i < N; ++i) {
+    elements[i] = {hmap::ct::detail::mix(i + 1), i};
+  }
+}
+
+template <std::size_t N>
+std::vector<key_type> random_keys(const elements_type<N> &elements) {
+  std::vector<key_type> keys(lookups);
+  std::uint64_t state = 42;
+  for (auto &key : keys) {
+    state = hmap::ct::detail::mix(state);
+    key = elements[state % N].first;
+  }
+  return keys;
+}
+
+template <typename F> double best_seconds(F &&f) {
+  double best = 1e30;
+  for (int rep = 0; rep < 5; ++rep) {
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    best = std::min(best, std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - start)
+                              .count());
+  }
+  return best;
+}
+
+volatile value_type sink;
+
+template <std::size_t N, typename Map>
+void bench_lookup(const Map &map, const elements_type<N> &elements,
+                  double build_seconds) {
+  const auto keys = random_keys<N>(elements);
+
+  const double perfect = best_seconds([&] {
+    value_type sum = 0;
+    for (const key_type key : keys) {
+      sum += map.find(key)->second;
+    }
+    sink = sum;
+  });
+
+  const std::unordered_map<key_type, value_type> unordered(elements.begin(),
+                                                           elements.end());
+  const double baseline = best_seconds([&] {
+    value_type sum = 0;
+    for (const key_type key : keys) {
+      sum += unordered.find(key)->second;
+    }
+    sink = sum;
+  });
+
+  std::cout << std::setw(7) << N << " keys: hash_map "
+            << perfect / lookups * 1e9 << " ns, unordered_map "
+            << baseline / lookups * 1e9 << " ns";
+  if constexpr (N <= max_linear) {
+    const double linear = best_seconds([&] {
+      value_type sum = 0;
+      for (std::size_t i = 0; i < keys.size(); i += 64) {
+        sum += std::find_if(elements.begin(), elements.end(),
+                            [&](const auto &element) {
+                              return element.first == keys[i];
+                            })
+                   ->second;
+      }
+      sink = sum;
+    });
+    std::cout << ", linear " << linear / (lookups / 64) * 1e9 << " ns";
+  }
+  if (build_seconds > 0) {
+    std::cout << ", runtime build " << build_seconds * 1e3 << " ms";
+  }
+  std::cout << '\n';
+}
+
+template <std::size_t N> void bench_compile_time() {
+  static constexpr auto elements = [] {
+    elements_type<N> elements{};
+    fill_elements<N>(elements);
+    return elements;
+  }();
+  static constexpr hmap::ct::hash_map<N, key_type, value_type> map(elements);
+  bench_lookup<N>(map, elements, 0);
+}
+
+template <std::size_t N> void bench_runtime() {
+  // both are too large for the stack
+  const auto elements = std::make_unique<elements_type<N>>();
+  fill_elements<N>(*elements);
+  const auto start = std::chrono::steady_clock::now();
+  const auto map = std::make_unique<hmap::ct::hash_map<N, key_type, value_type>>(
+      *elements);
+  const double build = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+  bench_lookup<N>(*map, *elements, build);
+}
+} // namespace
+
+int main() {
+  bench_compile_time<8>();
+  bench_compile_time<64>();
+  bench_compile_time<512>();
+  bench_compile_time<4096>();
+  bench_runtime<32768>();
+  bench_runtime<100000>();
+}
@@ -1,30 +1,127 @@
 #ifndef CONSTEXPR_HASH_MAP_CONSTEXPR_HASH_MAP_HPP
 #define CONSTEXPR_HASH_MAP_CONSTEXPR_HASH_MAP_HPP
 
+#include <algorithm>
 #include <array>
+#include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <iterator>
+#include <limits>
+#include <string_view>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 namespace hmap::ct {
-template <std::size_t N, typename K, typename V> class hash_map {
+namespace detail {
+// splitmix64 finalizer, a bijection that spreads every input bit over the
+// whole output
+[[nodiscard]] constexpr std::uint64_t mix(std::uint64_t x) noexcept {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+// FNV-1a over the characters, finalized with mix
+template <typename It>
+[[nodiscard]] constexpr std::uint64_t hash_chars(It first, It last,
+                                                 std::uint64_t seed) noexcept {
+  std::uint64_t h = 0xcbf29ce484222325ULL ^ seed;
+  for (; first != last; ++first) {
+    h ^= static_cast<unsigned char>(*first);
+    h *= 0x100000001b3ULL;
+  }
+  return mix(h);
+}
+
+// Not constexpr: reaching it while building a map in a constant expression
+// fails compilation naming the cause, at runtime it reports the cause and
+// aborts
+[[noreturn]] inline void build_failed(const char *cause) noexcept {
+  std::fprintf(stderr, "hmap::ct::hash_map: %s\n", cause);
+  std::abort();
+}
+} // namespace detail
+
+/**
+ * Seeded 64-bit hash of a key of a hash_map. Integral and enum keys are
+ * supported here, strings by the specializations below; specialize it for
+ * other key types. A hasher must spread the seed over its whole result: a map
+ * whose keys collide under one seed is rebuilt with another, and the build
+ * gives up after a few dozen seeds.
+ */
+template <typename K> struct hash {
+  static_assert(std::is_integral_v<K> || std::is_enum_v<K>,
+                "specialize hmap::ct::hash for this key type");
+
+  [[nodiscard]] constexpr std::uint64_t
+  operator()(const K &key, std::uint64_t seed) const noexcept {
+    return detail::mix(static_cast<std::uint64_t>(key) ^ seed);
+  }
+};
+
+template <> struct hash<std::string_view> {
+  [[nodiscard]] constexpr std::uint64_t
+  operator()(std::string_view key, std::uint64_t seed) const noexcept {
+    return detail::hash_chars(key.begin(), key.end(), seed);
+  }
+};
+
+template <> struct hash<const char *> {
+  [[nodiscard]] constexpr std::uint64_t
+  operator()(const char *key, std::uint64_t seed) const noexcept {
+    return hash<std::string_view>{}(key, seed);
+  }
+};
+
+/**
+ * Immutable map built around a minimal perfect hash of its keys.
+ *
+ * The constructor, usable in constant expressions, runs a CHD/PTHash style
+ * displacement search: keys are split into buckets of about four by their
+ * hash, and buckets from the largest down get the first pilot under which all
+ * of their keys land on free slots. A lookup hashes the key once, reads the
+ * pilot of its bucket and compares the one key in its slot. The elements are
+ * stored in slot order, which is the iteration order.
+ *
+ * GCC's default constexpr operation limit fits maps of about 4096 keys;
+ * larger ones need -fconstexpr-ops-limit or are built at runtime.
+ */
+template <std::size_t N, typename K, typename V, typename Hash = hash<K>>
+class hash_map {
 public:
   using key_type = K;
   using value_type = V;
+  using hasher = Hash;
   using size_type = decltype(N);
   using data_type = std::array<std::pair<K, V>, N>;
   using const_iterator = typename data_type::const_iterator;
 
   template <typename... E>
+    requires(std::is_constructible_v<std::pair<K, V>, E> && ...)
   explicit constexpr hash_map(E &&...elements) noexcept
-      : data{std::forward<E>(elements)...} {
-    static_assert(N > 0, "N should be positive");
+      : hash_map(data_type{std::forward<E>(elements)...}) {
     static_assert(N == sizeof...(elements),
                   "Elements size doesn't match expected size of a hash-map");
   }
 
+  explicit constexpr hash_map(const data_type &elements) noexcept
+      : hash_map(elements, build(elements)) {
+    static_assert(N > 0, "N should be positive");
+  }
+
   [[nodiscard]] constexpr const_iterator find(const K &key) const noexcept {
-    return search<0, N>(key);
+    const index_type position = slot(Hash{}(key, seed));
+    if (equal(data[position].first, key)) {
+      return std::next(cbegin(), position);
+    }
+    return cend();
   }
 
   [[nodiscard]] constexpr std::pair<bool, const V &>
@@ -43,7 +140,7 @@ public:
   }
 
   [[nodiscard]] constexpr bool contains(const K &key) const noexcept {
-    return search<0, N>(key) != cend();
+    return find(key) != cend();
   }
 
   [[nodiscard]] constexpr size_type size() const noexcept {
@@ -68,32 +165,203 @@ public:
 
 protected:
   using index_type = size_type;
+  using pilot_type = std::uint32_t;
+
+  static constexpr index_type keys_per_bucket = 4;
+  static constexpr index_type bucket_count =
+      (N + keys_per_bucket - 1) / keys_per_bucket;
+  // Pilots place keys in a table an eighth larger than N, which spares the
+  // last buckets from hunting for the last few free slots; the slots past N
+  // taken in the end are remapped onto the ones left free below it
+  static constexpr index_type table_size = N + N / 8;
+
+  // Pilots tried for one bucket before the build starts over with another
+  // seed, far more than the few hundred a bucket takes
+  static constexpr std::uint64_t max_pilot = std::min<std::uint64_t>(
+      64 * std::uint64_t{N} + 1024, std::numeric_limits<pilot_type>::max());
+
+  [[nodiscard]] static constexpr index_type
+  bucket(std::uint64_t h) noexcept {
+    return static_cast<index_type>((h >> 32) % bucket_count);
+  }
+
+  [[nodiscard]] static constexpr index_type
+  position(std::uint64_t h, pilot_type pilot) noexcept {
+    return static_cast<index_type>(
+        detail::mix(h ^ (pilot * 0x9e3779b97f4a7c15ULL)) % table_size);
+  }
+
+  // Seeds tried before the build gives up; one almost always succeeds
+  static constexpr std::uint64_t max_attempts = 64;
 
-  template <index_type L, index_type R>
-  [[nodiscard]] constexpr const_iterator search(const K &key) const noexcept {
-    if constexpr (L < R) {
-      if (equal(data[L].first, key)) {
-        return std::next(cbegin(), L);
+  [[nodiscard]] static constexpr index_type
+  slot(std::uint64_t h, const std::array<pilot_type, bucket_count> &pilots,
+       const std::array<index_type, table_size - N> &remap) noexcept {
+    const index_type p = position(h, pilots[bucket(h)]);
+    return p < N ? p : remap[p - N];
+  }
+
+  [[nodiscard]] constexpr index_type slot(std::uint64_t h) const noexcept {
+    return slot(h, pilots, remap);
+  }
+
+  // Everything the search finds: the element of every slot, and the pilots,
+  // remapped slots and seed that lead a key to its slot
+  struct layout {
+    std::vector<index_type> order;
+    std::array<pilot_type, bucket_count> pilots{};
+    std::array<index_type, table_size - N> remap{};
+    std::uint64_t seed = 0;
+  };
+
+  constexpr hash_map(const data_type &elements, const layout &found) noexcept
+      : data(arrange(elements, found.order)), pilots(found.pilots),
+        remap(found.remap), seed(found.seed) {}
+
+  // The elements in slot order. Elements that cannot be default constructed
+  // and assigned are copied straight into place by a pack expansion, whose
+  // compile time grows quickly with N, the others by a loop
+  [[nodiscard]] static constexpr data_type
+  arrange(const data_type &elements,
+          const std::vector<index_type> &order) noexcept {
+    using element_type = typename data_type::value_type;
+    if constexpr (std::is_default_constructible_v<element_type> &&
+                  std::is_copy_assignable_v<element_type>) {
+      data_type result{};
+      for (index_type i = 0; i < N; ++i) {
+        result[i] = elements[order[i]];
       }
-      return search<L + 1, R>(key);
+      return result;
+    } else {
+      return [&]<std::size_t... I>(std::index_sequence<I...>) {
+        return data_type{elements[order[I]]...};
+      }(std::make_index_sequence<N>());
     }
+  }
 
-    return cend();
+  [[nodiscard]] static constexpr layout
+  build(const data_type &elements) noexcept {
+    layout found;
+    for (std::uint64_t attempt = 0; attempt < max_attempts; ++attempt) {
+      found.seed = detail::mix(attempt);
+      if (try_build(elements, found)) {
+        return found;
+      }
+    }
+    assert(!"hmap::ct::hash_map: keys collide under every seed");
+    detail::build_failed("keys collide under every seed, does the hasher use "
+                         "the seed?");
+  }
+
+  // Searches pilots for every bucket under the seed of found, false when a
+  // bucket has none within max_pilot or two of its keys hash alike
+  [[nodiscard]] static constexpr bool try_build(const data_type &elements,
+                                                layout &found) noexcept {
+    std::vector<std::uint64_t> hashes(N);
+    std::vector<index_type> start(bucket_count + 1);
+    for (index_type i = 0; i < N; ++i) {
+      hashes[i] = Hash{}(elements[i].first, found.seed);
+      ++start[bucket(hashes[i]) + 1];
+    }
+    for (index_type b = 0; b < bucket_count; ++b) {
+      start[b + 1] += start[b];
+    }
+    // keys grouped by bucket
+    std::vector<index_type> members(N);
+    std::vector<index_type> fill(start.begin(), start.end() - 1);
+    for (index_type i = 0; i < N; ++i) {
+      members[fill[bucket(hashes[i])]++] = i;
+    }
+
+    std::vector<index_type> order(bucket_count);
+    for (index_type b = 0; b < bucket_count; ++b) {
+      order[b] = b;
+    }
+    // largest buckets first, while most slots are still free
+    std::sort(order.begin(), order.end(), [&](index_type lhs, index_type rhs) {
+      const index_type lhs_size = start[lhs + 1] - start[lhs];
+      const index_type rhs_size = start[rhs + 1] - start[rhs];
+      return lhs_size != rhs_size ? lhs_size > rhs_size : lhs < rhs;
+    });
+
+    std::vector<unsigned char> taken(table_size);
+    std::vector<index_type> placed(N);
+    for (const index_type b : order) {
+      const index_type first = start[b];
+      const index_type last = start[b + 1];
+      if (first == last) {
+        break;
+      }
+      for (index_type i = first; i < last; ++i) {
+        for (index_type j = first; j < i; ++j) {
+          if (hashes[members[i]] == hashes[members[j]]) {
+            if (equal(elements[members[i]].first,
+                      elements[members[j]].first)) {
+              assert(!"hmap::ct::hash_map: duplicate key");
+              detail::build_failed("duplicate key");
+            }
+            return false;
+          }
+        }
+      }
+      std::uint64_t pilot = 0;
+      for (;; ++pilot) {
+        if (pilot == max_pilot) {
+          return false;
+        }
+        index_type i = first;
+        for (; i < last; ++i) {
+          const index_type p =
+              position(hashes[members[i]], static_cast<pilot_type>(pilot));
+          if (taken[p]) {
+            break;
+          }
+          taken[p] = 1;
+          placed[members[i]] = p;
+        }
+        if (i == last) {
+          break;
+        }
+        // release the slots of the keys placed under this pilot
+        for (index_type j = first; j < i; ++j) {
+          taken[placed[members[j]]] = 0;
+        }
+      }
+      found.pilots[b] = static_cast<pilot_type>(pilot);
+    }
+
+    index_type free_slot = 0;
+    for (index_type p = N; p < table_size; ++p) {
+      if (taken[p]) {
+        while (taken[free_slot]) {
+          ++free_slot;
+        }
+        found.remap[p - N] = free_slot++;
+      }
+    }
+    found.order.assign(N, 0);
+    for (index_type i = 0; i < N; ++i) {
+      found.order[slot(hashes[i], found.pilots, found.remap)] = i;
+    }
+    return true;
   }
 
   template <typename T = K>
-  [[nodiscard]] constexpr bool equal(const T &lhs,
-                                     const T &rhs) const noexcept {
+  [[nodiscard]] static constexpr bool equal(const T &lhs,
+                                            const T &rhs) noexcept {
     return lhs == rhs;
   }
 
-  [[nodiscard]] constexpr bool equal(const char *lhs,
-                                     const char *rhs) const noexcept {
+  [[nodiscard]] static constexpr bool equal(const char *lhs,
+                                            const char *rhs) noexcept {
     return *lhs == *rhs && (*lhs == '\0' || equal(lhs + 1, rhs + 1));
   }
 
 private:
   data_type data;
+  std::array<pilot_type, bucket_count> pilots;
+  std::array<index_type, table_size - N> remap;
+  std::uint64_t seed;
 };
 } // namespace hmap::ct
 
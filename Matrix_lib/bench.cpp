@@ -0,0 +1,749 @@
+#include "bench_common.hpp"
+#include "mapped_matrix.hpp"
+#include "shizmatrix.hpp"
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace shizmatrix;
+
+// Build with optimizations, e.g.
+//   g++ -std=c++17 -O3 -march=native -DNDEBUG -pthread bench.cpp bench_common.cpp -o bench
+// and pass the square sizes to run as arguments, optionally preceded by the name of a single
+// section (product, cwise, parallel, fused, small, alloc, update, reduce, sparse, factor, mapped,
+// batch, lowp, plan):
+//   ./bench 512 1024 2048 or ./bench cwise 4096
+
+// The i-j-k loop matrix_product used before the packed kernel
+template <typename T>
+matrix<T> naive_product(matrix<T> const &a, matrix<T> const &b) {
+	matrix<T> c(a.num_rows(), b.num_cols());
+	for (std::size_t i = 0; i < a.num_rows(); ++i) {
+		for (std::size_t j = 0; j < b.num_cols(); ++j) {
+			c.set_elt(i, j, a(i, 0) * b(0, j));
+			for (std::size_t k = 1; k < a.num_cols(); ++k) {
+				c.set_elt(i, j, a(i, k) * b(k, j) + c(i, j));
+			}
+		}
+	}
+	return c;
+}
+
+template <typename T>
+void bench_product(std::size_t n, char const *type_name) {
+	matrix<T> a = random_matrix<T>(n, n, 1);
+	matrix<T> b = random_matrix<T>(n, n, 2);
+	matrix<T> packed(n, n);
+	matrix<T> naive(n, n);
+
+	double const flop = 2.0 * n * n * n;
+	double t_packed = seconds([&] { packed = a * b; });
+	double t_naive = seconds([&] { naive = naive_product(a, b); }, 1);
+
+	double max_err = 0;
+	for (std::size_t i = 0; i < n * n; ++i) {
+		max_err = std::max<double>(max_err, std::abs(packed.get_container()[i] - naive.get_container()[i]));
+	}
+
+	std::cout << "product " << type_name << " " << n << "x" << n
+	          << "  packed: " << flop / t_packed * 1e-9 << " GFLOP/s"
+	          << "  naive: " << flop / t_naive * 1e-9 << " GFLOP/s"
+	          << "  speedup: " << t_naive / t_packed
+	          << "  max |diff|: " << max_err << '\n';
+}
+
+// Evaluation through operator()(i, j), as matrix::assign did before the linear path
+template <typename T, typename E>
+void assign_indexed(matrix<T> &dst, expression<E> const &expr) {
+	for (std::size_t i = 0; i < dst.num_rows(); ++i) {
+		for (std::size_t j = 0; j < dst.num_cols(); ++j) {
+			dst.set_elt(i, j, expr.get_const_derived()(i, j));
+		}
+	}
+}
+
+// Element-wise a * 2 + b - c on one thread, through the old per (i, j) loop and the linear SIMD path
+template <typename T>
+void bench_cwise(std::size_t n, char const *type_name) {
+	matrix<T> a = random_matrix<T>(n, n, 1);
+	matrix<T> b = random_matrix<T>(n, n, 2);
+	matrix<T> c = random_matrix<T>(n, n, 3);
+	matrix<T> linear(n, n);
+	matrix<T> indexed(n, n);
+
+	std::size_t const threads = get_num_threads();
+	set_num_threads(1);
+	double t_linear = seconds([&] { linear = a * T(2) + b - c; });
+	set_num_threads(threads);
+	double t_indexed = seconds([&] { assign_indexed(indexed, a * T(2) + b - c); });
+
+	// three matrices read and one written per element
+	double const bytes = 4.0 * n * n * sizeof(T);
+	std::cout << "a * 2 + b - c " << type_name << " " << n << "x" << n
+	          << "  linear: " << bytes / t_linear * 1e-9 << " GB/s"
+	          << "  indexed: " << bytes / t_indexed * 1e-9 << " GB/s"
+	          << "  speedup: " << t_indexed / t_linear
+	          << "  identical: " << (linear.get_container() == indexed.get_container()) << '\n';
+}
+
+// a + b * c with one thread against all hardware threads
+template <typename T>
+void bench_parallel(std::size_t n, char const *type_name) {
+	matrix<T> a = random_matrix<T>(n, n, 1);
+	matrix<T> b = random_matrix<T>(n, n, 2);
+	matrix<T> c = random_matrix<T>(n, n, 3);
+	matrix<T> serial(n, n);
+	matrix<T> parallel(n, n);
+
+	std::size_t const threads = get_num_threads();
+	set_num_threads(1);
+	double t_serial = seconds([&] { serial = a + b * c; });
+	double t_cwise_serial = seconds([&] { serial = a + b - c * 2; });
+	set_num_threads(threads);
+	double t_parallel = seconds([&] { parallel = a + b * c; });
+	double t_cwise_parallel = seconds([&] { parallel = a + b - c * 2; });
+
+	std::cout << "a + b * c " << type_name << " " << n << "x" << n << "  " << threads << " threads: "
+	          << t_parallel * 1e3 << " ms  1 thread: " << t_serial * 1e3 << " ms  speedup: "
+	          << t_serial / t_parallel << '\n';
+	std::cout << "a + b - c * 2 " << type_name << " " << n << "x" << n << "  " << threads
+	          << " threads: " << t_cwise_parallel * 1e3 << " ms  1 thread: " << t_cwise_serial * 1e3
+	          << " ms  speedup: " << t_cwise_serial / t_cwise_parallel
+	          << "  identical: " << (serial.get_container() == parallel.get_container()) << '\n';
+}
+
+// a * b + c written back by the product kernel against a product temporary followed by the sum,
+// and a * b * v with a skinny v, reordered to a * (b * v), against the left to right order
+template <typename T>
+void bench_fused(std::size_t n, char const *type_name) {
+	matrix<T> a = random_matrix<T>(n, n, 1);
+	matrix<T> b = random_matrix<T>(n, n, 2);
+	matrix<T> c = random_matrix<T>(n, n, 3);
+	matrix<T> v = random_matrix<T>(n, 8, 4);
+	matrix<T> fused(n, n);
+	matrix<T> two_pass(n, n);
+	matrix<T> reordered(n, 8);
+	matrix<T> in_order(n, 8);
+
+	double t_fused = seconds([&] { fused = a * b + c; });
+	double t_two_pass = seconds([&] {
+		matrix<T> ab = a * b;
+		two_pass = ab + c;
+	});
+	double t_reordered = seconds([&] { reordered = a * b * v; });
+	double t_in_order = seconds([&] {
+		matrix<T> ab = a * b;
+		in_order = ab * v;
+	});
+
+	double max_err = 0;
+	for (std::size_t i = 0; i < n * 8; ++i) {
+		max_err = std::max<double>(max_err, std::abs(reordered.get_container()[i] - in_order.get_container()[i]));
+	}
+	std::cout << "a * b + c " << type_name << " " << n << "x" << n
+	          << "  fused: " << t_fused * 1e3 << " ms  two pass: " << t_two_pass * 1e3
+	          << " ms  speedup: " << t_two_pass / t_fused
+	          << "  identical: " << (fused.get_container() == two_pass.get_container()) << '\n';
+	std::cout << "a * b * v " << type_name << " " << n << "x" << n << " * " << n << "x8"
+	          << "  reordered: " << t_reordered * 1e3 << " ms  left to right: " << t_in_order * 1e3
+	          << " ms  speedup: " << t_in_order / t_reordered << "  max |diff|: " << max_err << '\n';
+}
+
+// Chains of small transforms t = t * m + m through fixed-size and runtime-sized 4x4 matrices. The
+// size argument is the number of transforms applied, in thousands
+template <typename T>
+void bench_small(std::size_t n, char const *type_name) {
+	std::size_t const count = n * 1000;
+	matrix<T, 4, 4> fixed_m;
+	matrix<T> dynamic_m = random_matrix<T>(4, 4, 1);
+	for (std::size_t i = 0; i < 4; ++i) {
+		for (std::size_t j = 0; j < 4; ++j) {
+			// keep the chain bounded
+			dynamic_m.set_elt(i, j, dynamic_m(i, j) * T(0.25));
+			fixed_m.set_elt(i, j, dynamic_m(i, j));
+		}
+	}
+	matrix<T, 4, 4> fixed_t(T(1));
+	matrix<T> dynamic_t(4, 4, T(1));
+
+	double t_fixed = seconds([&] {
+		for (std::size_t r = 0; r < count; ++r) {
+			fixed_t = fixed_t * fixed_m + fixed_m;
+		}
+	});
+	double t_dynamic = seconds([&] {
+		for (std::size_t r = 0; r < count; ++r) {
+			dynamic_t = dynamic_t * dynamic_m + dynamic_m;
+		}
+	});
+
+	std::cout << "4x4 t = t * m + m " << type_name << " x" << count
+	          << "  fixed: " << count / t_fixed * 1e-6 << " M/s"
+	          << "  dynamic: " << count / t_dynamic * 1e-6 << " M/s"
+	          << "  speedup: " << t_dynamic / t_fixed << "  checksum: " << fixed_t(0, 0) - dynamic_t(0, 0)
+	          << '\n';
+}
+
+// A solver-like loop body on n x n matrices, with temporaries from the heap and from a scoped arena
+// reused across iterations
+template <typename T>
+void bench_alloc(std::size_t n, char const *type_name) {
+	matrix<T> a = random_matrix<T>(n, n, 1);
+	matrix<T> b = random_matrix<T>(n, n, 2);
+	matrix<T> c = random_matrix<T>(n, n, 3);
+	matrix<T> d = random_matrix<T>(n, n, 4);
+	matrix<T> x(n, n);
+	matrix<T> y(n, n);
+	int const iterations = 20;
+
+	auto body = [&] {
+		x = a * b * c + d;
+		y = (a + b) * (c - d) - x;
+		x = x * y;
+	};
+	auto per_iteration = [&](auto &&iteration) {
+		iteration();  // warm up caches and arena chunks
+		std::size_t const before = allocation_count.load();
+		double t = seconds([&] {
+			for (int r = 0; r < iterations; ++r) {
+				iteration();
+			}
+		}, 1);
+		return std::make_pair(double(allocation_count.load() - before) / iterations, t / iterations);
+	};
+
+	auto heap = per_iteration(body);
+	arena temporaries;
+	auto arena_stats = per_iteration([&] {
+		scoped_arena scope(temporaries);
+		body();
+	});
+
+	std::cout << "solver loop " << type_name << " " << n << "x" << n
+	          << "  heap: " << heap.first << " allocs/iter " << heap.second * 1e3 << " ms"
+	          << "  arena: " << arena_stats.first << " allocs/iter " << arena_stats.second * 1e3
+	          << " ms  arena capacity: " << temporaries.capacity() / 1024 << " KiB\n";
+}
+
+// Update steps reading their destination, evaluated in place, against copying the destination first
+template <typename T>
+void bench_update(std::size_t n, char const *type_name) {
+	matrix<T> a = random_matrix<T>(n, n, 1);
+	matrix<T> b = random_matrix<T>(n, n, 2);
+	matrix<T> c = random_matrix<T>(n, n, 3);
+	matrix<T> d = random_matrix<T>(n, n, 4);
+
+	auto measure = [&](auto &&update) {
+		update();
+		std::size_t const before = allocation_count.load();
+		double t = seconds(update, 1);
+		return std::make_pair(allocation_count.load() - before, t);
+	};
+	auto in_place = measure([&] {
+		c = a * b + c;
+		c = c * T(0.5) - d;
+	});
+	auto copied = measure([&] {
+		matrix<T> old_c = c + T(0);
+		c = a * b + old_c;
+		matrix<T> half_c = c * T(0.5);
+		c = half_c - d;
+	});
+
+	std::cout << "update " << type_name << " " << n << "x" << n
+	          << "  in place: " << in_place.first << " allocs " << in_place.second * 1e3
+	          << " ms  copied: " << copied.first << " allocs " << copied.second * 1e3
+	          << " ms  speedup: " << copied.second / in_place.second << '\n';
+}
+
+// sum(a - b) and norm2(a * 2) against hand loops over the storage, and the deterministic mode
+template <typename T>
+void bench_reduce(std::size_t n, char const *type_name) {
+	matrix<T> a = random_matrix<T>(n, n, 1);
+	matrix<T> b = random_matrix<T>(n, n, 2);
+	T reduced = 0;
+	T looped = 0;
+	T reduced_norm = 0;
+	T looped_norm = 0;
+
+	double t_sum = seconds([&] { reduced = sum(a - b); });
+	double t_loop = seconds([&] {
+		T total = 0;
+		for (std::size_t i = 0; i < n * n; ++i) {
+			total += a.get_container()[i] - b.get_container()[i];
+		}
+		looped = total;
+	});
+	double t_norm = seconds([&] { reduced_norm = norm2(a * T(2)); });
+	double t_norm_loop = seconds([&] {
+		T squares = 0;
+		for (T x : a.get_container()) {
+			squares += (x * T(2)) * (x * T(2));
+		}
+		looped_norm = std::sqrt(squares);
+	});
+	bool const deterministic = get_deterministic_reductions();
+	set_deterministic_reductions(true);
+	T tree = 0;
+	double t_tree = seconds([&] { tree = sum(a - b); });
+	set_deterministic_reductions(deterministic);
+
+	// two matrices read for the sum, one for the norm
+	double const bytes = double(n) * n * sizeof(T);
+	std::cout << "sum(a - b) " << type_name << " " << n << "x" << n
+	          << "  reduce: " << 2 * bytes / t_sum * 1e-9 << " GB/s"
+	          << "  deterministic: " << 2 * bytes / t_tree * 1e-9 << " GB/s"
+	          << "  loop: " << 2 * bytes / t_loop * 1e-9 << " GB/s"
+	          << "  speedup: " << t_loop / t_sum << "  |diff|: " << std::abs(reduced - looped)
+	          << "  tree |diff|: " << std::abs(tree - looped) << '\n';
+	std::cout << "norm2(a * 2) " << type_name << " " << n << "x" << n
+	          << "  reduce: " << bytes / t_norm * 1e-9 << " GB/s"
+	          << "  loop: " << bytes / t_norm_loop * 1e-9 << " GB/s"
+	          << "  speedup: " << t_norm_loop / t_norm
+	          << "  |diff|: " << std::abs(reduced_norm - looped_norm) << '\n';
+}
+
+// Generators of SuiteSparse-like structures: a 2D Poisson problem, rows with a few uniformly
+// random columns, and rows with power-law lengths as in web and social graphs
+template <typename T>
+csr_matrix<T> laplacian_2d(std::size_t side) {
+	std::vector<sparse_entry<T>> entries;
+	for (std::size_t y = 0; y < side; ++y) {
+		for (std::size_t x = 0; x < side; ++x) {
+			std::size_t const i = y * side + x;
+			entries.push_back({i, i, T(4)});
+			if (x > 0) entries.push_back({i, i - 1, T(-1)});
+			if (x + 1 < side) entries.push_back({i, i + 1, T(-1)});
+			if (y > 0) entries.push_back({i, i - side, T(-1)});
+			if (y + 1 < side) entries.push_back({i, i + side, T(-1)});
+		}
+	}
+	return csr_matrix<T>(side * side, side * side, std::move(entries));
+}
+
+template <typename T>
+csr_matrix<T> random_rows(std::size_t n, std::size_t per_row, unsigned seed) {
+	std::mt19937 gen(seed);
+	std::uniform_int_distribution<std::size_t> col(0, n - 1);
+	std::uniform_real_distribution<double> value(-1.0, 1.0);
+	std::vector<sparse_entry<T>> entries;
+	for (std::size_t i = 0; i < n; ++i) {
+		for (std::size_t p = 0; p < per_row; ++p) {
+			entries.push_back({i, col(gen), static_cast<T>(value(gen))});
+		}
+	}
+	return csr_matrix<T>(n, n, std::move(entries));
+}
+
+template <typename T>
+csr_matrix<T> power_law_rows(std::size_t n, unsigned seed) {
+	std::mt19937 gen(seed);
+	std::uniform_int_distribution<std::size_t> col(0, n - 1);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	std::vector<sparse_entry<T>> entries;
+	for (std::size_t i = 0; i < n; ++i) {
+		// Pareto distributed lengths with exponent 1.5, 2 nonzeros at least, capped at n / 8
+		std::size_t const length = std::min<std::size_t>(n / 8, std::size_t(2 / std::pow(1 - uniform(gen), 1 / 1.5)));
+		for (std::size_t p = 0; p < length; ++p) {
+			entries.push_back({i, col(gen), static_cast<T>(uniform(gen))});
+		}
+	}
+	return csr_matrix<T>(n, n, std::move(entries));
+}
+
+// Sparse matrix-vector and matrix-matrix products on generated matrices with n * n / 4 rows, and a
+// 1% dense n x n matrix against the dense kernels
+template <typename T>
+void bench_sparse(std::size_t n, char const *type_name) {
+	std::size_t const rows = n * n / 4;
+	auto report = [&](char const *name, csr_matrix<T> const &a) {
+		matrix<T> x = random_matrix<T>(a.num_cols(), 1, 1);
+		matrix<T> y(a.num_rows(), 1);
+		matrix<T> b = random_matrix<T>(a.num_cols(), 16, 2);
+		matrix<T> c(a.num_rows(), 16);
+		std::size_t const threads = get_num_threads();
+		set_num_threads(1);
+		double t_serial = seconds([&] { y = a * x; });
+		set_num_threads(threads);
+		double t_spmv = seconds([&] { y = a * x; });
+		double t_spmm = seconds([&] { c = a * b; });
+		// values and indices of the nonzeros, row offsets, x and y
+		double const bytes = a.non_zeros() * (sizeof(T) + sizeof(std::uint32_t)) +
+		                     a.num_rows() * (sizeof(std::size_t) + 2 * sizeof(T));
+		std::cout << "sparse " << name << " " << type_name << " " << a.num_rows() << " rows "
+		          << a.non_zeros() << " nonzeros  spmv serial: " << bytes / t_serial * 1e-9
+		          << " GB/s  spmv " << threads << " threads: " << bytes / t_spmv * 1e-9
+		          << " GB/s " << 2.0 * a.non_zeros() / t_spmv * 1e-9 << " GFLOP/s  spmm x16: "
+		          << 32.0 * a.non_zeros() / t_spmm * 1e-9 << " GFLOP/s\n";
+	};
+	std::size_t side = 1;
+	while ((side + 1) * (side + 1) <= rows) {
+		++side;
+	}
+	report("laplacian", laplacian_2d<T>(side));
+	report("random", random_rows<T>(rows, 16, 3));
+	report("power law", power_law_rows<T>(rows, 4));
+
+	std::mt19937 gen(5);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	matrix<T> dense(n, n, T(0));
+	for (auto &x : dense.get_container()) {
+		if (uniform(gen) < 0.01) {
+			x = static_cast<T>(uniform(gen));
+		}
+	}
+	csr_matrix<T> sparse(dense);
+	matrix<T> b = random_matrix<T>(n, 16, 6);
+	matrix<T> c_sparse(n, 16);
+	matrix<T> c_dense(n, 16);
+	double t_sparse = seconds([&] { c_sparse = sparse * b; });
+	double t_dense = seconds([&] { c_dense = dense * b; });
+	double max_err = 0;
+	for (std::size_t i = 0; i < n * 16; ++i) {
+		max_err = std::max<double>(max_err, std::abs(c_sparse.get_container()[i] - c_dense.get_container()[i]));
+	}
+	std::cout << "1% dense " << type_name << " " << n << "x" << n << " * " << n << "x16"
+	          << "  sparse: " << t_sparse * 1e3 << " ms  dense: " << t_dense * 1e3
+	          << " ms  speedup: " << t_dense / t_sparse << "  max |diff|: " << max_err << '\n';
+}
+
+// Textbook right-looking LU with partial pivoting, one rank-1 update per column
+template <typename T>
+void unblocked_lu(matrix<T> &a) {
+	std::size_t const n = a.num_rows();
+	T *data = a.data();
+	for (std::size_t j = 0; j < n; ++j) {
+		std::size_t pivot = j;
+		for (std::size_t r = j + 1; r < n; ++r) {
+			if (std::abs(data[r * n + j]) > std::abs(data[pivot * n + j])) {
+				pivot = r;
+			}
+		}
+		for (std::size_t c = 0; c < n; ++c) {
+			std::swap(data[j * n + c], data[pivot * n + c]);
+		}
+		for (std::size_t r = j + 1; r < n; ++r) {
+			T const l = data[r * n + j] /= data[j * n + j];
+			for (std::size_t c = j + 1; c < n; ++c) {
+				data[r * n + c] -= l * data[j * n + c];
+			}
+		}
+	}
+}
+
+// Time per LU, Cholesky and QR factorization of an n x n matrix, with the residual of a solve
+template <typename T>
+void bench_factor(std::size_t n, char const *type_name) {
+	matrix<T> a = random_matrix<T>(n, n, 1);
+	matrix<T> spd = a.transpose() * a;
+	for (std::size_t i = 0; i < n; ++i) {
+		spd.data()[i * n + i] += static_cast<T>(n);
+	}
+	matrix<T> b = random_matrix<T>(n, 1, 2);
+
+	// every repetition factorizes a fresh copy, the copy is not timed
+	auto measure = [&](matrix<T> const &source, auto &&factor) {
+		double best = 1e300;
+		for (int r = 0; r < 3; ++r) {
+			matrix<T> work = source + T(0);
+			best = std::min(best, seconds([&] { factor(work); }, 1));
+		}
+		return best;
+	};
+	std::vector<std::size_t> pivots;
+	std::vector<T> tau;
+	double t_lu = measure(a, [&](matrix<T> &m) { lu_factor(m, pivots); });
+	double t_unblocked = measure(a, [&](matrix<T> &m) { unblocked_lu(m); });
+	double t_cholesky = measure(spd, [&](matrix<T> &m) { cholesky_factor(m); });
+	double t_qr = measure(a, [&](matrix<T> &m) { qr_factor(m, tau); });
+
+	matrix<T> lu = a + T(0);
+	lu_factor(lu, pivots);
+	matrix<T> x = b + T(0);
+	lu_solve(lu, pivots, x);
+	double const lu_residual = norm_inf(a * x - b);
+	matrix<T> l = spd + T(0);
+	cholesky_factor(l);
+	x = b + T(0);
+	cholesky_solve(l, x);
+	double const cholesky_residual = norm_inf(spd * x - b);
+	matrix<T> qr = a + T(0);
+	qr_factor(qr, tau);
+	x = b + T(0);
+	qr_solve(qr, tau, x);
+	double const qr_residual = norm_inf(a * x - b);
+
+	double const cube = static_cast<double>(n) * n * n;
+	std::cout << "factor " << type_name << " " << n << "x" << n
+	          << "  lu: " << t_lu * 1e3 << " ms " << 2.0 / 3.0 * cube / t_lu * 1e-9 << " GFLOP/s"
+	          << "  unblocked lu: " << t_unblocked * 1e3 << " ms"
+	          << "  cholesky: " << t_cholesky * 1e3 << " ms " << cube / 3.0 / t_cholesky * 1e-9 << " GFLOP/s"
+	          << "  qr: " << t_qr * 1e3 << " ms " << 4.0 / 3.0 * cube / t_qr * 1e-9 << " GFLOP/s"
+	          << "  max residual: " << std::max({lu_residual, cholesky_residual, qr_residual}) << '\n';
+}
+
+// Streaming passes over a matrix file mapped read-only against the same matrix in memory. The file
+// has just been written, so its pages are in the page cache and the difference is the cost of the
+// mapping itself, not of the disk
+template <typename T>
+void bench_mapped(std::size_t n, char const *type_name) {
+	char const *path = "bench_mapped.shz";
+	matrix<T> a = random_matrix<T>(n, n, 1);
+	matrix<T> b = random_matrix<T>(n, n, 2);
+	save_mapped(path, a);
+	mapped_matrix<T> const mapped(path);
+	matrix<T> c(n, n);
+	T in_memory_sum = 0;
+	T mapped_sum = 0;
+
+	double t_sum = seconds([&] { in_memory_sum = sum(a); });
+	double t_mapped_sum = seconds([&] { mapped_sum = sum(mapped.view()); });
+	double t_cwise = seconds([&] { c = a * T(2) + b; });
+	double t_mapped_cwise = seconds([&] { c = mapped.view() * T(2) + b; });
+	double t_product = seconds([&] { c = a * b; }, 1);
+	double t_mapped_product = seconds([&] { c = mapped.view() * b; }, 1);
+	std::remove(path);
+
+	double const bytes = static_cast<double>(n) * n * sizeof(T);
+	std::cout << "mapped " << type_name << " " << n << "x" << n
+	          << "  sum: " << bytes / t_sum * 1e-9 << " GB/s mapped: " << bytes / t_mapped_sum * 1e-9
+	          << " GB/s  a * 2 + b: " << 3 * bytes / t_cwise * 1e-9 << " GB/s mapped: "
+	          << 3 * bytes / t_mapped_cwise * 1e-9 << " GB/s  product: "
+	          << 2.0 * n * n * n / t_product * 1e-9 << " GFLOP/s mapped: "
+	          << 2.0 * n * n * n / t_mapped_product * 1e-9 << " GFLOP/s  |sum diff|: "
+	          << std::abs(mapped_sum - in_memory_sum) << '\n';
+}
+
+// n independent 8x8, 16x16 and 32x32 products c_k = a_k * b_k and updates d_k = c_k * 2 + d_k
+// through a batch against a loop over individual matrices. The size argument is the number of
+// matrices
+template <typename T>
+void bench_batch(std::size_t n, char const *type_name) {
+	for (std::size_t size : {8, 16, 32}) {
+		std::vector<matrix<T>> a;
+		std::vector<matrix<T>> b;
+		std::vector<matrix<T>> c;
+		std::vector<matrix<T>> d;
+		for (std::size_t k = 0; k < n; ++k) {
+			a.push_back(random_matrix<T>(size, size, 2 * k));
+			b.push_back(random_matrix<T>(size, size, 2 * k + 1));
+			c.emplace_back(size, size);
+			d.emplace_back(size, size, T(0));
+		}
+		matrix_batch<T> batch_a(n, size, size);
+		matrix_batch<T> batch_b(n, size, size);
+		matrix_batch<T> batch_c(n, size, size);
+		matrix_batch<T> batch_d(n, size, size);
+		for (std::size_t k = 0; k < n; ++k) {
+			batch_a.set(k, a[k]);
+			batch_b.set(k, b[k]);
+		}
+
+		std::size_t const before_loop = allocation_count.load();
+		double t_loop = seconds([&] {
+			for (std::size_t k = 0; k < n; ++k) {
+				c[k] = a[k] * b[k];
+				d[k] = c[k] * T(2) + d[k];
+			}
+		}, 1);
+		std::size_t const loop_allocations = allocation_count.load() - before_loop;
+		std::size_t const before_batch = allocation_count.load();
+		double t_batch = seconds([&] {
+			batch_product(batch_a, batch_b, batch_c);
+			batch_d.flat() = batch_c.flat() * T(2) + batch_d.flat();
+		}, 1);
+		std::size_t const batch_allocations = allocation_count.load() - before_batch;
+
+		double max_err = 0;
+		for (std::size_t k = 0; k < n; k += n / 16 + 1) {
+			max_err = std::max<double>(max_err, norm_inf(batch_d.get(k) - d[k]));
+		}
+		double const flop = 2.0 * n * size * size * size;
+		std::cout << "batch " << type_name << " " << n << " x " << size << "x" << size
+		          << "  loop: " << flop / t_loop * 1e-9 << " GFLOP/s " << loop_allocations << " allocs"
+		          << "  batch: " << flop / t_batch * 1e-9 << " GFLOP/s " << batch_allocations << " allocs"
+		          << "  speedup: " << t_loop / t_batch << "  max |diff|: " << max_err << '\n';
+	}
+}
+
+// Copy of a matrix in a narrower storage type
+template <typename S, typename T>
+matrix<S> narrowed(matrix<T> const &m) {
+	matrix<S> result(m.num_rows(), m.num_cols());
+	for (std::size_t i = 0; i < m.get_container().size(); ++i) {
+		result.data()[i] = static_cast<S>(m.data()[i]);
+	}
+	return result;
+}
+
+// Products of operands stored as float16, bfloat16 and int8 accumulating in float and int32, against
+// float storage. Operand bytes is what the kernel streams from memory for A and B
+void bench_lowp(std::size_t n) {
+	matrix<float> const a = random_matrix<float>(n, n, 1);
+	matrix<float> const b = random_matrix<float>(n, n, 2);
+	matrix<float> c;
+	double const t_float = seconds([&] { c = product(a, b); });
+	double const flop = 2.0 * n * n * n;
+	double const float_bytes = 2.0 * n * n * sizeof(float);
+	std::cout << "lowp float    " << n << "  " << flop / t_float * 1e-9 << " GFLOP/s  operands: "
+	          << float_bytes / (1 << 20) << " MiB\n";
+
+	auto report = [&](char const *name, auto const &lhs, auto const &rhs) {
+		using S = element_type_t<std::decay_t<decltype(lhs)>>;
+		matrix<float> low;
+		double const t_low = seconds([&] { low = product(lhs, rhs); });
+		std::cout << "lowp " << name << " " << n << "  " << flop / t_low * 1e-9
+		          << " GFLOP/s  operands: " << 2.0 * n * n * sizeof(S) / (1 << 20)
+		          << " MiB  max |diff| vs float: " << norm_inf(low - c) << '\n';
+	};
+	report("float16 ", narrowed<float16>(a), narrowed<float16>(b));
+	report("bfloat16", narrowed<bfloat16>(a), narrowed<bfloat16>(b));
+
+	matrix<float> const a_scaled = a * 127.0f;
+	matrix<float> const b_scaled = b * 127.0f;
+	matrix<std::int8_t> const a8 = narrowed<std::int8_t>(a_scaled);
+	matrix<std::int8_t> const b8 = narrowed<std::int8_t>(b_scaled);
+	matrix<std::int32_t> c32;
+	double const t_int8 = seconds([&] { c32 = product(a8, b8); });
+	std::cout << "lowp int8     " << n << "  " << flop / t_int8 * 1e-9 << " GOP/s    operands: "
+	          << 2.0 * n * n / (1 << 20) << " MiB\n";
+}
+
+// Expressions repeating a subexpression, assigned as usual and through an evaluation plan
+template <typename T>
+void bench_plan(std::size_t n, char const *type_name) {
+	matrix<T> a = random_matrix<T>(n, n, 1);
+	matrix<T> b = random_matrix<T>(n, n, 2);
+	matrix<T> x = random_matrix<T>(n, n, 3);
+	matrix<T> y = random_matrix<T>(n, n, 4);
+	matrix<T> usual(n, n);
+	matrix<T> planned(n, n);
+
+	auto report = [&](char const *name, auto const &plan, auto &&assign_usual, auto &&assign_plan) {
+		std::size_t const before_usual = allocation_count.load();
+		assign_usual();
+		std::size_t const usual_allocations = allocation_count.load() - before_usual;
+		std::size_t const before_plan = allocation_count.load();
+		assign_plan();
+		std::size_t const plan_allocations = allocation_count.load() - before_plan;
+		double const t_usual = seconds(assign_usual);
+		double const t_plan = seconds(assign_plan);
+		std::cout << name << " " << type_name << " " << n << "x" << n << "  usual: " << t_usual * 1e3
+		          << " ms " << usual_allocations << " allocs  planned: " << t_plan * 1e3 << " ms "
+		          << plan_allocations << " allocs  steps: " << plan.num_steps()
+		          << "  shared: " << plan.num_shared() << "  pool: " << plan.pool_bytes() / 1024.0
+		          << " KiB  speedup: " << t_usual / t_plan << "  max |diff|: " << norm_inf(usual - planned)
+		          << '\n';
+	};
+	report("(a + b) * (a + b)        ", evaluation_plan((a + b) * (a + b)),
+	       [&] { usual = (a + b) * (a + b); }, [&] { assign_planned(planned, (a + b) * (a + b)); });
+	report("x * (a - b) + y * (a - b)", evaluation_plan(x * (a - b) + y * (a - b)),
+	       [&] { usual = x * (a - b) + y * (a - b); },
+	       [&] { assign_planned(planned, x * (a - b) + y * (a - b)); });
+}
+
+int main(int argc, char **argv) {
+	// An optional leading non-numeric argument selects a single section
+	std::string section;
+	int first_size = 1;
+	if (argc > 1 && !std::isdigit(static_cast<unsigned char>(argv[1][0]))) {
+		section = argv[1];
+		first_size = 2;
+	}
+	std::vector<std::size_t> sizes;
+	for (int i = first_size; i < argc; ++i) {
+		sizes.push_back(std::strtoul(argv[i], nullptr, 10));
+	}
+	if (sizes.empty()) {
+		sizes = {256, 512, 1024};
+	}
+	auto run = [&](char const *name) { return section.empty() || section == name; };
+
+	for (std::size_t n : sizes) {
+		if (run("product")) {
+			bench_product<float>(n, "float");
+			bench_product<double>(n, "double");
+		}
+	}
+	for (std::size_t n : sizes) {
+		if (run("cwise")) {
+			bench_cwise<float>(n, "float");
+			bench_cwise<double>(n, "double");
+		}
+	}
+	for (std::size_t n : sizes) {
+		if (run("parallel")) {
+			bench_parallel<float>(n, "float");
+			bench_parallel<double>(n, "double");
+		}
+	}
+	for (std::size_t n : sizes) {
+		if (run("fused")) {
+			bench_fused<float>(n, "float");
+			bench_fused<double>(n, "double");
+		}
+	}
+	for (std::size_t n : sizes) {
+		if (run("small")) {
+			bench_small<float>(n, "float");
+			bench_small<double>(n, "double");
+		}
+	}
+	for (std::size_t n : sizes) {
+		if (run("alloc")) {
+			bench_alloc<float>(n, "float");
+			bench_alloc<double>(n, "double");
+		}
+	}
+	for (std::size_t n : sizes) {
+		if (run("update")) {
+			bench_update<float>(n, "float");
+			bench_update<double>(n, "double");
+		}
+	}
+	for (std::size_t n : sizes) {
+		if (run("reduce")) {
+			bench_reduce<float>(n, "float");
+			bench_reduce<double>(n, "double");
+		}
+	}
+	for (std::size_t n : sizes) {
+		if (run("sparse")) {
+			bench_sparse<float>(n, "float");
+			bench_sparse<double>(n, "double");
+		}
+	}
+	for (std::size_t n : sizes) {
+		if (run("factor")) {
+			bench_factor<float>(n, "float");
+			bench_factor<double>(n, "double");
+		}
+	}
+	for (std::size_t n : sizes) {
+		if (run("mapped")) {
+			bench_mapped<float>(n, "float");
+			bench_mapped<double>(n, "double");
+		}
+	}
+	for (std::size_t n : sizes) {
+		if (run("batch")) {
+			bench_batch<float>(n, "float");
+			bench_batch<double>(n, "double");
+		}
+	}
+	for (std::size_t n : sizes) {
+		if (run("lowp")) {
+			bench_lowp(n);
+		}
+	}
+	for (std::size_t n : sizes) {
+		if (run("plan")) {
+			bench_plan<float>(n, "float");
+			bench_plan<double>(n, "double");
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,43 @@
+// Global operator new and delete counting the heap allocations of the benchmark programs. They
+// live apart from the code they count: once inlined next to an allocation, GCC pairs the free of
+// the replaced delete with the operator new call and reports -Wmismatched-new-delete
+#include "bench_common.hpp"
+#include <cstdlib>
+#include <new>
+
+// Every heap allocation of the program goes through here, so sections can report allocation counts
+std::atomic<std::size_t> allocation_count{0};
+
+void *operator new(std::size_t size) {
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	if (void *memory = std::malloc(size == 0 ? 1 : size)) {
+		return memory;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept {
+	std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept {
+	std::free(memory);
+}
+
+// std::pmr::new_delete_resource() allocates through the aligned forms
+void *operator new(std::size_t size, std::align_val_t alignment) {
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	std::size_t const align = std::max(static_cast<std::size_t>(alignment), sizeof(void *));
+	if (void *memory = std::aligned_alloc(align, (size + align - 1) / align * align)) {
+		return memory;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void *memory, std::align_val_t) noexcept {
+	std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t, std::align_val_t) noexcept {
+	std::free(memory);
+}
@@ -0,0 +1,39 @@
+// Helpers shared by the benchmark programs: allocation counting, timing and random operands.
+// Link bench_common.cpp into the program, it replaces the global operator new
+#ifndef SHIZMATRIX_BENCH_COMMON_HPP
+#define SHIZMATRIX_BENCH_COMMON_HPP
+
+#include "shizmatrix.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+
+// Number of heap allocations so far, counted by the global operator new of bench_common.cpp
+extern std::atomic<std::size_t> allocation_count;
+
+// Random matrix with elements uniform in [-1, 1]
+template <typename T>
+shizmatrix::matrix<T> random_matrix(std::size_t rows, std::size_t cols, unsigned seed) {
+	std::mt19937 gen(seed);
+	std::uniform_real_distribution<double> dist(-1.0, 1.0);
+	shizmatrix::matrix<T> m(rows, cols);
+	for (auto &x : m.get_container()) {
+		x = static_cast<T>(dist(gen));
+	}
+	return m;
+}
+
+// Best wall time out of a few repetitions, in seconds
+template <typename F>
+double seconds(F &&f, int repetitions = 3) {
+	double best = 1e300;
+	for (int r = 0; r < repetitions; ++r) {
+		auto start = std::chrono::steady_clock::now();
+		f();
+		best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+	return best;
+}
+
+#endif // SHIZMATRIX_BENCH_COMMON_HPP
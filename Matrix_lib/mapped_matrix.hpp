@@ -0,0 +1,576 @@
+#ifndef SHIZMATRIX_MAPPED_MATRIX_HPP
+#define SHIZMATRIX_MAPPED_MATRIX_HPP
+
+#include "shizmatrix.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace shizmatrix {
+
+/**
+ * \brief      Type of the elements stored in a matrix file
+ */
+enum class dtype : std::uint32_t {
+  unknown = 0,
+  float32 = 1,
+  float64 = 2,
+  int8 = 3,
+  int16 = 4,
+  int32 = 5,
+  int64 = 6,
+  uint8 = 7,
+  uint16 = 8,
+  uint32 = 9,
+  uint64 = 10,
+  float16 = 11,
+  bfloat16 = 12
+};
+
+/**
+ * \brief      Element type code of T, dtype::unknown if T cannot be stored in a matrix file
+ *
+ * \tparam     T     Element type
+ */
+template <typename T>
+struct dtype_of : std::integral_constant<dtype, dtype::unknown> {};
+
+template <>
+struct dtype_of<float> : std::integral_constant<dtype, dtype::float32> {};
+
+template <>
+struct dtype_of<double> : std::integral_constant<dtype, dtype::float64> {};
+
+template <>
+struct dtype_of<std::int8_t> : std::integral_constant<dtype, dtype::int8> {};
+
+template <>
+struct dtype_of<std::int16_t> : std::integral_constant<dtype, dtype::int16> {};
+
+template <>
+struct dtype_of<std::int32_t> : std::integral_constant<dtype, dtype::int32> {};
+
+template <>
+struct dtype_of<std::int64_t> : std::integral_constant<dtype, dtype::int64> {};
+
+template <>
+struct dtype_of<std::uint8_t> : std::integral_constant<dtype, dtype::uint8> {};
+
+template <>
+struct dtype_of<std::uint16_t> : std::integral_constant<dtype, dtype::uint16> {};
+
+template <>
+struct dtype_of<std::uint32_t> : std::integral_constant<dtype, dtype::uint32> {};
+
+template <>
+struct dtype_of<std::uint64_t> : std::integral_constant<dtype, dtype::uint64> {};
+
+template <>
+struct dtype_of<float16> : std::integral_constant<dtype, dtype::float16> {};
+
+template <>
+struct dtype_of<bfloat16> : std::integral_constant<dtype, dtype::bfloat16> {};
+
+/**
+ * \brief      Header at the start of a matrix file
+ *
+ * The elements follow at data_offset, row-major and in the byte order of the machine that wrote
+ * them. The offset is a multiple of 64 so the elements are aligned for every packet type
+ */
+struct matrix_file_header {
+  char magic[8];
+  std::uint32_t version;
+  dtype type;
+  std::uint64_t rows;
+  std::uint64_t cols;
+  std::uint64_t data_offset;
+  std::uint8_t reserved[24];
+};
+
+static_assert(sizeof(matrix_file_header) == 64, "the matrix file header must be 64 bytes");
+
+/**
+ * \brief      How a matrix file is mapped
+ *
+ * read_only maps the file shared and read-only. copy_on_write maps it privately: writes stay in
+ * memory and never reach the file. read_write maps it shared, so writes go to the file
+ */
+enum class map_mode { read_only, copy_on_write, read_write };
+
+/**
+ * \brief      Access pattern hint for a range of rows of a mapped matrix
+ *
+ * sequential makes the kernel read ahead aggressively and drop pages once they have been read,
+ * random disables read-ahead, will_need starts reading the rows in the background and dont_need
+ * releases them from memory
+ */
+enum class map_access { normal, sequential, random, will_need, dont_need };
+
+/**
+ * \brief      Outcome of mapping a matrix file
+ */
+enum class map_status { ok, open_failed, bad_header, type_mismatch, map_failed };
+
+/**
+ * \brief      Dense row-major matrix stored in a file that is mapped into memory
+ *
+ * Pages are read from disk when first touched, so the matrix may be larger than the memory of the
+ * machine. The mapping is accessed through views, which take part in expressions like the views
+ * of any in-memory matrix: element-wise expressions stream through the rows in order and products
+ * pack the mapped operands tile by tile. The file is mapped with the sequential hint, which keeps
+ * read-ahead going during such passes
+ *
+ * \tparam     T     Element type
+ */
+template <typename T>
+class mapped_matrix {
+public:
+  /**
+   * Type of elements of this matrix
+   */
+  using ElementType = T;
+
+private:
+  /**
+   * Start of the mapping, the file header
+   */
+  void *mapping = nullptr;
+
+  /**
+   * Size of the mapping in bytes
+   */
+  std::size_t mapping_size = 0;
+
+  /**
+   * Pointer to the first element
+   */
+  T *elements = nullptr;
+
+  /**
+   * Number of rows of this matrix
+   */
+  std::size_t n_rows = 0;
+
+  /**
+   * Number of columns of this matrix
+   */
+  std::size_t n_cols = 0;
+
+  /**
+   * How the file is mapped
+   */
+  map_mode mode = map_mode::read_only;
+
+  /**
+   * Outcome of the mapping
+   */
+  map_status map_result = map_status::map_failed;
+
+  /**
+   * \brief      Maps size bytes of an open file, closing it
+   *
+   * \param[in]  fd    The file descriptor
+   * \param[in]  size  Number of bytes to map
+   *
+   * \return     True on success
+   */
+  inline bool map_file(int fd, std::size_t size) {
+    int const protection = mode == map_mode::read_only ? PROT_READ : PROT_READ | PROT_WRITE;
+    int const flags = mode == map_mode::copy_on_write ? MAP_PRIVATE : MAP_SHARED;
+    void *address = ::mmap(nullptr, size, protection, flags, fd, 0);
+    ::close(fd);
+    if (address == MAP_FAILED) {
+      map_result = map_status::map_failed;
+      return false;
+    }
+    mapping = address;
+    mapping_size = size;
+    return true;
+  }
+
+  /**
+   * \brief      Unmaps the file, leaving an empty matrix
+   */
+  inline void unmap() {
+    if (mapping) {
+      ::munmap(mapping, mapping_size);
+    }
+    mapping = nullptr;
+    mapping_size = 0;
+    elements = nullptr;
+    n_rows = 0;
+    n_cols = 0;
+  }
+
+public:
+  /**
+   * \brief      Constructor of an empty matrix that maps no file
+   */
+  inline mapped_matrix() = default;
+
+  /**
+   * \brief      Maps an existing matrix file
+   *
+   * On failure the matrix is empty and status() tells what went wrong
+   *
+   * \param[in]  path  Path of the file
+   * \param[in]  mode  How the file is mapped
+   */
+  inline explicit mapped_matrix(char const *path, map_mode mode = map_mode::read_only)
+      : mode(mode) {
+    int const fd = ::open(path, mode == map_mode::read_write ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+      map_result = map_status::open_failed;
+      return;
+    }
+    matrix_file_header header;
+    struct stat file_stat;
+    if (::fstat(fd, &file_stat) != 0 ||
+        static_cast<std::size_t>(file_stat.st_size) < sizeof(header) ||
+        ::pread(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)) ||
+        std::memcmp(header.magic, "SHZMATRX", 8) != 0 || header.version != 1 ||
+        header.data_offset < sizeof(header) || header.data_offset % alignof(T) != 0 ||
+        header.data_offset + header.rows * header.cols * sizeof(T) >
+            static_cast<std::uint64_t>(file_stat.st_size)) {
+      ::close(fd);
+      map_result = map_status::bad_header;
+      return;
+    }
+    if (header.type != dtype_of<T>::value) {
+      ::close(fd);
+      map_result = map_status::type_mismatch;
+      return;
+    }
+    if (!map_file(fd, static_cast<std::size_t>(file_stat.st_size))) {
+      return;
+    }
+    elements = reinterpret_cast<T *>(static_cast<std::byte *>(mapping) + header.data_offset);
+    n_rows = header.rows;
+    n_cols = header.cols;
+    map_result = map_status::ok;
+    advise(map_access::sequential);
+  }
+
+  /**
+   * \brief      Creates a matrix file, replacing any existing file, and maps it for writing
+   *
+   * The elements are zero. On failure the matrix is empty and status() tells what went wrong
+   *
+   * \param[in]  path    Path of the file
+   * \param[in]  n_rows  The number of rows
+   * \param[in]  n_cols  The number of columns
+   */
+  inline mapped_matrix(char const *path, std::size_t n_rows, std::size_t n_cols)
+      : mode(map_mode::read_write) {
+    static_assert(dtype_of<T>::value != dtype::unknown, "element type cannot be stored in a file");
+    int const fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      map_result = map_status::open_failed;
+      return;
+    }
+    matrix_file_header header{};
+    std::memcpy(header.magic, "SHZMATRX", 8);
+    header.version = 1;
+    header.type = dtype_of<T>::value;
+    header.rows = n_rows;
+    header.cols = n_cols;
+    header.data_offset = sizeof(header);
+    std::size_t const size = sizeof(header) + n_rows * n_cols * sizeof(T);
+    if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+      ::close(fd);
+      map_result = map_status::open_failed;
+      return;
+    }
+    if (!map_file(fd, size)) {
+      return;
+    }
+    std::memcpy(mapping, &header, sizeof(header));
+    elements = reinterpret_cast<T *>(static_cast<std::byte *>(mapping) + header.data_offset);
+    this->n_rows = n_rows;
+    this->n_cols = n_cols;
+    map_result = map_status::ok;
+    advise(map_access::sequential);
+  }
+
+  mapped_matrix(mapped_matrix const &) = delete;
+  mapped_matrix &operator=(mapped_matrix const &) = delete;
+
+  /**
+   * \brief      Move constructor, taking over the mapping
+   *
+   * \param[in]  other  The matrix to take the mapping from, left empty
+   */
+  inline mapped_matrix(mapped_matrix &&other) noexcept
+      : mapping(std::exchange(other.mapping, nullptr)),
+        mapping_size(std::exchange(other.mapping_size, 0)),
+        elements(std::exchange(other.elements, nullptr)), n_rows(std::exchange(other.n_rows, 0)),
+        n_cols(std::exchange(other.n_cols, 0)), mode(other.mode),
+        map_result(std::exchange(other.map_result, map_status::map_failed)) {}
+
+  /**
+   * \brief      Move assignment, unmapping the current file and taking over the mapping
+   *
+   * \param[in]  other  The matrix to take the mapping from, left empty
+   *
+   * \return     This matrix
+   */
+  inline mapped_matrix &operator=(mapped_matrix &&other) noexcept {
+    if (this != &other) {
+      unmap();
+      mapping = std::exchange(other.mapping, nullptr);
+      mapping_size = std::exchange(other.mapping_size, 0);
+      elements = std::exchange(other.elements, nullptr);
+      n_rows = std::exchange(other.n_rows, 0);
+      n_cols = std::exchange(other.n_cols, 0);
+      mode = other.mode;
+      map_result = std::exchange(other.map_result, map_status::map_failed);
+    }
+    return *this;
+  }
+
+  /**
+   * \brief      Destructor, unmapping the file
+   *
+   * Writes to a read_write mapping reach the file even without flush()
+   */
+  inline ~mapped_matrix() {
+    unmap();
+  }
+
+  /**
+   * \brief      Outcome of mapping the file
+   *
+   * \return     map_status::ok if the file is mapped
+   */
+  inline map_status status() const {
+    return map_result;
+  }
+
+  /**
+   * \brief      Whether a file is mapped
+   *
+   * \return     True if a file is mapped
+   */
+  inline bool is_open() const {
+    return map_result == map_status::ok;
+  }
+
+  /**
+   * \brief      How the file is mapped
+   *
+   * \return     The mapping mode
+   */
+  inline map_mode get_mode() const {
+    return mode;
+  }
+
+  /**
+   * \brief      Returns the number of rows of the matrix
+   *
+   * \return     Number of rows of the matrix
+   */
+  inline std::size_t num_rows() const {
+    return n_rows;
+  }
+
+  /**
+   * \brief      Returns the number of columns of the matrix
+   *
+   * \return     Number of columns of the matrix
+   */
+  inline std::size_t num_cols() const {
+    return n_cols;
+  }
+
+  /**
+   * \brief      Function call operator to get an element
+   *
+   * \param[in]  i     Row number of the element to get
+   * \param[in]  j     Column number of the element to get
+   *
+   * \return     The element
+   */
+  inline T operator()(std::size_t i, std::size_t j) const {
+    assert(i < n_rows && j < n_cols);
+    return elements[i * n_cols + j];
+  }
+
+  /**
+   * \brief      Pointer to the first element, only to be written through if the file is not
+   * mapped read-only
+   *
+   * \return     The pointer
+   */
+  inline T *data() {
+    return elements;
+  }
+
+  /**
+   * \brief      Pointer to the first element
+   *
+   * \return     The pointer
+   */
+  inline T const *data() const {
+    return elements;
+  }
+
+  /**
+   * \brief      Distance in elements between two consecutive rows
+   *
+   * \return     The row stride
+   */
+  inline std::size_t row_stride() const {
+    return n_cols;
+  }
+
+  /**
+   * \brief      Distance in elements between two consecutive columns
+   *
+   * \return     The column stride
+   */
+  inline std::size_t col_stride() const {
+    return 1;
+  }
+
+  /**
+   * \brief      View of the whole matrix, only to be written through if the file is not mapped
+   * read-only
+   *
+   * \return     The view
+   */
+  inline matrix_view<T> view() {
+    return matrix_view<T>(data(), n_rows, n_cols, n_cols, 1);
+  }
+
+  /**
+   * \brief      Read-only view of the whole matrix, through which it takes part in expressions
+   *
+   * \return     The view
+   */
+  inline matrix_view<T const> view() const {
+    return matrix_view<T const>(data(), n_rows, n_cols, n_cols, 1);
+  }
+
+  /**
+   * \brief      View of a contiguous range of rows, the tile of a streaming pass
+   *
+   * \param[in]  first  First row
+   * \param[in]  count  Number of rows
+   *
+   * \return     The view
+   */
+  inline matrix_view<T> row_range(std::size_t first, std::size_t count) {
+    return view().block(first, 0, count, n_cols);
+  }
+
+  /**
+   * \brief      Read-only view of a contiguous range of rows, the tile of a streaming pass
+   *
+   * \param[in]  first  First row
+   * \param[in]  count  Number of rows
+   *
+   * \return     The view
+   */
+  inline matrix_view<T const> row_range(std::size_t first, std::size_t count) const {
+    return view().block(first, 0, count, n_cols);
+  }
+
+  /**
+   * \brief      Gives the kernel a hint on how a range of rows is going to be accessed
+   *
+   * The range is widened to whole pages. dont_need discards the changes made to a copy_on_write
+   * mapping and is therefore not allowed on one
+   *
+   * \param[in]  access  The access pattern
+   * \param[in]  first   First row
+   * \param[in]  count   Number of rows, all rows from first if omitted
+   */
+  inline void advise(map_access access, std::size_t first = 0,
+                     std::size_t count = static_cast<std::size_t>(-1)) const {
+    assert(access != map_access::dont_need || mode != map_mode::copy_on_write);
+    if (!mapping || first >= n_rows) {
+      return;
+    }
+    count = std::min(count, n_rows - first);
+    std::size_t const page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    std::byte *const base = static_cast<std::byte *>(mapping);
+    std::byte *const begin = reinterpret_cast<std::byte *>(elements + first * n_cols);
+    std::byte *const end = reinterpret_cast<std::byte *>(elements + (first + count) * n_cols);
+    std::size_t const offset = static_cast<std::size_t>(begin - base) / page * page;
+    std::size_t const length = static_cast<std::size_t>(end - base) - offset;
+    int advice = MADV_NORMAL;
+    switch (access) {
+    case map_access::normal:
+      advice = MADV_NORMAL;
+      break;
+    case map_access::sequential:
+      advice = MADV_SEQUENTIAL;
+      break;
+    case map_access::random:
+      advice = MADV_RANDOM;
+      break;
+    case map_access::will_need:
+      advice = MADV_WILLNEED;
+      break;
+    case map_access::dont_need:
+      advice = MADV_DONTNEED;
+      break;
+    }
+    ::madvise(base + offset, length, advice);
+  }
+
+  /**
+   * \brief      Writes the changes made to a read_write mapping back to the file and waits for
+   * the write to complete
+   *
+   * \return     True on success
+   */
+  inline bool flush() const {
+    assert(mode == map_mode::read_write);
+    return mapping && ::msync(mapping, mapping_size, MS_SYNC) == 0;
+  }
+};
+
+/**
+ * \brief      Writes an expression to a new matrix file, evaluating it straight into the mapping
+ *
+ * The file is written under the path with ".tmp" appended and renamed over the path once it is
+ * complete, so the expression may read the file it replaces and a failed or interrupted save leaves
+ * the previous file intact
+ *
+ * \param[in]  path  Path of the file, replaced if it exists
+ * \param      expr  The expression
+ *
+ * \tparam     E     Type of the expression
+ *
+ * \return     True on success
+ */
+template <typename E>
+inline bool save_mapped(char const *path, expression<E> const &expr) {
+  using T = element_type_t<E>;
+  std::string const temporary = std::string(path) + ".tmp";
+  bool written = false;
+  {
+    mapped_matrix<T> file(temporary.c_str(), expr.num_rows(), expr.num_cols());
+    if (file.is_open()) {
+      file.view() = expr;
+      written = file.flush();
+    }
+  }
+  if (!written || std::rename(temporary.c_str(), path) != 0) {
+    ::unlink(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+} // namespace shizmatrix
+
+#endif // SHIZMATRIX_MAPPED_MATRIX_HPP
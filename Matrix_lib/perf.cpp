@@ -0,0 +1,239 @@
+#include "bench_common.hpp"
+#include "shizmatrix.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace shizmatrix;
+
+// Performance regression suite: a fixed set of cases covering element-wise chains of increasing
+// depth, products of square and skinny shapes, scalar broadcasts and assignments into existing
+// storage. Every case is printed as one CSV record
+//   case,type,size,seconds,gflops,gbps,allocs
+// where gbps counts the bytes of the operands read and of the result written once, and allocs the
+// heap allocations of one evaluation after a warm-up. Records of two builds can be diffed as they
+// are, or compared by the program itself:
+//   ./perf --size 512 --output before.csv
+//   ./perf --size 512 --baseline before.csv --tolerance 0.1
+// fails when a case got slower than the baseline by more than the tolerance or allocates more.
+// Build with optimizations, e.g.
+//   g++ -std=c++17 -O3 -march=native -DNDEBUG -pthread perf.cpp bench_common.cpp -o perf
+
+struct record {
+	std::string name;
+	std::string type;
+	std::size_t size;
+	double seconds;
+	double gflops;
+	double gbps;
+	std::size_t allocs;
+
+	std::string key() const {
+		return name + ',' + type + ',' + std::to_string(size);
+	}
+};
+
+struct suite {
+	std::size_t n;
+	int repetitions;
+	std::vector<record> records;
+
+	// Times f, which performs flop floating point operations and moves bytes bytes
+	template <typename F>
+	void run(std::string name, char const *type, double flop, double bytes, F &&f) {
+		f();
+		std::size_t const before = allocation_count.load();
+		f();
+		std::size_t const allocs = allocation_count.load() - before;
+		double const t = seconds(f, repetitions);
+		records.push_back({std::move(name), type, n, t, flop / t * 1e-9, bytes / t * 1e-9, allocs});
+	}
+};
+
+template <typename T>
+void chains(suite &s, char const *type) {
+	std::size_t const n = s.n;
+	std::vector<matrix<T>> m;
+	for (unsigned i = 0; i < 9; ++i) {
+		m.push_back(random_matrix<T>(n, n, i));
+	}
+	matrix<T> dst(n, n);
+	double const elements = static_cast<double>(n) * n;
+	auto chain = [&](std::size_t depth, auto &&assign) {
+		s.run("chain/" + std::to_string(depth), type, depth * elements,
+		      (depth + 2) * elements * sizeof(T), assign);
+	};
+	chain(1, [&] { dst = m[0] + m[1]; });
+	chain(2, [&] { dst = m[0] + m[1] - m[2]; });
+	chain(3, [&] { dst = m[0] + m[1] - m[2] + m[3]; });
+	chain(4, [&] { dst = m[0] + m[1] - m[2] + m[3] - m[4]; });
+	chain(6, [&] { dst = m[0] + m[1] - m[2] + m[3] - m[4] + m[5] - m[6]; });
+	chain(8, [&] { dst = m[0] + m[1] - m[2] + m[3] - m[4] + m[5] - m[6] + m[7] - m[8]; });
+}
+
+template <typename T>
+void broadcasts(suite &s, char const *type) {
+	std::size_t const n = s.n;
+	matrix<T> a = random_matrix<T>(n, n, 1);
+	matrix<T> b = random_matrix<T>(n, n, 2);
+	matrix<T> dst(n, n);
+	T const scale = T(1.5);
+	T const shift = T(0.25);
+	double const elements = static_cast<double>(n) * n;
+	double const size = sizeof(T);
+	s.run("broadcast/a*s", type, elements, 2 * elements * size, [&] { dst = a * scale; });
+	s.run("broadcast/a*s+t", type, 2 * elements, 2 * elements * size,
+	      [&] { dst = a * scale + shift; });
+	s.run("broadcast/(a-t)*s+b", type, 3 * elements, 3 * elements * size,
+	      [&] { dst = (a - shift) * scale + b; });
+	s.run("broadcast/a+b*s", type, 2 * elements, 3 * elements * size,
+	      [&] { dst = a + b * scale; });
+}
+
+template <typename T>
+void products(suite &s, char const *type) {
+	std::size_t const n = s.n;
+	std::size_t const thin = 16;
+	auto product_case = [&](std::size_t m, std::size_t k, std::size_t p, bool transposed) {
+		matrix<T> a = transposed ? random_matrix<T>(k, m, 1) : random_matrix<T>(m, k, 1);
+		matrix<T> b = random_matrix<T>(k, p, 2);
+		matrix<T> dst(m, p);
+		std::string name = "product/" + std::to_string(m) + "x" + std::to_string(k) + "x" +
+		                   std::to_string(p) + (transposed ? "/at" : "");
+		double const flop = 2.0 * m * k * p;
+		double const bytes = (static_cast<double>(m) * k + static_cast<double>(k) * p +
+		                      static_cast<double>(m) * p) * sizeof(T);
+		if (transposed) {
+			s.run(name, type, flop, bytes, [&] { dst = a.transpose() * b; });
+		} else {
+			s.run(name, type, flop, bytes, [&] { dst = a * b; });
+		}
+	};
+	product_case(n, n, n, false);
+	product_case(n, n, n, true);
+	product_case(n, n, thin, false);
+	product_case(thin, n, n, false);
+	product_case(n, thin, n, false);
+	product_case(thin, n, thin, false);
+}
+
+template <typename T>
+void assignments(suite &s, char const *type) {
+	std::size_t const n = s.n;
+	std::size_t const half = n / 2;
+	matrix<T> a = random_matrix<T>(n, n, 1);
+	matrix<T> b = random_matrix<T>(n, n, 2);
+	matrix<T> dst(n, n);
+	double const elements = static_cast<double>(n) * n;
+	double const size = sizeof(T);
+	s.run("assign/copy", type, 0, 2 * elements * size, [&] { dst = a.block(0, 0, n, n); });
+	s.run("assign/existing", type, elements, 3 * elements * size, [&] { dst = a + b; });
+	s.run("assign/fresh", type, elements, 3 * elements * size, [&] {
+		matrix<T> fresh(a + b);
+		dst.data()[0] = fresh.data()[0];
+	});
+	s.run("assign/block", type, static_cast<double>(half) * half, 3.0 * half * half * size, [&] {
+		dst.block(half / 2, half / 2, half, half) = a.block(0, 0, half, half) + b.block(1, 1, half, half);
+	});
+	s.run("assign/transpose", type, 0, 2 * elements * size, [&] { dst = a.transpose(); });
+}
+
+// Reads the records of an earlier run, keyed by case, type and size
+std::map<std::string, record> read_records(char const *path) {
+	std::map<std::string, record> result;
+	std::ifstream in(path);
+	std::string line;
+	while (std::getline(in, line)) {
+		std::istringstream fields(line);
+		record r;
+		std::string size;
+		std::string value[4];
+		if (!std::getline(fields, r.name, ',') || !std::getline(fields, r.type, ',') ||
+		    !std::getline(fields, size, ',') || !std::getline(fields, value[0], ',') ||
+		    !std::getline(fields, value[1], ',') || !std::getline(fields, value[2], ',') ||
+		    !std::getline(fields, value[3]) || r.name == "case") {
+			continue;
+		}
+		r.size = std::strtoul(size.c_str(), nullptr, 10);
+		r.seconds = std::strtod(value[0].c_str(), nullptr);
+		r.gflops = std::strtod(value[1].c_str(), nullptr);
+		r.gbps = std::strtod(value[2].c_str(), nullptr);
+		r.allocs = std::strtoul(value[3].c_str(), nullptr, 10);
+		result[r.key()] = r;
+	}
+	return result;
+}
+
+int main(int argc, char **argv) {
+	suite s{512, 5, {}};
+	double tolerance = 0.1;
+	char const *baseline = nullptr;
+	char const *output = nullptr;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string const option = argv[i];
+		if (option == "--size") {
+			s.n = std::strtoul(argv[i + 1], nullptr, 10);
+		} else if (option == "--repetitions") {
+			s.repetitions = std::atoi(argv[i + 1]);
+		} else if (option == "--tolerance") {
+			tolerance = std::strtod(argv[i + 1], nullptr);
+		} else if (option == "--baseline") {
+			baseline = argv[i + 1];
+		} else if (option == "--output") {
+			output = argv[i + 1];
+		} else {
+			std::cerr << "unknown option " << option << '\n';
+			return 2;
+		}
+	}
+
+	chains<float>(s, "float");
+	chains<double>(s, "double");
+	broadcasts<float>(s, "float");
+	broadcasts<double>(s, "double");
+	products<float>(s, "float");
+	products<double>(s, "double");
+	assignments<float>(s, "float");
+	assignments<double>(s, "double");
+
+	std::ofstream file;
+	if (output) {
+		file.open(output);
+	}
+	std::ostream &out = output ? static_cast<std::ostream &>(file) : std::cout;
+	out << "case,type,size,seconds,gflops,gbps,allocs\n";
+	for (record const &r : s.records) {
+		char line[256];
+		std::snprintf(line, sizeof(line), "%s,%s,%zu,%.6e,%.3f,%.3f,%zu\n", r.name.c_str(),
+		              r.type.c_str(), r.size, r.seconds, r.gflops, r.gbps, r.allocs);
+		out << line;
+	}
+
+	if (!baseline) {
+		return 0;
+	}
+	std::map<std::string, record> const before = read_records(baseline);
+	int regressions = 0;
+	for (record const &r : s.records) {
+		auto const found = before.find(r.key());
+		if (found == before.end()) {
+			continue;
+		}
+		double const speedup = found->second.seconds / r.seconds;
+		bool const slower = speedup < 1 / (1 + tolerance);
+		bool const allocates_more = r.allocs > found->second.allocs;
+		if (slower || allocates_more) {
+			++regressions;
+		}
+		std::fprintf(stderr, "%-28s %-6s %6zu  speedup %6.3f  allocs %zu -> %zu%s\n",
+		             r.name.c_str(), r.type.c_str(), r.size, speedup, found->second.allocs,
+		             r.allocs, slower || allocates_more ? "  REGRESSION" : "");
+	}
+	std::fprintf(stderr, "%d regression%s\n", regressions, regressions == 1 ? "" : "s");
+	return regressions == 0 ? 0 : 1;
+}
@@ -1,11 +1,33 @@
 #ifndef SHIZMATRIX_SHIZMATRIX_HPP
 #define SHIZMATRIX_SHIZMATRIX_HPP
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
 #include <ostream>
+#include <thread>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
+#if defined(__AVX512F__) || defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 namespace shizmatrix {
 
 /**
@@ -181,710 +203,8025 @@ public:
     return 0;
   }
 };
+
 /**
- * \brief      Class for an actual matrix
+ * \brief      Type of a user supplied executor for parallel evaluation
  *
- * This is a 2D matrix that stores elements of any scalar type in a container
+ * An executor is called with a number of tasks and a task function. It must call the function once
+ * for every task index in [0, n_tasks), from any threads it likes, and return only after all calls
+ * have finished
+ */
+using executor = std::function<void(std::size_t, std::function<void(std::size_t)> const &)>;
+
+/**
+ * \brief      Fixed-size pool of worker threads used for parallel evaluation
  *
- * \tparam     T     The type of an element stored in the matrix
+ * The thread calling run() takes part in the work, so a pool of n threads starts n - 1 workers. The
+ * first exception thrown by a task of a job is rethrown by run() once every thread has left the job
  */
-template <typename T>
-class matrix : public expression<matrix<T>> {
+class thread_pool {
 private:
   /**
-   * Container in which the matrix elements are stored
+   * Worker threads of this pool
    */
-  std::vector<T> container;
+  std::vector<std::thread> workers;
 
   /**
-   * Number of rows of this matrix
+   * Serialises run() calls coming from different threads
    */
-  std::size_t n_rows;
+  std::mutex run_mutex;
 
   /**
-   * Number of columns of this matrix
+   * Protects the job description below
    */
-  std::size_t n_cols;
+  std::mutex mutex;
 
-public:
   /**
-   * Return type of eval() method
+   * Signalled when a new job is published or the pool is stopped
    */
-  using EvalReturnType = matrix<T>;
+  std::condition_variable wake;
 
   /**
-   * Type of elements of this matrix
+   * Signalled when the last worker leaves the current job
    */
-  using ElementType = T;
+  std::condition_variable done;
 
   /**
-   * \brief      Default constructor to allow empty matrix construction
+   * Task function of the current job
    */
-  inline matrix() = default;
+  std::function<void(std::size_t)> const *job = nullptr;
 
   /**
-   * \brief      Constructor
-   *
-   * Sizes the container appropriately
-   *
-   * \param[in]  n_rows  The number of rows the matrix should have
-   * \param[in]  n_cols  The number of columns the matrix should have
+   * Number of tasks of the current job
    */
-  inline matrix(std::size_t n_rows, std::size_t n_cols)
-      : container(n_rows * n_cols), n_rows(n_rows), n_cols(n_cols) {}
+  std::size_t n_tasks = 0;
 
   /**
-   * \brief      Constructor
-   *
-   * Fills the container with the given value
-   *
-   * \param[in]  n_rows  The number of rows the matrix should have
-   * \param[in]  n_cols  The number of columns the matrix should have
-   * \param[in]  fill    The element with which to fill the container
+   * Index of the next task to hand out
    */
-  inline matrix(std::size_t n_rows, std::size_t n_cols, T fill)
-      : container(n_rows * n_cols, fill), n_rows(n_rows), n_cols(n_cols) {}
+  std::atomic<std::size_t> next_task{0};
 
   /**
-   * \brief      Move constructor
-   *
-   * \param[in]  other  The matrix to construct from
+   * Number of workers that have not finished the current job yet
    */
-  inline matrix(matrix<T> &&other)
-      : container(std::move(other.container)), n_rows(other.num_rows()), n_cols(other.num_cols()) {}
+  std::size_t active = 0;
 
   /**
-   * \brief      Constructor from another expression
-   *
-   * Construct the matrix from the given expression. After building an expression tree, this (and
-   * the assignment operator) trigger the actual evaluation of the expression
-   *
-   * \param      other  The expression
-   *
-   * \tparam     E      The type of the expression
+   * Incremented for every new job so workers can tell jobs apart
    */
-  template <typename E>
-  inline matrix(expression<E> const &other)
-      : container(other.num_rows() * other.num_cols()), n_rows(other.num_rows()),
-        n_cols(other.num_cols()) {
-    assign(other.get_const_derived());
-  }
+  std::size_t generation = 0;
 
   /**
-   * \brief      Assignment from another expression
-   *
-   * This and the move constructor trigger evaluation of an expression
-   *
-   * \param      other  The expression
-   *
-   * \tparam     E      The type of the expression
-   *
-   * \return     This matrix
+   * First exception thrown by a task of the current job
    */
-  template <typename E>
-  inline matrix &operator=(expression<E> const &other) {
-    assert(n_rows >= other.num_rows());
-    assert(n_cols >= other.num_cols());
-    assign(other.get_const_derived());
-    return *this;
-  }
+  std::exception_ptr error;
 
   /**
-   * \brief      Move assignment operator
-   *
-   * \param[in]  other  The other matrix
-   *
-   * \return     This matrix
+   * Set when the pool is destroyed
    */
-  inline matrix &operator=(matrix<T> &&other) {
-    if (this != &other) {
-      container = std::move(other.container);
-      n_rows = other.n_rows;
-      n_cols = other.n_cols;
-    }
-    return *this;
-  }
+  bool stop = false;
 
   /**
-   * \brief      Function operator to return elements of this matrix
+   * \brief      Whether the calling thread is currently executing a task of some pool
    *
-   * \param[in]  i     Row number of the element to return
-   * \param[in]  j     Column number of the element to return
-   *
-   * \return     The desired element
+   * \return     Reference to the thread local flag
    */
-  inline T operator()(std::size_t i, std::size_t j) const {
-    assert(i < n_rows && i >= 0);
-    assert(j < n_cols && j >= 0);
-    return container[i * n_cols + j];
+  static bool &in_task() {
+    thread_local bool flag = false;
+    return flag;
   }
 
   /**
-   * \brief      Get a reference to the underlying storage container
+   * \brief      Executes tasks of the current job until none are left
    *
-   * \return     The container
-   */
-  inline std::vector<T> &get_container() {
-    return container;
-  }
-
-  /**
-   * \brief      Gets number of rows in this matrix
+   * A throwing task keeps its exception as the error of the job, unless another task failed first,
+   * and cancels the tasks not handed out yet
    *
-   * \return     Number of rows
+   * \param      task   The task function
+   * \param[in]  count  Number of tasks of the job
    */
-  inline std::size_t num_rows() const {
-    return n_rows;
+  inline void drain(std::function<void(std::size_t)> const &task, std::size_t count) {
+    struct task_scope {
+      bool const was_in_task = in_task();
+      task_scope() {
+        in_task() = true;
+      }
+      ~task_scope() {
+        in_task() = was_in_task;
+      }
+    } scope;
+    for (std::size_t i = next_task++; i < count; i = next_task++) {
+      try {
+        task(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+        next_task = count;
+      }
+    }
   }
 
   /**
-   * \brief      Gets number of columns in this matrix
-   *
-   * \return     Number of columns
+   * \brief      Main loop of a worker thread
    */
-  inline std::size_t num_cols() const {
-    return n_cols;
+  inline void worker_loop() {
+    std::size_t seen = 0;
+    for (;;) {
+      std::function<void(std::size_t)> const *task;
+      std::size_t count;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&] { return stop || generation != seen; });
+        if (stop) {
+          return;
+        }
+        seen = generation;
+        task = job;
+        count = n_tasks;
+      }
+      drain(*task, count);
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--active == 0) {
+        done.notify_one();
+      }
+    }
   }
 
+public:
   /**
-   * \brief      Evaluate this expression
-   *
-   * Since this is a matrix whose actual value is already known, simply return a const reference to
-   * itself
+   * \brief      Constructor
    *
-   * \return     Const reference to this matrix
+   * \param[in]  n_threads  Total number of threads working on a job, including the caller
    */
-  inline const matrix<T> &eval() const {
-    return *this;
+  inline explicit thread_pool(std::size_t n_threads) {
+    for (std::size_t i = 1; i < n_threads; ++i) {
+      workers.emplace_back([this] { worker_loop(); });
+    }
   }
 
   /**
-   * \brief      Set an element of this matrix
-   *
-   * \param[in]  i      Row number of the element to set
-   * \param[in]  j      Column number of this element to set
-   * \param[in]  value  The new value of the element
+   * \brief      Destructor, joins all worker threads
    */
-  inline void set_elt(std::size_t i, std::size_t j, T value) {
-    container[i * n_cols + j] = value;
+  inline ~thread_pool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+    wake.notify_all();
+    for (auto &worker : workers) {
+      worker.join();
+    }
   }
 
   /**
-   * \brief      Assign an expression to this matrix
-   *
-   * \param      expr  The expression to assign
+   * \brief      Total number of threads working on a job, including the caller
    *
-   * \tparam     E     The type of the expression
+   * \return     Number of threads
    */
-  template <typename E>
-  inline void assign(expression<E> const &expr) {
-    for (std::size_t i = 0; i < n_rows; ++i) {
-      for (std::size_t j = 0; j < n_cols; ++j) {
-        container[i * n_cols + j] = expr.get_const_derived()(i, j);
-      }
-    }
+  inline std::size_t num_threads() const {
+    return workers.size() + 1;
   }
 
   /**
-   * \brief      The stream operator to print the matrix easily
+   * \brief      Runs the task function for every index in [0, count) and waits for completion
    *
-   * \param      ostream  The output stream
-   * \param[in]  mat      The matrix
+   * Calls made from inside a task run serially on the calling thread. If a task throws, the tasks
+   * not started yet are skipped and the first exception is rethrown after all threads are done
    *
-   * \return     The output stream
+   * \param[in]  count  Number of tasks
+   * \param      task   The task function
    */
-  friend std::ostream &operator<<(std::ostream &ostream, const matrix<T> &mat) {
-    for (std::size_t i = 0; i < mat.n_rows; ++i) {
-      for (std::size_t j = 0; j < mat.n_cols; ++j) {
-        ostream << mat(i, j) << ", ";
+  inline void run(std::size_t count, std::function<void(std::size_t)> const &task) {
+    if (workers.empty() || count <= 1 || in_task()) {
+      for (std::size_t i = 0; i < count; ++i) {
+        task(i);
       }
-      ostream << "\n";
+      return;
+    }
+    std::lock_guard<std::mutex> run_lock(run_mutex);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      job = &task;
+      n_tasks = count;
+      next_task = 0;
+      active = workers.size();
+      ++generation;
+    }
+    wake.notify_all();
+    drain(task, count);
+    std::exception_ptr failed;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      done.wait(lock, [&] { return active == 0; });
+      failed = std::exchange(error, nullptr);
+    }
+    if (failed) {
+      std::rethrow_exception(failed);
     }
-    return ostream;
   }
+};
 
+namespace detail {
+
+/**
+ * \brief      Global settings of parallel evaluation
+ */
+struct parallel_settings {
   /**
-   * \brief      Addition assignment operator with an expression
-   *
-   * \param      expr  The expression
-   *
-   * \tparam     E     The type of the expression
-   *
-   * \return     This matrix
+   * Number of threads to use, 1 disables parallel evaluation
    */
-  template <typename E>
-  inline matrix<T> &operator+=(expression<E> const &expr);
+  std::size_t n_threads = std::max<std::size_t>(1, std::thread::hardware_concurrency());
 
   /**
-   * \brief      Multiplication assignment operator with an expression
-   *
-   * \param      expr  The expression
-   *
-   * \tparam     E     The type of the expression
-   *
-   * \return     This matrix
+   * Minimum amount of work, in evaluated elements or multiply-adds, worth splitting across threads
    */
-  template <typename E>
-  inline matrix<T> &operator*=(expression<E> const &expr);
+  std::size_t threshold = std::size_t(1) << 18;
 
   /**
-   * \brief      Subtraction assignment operator with an expression
-   *
-   * \param      expr  The expression
-   *
-   * \tparam     E     The type of the expression
-   *
-   * \return     This matrix
+   * Whether reductions combine partial results in a fixed tree that does not depend on the number
+   * of threads
    */
-  template <typename E>
-  inline matrix<T> &operator-=(expression<E> const &expr);
+  bool deterministic_reductions = false;
 
   /**
-   * \brief      Addition assignment operator with a scalar
-   *
-   * \param      expr    The expression
-   *
-   * \tparam     Scalar  The type of the scalar
-   *
-   * \return     This matrix
+   * User supplied executor, used instead of the internal pool when set
    */
-  template <typename Scalar, typename = enable_if_not_expression<Scalar>>
-  inline matrix<T> &operator+=(Scalar const &expr);
+  shizmatrix::executor custom_executor;
 
   /**
-   * \brief      Subtraction assignment operator with a scalar
-   *
-   * \param      expr    The expression
-   *
-   * \tparam     Scalar  The type of the scalar
-   *
-   * \return     This matrix
+   * Internal pool, created lazily on first parallel evaluation
    */
-  template <typename Scalar, typename = enable_if_not_expression<Scalar>>
-  inline matrix<T> &operator-=(Scalar const &expr);
+  std::unique_ptr<thread_pool> pool;
 
   /**
-   * \brief      Multiplication assignment operator with a scalar
-   *
-   * \param      expr    The expression
-   *
-   * \tparam     Scalar  The type of the scalar
-   *
-   * \return     This matrix
+   * Guards lazy creation of the pool
    */
-  template <typename Scalar, typename = enable_if_not_expression<Scalar>>
-  inline matrix<T> &operator*=(Scalar const &expr);
+  std::mutex pool_mutex;
 };
-} // namespace shizmatrix
 
-namespace std {
-using namespace shizmatrix;
+/**
+ * \brief      Access the global parallel settings
+ *
+ * \return     Reference to the settings
+ */
+inline parallel_settings &get_parallel_settings() {
+  static parallel_settings settings;
+  return settings;
+}
 
 /**
- * \brief      Overloading common_type trait for two matrices with different element types
+ * \brief      Whether the given amount of work should be evaluated in parallel
  *
- * \tparam     T1    Type of elements of matrix 1
- * \tparam     T2    Type of elements of matrix 2
+ * \param[in]  work  Number of evaluated elements or multiply-adds
+ *
+ * \return     True if the work should be split across threads
  */
-template <typename T1, typename T2>
-struct common_type<matrix<T1>, matrix<T2>> {
-  using type = matrix<std::common_type_t<T1, T2>>;
-};
+inline bool use_parallel(std::size_t work) {
+  parallel_settings const &settings = get_parallel_settings();
+  return (settings.n_threads > 1 || settings.custom_executor) && work >= settings.threshold;
+}
 
 /**
- * \brief      Overloading common_type trait for a matrix and a scalar
+ * \brief      Number of tasks to split a parallel evaluation into
  *
- * \tparam     T1    Type of elements of matrix 1
- * \tparam     T2    Type of scalar
+ * A few tasks per thread balance uneven task durations without much scheduling overhead
+ *
+ * \return     Number of tasks
  */
-template <typename T1, typename T2>
-struct common_type<matrix<T1>, T2> {
-  using type = matrix<std::common_type_t<T1, T2>>;
-};
-} // namespace std
+inline std::size_t parallel_task_count() {
+  return 4 * get_parallel_settings().n_threads;
+}
 
-namespace shizmatrix {
+/**
+ * \brief      Runs the task function for every index in [0, n_tasks) on the configured executor
+ *
+ * \param[in]  n_tasks  Number of tasks
+ * \param      task     The task function
+ */
+inline void parallel_for(std::size_t n_tasks, std::function<void(std::size_t)> const &task) {
+  parallel_settings &settings = get_parallel_settings();
+  if (settings.custom_executor) {
+    settings.custom_executor(n_tasks, task);
+    return;
+  }
+  thread_pool *pool;
+  {
+    std::lock_guard<std::mutex> lock(settings.pool_mutex);
+    if (!settings.pool || settings.pool->num_threads() != settings.n_threads) {
+      settings.pool = std::make_unique<thread_pool>(settings.n_threads);
+    }
+    pool = settings.pool.get();
+  }
+  pool->run(n_tasks, task);
+}
 
 /**
- * \brief      Template specialization for storage type of scalar expressions
+ * \brief      Splits the range [0, n) into contiguous chunks and processes them in parallel
  *
- * \tparam     T     Type of scalar
+ * \param[in]  n     Size of the range
+ * \param      body  Function called with the bounds [begin, end) of every chunk
+ *
+ * \tparam     F     Type of the function
  */
-template <typename T>
-struct storage_type<scalar_expression<T>> {
-  using type = scalar_expression<T>;
-};
+template <typename F>
+inline void parallel_range(std::size_t n, F &&body) {
+  std::size_t const n_tasks = std::min(n, parallel_task_count());
+  parallel_for(n_tasks, [&](std::size_t task) {
+    body(n * task / n_tasks, n * (task + 1) / n_tasks);
+  });
+}
+} // namespace detail
 
 /**
- * \brief      Class for coefficient-wise (element-wise) binary operations on matrix expressions
+ * \brief      Sets the number of threads used for parallel evaluation
  *
- * \tparam     Op    Operation to be performed on the two expressions
- * \tparam     E1    Type of expression 1, must be matrix expression
- * \tparam     E2    Type of expression 2, can be matrix or scalar expression
+ * Must not be called while an expression is being evaluated
+ *
+ * \param[in]  n_threads  Number of threads including the calling one, 1 disables parallel evaluation
  */
-template <typename Op, typename E1, typename E2>
-class cwise_matrix_binary_operation : public expression<cwise_matrix_binary_operation<Op, E1, E2>> {
+inline void set_num_threads(std::size_t n_threads) {
+  detail::get_parallel_settings().n_threads = std::max<std::size_t>(1, n_threads);
+}
+
+/**
+ * \brief      Gets the number of threads used for parallel evaluation
+ *
+ * \return     Number of threads
+ */
+inline std::size_t get_num_threads() {
+  return detail::get_parallel_settings().n_threads;
+}
+
+/**
+ * \brief      Sets the minimum amount of work that is evaluated in parallel
+ *
+ * Element-wise assignments count one unit per element of the result, products one unit per
+ * multiply-add
+ *
+ * \param[in]  threshold  The threshold
+ */
+inline void set_parallel_threshold(std::size_t threshold) {
+  detail::get_parallel_settings().threshold = threshold;
+}
+
+/**
+ * \brief      Sets whether reductions are deterministic
+ *
+ * By default, a parallel reduction is split into one chunk per task and its floating-point result
+ * may change with the number of threads. In deterministic mode, the elements are split into blocks
+ * of a fixed size whose partial results are combined pairwise in a fixed tree, serial evaluations
+ * included, so the result only depends on the reduced values
+ *
+ * \param[in]  deterministic  Whether reductions are deterministic
+ */
+inline void set_deterministic_reductions(bool deterministic) {
+  detail::get_parallel_settings().deterministic_reductions = deterministic;
+}
+
+/**
+ * \brief      Gets whether reductions are deterministic
+ *
+ * \return     True if reductions do not depend on the number of threads
+ */
+inline bool get_deterministic_reductions() {
+  return detail::get_parallel_settings().deterministic_reductions;
+}
+
+/**
+ * \brief      Sets an executor that runs parallel evaluations instead of the internal pool
+ *
+ * The number of tasks handed to the executor still follows set_num_threads(). Passing an empty
+ * executor switches back to the internal pool
+ *
+ * \param      exec  The executor
+ */
+inline void set_executor(executor exec) {
+  detail::get_parallel_settings().custom_executor = std::move(exec);
+}
+
+/**
+ * \brief      Bump allocator for the temporaries of expression evaluation
+ *
+ * Memory is handed out from a list of chunks by moving a pointer, deallocation does nothing.
+ * Memory is reclaimed all at once by rewinding to a mark, which takes constant time. Chunks are kept
+ * across rewinds, so a loop evaluating the same expressions stops allocating after its first
+ * iteration. An arena must only be used by one thread at a time
+ */
+class arena : public std::pmr::memory_resource {
+public:
+  /**
+   * \brief      Position in the arena to rewind to
+   */
+  struct mark {
+    std::size_t chunk;
+    std::size_t offset;
+  };
+
 private:
   /**
-   * Expression 1
+   * \brief      Block of memory obtained from the upstream resource
    */
-  E1 const &expr1;
+  struct chunk {
+    std::byte *data;
+    std::size_t size;
+  };
 
   /**
-   * Expression 2, using storage_type trait as matrix expressions are stored as const references and
-   * scalar expressions are stored by value
+   * Chunks obtained so far, in allocation order
    */
-  storage_type_t<E2> expr2;
+  std::vector<chunk> chunks;
 
-public:
   /**
-   * Return type of eval() method
+   * Index of the chunk memory is currently taken from
    */
-  using EvalReturnType = std::common_type_t<eval_return_type_t<E1>, eval_return_type_t<E2>>;
+  std::size_t current = 0;
 
   /**
-   * Type of elements of this expression
+   * Number of bytes used in the current chunk
    */
-  using ElementType = std::common_type_t<element_type_t<E1>, element_type_t<E2>>;
+  std::size_t offset = 0;
 
   /**
-   * \brief      Constructor
-   *
-   * \param      expr1  Expression 1
-   * \param      expr2  Expression 2
+   * Size of the next chunk to obtain
    */
-  inline cwise_matrix_binary_operation(expression<E1> const &expr1, expression<E2> const &expr2)
-      : expr1(expr1.get_const_derived()), expr2(expr2.get_const_derived()) {}
+  std::size_t next_size;
 
   /**
-   * \brief      Function call operator to get an element of this matrix
+   * Resource the chunks are obtained from
+   */
+  std::pmr::memory_resource *upstream;
+
+  /**
+   * \brief      Takes memory from the current chunk if it has enough room left
    *
-   * This uses lazy evaluation when possible to apply an operation only to the required elements of
-   * expression 1 and 2
+   * \param[in]  bytes      Size of the allocation
+   * \param[in]  alignment  Alignment of the allocation
    *
-   * \param[in]  i     Row number of the element to get
-   * \param[in]  j     Column number of the element to get
+   * \return     The memory, or null if the chunk is too full
+   */
+  inline void *take(std::size_t bytes, std::size_t alignment) {
+    chunk const &c = chunks[current];
+    std::uintptr_t const base = reinterpret_cast<std::uintptr_t>(c.data);
+    std::size_t const start = (base + offset + alignment - 1) / alignment * alignment - base;
+    if (start + bytes > c.size) {
+      return nullptr;
+    }
+    offset = start + bytes;
+    return c.data + start;
+  }
+
+protected:
+  void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+    for (; current < chunks.size(); ++current, offset = 0) {
+      if (void *memory = take(bytes, alignment)) {
+        return memory;
+      }
+    }
+    std::size_t const size = std::max(next_size, bytes + alignment);
+    chunks.push_back(
+        {static_cast<std::byte *>(upstream->allocate(size, alignof(std::max_align_t))), size});
+    next_size = 2 * size;
+    current = chunks.size() - 1;
+    offset = 0;
+    return take(bytes, alignment);
+  }
+
+  void do_deallocate(void *, std::size_t, std::size_t) override {}
+
+  bool do_is_equal(std::pmr::memory_resource const &other) const noexcept override {
+    return this == &other;
+  }
+
+public:
+  /**
+   * \brief      Constructor
    *
-   * \return     The desired element
+   * \param[in]  initial_size  Size in bytes of the first chunk, later chunks double in size
+   * \param      upstream      Resource the chunks are obtained from
    */
-  inline ElementType operator()(std::size_t i, std::size_t j) const {
-    return Op::apply(expr1, expr2, i, j);
+  inline explicit arena(std::size_t initial_size = std::size_t(1) << 20,
+                        std::pmr::memory_resource *upstream = std::pmr::new_delete_resource())
+      : next_size(std::max<std::size_t>(initial_size, 64)), upstream(upstream) {}
+
+  arena(arena const &) = delete;
+  arena &operator=(arena const &) = delete;
+
+  /**
+   * \brief      Destructor returning all chunks to the upstream resource
+   */
+  inline ~arena() override {
+    for (chunk const &c : chunks) {
+      upstream->deallocate(c.data, c.size, alignof(std::max_align_t));
+    }
   }
 
   /**
-   * \brief      Evaluates this expression fully and returns the resultant matrix
+   * \brief      Current position, to rewind to later
    *
-   * This can also be triggered by a user of this library manually when they think that eagerly
-   * evaluating an expression is beneficial, e.g.: a * (b + c) would benefit from eager evaluation
-   * of b + c to prevent repeated calculations of the sum b + c. Thus, it could be re-written as
-   * a * (b + c).eval()
+   * \return     The mark
+   */
+  inline mark get_mark() const {
+    return {current, offset};
+  }
+
+  /**
+   * \brief      Frees everything allocated since the mark was taken, in constant time
    *
-   * \return     The result of evaluating this expression
+   * \param[in]  position  The mark
    */
-  inline const EvalReturnType eval() const {
-    EvalReturnType temp(num_rows(), num_cols());
-    temp.assign((*this));
-    return temp;
+  inline void rewind(mark position) {
+    current = position.chunk;
+    offset = position.offset;
   }
 
   /**
-   * \brief      Gets number of rows in this expression
+   * \brief      Total size in bytes of the chunks obtained so far
    *
-   * \return     Number of rows
+   * \return     The capacity
    */
-  inline std::size_t num_rows() const {
-    return expr1.num_rows();
+  inline std::size_t capacity() const {
+    std::size_t total = 0;
+    for (chunk const &c : chunks) {
+      total += c.size;
+    }
+    return total;
   }
+};
+
+namespace detail {
+
+/**
+ * \brief      Resource temporaries of the calling thread are allocated from, null for the default
+ *
+ * \return     Reference to the thread's slot
+ */
+inline std::pmr::memory_resource *&temporary_resource_slot() {
+  thread_local std::pmr::memory_resource *resource = nullptr;
+  return resource;
+}
+
+/**
+ * \brief      Resource the temporaries of an evaluation on the calling thread are allocated from
+ *
+ * \return     The innermost scoped_arena of the thread, or the default memory resource
+ */
+inline std::pmr::memory_resource *temporary_resource() {
+  std::pmr::memory_resource *resource = temporary_resource_slot();
+  return resource ? resource : std::pmr::get_default_resource();
+}
+} // namespace detail
 
+/**
+ * \brief      Makes temporaries of the calling thread come from an arena until the end of the scope
+ *
+ * Products, chain intermediates and evaluated operands created in the scope are allocated from the
+ * arena, which is rewound to where it was when the scope is left. Matrices constructed by the user
+ * keep using the default resource, but products evaluated in the scope must not be read after it.
+ * Scopes can be nested
+ */
+class scoped_arena {
+private:
   /**
-   * \brief      Gets the number of columns in this expression
+   * Arena owned by this scope, if none was given
+   */
+  std::optional<arena> owned;
+
+  /**
+   * Arena temporaries are allocated from
+   */
+  arena &target;
+
+  /**
+   * Position of the arena when the scope was entered
+   */
+  arena::mark start;
+
+  /**
+   * Resource used before the scope was entered
+   */
+  std::pmr::memory_resource *previous;
+
+public:
+  /**
+   * \brief      Enters a scope allocating from an existing arena, typically one reused across
+   * iterations of a loop
    *
-   * \return     Number of columns
+   * \param      target  The arena
    */
-  inline std::size_t num_cols() const {
-    return expr1.num_cols();
+  inline explicit scoped_arena(arena &target)
+      : target(target), start(target.get_mark()), previous(detail::temporary_resource_slot()) {
+    detail::temporary_resource_slot() = &target;
+  }
+
+  /**
+   * \brief      Enters a scope allocating from an arena of its own
+   *
+   * \param[in]  initial_size  Size in bytes of the first chunk of the arena
+   */
+  inline explicit scoped_arena(std::size_t initial_size = std::size_t(1) << 20)
+      : owned(std::in_place, initial_size), target(*owned), start(target.get_mark()),
+        previous(detail::temporary_resource_slot()) {
+    detail::temporary_resource_slot() = &target;
+  }
+
+  scoped_arena(scoped_arena const &) = delete;
+  scoped_arena &operator=(scoped_arena const &) = delete;
+
+  /**
+   * \brief      Leaves the scope, restoring the previous resource and rewinding the arena
+   */
+  inline ~scoped_arena() {
+    detail::temporary_resource_slot() = previous;
+    target.rewind(start);
   }
 };
 
+template <typename Op, typename E1, typename E2>
+class cwise_matrix_binary_operation;
+
+namespace detail {
+
 /**
- * \brief      Makes a cwise matrix binary operation
+ * \brief      Trait deciding whether an expression can be evaluated into a matrix of element type T
+ * by one linear loop over the flat storage
  *
- * Helps with template argument inference, so that the types of operands need not be specified while
- * specifying the operator
+ * True for matrix and view leaves of element type T, scalar leaves, products evaluating to such
+ * matrices and element-wise additions, subtractions and multiplications of such expressions that
+ * compute in T. Views must also be contiguous at runtime, see linear_ok(). Specializations follow
+ * the definitions of the expression classes
  *
- * \param      expr1  Expression 1
- * \param      expr2  Expression 2
+ * \tparam     E     Type of the expression
+ * \tparam     T     Element type of the destination
+ */
+template <typename E, typename T>
+struct is_linear : std::false_type {};
+
+template <typename T, typename E>
+inline void assign_linear(T *dst, E const &expr, std::size_t begin, std::size_t end);
+
+/**
+ * \brief      Trait deciding whether the assignment of an expression to a matrix of element type T
+ * can be fused into the packed kernel of one of its products
  *
- * \tparam     Op     Type of operation
- * \tparam     E1     Type of expression 1
- * \tparam     E2     Type of expression 2
+ * True for products going through the packed kernel and for element-wise operations computing in T
+ * with such a product among their operands. Specializations follow the definitions of the
+ * expression classes
  *
- * \return     A cwise matrix binary operation
+ * \tparam     E     Type of the expression
+ * \tparam     T     Element type of the destination
  */
-template <template <typename E1, typename E2> typename Op, typename E1, typename E2>
-cwise_matrix_binary_operation<Op<E1, E2>, E1, E2>
-make_cwise_matrix_binary_operation(expression<E1> const &expr1, expression<E2> const &expr2) {
-  return cwise_matrix_binary_operation<Op<E1, E2>, E1, E2>(expr1, expr2);
+template <typename E, typename T>
+struct is_fusable : std::false_type {};
+
+template <typename E>
+inline void prepare(E const &expr);
+
+/**
+ * \brief      How an expression reads the matrix or view it is assigned to, from harmless to worst
+ *
+ * - none: the destination is not read
+ * - same_index: element-wise operations read the destination only at the position being written,
+ *   so the expression can be evaluated in place
+ * - product: a product or a partial reduction reads the destination, it has to be evaluated into
+ *   a temporary before anything is written
+ * - shifted: element-wise operations read the destination at other positions than the one being
+ *   written, like in m = m.transpose(), the whole expression has to be evaluated into a temporary
+ */
+enum class aliasing { none, same_index, product, shifted };
+
+template <typename E, typename D>
+inline aliasing alias_analysis(E const &expr, D const &dst);
+
+template <typename D, typename E>
+inline void assign_dense(D &dst, E const &expr, aliasing alias);
+
+template <typename D, typename E>
+inline void assign_dense(D &dst, E const &expr);
+} // namespace detail
+
+template <typename T>
+class matrix_view;
+
+/**
+ * \brief      Direction of a partial reduction
+ *
+ * rowwise reduces every row to a single element, giving a column, colwise reduces every column,
+ * giving a row
+ */
+enum class direction { rowwise, colwise };
+
+template <typename Reduction, typename E, direction Dir>
+class partial_reduction;
+
+/**
+ * \brief      Storage format of a sparse matrix
+ *
+ * csr compresses rows, each row storing the columns and values of its nonzeros, csc compresses
+ * columns
+ */
+enum class sparse_format { csr, csc };
+
+template <typename T, sparse_format Format = sparse_format::csr>
+class sparse_matrix;
+
+namespace detail {
+
+/**
+ * \brief      Trait telling whether an expression is a sparse matrix
+ *
+ * \tparam     E     Type of the expression
+ */
+template <typename E>
+struct is_sparse : std::false_type {};
+
+template <typename T, sparse_format Format>
+struct is_sparse<sparse_matrix<T, Format>> : std::true_type {};
+
+template <typename T, typename E1, typename E2>
+inline void evaluate_sparse_product(E1 const &lhs, E2 const &rhs, T *c, std::size_t rsc,
+                                    std::size_t csc);
+} // namespace detail
+
+/**
+ * Value of the shape parameters of a matrix whose shape is only known at runtime
+ */
+inline constexpr std::size_t dynamic = static_cast<std::size_t>(-1);
+
+/**
+ * \brief      Class for an actual matrix with R rows and C columns known at compile time
+ *
+ * Both R and C are either given or left dynamic. The primary template is the fixed-size matrix, the
+ * runtime-sized matrix is its specialization for dynamic shapes
+ *
+ * \tparam     T     The type of an element stored in the matrix
+ * \tparam     R     Number of rows, or dynamic
+ * \tparam     C     Number of columns, or dynamic
+ */
+template <typename T, std::size_t R = dynamic, std::size_t C = dynamic>
+class matrix;
+
+namespace detail {
+
+/**
+ * \brief      Trait telling whether a type is a matrix, of any shape
+ *
+ * \tparam     E     The type
+ */
+template <typename E>
+struct is_matrix : std::false_type {};
+
+template <typename T, std::size_t R, std::size_t C>
+struct is_matrix<matrix<T, R, C>> : std::true_type {};
+
+/**
+ * \brief      Trait returning the number of rows and columns of a matrix type known at compile
+ * time, dynamic for runtime-sized matrices and non-matrix types
+ *
+ * \tparam     M     The type
+ */
+template <typename M>
+struct static_shape {
+  static constexpr std::size_t rows = dynamic;
+  static constexpr std::size_t cols = dynamic;
+};
+
+template <typename T, std::size_t R, std::size_t C>
+struct static_shape<matrix<T, R, C>> {
+  static constexpr std::size_t rows = R;
+  static constexpr std::size_t cols = C;
+};
+
+/**
+ * Number of rows of the result of an expression known at compile time, or dynamic
+ */
+template <typename E>
+inline constexpr std::size_t static_rows_v = static_shape<eval_return_type_t<E>>::rows;
+
+/**
+ * Number of columns of the result of an expression known at compile time, or dynamic
+ */
+template <typename E>
+inline constexpr std::size_t static_cols_v = static_shape<eval_return_type_t<E>>::cols;
+
+/**
+ * \brief      Tells whether two dimensions can be equal, which is the case unless both are known
+ * at compile time and differ
+ *
+ * \param[in]  lhs   Dimension 1, or dynamic
+ * \param[in]  rhs   Dimension 2, or dynamic
+ *
+ * \return     False if the dimensions certainly differ
+ */
+constexpr bool dims_agree(std::size_t lhs, std::size_t rhs) {
+  return lhs == dynamic || rhs == dynamic || lhs == rhs;
 }
 
 /**
- * \brief      Class to represent a matrix product
+ * Type of a matrix with the given shape, runtime-sized unless both dimensions are known
+ */
+template <typename T, std::size_t R, std::size_t C>
+using shaped_matrix_t = std::conditional_t<R == dynamic || C == dynamic, matrix<T>, matrix<T, R, C>>;
+
+/**
+ * Largest number of iterations static_for unrolls
+ */
+inline constexpr std::size_t unroll_limit = 64;
+
+template <typename F, std::size_t... I>
+inline void static_for_impl(F &&f, std::index_sequence<I...>) {
+  (f(std::integral_constant<std::size_t, I>()), ...);
+}
+
+/**
+ * \brief      Calls f(0), ..., f(N - 1), fully unrolled when N is at most unroll_limit
  *
- * Matrix products are eagerly evaluated and stored in a temporary, as statements like x = x * a can
- * cause incorrect results if lazily evaluated
+ * \param      f     The function, taking the index as a std::size_t
  *
- * \tparam     E1    Type of expression 1
- * \tparam     E2    Type of expression 2
+ * \tparam     N     Number of iterations
+ * \tparam     F     Type of the function
  */
-template <typename E1, typename E2>
-class matrix_product : public expression<matrix_product<E1, E2>> {
+template <std::size_t N, typename F>
+inline void static_for(F &&f) {
+  if constexpr (N <= unroll_limit) {
+    static_for_impl(f, std::make_index_sequence<N>());
+  } else {
+    for (std::size_t i = 0; i < N; ++i) {
+      f(i);
+    }
+  }
+}
+} // namespace detail
+
+/**
+ * \brief      Class for an actual matrix whose shape is chosen at runtime
+ *
+ * This is a 2D matrix that stores elements of any scalar type in a container
+ *
+ * \tparam     T     The type of an element stored in the matrix
+ */
+template <typename T>
+class matrix<T, dynamic, dynamic> : public expression<matrix<T>> {
 public:
   /**
-   * Return type of eval() method
+   * Allocator of the container, see scoped_arena
+   */
+  using allocator_type = std::pmr::polymorphic_allocator<T>;
+
+private:
+  /**
+   * Container in which the matrix elements are stored
+   */
+  std::pmr::vector<T> container;
+
+  /**
+   * Number of rows of this matrix
+   */
+  std::size_t n_rows;
+
+  /**
+   * Number of columns of this matrix
+   */
+  std::size_t n_cols;
+
+public:
+  /**
+   * Return type of eval() method
+   */
+  using EvalReturnType = matrix<T>;
+
+  /**
+   * Type of elements of this matrix
+   */
+  using ElementType = T;
+
+  /**
+   * \brief      Default constructor to allow empty matrix construction
+   */
+  inline matrix() = default;
+
+  /**
+   * \brief      Constructor of an empty matrix allocating from the given allocator
+   *
+   * \param[in]  alloc  The allocator
+   */
+  inline explicit matrix(allocator_type alloc) : container(alloc), n_rows(0), n_cols(0) {}
+
+  /**
+   * \brief      Constructor
+   *
+   * Sizes the container appropriately
+   *
+   * \param[in]  n_rows  The number of rows the matrix should have
+   * \param[in]  n_cols  The number of columns the matrix should have
+   * \param[in]  alloc   The allocator, the default memory resource if omitted
+   */
+  inline matrix(std::size_t n_rows, std::size_t n_cols, allocator_type alloc = {})
+      : container(n_rows * n_cols, alloc), n_rows(n_rows), n_cols(n_cols) {}
+
+  /**
+   * \brief      Constructor
+   *
+   * Fills the container with the given value
+   *
+   * \param[in]  n_rows  The number of rows the matrix should have
+   * \param[in]  n_cols  The number of columns the matrix should have
+   * \param[in]  fill    The element with which to fill the container
+   * \param[in]  alloc   The allocator, the default memory resource if omitted
+   */
+  inline matrix(std::size_t n_rows, std::size_t n_cols, T fill, allocator_type alloc = {})
+      : container(n_rows * n_cols, fill, alloc), n_rows(n_rows), n_cols(n_cols) {}
+
+  /**
+   * \brief      Move constructor
+   *
+   * \param[in]  other  The matrix to construct from
+   */
+  inline matrix(matrix<T> &&other)
+      : container(std::move(other.container)), n_rows(other.num_rows()), n_cols(other.num_cols()) {}
+
+  /**
+   * \brief      Constructor from another expression
+   *
+   * Construct the matrix from the given expression. After building an expression tree, this (and
+   * the assignment operator) trigger the actual evaluation of the expression
+   *
+   * \param      other  The expression
+   * \param[in]  alloc  The allocator, the default memory resource if omitted
+   *
+   * \tparam     E      The type of the expression
+   */
+  template <typename E>
+  inline matrix(expression<E> const &other, allocator_type alloc = {})
+      : container(other.num_rows() * other.num_cols(), alloc), n_rows(other.num_rows()),
+        n_cols(other.num_cols()) {
+    // the storage was just allocated, the expression cannot read it
+    detail::assign_dense(*this, other.get_const_derived(), detail::aliasing::none);
+  }
+
+  /**
+   * \brief      Assignment from another expression
+   *
+   * This and the move constructor trigger evaluation of an expression
+   *
+   * \param      other  The expression
+   *
+   * \tparam     E      The type of the expression
+   *
+   * \return     This matrix
+   */
+  template <typename E>
+  inline matrix &operator=(expression<E> const &other) {
+    assert(n_rows >= other.num_rows());
+    assert(n_cols >= other.num_cols());
+    assign(other.get_const_derived());
+    return *this;
+  }
+
+  /**
+   * \brief      Move assignment operator
+   *
+   * This matrix keeps its allocator, the elements are copied if the two allocators differ, so a
+   * matrix never picks up memory of a scoped_arena this way
+   *
+   * \param[in]  other  The other matrix
+   *
+   * \return     This matrix
+   */
+  inline matrix &operator=(matrix<T> &&other) {
+    if (this != &other) {
+      container = std::move(other.container);
+      n_rows = other.n_rows;
+      n_cols = other.n_cols;
+    }
+    return *this;
+  }
+
+  /**
+   * \brief      Function operator to return elements of this matrix
+   *
+   * \param[in]  i     Row number of the element to return
+   * \param[in]  j     Column number of the element to return
+   *
+   * \return     The desired element
+   */
+  inline T operator()(std::size_t i, std::size_t j) const {
+    assert(i < n_rows && i >= 0);
+    assert(j < n_cols && j >= 0);
+    return container[i * n_cols + j];
+  }
+
+  /**
+   * \brief      Get a reference to the underlying storage container
+   *
+   * The container is a std::pmr::vector<T> allocating from the memory resource of the matrix; it
+   * used to be a std::vector<T>. Callers that bound a std::vector<T>& should read the elements
+   * through data() instead, or copy them with std::vector<T>(c.begin(), c.end()). A container
+   * moved out of the matrix keeps allocating from that resource, which must outlive it
+   *
+   * \return     The container
+   */
+  inline std::pmr::vector<T> &get_container() {
+    return container;
+  }
+
+  /**
+   * \brief      Get a const reference to the underlying storage container
+   *
+   * A std::pmr::vector<T>, see the non-const overload for migrating from std::vector<T>
+   *
+   * \return     The container
+   */
+  inline std::pmr::vector<T> const &get_container() const {
+    return container;
+  }
+
+  /**
+   * \brief      Get the allocator of the container
+   *
+   * \return     The allocator
+   */
+  inline allocator_type get_allocator() const {
+    return container.get_allocator();
+  }
+
+  /**
+   * \brief      Get a pointer to the first element of the row-major storage
+   *
+   * \return     Pointer to the element (0, 0)
+   */
+  inline T *data() {
+    return container.data();
+  }
+
+  /**
+   * \brief      Get a const pointer to the first element of the row-major storage
+   *
+   * \return     Const pointer to the element (0, 0)
+   */
+  inline T const *data() const {
+    return container.data();
+  }
+
+  /**
+   * \brief      Distance in elements between two vertically adjacent elements
+   *
+   * \return     Row stride of the storage
+   */
+  inline std::size_t row_stride() const {
+    return n_cols;
+  }
+
+  /**
+   * \brief      Distance in elements between two horizontally adjacent elements
+   *
+   * \return     Column stride of the storage
+   */
+  inline std::size_t col_stride() const {
+    return 1;
+  }
+
+  /**
+   * \brief      Gets number of rows in this matrix
+   *
+   * \return     Number of rows
+   */
+  inline std::size_t num_rows() const {
+    return n_rows;
+  }
+
+  /**
+   * \brief      Gets number of columns in this matrix
+   *
+   * \return     Number of columns
+   */
+  inline std::size_t num_cols() const {
+    return n_cols;
+  }
+
+  /**
+   * \brief      View of a rectangular block of this matrix, sharing its storage
+   *
+   * \param[in]  i     Row of the top left element of the block
+   * \param[in]  j     Column of the top left element of the block
+   * \param[in]  rows  Number of rows of the block
+   * \param[in]  cols  Number of columns of the block
+   *
+   * \return     The view
+   */
+  inline matrix_view<T> block(std::size_t i, std::size_t j, std::size_t rows, std::size_t cols) {
+    return matrix_view<T>(data(), num_rows(), num_cols(), row_stride(), col_stride())
+        .block(i, j, rows, cols);
+  }
+
+  /**
+   * \brief      Read-only view of a rectangular block of this matrix, sharing its storage
+   *
+   * \param[in]  i     Row of the top left element of the block
+   * \param[in]  j     Column of the top left element of the block
+   * \param[in]  rows  Number of rows of the block
+   * \param[in]  cols  Number of columns of the block
+   *
+   * \return     The view
+   */
+  inline matrix_view<T const> block(std::size_t i, std::size_t j, std::size_t rows,
+                                    std::size_t cols) const {
+    return matrix_view<T const>(data(), num_rows(), num_cols(), row_stride(), col_stride())
+        .block(i, j, rows, cols);
+  }
+
+  /**
+   * \brief      View of a row of this matrix, as a 1 x n matrix
+   *
+   * \param[in]  i     The row
+   *
+   * \return     The view
+   */
+  inline matrix_view<T> row(std::size_t i) {
+    return block(i, 0, 1, num_cols());
+  }
+
+  /**
+   * \brief      Read-only view of a row of this matrix, as a 1 x n matrix
+   *
+   * \param[in]  i     The row
+   *
+   * \return     The view
+   */
+  inline matrix_view<T const> row(std::size_t i) const {
+    return block(i, 0, 1, num_cols());
+  }
+
+  /**
+   * \brief      View of a column of this matrix, as an n x 1 matrix
+   *
+   * \param[in]  j     The column
+   *
+   * \return     The view
+   */
+  inline matrix_view<T> col(std::size_t j) {
+    return block(0, j, num_rows(), 1);
+  }
+
+  /**
+   * \brief      Read-only view of a column of this matrix, as an n x 1 matrix
+   *
+   * \param[in]  j     The column
+   *
+   * \return     The view
+   */
+  inline matrix_view<T const> col(std::size_t j) const {
+    return block(0, j, num_rows(), 1);
+  }
+
+  /**
+   * \brief      View of the transpose of this matrix, sharing its storage
+   *
+   * \return     The view
+   */
+  inline matrix_view<T> transpose() {
+    return matrix_view<T>(data(), num_cols(), num_rows(), col_stride(), row_stride());
+  }
+
+  /**
+   * \brief      Read-only view of the transpose of this matrix, sharing its storage
+   *
+   * \return     The view
+   */
+  inline matrix_view<T const> transpose() const {
+    return matrix_view<T const>(data(), num_cols(), num_rows(), col_stride(), row_stride());
+  }
+
+  /**
+   * \brief      Evaluate this expression
+   *
+   * Since this is a matrix whose actual value is already known, simply return a const reference to
+   * itself
+   *
+   * \return     Const reference to this matrix
+   */
+  inline const matrix<T> &eval() const {
+    return *this;
+  }
+
+  /**
+   * \brief      Set an element of this matrix
+   *
+   * \param[in]  i      Row number of the element to set
+   * \param[in]  j      Column number of this element to set
+   * \param[in]  value  The new value of the element
+   */
+  inline void set_elt(std::size_t i, std::size_t j, T value) {
+    container[i * n_cols + j] = value;
+  }
+
+  /**
+   * \brief      Assign an expression to this matrix
+   *
+   * Products are evaluated lazily. When the expression is a product, or an element-wise operation on
+   * one, whose operands do not read this matrix, the element-wise part is applied while the packed
+   * kernel writes the product back, so the product is never stored in a temporary. This includes
+   * updates like m = a * b + m, see detail::alias_analysis(). Otherwise all products are evaluated
+   * first, then element-wise sums, differences and products of contiguous matrices, views and
+   * scalars are evaluated in place by one SIMD loop over the flat storage, any other expression
+   * element by element. Only expressions reading this matrix through a view at other positions than
+   * the ones being written, like m = m.transpose(), are evaluated into a temporary first. Large
+   * results are split into blocks that are evaluated in parallel, see set_num_threads() and
+   * set_parallel_threshold(). Every element is computed exactly as in the serial loop, so the result
+   * does not depend on the number of threads
+   *
+   * \param      expr  The expression to assign
+   *
+   * \tparam     E     The type of the expression
+   */
+  template <typename E>
+  inline void assign(expression<E> const &expr) {
+    detail::assign_dense(*this, expr.get_const_derived());
+  }
+
+  /**
+   * \brief      The stream operator to print the matrix easily
+   *
+   * \param      ostream  The output stream
+   * \param[in]  mat      The matrix
+   *
+   * \return     The output stream
+   */
+  friend std::ostream &operator<<(std::ostream &ostream, const matrix<T> &mat) {
+    for (std::size_t i = 0; i < mat.n_rows; ++i) {
+      for (std::size_t j = 0; j < mat.n_cols; ++j) {
+        ostream << mat(i, j) << ", ";
+      }
+      ostream << "\n";
+    }
+    return ostream;
+  }
+
+  /**
+   * \brief      Addition assignment operator with an expression
+   *
+   * \param      expr  The expression
+   *
+   * \tparam     E     The type of the expression
+   *
+   * \return     This matrix
+   */
+  template <typename E>
+  inline matrix<T> &operator+=(expression<E> const &expr);
+
+  /**
+   * \brief      Multiplication assignment operator with an expression
+   *
+   * \param      expr  The expression
+   *
+   * \tparam     E     The type of the expression
+   *
+   * \return     This matrix
+   */
+  template <typename E>
+  inline matrix<T> &operator*=(expression<E> const &expr);
+
+  /**
+   * \brief      Subtraction assignment operator with an expression
+   *
+   * \param      expr  The expression
+   *
+   * \tparam     E     The type of the expression
+   *
+   * \return     This matrix
+   */
+  template <typename E>
+  inline matrix<T> &operator-=(expression<E> const &expr);
+
+  /**
+   * \brief      Addition assignment operator with a scalar
+   *
+   * \param      expr    The expression
+   *
+   * \tparam     Scalar  The type of the scalar
+   *
+   * \return     This matrix
+   */
+  template <typename Scalar, typename = enable_if_not_expression<Scalar>>
+  inline matrix<T> &operator+=(Scalar const &expr);
+
+  /**
+   * \brief      Subtraction assignment operator with a scalar
+   *
+   * \param      expr    The expression
+   *
+   * \tparam     Scalar  The type of the scalar
+   *
+   * \return     This matrix
+   */
+  template <typename Scalar, typename = enable_if_not_expression<Scalar>>
+  inline matrix<T> &operator-=(Scalar const &expr);
+
+  /**
+   * \brief      Multiplication assignment operator with a scalar
+   *
+   * \param      expr    The expression
+   *
+   * \tparam     Scalar  The type of the scalar
+   *
+   * \return     This matrix
+   */
+  template <typename Scalar, typename = enable_if_not_expression<Scalar>>
+  inline matrix<T> &operator*=(Scalar const &expr);
+};
+
+/**
+ * \brief      Class for an actual matrix with a shape known at compile time
+ *
+ * The elements are stored inline in a std::array, so the matrix lives on the stack, is trivially
+ * copyable when T is, and needs no allocation. Assignments and products are fully unrolled for
+ * small shapes and shapes are checked at compile time against other fixed-size expressions. It can
+ * be mixed with runtime-sized matrices in expressions, whose shapes are then checked at runtime
+ *
+ * \tparam     T     The type of an element stored in the matrix
+ * \tparam     R     Number of rows
+ * \tparam     C     Number of columns
+ */
+template <typename T, std::size_t R, std::size_t C>
+class matrix : public expression<matrix<T, R, C>> {
+  static_assert(R != dynamic && C != dynamic,
+                "a matrix is either fully fixed-size or fully runtime-sized");
+  static_assert(R > 0 && C > 0, "fixed-size matrices cannot be empty");
+
+private:
+  /**
+   * Container in which the matrix elements are stored, row-major
+   */
+  std::array<T, R * C> container;
+
+public:
+  /**
+   * Return type of eval() method
+   */
+  using EvalReturnType = matrix<T, R, C>;
+
+  /**
+   * Type of an element in this matrix
+   */
+  using ElementType = T;
+
+  /**
+   * \brief      Default constructor, initializing all elements to zero
+   */
+  constexpr matrix() : container() {}
+
+  /**
+   * \brief      Constructor initializing all elements to a given value
+   *
+   * \param[in]  fill  The value to initialize elements to
+   */
+  constexpr explicit matrix(T fill) : container() {
+    for (std::size_t idx = 0; idx < R * C; ++idx) {
+      container[idx] = fill;
+    }
+  }
+
+  /**
+   * \brief      Constructor from the elements in row-major order
+   *
+   * \param[in]  elements  The elements
+   */
+  constexpr matrix(std::array<T, R * C> const &elements) : container(elements) {}
+
+  /**
+   * \brief      Constructs the matrix from any expression of the same shape
+   *
+   * \param      other  The expression
+   *
+   * \tparam     E      Type of the expression
+   */
+  template <typename E>
+  inline matrix(expression<E> const &other) : container() {
+    assign(other.get_const_derived());
+  }
+
+  /**
+   * \brief      Assigns an expression of the same shape to this matrix
+   *
+   * \param      other  The expression
+   *
+   * \tparam     E      Type of the expression
+   *
+   * \return     Reference to this matrix
+   */
+  template <typename E>
+  inline matrix &operator=(expression<E> const &other) {
+    assign(other.get_const_derived());
+    return *this;
+  }
+
+  /**
+   * \brief      Function call operator to get an element
+   *
+   * \param[in]  i     Row number of the element to get
+   * \param[in]  j     Column number of the element to get
+   *
+   * \return     The element
+   */
+  constexpr T operator()(std::size_t i, std::size_t j) const {
+    assert(i < R && j < C);
+    return container[i * C + j];
+  }
+
+  /**
+   * \brief      Sets the value of an element
+   *
+   * \param[in]  i      Row number of the element to set
+   * \param[in]  j      Column number of this element to set
+   * \param[in]  value  The new value of the element
+   */
+  constexpr void set_elt(std::size_t i, std::size_t j, T value) {
+    assert(i < R && j < C);
+    container[i * C + j] = value;
+  }
+
+  /**
+   * \brief      Get the container holding the elements
+   *
+   * \return     The container
+   */
+  constexpr std::array<T, R * C> &get_container() {
+    return container;
+  }
+
+  /**
+   * \brief      Get the container holding the elements
+   *
+   * \return     The container
+   */
+  constexpr std::array<T, R * C> const &get_container() const {
+    return container;
+  }
+
+  /**
+   * \brief      Pointer to the row-major storage
+   *
+   * \return     Pointer to the first element
+   */
+  constexpr T *data() {
+    return container.data();
+  }
+
+  /**
+   * \brief      Pointer to the row-major storage
+   *
+   * \return     Pointer to the first element
+   */
+  constexpr T const *data() const {
+    return container.data();
+  }
+
+  /**
+   * \brief      Distance in elements between two consecutive rows
+   *
+   * \return     The number of columns
+   */
+  static constexpr std::size_t row_stride() {
+    return C;
+  }
+
+  /**
+   * \brief      Distance in elements between two consecutive columns
+   *
+   * \return     Always 1
+   */
+  static constexpr std::size_t col_stride() {
+    return 1;
+  }
+
+  /**
+   * \brief      Get number of rows of this matrix
+   *
+   * \return     Number of rows
+   */
+  static constexpr std::size_t num_rows() {
+    return R;
+  }
+
+  /**
+   * \brief      Get number of columns of this matrix
+   *
+   * \return     Number of columns
+   */
+  static constexpr std::size_t num_cols() {
+    return C;
+  }
+
+  /**
+   * \brief      View of a rectangular block of this matrix, sharing its storage
+   *
+   * \param[in]  i     Row of the top left element of the block
+   * \param[in]  j     Column of the top left element of the block
+   * \param[in]  rows  Number of rows of the block
+   * \param[in]  cols  Number of columns of the block
+   *
+   * \return     The view
+   */
+  inline matrix_view<T> block(std::size_t i, std::size_t j, std::size_t rows, std::size_t cols) {
+    return matrix_view<T>(data(), num_rows(), num_cols(), row_stride(), col_stride())
+        .block(i, j, rows, cols);
+  }
+
+  /**
+   * \brief      Read-only view of a rectangular block of this matrix, sharing its storage
+   *
+   * \param[in]  i     Row of the top left element of the block
+   * \param[in]  j     Column of the top left element of the block
+   * \param[in]  rows  Number of rows of the block
+   * \param[in]  cols  Number of columns of the block
+   *
+   * \return     The view
+   */
+  inline matrix_view<T const> block(std::size_t i, std::size_t j, std::size_t rows,
+                                    std::size_t cols) const {
+    return matrix_view<T const>(data(), num_rows(), num_cols(), row_stride(), col_stride())
+        .block(i, j, rows, cols);
+  }
+
+  /**
+   * \brief      View of a row of this matrix, as a 1 x n matrix
+   *
+   * \param[in]  i     The row
+   *
+   * \return     The view
+   */
+  inline matrix_view<T> row(std::size_t i) {
+    return block(i, 0, 1, num_cols());
+  }
+
+  /**
+   * \brief      Read-only view of a row of this matrix, as a 1 x n matrix
+   *
+   * \param[in]  i     The row
+   *
+   * \return     The view
+   */
+  inline matrix_view<T const> row(std::size_t i) const {
+    return block(i, 0, 1, num_cols());
+  }
+
+  /**
+   * \brief      View of a column of this matrix, as an n x 1 matrix
+   *
+   * \param[in]  j     The column
+   *
+   * \return     The view
+   */
+  inline matrix_view<T> col(std::size_t j) {
+    return block(0, j, num_rows(), 1);
+  }
+
+  /**
+   * \brief      Read-only view of a column of this matrix, as an n x 1 matrix
+   *
+   * \param[in]  j     The column
+   *
+   * \return     The view
+   */
+  inline matrix_view<T const> col(std::size_t j) const {
+    return block(0, j, num_rows(), 1);
+  }
+
+  /**
+   * \brief      View of the transpose of this matrix, sharing its storage
+   *
+   * \return     The view
+   */
+  inline matrix_view<T> transpose() {
+    return matrix_view<T>(data(), num_cols(), num_rows(), col_stride(), row_stride());
+  }
+
+  /**
+   * \brief      Read-only view of the transpose of this matrix, sharing its storage
+   *
+   * \return     The view
+   */
+  inline matrix_view<T const> transpose() const {
+    return matrix_view<T const>(data(), num_cols(), num_rows(), col_stride(), row_stride());
+  }
+
+  /**
+   * \brief      Evaluate the matrix, which simply returns a reference to itself
+   *
+   * \return     Reference to this matrix
+   */
+  constexpr matrix const &eval() const {
+    return *this;
+  }
+
+  /**
+   * \brief      Assign an expression to this matrix
+   *
+   * Products are evaluated first, then every element is computed by a fully unrolled loop for
+   * small shapes. Expressions reading this matrix through a view at other positions than the ones
+   * being written are evaluated into a temporary first. The shape of the expression is checked at
+   * compile time if it is known, at runtime otherwise
+   *
+   * \param      expr  The expression to assign
+   *
+   * \tparam     E     The type of the expression
+   */
+  template <typename E>
+  inline void assign(expression<E> const &expr) {
+    static_assert(detail::dims_agree(R, detail::static_rows_v<E>) &&
+                      detail::dims_agree(C, detail::static_cols_v<E>),
+                  "assigning an expression of a different shape");
+    assert(expr.num_rows() == R && expr.num_cols() == C);
+    E const &derived = expr.get_const_derived();
+    if (detail::alias_analysis(derived, *this) == detail::aliasing::shifted) {
+      matrix const temp(derived);
+      container = temp.container;
+      return;
+    }
+    detail::prepare(derived);
+    detail::static_for<R * C>(
+        [&](std::size_t idx) { container[idx] = static_cast<T>(derived(idx / C, idx % C)); });
+  }
+
+  /**
+   * \brief      The stream operator to print the matrix easily
+   *
+   * \param      ostream  The output stream
+   * \param[in]  mat      The matrix
+   *
+   * \return     The output stream
+   */
+  friend std::ostream &operator<<(std::ostream &ostream, const matrix &mat) {
+    for (std::size_t i = 0; i < R; ++i) {
+      for (std::size_t j = 0; j < C; ++j) {
+        ostream << mat(i, j) << ", ";
+      }
+      ostream << "\n";
+    }
+    return ostream;
+  }
+
+  template <typename E>
+  inline matrix &operator+=(expression<E> const &expr);
+
+  template <typename E>
+  inline matrix &operator*=(expression<E> const &expr);
+
+  template <typename E>
+  inline matrix &operator-=(expression<E> const &expr);
+
+  template <typename Scalar, typename = enable_if_not_expression<Scalar>>
+  inline matrix &operator+=(Scalar const &expr);
+
+  template <typename Scalar, typename = enable_if_not_expression<Scalar>>
+  inline matrix &operator-=(Scalar const &expr);
+
+  template <typename Scalar, typename = enable_if_not_expression<Scalar>>
+  inline matrix &operator*=(Scalar const &expr);
+};
+
+/**
+ * \brief      Class for a view of the elements of a matrix, without copying them
+ *
+ * A view references the storage of a matrix through a pointer to its first element and a row and a
+ * column stride, so blocks, rows, columns and transposes of matrices and of other views are views
+ * too. Views are expressions and can be read in any expression. Views of non-const elements can be
+ * assigned to, which writes through to the matrix: assigning a view, including from another view,
+ * assigns the elements and never rebinds the view. Contiguous views go through the SIMD loop and all
+ * views are read in place by the packed product kernel. A view must not outlive its matrix
+ *
+ * \tparam     T     The type of an element, const-qualified for read-only views
+ */
+template <typename T>
+class matrix_view : public expression<matrix_view<T>> {
+public:
+  /**
+   * Type of an element of this view
+   */
+  using ElementType = std::remove_const_t<T>;
+
+  /**
+   * Return type of eval() method
+   */
+  using EvalReturnType = matrix<ElementType>;
+
+private:
+  /**
+   * Pointer to the first element
+   */
+  T *ptr;
+
+  /**
+   * Number of rows of this view
+   */
+  std::size_t n_rows;
+
+  /**
+   * Number of columns of this view
+   */
+  std::size_t n_cols;
+
+  /**
+   * Distance in elements between two consecutive rows
+   */
+  std::size_t rs;
+
+  /**
+   * Distance in elements between two consecutive columns
+   */
+  std::size_t cs;
+
+public:
+  /**
+   * \brief      Constructor
+   *
+   * \param      data        Pointer to the first element
+   * \param[in]  n_rows      Number of rows
+   * \param[in]  n_cols      Number of columns
+   * \param[in]  row_stride  Distance in elements between two consecutive rows
+   * \param[in]  col_stride  Distance in elements between two consecutive columns
+   */
+  inline matrix_view(T *data, std::size_t n_rows, std::size_t n_cols, std::size_t row_stride,
+                     std::size_t col_stride)
+      : ptr(data), n_rows(n_rows), n_cols(n_cols), rs(row_stride), cs(col_stride) {}
+
+  /**
+   * \brief      Copy constructor, referencing the same elements
+   *
+   * \param[in]  other  The view
+   */
+  inline matrix_view(matrix_view const &other) = default;
+
+  /**
+   * \brief      Conversion of a view of non-const elements to a read-only view
+   *
+   * \param[in]  other  The view
+   *
+   * \tparam     U      Element type of the view
+   */
+  template <typename U, typename = std::enable_if_t<std::is_same<U const, T>::value &&
+                                                    !std::is_same<U, T>::value>>
+  inline matrix_view(matrix_view<U> const &other)
+      : ptr(other.data()), n_rows(other.num_rows()), n_cols(other.num_cols()),
+        rs(other.row_stride()), cs(other.col_stride()) {}
+
+  /**
+   * \brief      Assigns the elements of another view of the same shape to the elements of this view
+   *
+   * \param[in]  other  The view
+   *
+   * \return     This view
+   */
+  inline matrix_view &operator=(matrix_view const &other) {
+    assign(other);
+    return *this;
+  }
+
+  /**
+   * \brief      Assigns an expression of the same shape to the elements of this view
+   *
+   * \param      other  The expression
+   *
+   * \tparam     E      The type of the expression
+   *
+   * \return     This view
+   */
+  template <typename E>
+  inline matrix_view &operator=(expression<E> const &other) {
+    assign(other.get_const_derived());
+    return *this;
+  }
+
+  /**
+   * \brief      Function call operator to get an element
+   *
+   * \param[in]  i     Row number of the element to get
+   * \param[in]  j     Column number of the element to get
+   *
+   * \return     The element
+   */
+  inline ElementType operator()(std::size_t i, std::size_t j) const {
+    assert(i < n_rows && j < n_cols);
+    return ptr[i * rs + j * cs];
+  }
+
+  /**
+   * \brief      Sets the value of an element
+   *
+   * \param[in]  i      Row number of the element to set
+   * \param[in]  j      Column number of this element to set
+   * \param[in]  value  The new value of the element
+   */
+  inline void set_elt(std::size_t i, std::size_t j, ElementType value) const {
+    static_assert(!std::is_const<T>::value, "cannot write through a read-only view");
+    assert(i < n_rows && j < n_cols);
+    ptr[i * rs + j * cs] = value;
+  }
+
+  /**
+   * \brief      Pointer to the first element
+   *
+   * \return     The pointer
+   */
+  inline T *data() const {
+    return ptr;
+  }
+
+  /**
+   * \brief      Distance in elements between two consecutive rows
+   *
+   * \return     The row stride
+   */
+  inline std::size_t row_stride() const {
+    return rs;
+  }
+
+  /**
+   * \brief      Distance in elements between two consecutive columns
+   *
+   * \return     The column stride
+   */
+  inline std::size_t col_stride() const {
+    return cs;
+  }
+
+  /**
+   * \brief      Get number of rows of this view
+   *
+   * \return     Number of rows
+   */
+  inline std::size_t num_rows() const {
+    return n_rows;
+  }
+
+  /**
+   * \brief      Get number of columns of this view
+   *
+   * \return     Number of columns
+   */
+  inline std::size_t num_cols() const {
+    return n_cols;
+  }
+
+  /**
+   * \brief      Whether the elements are laid out row-major without gaps, like a matrix
+   *
+   * \return     True if the view is contiguous
+   */
+  inline bool is_contiguous() const {
+    return (cs == 1 || n_cols <= 1) && (rs == n_cols || n_rows <= 1);
+  }
+
+  /**
+   * \brief      Copies the viewed elements into a new matrix
+   *
+   * \return     The matrix
+   */
+  inline const EvalReturnType eval() const {
+    return EvalReturnType(*this);
+  }
+
+  /**
+   * \brief      View of a rectangular block of this view
+   *
+   * \param[in]  i     Row of the top left element of the block
+   * \param[in]  j     Column of the top left element of the block
+   * \param[in]  rows  Number of rows of the block
+   * \param[in]  cols  Number of columns of the block
+   *
+   * \return     The view
+   */
+  inline matrix_view block(std::size_t i, std::size_t j, std::size_t rows,
+                           std::size_t cols) const {
+    assert(i + rows <= n_rows && j + cols <= n_cols);
+    return matrix_view(ptr + i * rs + j * cs, rows, cols, rs, cs);
+  }
+
+  /**
+   * \brief      View of a row of this view, as a 1 x n matrix
+   *
+   * \param[in]  i     The row
+   *
+   * \return     The view
+   */
+  inline matrix_view row(std::size_t i) const {
+    return block(i, 0, 1, n_cols);
+  }
+
+  /**
+   * \brief      View of a column of this view, as an n x 1 matrix
+   *
+   * \param[in]  j     The column
+   *
+   * \return     The view
+   */
+  inline matrix_view col(std::size_t j) const {
+    return block(0, j, n_rows, 1);
+  }
+
+  /**
+   * \brief      View of the transpose of this view
+   *
+   * \return     The view
+   */
+  inline matrix_view transpose() const {
+    return matrix_view(ptr, n_cols, n_rows, cs, rs);
+  }
+
+  /**
+   * \brief      Assign an expression to the elements of this view
+   *
+   * Evaluated like matrix::assign, the SIMD loop being used when this view is contiguous
+   *
+   * \param      expr  The expression to assign
+   *
+   * \tparam     E     The type of the expression
+   */
+  template <typename E>
+  inline void assign(expression<E> const &expr) const {
+    static_assert(!std::is_const<T>::value, "cannot write through a read-only view");
+    assert(expr.num_rows() == n_rows && expr.num_cols() == n_cols);
+    matrix_view target = *this;
+    detail::assign_dense(target, expr.get_const_derived());
+  }
+
+  /**
+   * \brief      The stream operator to print the view easily
+   *
+   * \param      ostream  The output stream
+   * \param[in]  view     The view
+   *
+   * \return     The output stream
+   */
+  friend std::ostream &operator<<(std::ostream &ostream, const matrix_view &view) {
+    for (std::size_t i = 0; i < view.n_rows; ++i) {
+      for (std::size_t j = 0; j < view.n_cols; ++j) {
+        ostream << view(i, j) << ", ";
+      }
+      ostream << "\n";
+    }
+    return ostream;
+  }
+
+  template <typename E>
+  inline matrix_view &operator+=(expression<E> const &expr);
+
+  template <typename E>
+  inline matrix_view &operator-=(expression<E> const &expr);
+
+  template <typename Scalar, typename = enable_if_not_expression<Scalar>>
+  inline matrix_view &operator+=(Scalar const &expr);
+
+  template <typename Scalar, typename = enable_if_not_expression<Scalar>>
+  inline matrix_view &operator-=(Scalar const &expr);
+
+  template <typename Scalar, typename = enable_if_not_expression<Scalar>>
+  inline matrix_view &operator*=(Scalar const &expr);
+};
+
+/**
+ * \brief      Element of a sparse matrix given by its position, used to build sparse matrices
+ *
+ * \tparam     T     Element type
+ */
+template <typename T>
+struct sparse_entry {
+  std::size_t row;
+  std::size_t col;
+  T value;
+};
+
+/**
+ * \brief      Compressed sparse matrix, by rows (CSR) or by columns (CSC)
+ *
+ * The nonzeros of every row (CSR) or column (CSC), called the outer dimension, are stored
+ * contiguously, sorted by their column (CSR) or row (CSC), called the inner index. offsets[o] is
+ * the position of the first nonzero of outer slice o, offsets[outer size] the number of nonzeros.
+ *
+ * A sparse matrix is an expression: products with dense expressions go through dedicated kernels
+ * that only visit the nonzeros, assigning it to a dense matrix scatters its nonzeros, and it can be
+ * used in any other expression, where an element is found by a binary search in its slice
+ *
+ * \tparam     T       Element type
+ * \tparam     Format  sparse_format::csr or sparse_format::csc
+ */
+template <typename T, sparse_format Format>
+class sparse_matrix : public expression<sparse_matrix<T, Format>> {
+public:
+  /**
+   * Allocator of the arrays, see scoped_arena
+   */
+  using allocator_type = std::pmr::polymorphic_allocator<T>;
+
+  /**
+   * Type of the inner indices, 32 bits to save memory bandwidth
+   */
+  using index_type = std::uint32_t;
+
+  /**
+   * Return type of eval() method, the dense matrix
+   */
+  using EvalReturnType = matrix<T>;
+
+  /**
+   * Type of an element in this matrix
+   */
+  using ElementType = T;
+
+private:
+  /**
+   * Number of rows of this matrix
+   */
+  std::size_t n_rows;
+
+  /**
+   * Number of columns of this matrix
+   */
+  std::size_t n_cols;
+
+  /**
+   * Position of the first nonzero of every outer slice, followed by the number of nonzeros
+   */
+  std::pmr::vector<std::size_t> offsets;
+
+  /**
+   * Inner index of every nonzero
+   */
+  std::pmr::vector<index_type> indices;
+
+  /**
+   * Value of every nonzero
+   */
+  std::pmr::vector<T> nonzeros;
+
+  /**
+   * \brief      Number of outer slices
+   *
+   * \return     Rows for CSR, columns for CSC
+   */
+  inline std::size_t outer_size() const {
+    return Format == sparse_format::csr ? n_rows : n_cols;
+  }
+
+  /**
+   * \brief      Number of elements of every outer slice
+   *
+   * \return     Columns for CSR, rows for CSC
+   */
+  inline std::size_t inner_size() const {
+    return Format == sparse_format::csr ? n_cols : n_rows;
+  }
+
+  /**
+   * \brief      Fills the arrays from entries sorted by outer then inner index, summing duplicates
+   *
+   * \param      entries  The entries, sorted
+   */
+  inline void compress_sorted(std::vector<sparse_entry<T>> const &entries) {
+    assert(inner_size() <= std::numeric_limits<index_type>::max());
+    offsets.assign(outer_size() + 1, 0);
+    indices.clear();
+    nonzeros.clear();
+    for (std::size_t p = 0; p < entries.size(); ++p) {
+      std::size_t const outer = Format == sparse_format::csr ? entries[p].row : entries[p].col;
+      std::size_t const inner = Format == sparse_format::csr ? entries[p].col : entries[p].row;
+      assert(entries[p].row < n_rows && entries[p].col < n_cols);
+      std::size_t const previous_outer =
+          p == 0 ? outer_size()
+                 : Format == sparse_format::csr ? entries[p - 1].row : entries[p - 1].col;
+      if (outer == previous_outer && inner == indices.back()) {
+        nonzeros.back() += entries[p].value;
+        continue;
+      }
+      ++offsets[outer + 1];
+      indices.push_back(static_cast<index_type>(inner));
+      nonzeros.push_back(entries[p].value);
+    }
+    for (std::size_t o = 0; o < outer_size(); ++o) {
+      offsets[o + 1] += offsets[o];
+    }
+  }
+
+public:
+  /**
+   * \brief      Constructor of an empty matrix
+   *
+   * \param[in]  alloc  The allocator, the default memory resource if omitted
+   */
+  inline explicit sparse_matrix(allocator_type alloc = {})
+      : n_rows(0), n_cols(0), offsets(1, 0, alloc), indices(alloc), nonzeros(alloc) {}
+
+  /**
+   * \brief      Constructor of a matrix without nonzeros
+   *
+   * \param[in]  rows   Number of rows
+   * \param[in]  cols   Number of columns
+   * \param[in]  alloc  The allocator, the default memory resource if omitted
+   */
+  inline sparse_matrix(std::size_t rows, std::size_t cols, allocator_type alloc = {})
+      : n_rows(rows), n_cols(cols), offsets((Format == sparse_format::csr ? rows : cols) + 1, 0,
+                                            alloc),
+        indices(alloc), nonzeros(alloc) {}
+
+  /**
+   * \brief      Constructor from entries in any order, duplicates are summed
+   *
+   * \param[in]  rows     Number of rows
+   * \param[in]  cols     Number of columns
+   * \param[in]  entries  The entries
+   * \param[in]  alloc    The allocator, the default memory resource if omitted
+   */
+  inline sparse_matrix(std::size_t rows, std::size_t cols, std::vector<sparse_entry<T>> entries,
+                       allocator_type alloc = {})
+      : sparse_matrix(rows, cols, alloc) {
+    std::sort(entries.begin(), entries.end(),
+              [](sparse_entry<T> const &lhs, sparse_entry<T> const &rhs) {
+                if constexpr (Format == sparse_format::csr) {
+                  return lhs.row != rhs.row ? lhs.row < rhs.row : lhs.col < rhs.col;
+                } else {
+                  return lhs.col != rhs.col ? lhs.col < rhs.col : lhs.row < rhs.row;
+                }
+              });
+    compress_sorted(entries);
+  }
+
+  /**
+   * \brief      Constructor from the compressed arrays
+   *
+   * \param[in]  rows     Number of rows
+   * \param[in]  cols     Number of columns
+   * \param[in]  offsets  Position of the first nonzero of every outer slice, then the number of
+   *                      nonzeros
+   * \param[in]  indices  Inner index of every nonzero, sorted within every slice
+   * \param[in]  values   Value of every nonzero
+   * \param[in]  alloc    The allocator, the default memory resource if omitted
+   */
+  inline sparse_matrix(std::size_t rows, std::size_t cols, std::vector<std::size_t> const &offsets,
+                       std::vector<index_type> const &indices, std::vector<T> const &values,
+                       allocator_type alloc = {})
+      : n_rows(rows), n_cols(cols), offsets(offsets.begin(), offsets.end(), alloc),
+        indices(indices.begin(), indices.end(), alloc),
+        nonzeros(values.begin(), values.end(), alloc) {
+    assert(this->offsets.size() == outer_size() + 1);
+    assert(this->indices.size() == this->offsets.back() && nonzeros.size() == this->offsets.back());
+  }
+
+  /**
+   * \brief      Constructor from a dense expression, keeping its nonzero elements
+   *
+   * \param      expr   The expression
+   * \param[in]  alloc  The allocator, the default memory resource if omitted
+   *
+   * \tparam     E      The type of the expression
+   */
+  template <typename E>
+  inline explicit sparse_matrix(expression<E> const &expr, allocator_type alloc = {})
+      : sparse_matrix(expr.num_rows(), expr.num_cols(), alloc) {
+    assert(inner_size() <= std::numeric_limits<index_type>::max());
+    E const &derived = expr.get_const_derived();
+    detail::prepare(derived);
+    for (std::size_t o = 0; o < outer_size(); ++o) {
+      for (std::size_t in = 0; in < inner_size(); ++in) {
+        T const value = Format == sparse_format::csr ? derived(o, in) : derived(in, o);
+        if (value != T(0)) {
+          indices.push_back(static_cast<index_type>(in));
+          nonzeros.push_back(value);
+        }
+      }
+      offsets[o + 1] = nonzeros.size();
+    }
+  }
+
+  /**
+   * \brief      Constructor from a sparse matrix of the other format
+   *
+   * \param      other  The matrix to convert
+   * \param[in]  alloc  The allocator, the default memory resource if omitted
+   */
+  inline explicit sparse_matrix(
+      sparse_matrix<T, Format == sparse_format::csr ? sparse_format::csc : sparse_format::csr> const
+          &other,
+      allocator_type alloc = {})
+      : sparse_matrix(other.num_rows(), other.num_cols(), alloc) {
+    // counting sort of the nonzeros by their inner index in the other format
+    std::size_t const nnz = other.non_zeros();
+    indices.resize(nnz);
+    nonzeros.resize(nnz);
+    for (std::size_t p = 0; p < nnz; ++p) {
+      ++offsets[other.inner_indices()[p] + 1];
+    }
+    for (std::size_t o = 0; o < outer_size(); ++o) {
+      offsets[o + 1] += offsets[o];
+    }
+    std::pmr::vector<std::size_t> next(offsets.begin(), offsets.end() - 1,
+                                       detail::temporary_resource());
+    for (std::size_t other_outer = 0; other_outer < inner_size(); ++other_outer) {
+      for (std::size_t p = other.outer_offsets()[other_outer];
+           p < other.outer_offsets()[other_outer + 1]; ++p) {
+        std::size_t const q = next[other.inner_indices()[p]]++;
+        indices[q] = static_cast<index_type>(other_outer);
+        nonzeros[q] = other.values()[p];
+      }
+    }
+  }
+
+  /**
+   * \brief      Move constructor
+   *
+   * \param      other  The other matrix
+   */
+  inline sparse_matrix(sparse_matrix &&other) = default;
+
+  /**
+   * \brief      Copy constructor
+   *
+   * \param[in]  other  The other matrix
+   */
+  inline sparse_matrix(sparse_matrix const &other) = default;
+
+  /**
+   * \brief      Move assignment operator
+   *
+   * \param      other  The other matrix
+   *
+   * \return     This matrix
+   */
+  inline sparse_matrix &operator=(sparse_matrix &&other) = default;
+
+  /**
+   * \brief      Copy assignment operator
+   *
+   * \param[in]  other  The other matrix
+   *
+   * \return     This matrix
+   */
+  inline sparse_matrix &operator=(sparse_matrix const &other) = default;
+
+  /**
+   * \brief      Get an element, by a binary search in its slice
+   *
+   * \param[in]  i     Row number of the element to get
+   * \param[in]  j     Column number of the element to get
+   *
+   * \return     The element, zero if it is not stored
+   */
+  inline T operator()(std::size_t i, std::size_t j) const {
+    assert(i < n_rows && j < n_cols);
+    std::size_t const outer = Format == sparse_format::csr ? i : j;
+    std::size_t const inner = Format == sparse_format::csr ? j : i;
+    auto const first = indices.begin() + offsets[outer];
+    auto const last = indices.begin() + offsets[outer + 1];
+    auto const found = std::lower_bound(first, last, inner);
+    return found != last && *found == inner ? nonzeros[found - indices.begin()] : T(0);
+  }
+
+  /**
+   * \brief      Evaluate into a dense matrix
+   *
+   * \return     The dense matrix
+   */
+  inline EvalReturnType eval() const {
+    return EvalReturnType(*this);
+  }
+
+  /**
+   * \brief      Get number of rows of this matrix
+   *
+   * \return     Number of rows
+   */
+  inline std::size_t num_rows() const {
+    return n_rows;
+  }
+
+  /**
+   * \brief      Get number of columns of this matrix
+   *
+   * \return     Number of columns
+   */
+  inline std::size_t num_cols() const {
+    return n_cols;
+  }
+
+  /**
+   * \brief      Get number of stored elements
+   *
+   * \return     Number of nonzeros
+   */
+  inline std::size_t non_zeros() const {
+    return nonzeros.size();
+  }
+
+  /**
+   * \brief      Get the position of the first nonzero of every outer slice
+   *
+   * \return     Pointer to outer size + 1 offsets
+   */
+  inline std::size_t const *outer_offsets() const {
+    return offsets.data();
+  }
+
+  /**
+   * \brief      Get the inner index of every nonzero
+   *
+   * \return     Pointer to the indices
+   */
+  inline index_type const *inner_indices() const {
+    return indices.data();
+  }
+
+  /**
+   * \brief      Get the value of every nonzero
+   *
+   * \return     Pointer to the values
+   */
+  inline T const *values() const {
+    return nonzeros.data();
+  }
+
+  /**
+   * \brief      Get the value of every nonzero, to change values without changing the structure
+   *
+   * \return     Pointer to the values
+   */
+  inline T *values() {
+    return nonzeros.data();
+  }
+
+  /**
+   * \brief      Multiplies every nonzero by a scalar
+   *
+   * \param[in]  scalar  The scalar
+   *
+   * \return     This matrix
+   */
+  inline sparse_matrix &operator*=(T scalar) {
+    for (T &value : nonzeros) {
+      value *= scalar;
+    }
+    return *this;
+  }
+
+  /**
+   * \brief      Get the allocator of the arrays
+   *
+   * \return     The allocator
+   */
+  inline allocator_type get_allocator() const {
+    return nonzeros.get_allocator();
+  }
+
+  /**
+   * \brief      The stream operator to print the matrix as a list of nonzeros
+   *
+   * \param      ostream  The output stream
+   * \param[in]  mat      The matrix
+   *
+   * \return     The output stream
+   */
+  friend std::ostream &operator<<(std::ostream &ostream, const sparse_matrix &mat) {
+    for (std::size_t o = 0; o < mat.outer_size(); ++o) {
+      for (std::size_t p = mat.offsets[o]; p < mat.offsets[o + 1]; ++p) {
+        std::size_t const i = Format == sparse_format::csr ? o : mat.indices[p];
+        std::size_t const j = Format == sparse_format::csr ? mat.indices[p] : o;
+        ostream << "(" << i << ", " << j << "): " << mat.nonzeros[p] << "\n";
+      }
+    }
+    return ostream;
+  }
+};
+
+/**
+ * Sparse matrix compressed by rows
+ */
+template <typename T>
+using csr_matrix = sparse_matrix<T, sparse_format::csr>;
+
+/**
+ * Sparse matrix compressed by columns
+ */
+template <typename T>
+using csc_matrix = sparse_matrix<T, sparse_format::csc>;
+
+namespace detail {
+/**
+ * \brief      Bit pattern of a float
+ *
+ * \param[in]  value  The float
+ *
+ * \return     The bits
+ */
+inline std::uint32_t float_to_bits(float value) {
+  std::uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+/**
+ * \brief      Float with the given bit pattern
+ *
+ * \param[in]  bits  The bits
+ *
+ * \return     The float
+ */
+inline float float_from_bits(std::uint32_t bits) {
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+} // namespace detail
+
+/**
+ * \brief      IEEE 754 half-precision storage type
+ *
+ * Converts to and from float implicitly, rounding to nearest even, so arithmetic on it is carried
+ * out in float. Uses the F16C conversion instructions when they are enabled and emulates them
+ * otherwise
+ */
+struct float16 {
+  std::uint16_t bits = 0;
+
+  /**
+   * \brief      Constructor of positive zero
+   */
+  inline float16() = default;
+
+  /**
+   * \brief      Constructor rounding a float to the nearest half
+   *
+   * \param[in]  value  The float
+   */
+  inline float16(float value) : bits(from_float(value)) {}
+
+  /**
+   * \brief      Constructor from a bit pattern
+   *
+   * \param[in]  bits  The bits
+   *
+   * \return     The half
+   */
+  inline static float16 from_bits(std::uint16_t bits) {
+    float16 result;
+    result.bits = bits;
+    return result;
+  }
+
+  /**
+   * \brief      Exact conversion to float
+   *
+   * \return     The float
+   */
+  inline operator float() const {
+#if defined(__F16C__)
+    return _cvtsh_ss(bits);
+#else
+    std::uint32_t const sign = static_cast<std::uint32_t>(bits & 0x8000u) << 16;
+    std::uint32_t const exponent = (bits >> 10) & 0x1fu;
+    std::uint32_t const mantissa = bits & 0x3ffu;
+    if (exponent == 0x1fu) {
+      return detail::float_from_bits(sign | 0x7f800000u | mantissa << 13);
+    }
+    if (exponent == 0) {
+      // subnormal, a multiple of 2^-24
+      float const magnitude = static_cast<float>(mantissa) * 5.9604644775390625e-8f;
+      return sign ? -magnitude : magnitude;
+    }
+    return detail::float_from_bits(sign | (exponent + 112) << 23 | mantissa << 13);
+#endif
+  }
+
+private:
+  /**
+   * \brief      Rounds a float to the nearest half, ties to even
+   *
+   * \param[in]  value  The float
+   *
+   * \return     The bits of the half
+   */
+  inline static std::uint16_t from_float(float value) {
+#if defined(__F16C__)
+    return static_cast<std::uint16_t>(_cvtss_sh(value, 0));
+#else
+    std::uint32_t const bits = detail::float_to_bits(value);
+    std::uint32_t const sign = (bits >> 16) & 0x8000u;
+    std::uint32_t const magnitude = bits & 0x7fffffffu;
+    auto round = [](std::uint32_t half, std::uint32_t rest, std::uint32_t halfway) {
+      return half + (rest > halfway || (rest == halfway && (half & 1u)));
+    };
+    if (magnitude > 0x7f800000u) {
+      return static_cast<std::uint16_t>(sign | 0x7e00u);
+    }
+    if (magnitude >= 0x47800000u) {
+      return static_cast<std::uint16_t>(sign | 0x7c00u);
+    }
+    if (magnitude >= 0x38800000u) {
+      // normal, rebias the exponent from 127 to 15, a carry out of the mantissa rounds up to inf
+      std::uint32_t const rebiased = magnitude - 0x38000000u;
+      return static_cast<std::uint16_t>(sign | round(rebiased >> 13, rebiased & 0x1fffu, 0x1000u));
+    }
+    if (magnitude < 0x33000000u) {
+      return static_cast<std::uint16_t>(sign);
+    }
+    // subnormal, count multiples of 2^-24
+    std::uint32_t const shift = 126 - (magnitude >> 23);
+    std::uint32_t const mantissa = (magnitude & 0x7fffffu) | 0x800000u;
+    return static_cast<std::uint16_t>(
+        sign | round(mantissa >> shift, mantissa & ((1u << shift) - 1), 1u << (shift - 1)));
+#endif
+  }
+};
+
+/**
+ * \brief      Brain floating point storage type, the upper half of a float
+ *
+ * Converts to and from float implicitly, rounding to nearest even, so arithmetic on it is carried
+ * out in float
+ */
+struct bfloat16 {
+  std::uint16_t bits = 0;
+
+  /**
+   * \brief      Constructor of positive zero
+   */
+  inline bfloat16() = default;
+
+  /**
+   * \brief      Constructor rounding a float to the nearest bfloat16
+   *
+   * \param[in]  value  The float
+   */
+  inline bfloat16(float value) {
+    std::uint32_t const float_bits = detail::float_to_bits(value);
+    if ((float_bits & 0x7fffffffu) > 0x7f800000u) {
+      // keep NaNs quiet instead of letting the rounding carry turn them into infinities
+      bits = static_cast<std::uint16_t>(float_bits >> 16 | 0x40u);
+    } else {
+      bits = static_cast<std::uint16_t>((float_bits + 0x7fffu + (float_bits >> 16 & 1u)) >> 16);
+    }
+  }
+
+  /**
+   * \brief      Constructor from a bit pattern
+   *
+   * \param[in]  bits  The bits
+   *
+   * \return     The bfloat16
+   */
+  inline static bfloat16 from_bits(std::uint16_t bits) {
+    bfloat16 result;
+    result.bits = bits;
+    return result;
+  }
+
+  /**
+   * \brief      Exact conversion to float
+   *
+   * \return     The float
+   */
+  inline operator float() const {
+    return detail::float_from_bits(static_cast<std::uint32_t>(bits) << 16);
+  }
+};
+
+/**
+ * \brief      Type products of elements of type T are accumulated in by default
+ *
+ * Narrow integers accumulate in 32-bit integers and the 16-bit floating point types in float, the
+ * other types in themselves. Specialize it to change the default for a type
+ *
+ * \tparam     T     Element type
+ */
+template <typename T>
+struct accumulator_type {
+  using type = T;
+};
+
+template <>
+struct accumulator_type<std::int8_t> {
+  using type = std::int32_t;
+};
+
+template <>
+struct accumulator_type<std::uint8_t> {
+  using type = std::int32_t;
+};
+
+template <>
+struct accumulator_type<std::int16_t> {
+  using type = std::int32_t;
+};
+
+template <>
+struct accumulator_type<float16> {
+  using type = float;
+};
+
+template <>
+struct accumulator_type<bfloat16> {
+  using type = float;
+};
+
+/**
+ * Type products of elements of type T are accumulated in by default
+ */
+template <typename T>
+using accumulator_type_t = typename accumulator_type<T>::type;
+
+/**
+ * \brief      Accumulation policy of product() using accumulator_type of the common element type of
+ * the operands
+ */
+struct default_accumulation {
+  template <typename T1, typename T2>
+  using type = accumulator_type_t<std::common_type_t<T1, T2>>;
+};
+
+/**
+ * \brief      Accumulation policy of product() accumulating in a given type, whatever the element
+ * types of the operands
+ *
+ * \tparam     Accumulator  The type to accumulate in, an arithmetic type
+ */
+template <typename Accumulator>
+struct accumulate_in {
+  template <typename T1, typename T2>
+  using type = Accumulator;
+};
+
+namespace detail {
+/**
+ * \brief      Trait telling whether T is one of the 16-bit floating point storage types
+ *
+ * \tparam     T     The type
+ */
+template <typename T>
+struct is_low_precision_float
+    : std::integral_constant<bool, std::is_same<T, float16>::value ||
+                                       std::is_same<T, bfloat16>::value> {};
+
+/**
+ * \brief      Common type of a 16-bit floating point type L and another type, L for integers and
+ * the other type for wider floating point types
+ *
+ * \tparam     L     The 16-bit floating point type
+ * \tparam     T     The other type
+ */
+template <typename L, typename T, typename = void>
+struct low_precision_common {};
+
+template <typename L, typename T>
+struct low_precision_common<L, T, std::enable_if_t<std::is_arithmetic<T>::value>> {
+  using type = std::conditional_t<std::is_floating_point<T>::value, T, L>;
+};
+} // namespace detail
+} // namespace shizmatrix
+
+namespace std {
+using namespace shizmatrix;
+
+/**
+ * \brief      Overloading common_type trait for two matrices with different element types
+ *
+ * The common type of a fixed-size and a runtime-sized matrix is the fixed-size one
+ *
+ * \tparam     T1    Type of elements of matrix 1
+ * \tparam     R1    Number of rows of matrix 1
+ * \tparam     C1    Number of columns of matrix 1
+ * \tparam     T2    Type of elements of matrix 2
+ * \tparam     R2    Number of rows of matrix 2
+ * \tparam     C2    Number of columns of matrix 2
+ */
+template <typename T1, std::size_t R1, std::size_t C1, typename T2, std::size_t R2, std::size_t C2>
+struct common_type<matrix<T1, R1, C1>, matrix<T2, R2, C2>> {
+  using type = matrix<std::common_type_t<T1, T2>, R1 == shizmatrix::dynamic ? R2 : R1,
+                      C1 == shizmatrix::dynamic ? C2 : C1>;
+};
+
+/**
+ * \brief      Overloading common_type trait for a matrix and a scalar
+ *
+ * \tparam     T1    Type of elements of matrix 1
+ * \tparam     R     Number of rows of matrix 1
+ * \tparam     C     Number of columns of matrix 1
+ * \tparam     T2    Type of scalar
+ */
+template <typename T1, std::size_t R, std::size_t C, typename T2>
+struct common_type<matrix<T1, R, C>, T2> {
+  using type = matrix<std::common_type_t<T1, T2>, R, C>;
+};
+
+/**
+ * \brief      Overloading common_type trait for the 16-bit floating point types
+ *
+ * Mixed with an integer they stay 16-bit, mixed with a wider floating point type they widen to it,
+ * float16 and bfloat16 together widen to float
+ */
+template <>
+struct common_type<float16, float16> {
+  using type = float16;
+};
+
+template <>
+struct common_type<bfloat16, bfloat16> {
+  using type = bfloat16;
+};
+
+template <>
+struct common_type<float16, bfloat16> {
+  using type = float;
+};
+
+template <>
+struct common_type<bfloat16, float16> {
+  using type = float;
+};
+
+template <typename T>
+struct common_type<float16, T> : shizmatrix::detail::low_precision_common<float16, T> {};
+
+template <typename T>
+struct common_type<T, float16> : shizmatrix::detail::low_precision_common<float16, T> {};
+
+template <typename T>
+struct common_type<bfloat16, T> : shizmatrix::detail::low_precision_common<bfloat16, T> {};
+
+template <typename T>
+struct common_type<T, bfloat16> : shizmatrix::detail::low_precision_common<bfloat16, T> {};
+
+template <typename T1, std::size_t R, std::size_t C>
+struct common_type<matrix<T1, R, C>, float16> {
+  using type = matrix<std::common_type_t<T1, float16>, R, C>;
+};
+
+template <typename T1, std::size_t R, std::size_t C>
+struct common_type<matrix<T1, R, C>, bfloat16> {
+  using type = matrix<std::common_type_t<T1, bfloat16>, R, C>;
+};
+} // namespace std
+
+namespace shizmatrix {
+
+/**
+ * \brief      Template specialization for storage type of scalar expressions
+ *
+ * \tparam     T     Type of scalar
+ */
+template <typename T>
+struct storage_type<scalar_expression<T>> {
+  using type = scalar_expression<T>;
+};
+
+/**
+ * \brief      Template specialization for storage type of views, which are cheap to copy
+ *
+ * \tparam     T     Type of an element of the view
+ */
+template <typename T>
+struct storage_type<matrix_view<T>> {
+  using type = matrix_view<T>;
+};
+
+/**
+ * \brief      Class for coefficient-wise (element-wise) binary operations on matrix expressions
+ *
+ * \tparam     Op    Operation to be performed on the two expressions
+ * \tparam     E1    Type of expression 1, must be matrix expression
+ * \tparam     E2    Type of expression 2, can be matrix or scalar expression
+ */
+template <typename Op, typename E1, typename E2>
+class cwise_matrix_binary_operation : public expression<cwise_matrix_binary_operation<Op, E1, E2>> {
+private:
+  /**
+   * Expression 1
+   */
+  E1 const &expr1;
+
+  /**
+   * Expression 2, using storage_type trait as matrix expressions are stored as const references and
+   * scalar expressions are stored by value
+   */
+  storage_type_t<E2> expr2;
+
+public:
+  /**
+   * Return type of eval() method
+   */
+  using EvalReturnType = std::common_type_t<eval_return_type_t<E1>, eval_return_type_t<E2>>;
+
+  /**
+   * Type of elements of this expression
+   */
+  using ElementType = std::common_type_t<element_type_t<E1>, element_type_t<E2>>;
+
+  /**
+   * \brief      Constructor
+   *
+   * \param      expr1  Expression 1
+   * \param      expr2  Expression 2
+   */
+  inline cwise_matrix_binary_operation(expression<E1> const &expr1, expression<E2> const &expr2)
+      : expr1(expr1.get_const_derived()), expr2(expr2.get_const_derived()) {}
+
+  /**
+   * \brief      Function call operator to get an element of this matrix
+   *
+   * This uses lazy evaluation when possible to apply an operation only to the required elements of
+   * expression 1 and 2
+   *
+   * \param[in]  i     Row number of the element to get
+   * \param[in]  j     Column number of the element to get
+   *
+   * \return     The desired element
+   */
+  inline ElementType operator()(std::size_t i, std::size_t j) const {
+    return Op::apply(expr1, expr2, i, j);
+  }
+
+  /**
+   * \brief      Evaluates this expression fully and returns the resultant matrix
+   *
+   * This can also be triggered by a user of this library manually when they think that eagerly
+   * evaluating an expression is beneficial, e.g.: a * (b + c) would benefit from eager evaluation
+   * of b + c to prevent repeated calculations of the sum b + c. Thus, it could be re-written as
+   * a * (b + c).eval()
+   *
+   * \return     The result of evaluating this expression
+   */
+  inline const EvalReturnType eval() const {
+    EvalReturnType temp(num_rows(), num_cols());
+    temp.assign((*this));
+    return temp;
+  }
+
+  /**
+   * \brief      Gets number of rows in this expression
+   *
+   * \return     Number of rows
+   */
+  inline std::size_t num_rows() const {
+    return expr1.num_rows();
+  }
+
+  /**
+   * \brief      Gets the number of columns in this expression
+   *
+   * \return     Number of columns
+   */
+  inline std::size_t num_cols() const {
+    return expr1.num_cols();
+  }
+
+  /**
+   * \brief      Gets expression 1
+   *
+   * \return     Const reference to expression 1
+   */
+  inline E1 const &get_expr1() const {
+    return expr1;
+  }
+
+  /**
+   * \brief      Gets expression 2
+   *
+   * \return     Const reference to expression 2
+   */
+  inline E2 const &get_expr2() const {
+    return expr2;
+  }
+};
+
+/**
+ * \brief      Makes a cwise matrix binary operation
+ *
+ * Helps with template argument inference, so that the types of operands need not be specified while
+ * specifying the operator
+ *
+ * \param      expr1  Expression 1
+ * \param      expr2  Expression 2
+ *
+ * \tparam     Op     Type of operation
+ * \tparam     E1     Type of expression 1
+ * \tparam     E2     Type of expression 2
+ *
+ * \return     A cwise matrix binary operation
+ */
+template <template <typename E1, typename E2> typename Op, typename E1, typename E2>
+cwise_matrix_binary_operation<Op<E1, E2>, E1, E2>
+make_cwise_matrix_binary_operation(expression<E1> const &expr1, expression<E2> const &expr2) {
+  return cwise_matrix_binary_operation<Op<E1, E2>, E1, E2>(expr1, expr2);
+}
+
+namespace detail {
+
+/**
+ * \brief      Register and cache blocking parameters of the packed matrix product kernel
+ *
+ * The micro-kernel keeps an mr x nr tile of the result in registers. The left operand is packed in
+ * mc x kc blocks that stay resident in L2 and the right operand in kc x nc panels that stay resident
+ * in L3, so the micro-kernel only ever streams through contiguous, unit-stride memory
+ *
+ * \tparam     T     Element type the kernel computes in
+ */
+template <typename T>
+struct gemm_blocking {
+  static constexpr std::size_t mr = 4;
+  static constexpr std::size_t nr = sizeof(T) >= 8 ? 8 : 16;
+  static constexpr std::size_t kc = 256;
+  static constexpr std::size_t mc = 96;
+  static constexpr std::size_t nc = 2048;
+};
+
+/**
+ * \brief      Packs an mc x kc block of the left operand into mr-row slivers
+ *
+ * Within a sliver, the mr elements of one column are stored next to each other. Rows past the end
+ * of the block are padded with zeros so the micro-kernel never needs a remainder path. Elements of
+ * a narrower storage type are widened to the element type of the kernel on the way
+ *
+ * \param[in]  mc    Number of rows of the block
+ * \param[in]  kc    Number of columns of the block
+ * \param[in]  a     Pointer to the top left element of the block
+ * \param[in]  rs    Row stride of the left operand
+ * \param[in]  cs    Column stride of the left operand
+ * \param      dst   Packing buffer, at least round_up(mc, mr) * kc elements
+ *
+ * \tparam     T     Element type of the kernel
+ * \tparam     S     Element type of the left operand
+ */
+template <typename T, typename S>
+inline void pack_lhs(std::size_t mc, std::size_t kc, S const *a, std::size_t rs, std::size_t cs,
+                     T *dst) {
+  constexpr std::size_t mr = gemm_blocking<T>::mr;
+  for (std::size_t i = 0; i < mc; i += mr) {
+    std::size_t const rows = std::min(mr, mc - i);
+    for (std::size_t p = 0; p < kc; ++p) {
+      for (std::size_t r = 0; r < rows; ++r) {
+        dst[r] = static_cast<T>(a[(i + r) * rs + p * cs]);
+      }
+      for (std::size_t r = rows; r < mr; ++r) {
+        dst[r] = T(0);
+      }
+      dst += mr;
+    }
+  }
+}
+
+/**
+ * \brief      Packs a kc x nc panel of the right operand into nr-column slivers
+ *
+ * Within a sliver, the nr elements of one row are stored next to each other. Columns past the end
+ * of the panel are padded with zeros
+ *
+ * \param[in]  kc    Number of rows of the panel
+ * \param[in]  nc    Number of columns of the panel
+ * \param[in]  b     Pointer to the top left element of the panel
+ * \param[in]  rs    Row stride of the right operand
+ * \param[in]  cs    Column stride of the right operand
+ * \param      dst   Packing buffer, at least kc * round_up(nc, nr) elements
+ *
+ * \tparam     T     Element type of the kernel
+ * \tparam     S     Element type of the right operand
+ */
+template <typename T, typename S>
+inline void pack_rhs(std::size_t kc, std::size_t nc, S const *b, std::size_t rs, std::size_t cs,
+                     T *dst) {
+  constexpr std::size_t nr = gemm_blocking<T>::nr;
+  for (std::size_t j = 0; j < nc; j += nr) {
+    std::size_t const cols = std::min(nr, nc - j);
+    for (std::size_t p = 0; p < kc; ++p) {
+      for (std::size_t s = 0; s < cols; ++s) {
+        dst[s] = static_cast<T>(b[p * rs + (j + s) * cs]);
+      }
+      for (std::size_t s = cols; s < nr; ++s) {
+        dst[s] = T(0);
+      }
+      dst += nr;
+    }
+  }
+}
+
+/**
+ * \brief      Per-thread buffer the packed kernel packs its operands into
+ *
+ * The buffer only grows and lives as long as the thread, so repeated products do not allocate
+ *
+ * \param[in]  size  Minimum number of elements
+ *
+ * \tparam     T     Element type
+ * \tparam     Slot  Index of the buffer, one per packed operand
+ *
+ * \return     Pointer to the buffer
+ */
+template <typename T, int Slot>
+inline T *pack_buffer(std::size_t size) {
+  thread_local std::vector<T> buffer;
+  if (buffer.size() < size) {
+    buffer.resize(size);
+  }
+  return buffer.data();
+}
+
+/**
+ * \brief      Epilogue of the packed kernel that adds the product to the existing result
+ *
+ * An epilogue decides how the kernel writes back. If overwrite is set, the first block of the
+ * product depth replaces the result instead of being added to it. The call operator is applied to
+ * every element of the result once its full depth has been accumulated and receives the element's
+ * row and column. If single_pass is set, the call operator reads the previous value of the element
+ * it is applied to, so the kernel accumulates the full depth before writing anything back
+ */
+struct accumulate_epilogue {
+  static constexpr bool overwrite = false;
+  static constexpr bool single_pass = false;
+
+  template <typename T>
+  inline T operator()(T value, std::size_t, std::size_t) const {
+    return value;
+  }
+};
+
+/**
+ * \brief      Epilogue of the packed kernel that stores the product, ignoring the existing result
+ */
+struct store_epilogue {
+  static constexpr bool overwrite = true;
+  static constexpr bool single_pass = false;
+
+  template <typename T>
+  inline T operator()(T value, std::size_t, std::size_t) const {
+    return value;
+  }
+};
+
+/**
+ * \brief      Epilogue adapter shifting the row and column passed on to another epilogue
+ *
+ * Used when the kernel runs on a sub-block of the result
+ *
+ * \tparam     Epilogue  The wrapped epilogue
+ */
+template <typename Epilogue>
+struct offset_epilogue {
+  static constexpr bool overwrite = Epilogue::overwrite;
+  static constexpr bool single_pass = Epilogue::single_pass;
+
+  Epilogue const &epilogue;
+  std::size_t row0;
+  std::size_t col0;
+
+  template <typename T>
+  inline T operator()(T value, std::size_t i, std::size_t j) const {
+    return epilogue(value, row0 + i, col0 + j);
+  }
+};
+
+/**
+ * \brief      Computes an mr x nr tile of the product of two packed slivers and writes it back
+ *
+ * The tile is accumulated in a fixed-size local array the compiler keeps in vector registers, so the
+ * result is read and written exactly once per call
+ *
+ * \param[in]  kc        Depth of the slivers
+ * \param[in]  a         Packed sliver of the left operand
+ * \param[in]  b         Packed sliver of the right operand
+ * \param[in]  alpha     Factor the tile is scaled by before it is written back
+ * \param      c         Pointer to the top left element of the result tile
+ * \param[in]  rs        Row stride of the result
+ * \param[in]  cs        Column stride of the result
+ * \param[in]  m         Number of valid rows of the tile
+ * \param[in]  n         Number of valid columns of the tile
+ * \param[in]  first     Whether this is the first block of the product depth
+ * \param[in]  last      Whether this is the last block of the product depth
+ * \param      epilogue  The epilogue
+ * \param[in]  row       Row of the result the tile starts at
+ * \param[in]  col       Column of the result the tile starts at
+ *
+ * \tparam     T         Element type
+ * \tparam     Epilogue  Type of the epilogue
+ */
+template <typename T, typename Epilogue>
+inline void gemm_micro_kernel(std::size_t kc, T const *a, T const *b, T alpha, T *c, std::size_t rs,
+                              std::size_t cs, std::size_t m, std::size_t n, bool first, bool last,
+                              Epilogue const &epilogue, std::size_t row, std::size_t col) {
+  constexpr std::size_t mr = gemm_blocking<T>::mr;
+  constexpr std::size_t nr = gemm_blocking<T>::nr;
+  T acc[mr][nr] = {};
+  for (std::size_t p = 0; p < kc; ++p) {
+    T b_row[nr];
+    for (std::size_t s = 0; s < nr; ++s) {
+      b_row[s] = b[s];
+    }
+    for (std::size_t r = 0; r < mr; ++r) {
+      T const a_elt = a[r];
+      for (std::size_t s = 0; s < nr; ++s) {
+        acc[r][s] += a_elt * b_row[s];
+      }
+    }
+    a += mr;
+    b += nr;
+  }
+  bool const add = !(first && Epilogue::overwrite);
+  auto write_back = [&](std::size_t r, std::size_t s) {
+    T value = add ? c[r * rs + s * cs] + alpha * acc[r][s] : alpha * acc[r][s];
+    c[r * rs + s * cs] = last ? epilogue(value, row + r, col + s) : value;
+  };
+  if (m == mr && n == nr) {
+    for (std::size_t r = 0; r < mr; ++r) {
+      for (std::size_t s = 0; s < nr; ++s) {
+        write_back(r, s);
+      }
+    }
+  } else {
+    for (std::size_t r = 0; r < m; ++r) {
+      for (std::size_t s = 0; s < n; ++s) {
+        write_back(r, s);
+      }
+    }
+  }
+}
+
+/**
+ * \brief      Cache-blocked, packed general matrix product C = epilogue(C + alpha * A * B)
+ *
+ * All three operands are described by a pointer and a row and column stride, so transposed or
+ * strided operands are handled by the packing routines without copies of their own. The epilogue
+ * is applied while the last block of the depth is written back, see accumulate_epilogue. Single
+ * pass epilogues get one block spanning the full depth, the other blocks shrink so the packed
+ * panels keep their size
+ *
+ * \param[in]  m         Number of rows of A and C
+ * \param[in]  n         Number of columns of B and C
+ * \param[in]  k         Number of columns of A and rows of B
+ * \param[in]  alpha     Factor the product is scaled by
+ * \param[in]  a         Pointer to A
+ * \param[in]  rsa       Row stride of A
+ * \param[in]  csa       Column stride of A
+ * \param[in]  b         Pointer to B
+ * \param[in]  rsb       Row stride of B
+ * \param[in]  csb       Column stride of B
+ * \param      c         Pointer to C
+ * \param[in]  rsc       Row stride of C
+ * \param[in]  csc       Column stride of C
+ * \param      epilogue  The epilogue
+ *
+ * \tparam     T         Element type of C, the type the product is accumulated in
+ * \tparam     Epilogue  Type of the epilogue
+ * \tparam     TA        Element type of A, converted to T while it is packed
+ * \tparam     TB        Element type of B, converted to T while it is packed
+ */
+template <typename T, typename Epilogue = accumulate_epilogue, typename TA, typename TB>
+inline void gemm(std::size_t m, std::size_t n, std::size_t k, T alpha, TA const *a,
+                 std::size_t rsa, std::size_t csa, TB const *b, std::size_t rsb, std::size_t csb,
+                 T *c, std::size_t rsc, std::size_t csc, Epilogue const &epilogue = Epilogue()) {
+  using blocking = gemm_blocking<T>;
+  constexpr std::size_t mr = blocking::mr;
+  constexpr std::size_t nr = blocking::nr;
+  if (m == 0 || n == 0) {
+    return;
+  }
+  if (k == 0) {
+    for (std::size_t i = 0; i < m; ++i) {
+      for (std::size_t j = 0; j < n; ++j) {
+        c[i * rsc + j * csc] = epilogue(Epilogue::overwrite ? T(0) : c[i * rsc + j * csc], i, j);
+      }
+    }
+    return;
+  }
+
+  std::size_t const passes = Epilogue::single_pass ? (k + blocking::kc - 1) / blocking::kc : 1;
+  std::size_t const kc_block = Epilogue::single_pass ? k : blocking::kc;
+  std::size_t const mc_block = std::max(mr, blocking::mc / passes / mr * mr);
+  std::size_t const nc_block = std::max(nr, blocking::nc / passes / nr * nr);
+  std::size_t const mc_max = std::min(mc_block, (m + mr - 1) / mr * mr);
+  std::size_t const nc_max = std::min(nc_block, (n + nr - 1) / nr * nr);
+  std::size_t const kc_max = std::min(kc_block, k);
+  T *const packed_a = pack_buffer<T, 0>(mc_max * kc_max);
+  T *const packed_b = pack_buffer<T, 1>(kc_max * nc_max);
+
+  for (std::size_t jc = 0; jc < n; jc += nc_block) {
+    std::size_t const nc = std::min(nc_block, n - jc);
+    for (std::size_t pc = 0; pc < k; pc += kc_block) {
+      std::size_t const kc = std::min(kc_block, k - pc);
+      bool const first = pc == 0;
+      bool const last = pc + kc == k;
+      pack_rhs(kc, nc, b + pc * rsb + jc * csb, rsb, csb, packed_b);
+      for (std::size_t ic = 0; ic < m; ic += mc_block) {
+        std::size_t const mc = std::min(mc_block, m - ic);
+        pack_lhs(mc, kc, a + ic * rsa + pc * csa, rsa, csa, packed_a);
+        for (std::size_t jr = 0; jr < nc; jr += nr) {
+          for (std::size_t ir = 0; ir < mc; ir += mr) {
+            gemm_micro_kernel(kc, packed_a + ir * kc, packed_b + jr * kc, alpha,
+                              c + (ic + ir) * rsc + (jc + jr) * csc, rsc, csc,
+                              std::min(mr, mc - ir), std::min(nr, nc - jr), first, last, epilogue,
+                              ic + ir, jc + jr);
+          }
+        }
+      }
+    }
+  }
+}
+
+/**
+ * \brief      Packed matrix product C = epilogue(C + alpha * A * B), split into 2D tiles of C
+ * across threads
+ *
+ * Every tile runs the serial kernel over the full depth of the product, so each element of C is
+ * accumulated in the same order as in the serial kernel
+ *
+ * \param[in]  m         Number of rows of A and C
+ * \param[in]  n         Number of columns of B and C
+ * \param[in]  k         Number of columns of A and rows of B
+ * \param[in]  alpha     Factor the product is scaled by
+ * \param[in]  a         Pointer to A
+ * \param[in]  rsa       Row stride of A
+ * \param[in]  csa       Column stride of A
+ * \param[in]  b         Pointer to B
+ * \param[in]  rsb       Row stride of B
+ * \param[in]  csb       Column stride of B
+ * \param      c         Pointer to C
+ * \param[in]  rsc       Row stride of C
+ * \param[in]  csc       Column stride of C
+ * \param      epilogue  The epilogue, called concurrently from several threads
+ *
+ * \tparam     T         Element type of C, the type the product is accumulated in
+ * \tparam     Epilogue  Type of the epilogue
+ * \tparam     TA        Element type of A
+ * \tparam     TB        Element type of B
+ */
+template <typename T, typename Epilogue = accumulate_epilogue, typename TA, typename TB>
+inline void parallel_gemm(std::size_t m, std::size_t n, std::size_t k, T alpha, TA const *a,
+                          std::size_t rsa, std::size_t csa, TB const *b, std::size_t rsb,
+                          std::size_t csb, T *c, std::size_t rsc, std::size_t csc,
+                          Epilogue const &epilogue = Epilogue()) {
+  if (!use_parallel(m * n * k)) {
+    gemm(m, n, k, alpha, a, rsa, csa, b, rsb, csb, c, rsc, csc, epilogue);
+    return;
+  }
+  constexpr std::size_t mr = gemm_blocking<T>::mr;
+  constexpr std::size_t nr = gemm_blocking<T>::nr;
+  std::size_t const row_blocks = (m + mr - 1) / mr;
+  std::size_t const col_blocks = (n + nr - 1) / nr;
+  std::size_t const n_tasks = parallel_task_count();
+  std::size_t const row_parts = std::min(n_tasks, row_blocks);
+  std::size_t const col_parts = std::min((n_tasks + row_parts - 1) / row_parts, col_blocks);
+  parallel_for(row_parts * col_parts, [&](std::size_t task) {
+    std::size_t const row_part = task / col_parts;
+    std::size_t const col_part = task % col_parts;
+    std::size_t const i0 = row_blocks * row_part / row_parts * mr;
+    std::size_t const i1 = std::min(m, row_blocks * (row_part + 1) / row_parts * mr);
+    std::size_t const j0 = col_blocks * col_part / col_parts * nr;
+    std::size_t const j1 = std::min(n, col_blocks * (col_part + 1) / col_parts * nr);
+    gemm(i1 - i0, j1 - j0, k, alpha, a + i0 * rsa, rsa, csa, b + j0 * csb, rsb, csb,
+         c + i0 * rsc + j0 * csc, rsc, csc, offset_epilogue<Epilogue>{epilogue, i0, j0});
+  });
+}
+
+/**
+ * \brief      Trait deciding whether a product of two expressions can go through the packed kernel
+ *
+ * This is the case when both operands are, or evaluate to, dense matrices of the arithmetic element
+ * type of the product and the product is runtime-sized. Fixed-size products use unrolled loops,
+ * products with a sparse operand the sparse kernels
+ *
+ * \tparam     E1    Type of expression 1
+ * \tparam     E2    Type of expression 2
+ */
+template <typename E1, typename E2>
+struct use_packed_product {
+  using element = std::common_type_t<element_type_t<E1>, element_type_t<E2>>;
+  static constexpr bool value =
+      std::is_arithmetic<element>::value && is_matrix<eval_return_type_t<E1>>::value &&
+      is_matrix<eval_return_type_t<E2>>::value &&
+      std::is_same<element_type_t<eval_return_type_t<E1>>, element>::value &&
+      std::is_same<element_type_t<eval_return_type_t<E2>>, element>::value &&
+      (static_rows_v<E1> == dynamic || static_cols_v<E2> == dynamic) && !is_sparse<E1>::value &&
+      !is_sparse<E2>::value;
+};
+
+/**
+ * \brief      Trait deciding whether a product of two expressions is computed by the packed kernel
+ * in a wider accumulator type and rounded to its element type afterwards
+ *
+ * This is the case for runtime-sized products of dense operands whose element type is a storage
+ * only type, like float16, accumulating in an arithmetic type, see accumulator_type
+ *
+ * \tparam     E1    Type of expression 1
+ * \tparam     E2    Type of expression 2
+ */
+template <typename E1, typename E2>
+struct use_widened_product {
+  using element = std::common_type_t<element_type_t<E1>, element_type_t<E2>>;
+  static constexpr bool value =
+      !std::is_arithmetic<element>::value &&
+      std::is_arithmetic<accumulator_type_t<element>>::value &&
+      is_matrix<eval_return_type_t<E1>>::value && is_matrix<eval_return_type_t<E2>>::value &&
+      (static_rows_v<E1> == dynamic || static_cols_v<E2> == dynamic) && !is_sparse<E1>::value &&
+      !is_sparse<E2>::value;
+};
+
+/**
+ * \brief      Creates an empty temporary of matrix type M, allocating from the temporary resource
+ * of the calling thread if M is runtime-sized
+ *
+ * \tparam     M     The matrix type
+ *
+ * \return     The temporary
+ */
+template <typename M>
+inline M make_temporary() {
+  if constexpr (std::is_same<M, matrix<element_type_t<M>>>::value) {
+    return M(temporary_resource());
+  } else {
+    return M();
+  }
+}
+
+/**
+ * \brief      Evaluates a product going through the packed kernel, reordering chains of products
+ *
+ * \param      product   The product, use_packed_product must hold for its operands
+ * \param      c         Pointer to the result
+ * \param[in]  rsc       Row stride of the result
+ * \param[in]  csc       Column stride of the result
+ * \param      epilogue  Epilogue applied while the result is written back
+ *
+ * \tparam     T         Element type of the product
+ * \tparam     P         Type of the product
+ * \tparam     Epilogue  Type of the epilogue
+ */
+template <typename T, typename P, typename Epilogue>
+inline void evaluate_product(P const &product, T *c, std::size_t rsc, std::size_t csc,
+                             Epilogue const &epilogue);
+
+/**
+ * \brief      Computes a product in the accumulator type and rounds it into a matrix
+ *
+ * \param[in]  expr1  Expression 1
+ * \param[in]  expr2  Expression 2
+ * \param      dst    The matrix the product is rounded into, of the shape of the product
+ *
+ * \tparam     Accumulator  Type the product is accumulated in
+ * \tparam     E1           Type of expression 1
+ * \tparam     E2           Type of expression 2
+ * \tparam     M            Type of the destination
+ */
+template <typename Accumulator, typename E1, typename E2, typename M>
+inline void widened_product(E1 const &expr1, E2 const &expr2, M &dst);
+} // namespace detail
+
+template <typename E1, typename E2>
+class matrix_product;
+
+namespace detail {
+
+/**
+ * \brief      Trait for how a matrix product stores its operands
+ *
+ * Element-wise operations and products are stored by value, so a product of temporary expressions,
+ * like auto p = (a + b) * c, keeps them alive until it is evaluated. Other expressions are stored
+ * as given by storage_type: matrices as const references, views and scalars by value
+ *
+ * \tparam     E     Type of the operand
+ */
+template <typename E>
+struct product_storage_type {
+  using type = storage_type_t<E>;
+};
+
+template <typename Op, typename E1, typename E2>
+struct product_storage_type<cwise_matrix_binary_operation<Op, E1, E2>> {
+  using type = cwise_matrix_binary_operation<Op, E1, E2>;
+};
+
+template <typename E1, typename E2>
+struct product_storage_type<matrix_product<E1, E2>> {
+  using type = matrix_product<E1, E2>;
+};
+
+/**
+ * Convenience typedef of product_storage_type
+ */
+template <typename E>
+using product_storage_type_t = typename product_storage_type<E>::type;
+} // namespace detail
+
+/**
+ * \brief      Class to represent a matrix product
+ *
+ * Matrix products are evaluated lazily, the first time an element or the whole product is needed,
+ * and the result is kept in a temporary. Assigning an expression evaluates its products before any
+ * element is written, so statements like x = x * a are safe, and lets the product write straight
+ * into the destination when it is not read by the expression, see matrix::assign
+ *
+ * When both operands are, or evaluate to, dense matrices of an arithmetic type, the product is
+ * computed by the cache-blocked, packed kernel in detail::gemm. Chains of such products, like
+ * a * b * c, are multiplied in the order needing the fewest floating point operations. Products
+ * of fixed-size shape are computed by fully unrolled loops. Products of storage only element types,
+ * like float16, go through the same kernel in their accumulator_type and are rounded once at the
+ * end. Any other operands fall back to the element-wise triple loop over the expressions. The
+ * packed and element-wise paths split large products across threads
+ *
+ * \tparam     E1    Type of expression 1
+ * \tparam     E2    Type of expression 2
+ */
+template <typename E1, typename E2>
+class matrix_product : public expression<matrix_product<E1, E2>> {
+public:
+  /**
+   * Return type of eval() method
+   */
+  using EvalReturnType = detail::shaped_matrix_t<
+      std::common_type_t<element_type_t<E1>, element_type_t<E2>>, detail::static_rows_v<E1>,
+      detail::static_cols_v<E2>>;
+
+  /**
+   * Type of an element in this matrix product
+   */
+  using ElementType = std::common_type_t<element_type_t<E1>, element_type_t<E2>>;
+
+private:
+  /**
+   * Expression 1, stored as given by detail::product_storage_type
+   */
+  detail::product_storage_type_t<E1> expr1;
+
+  /**
+   * Expression 2, stored as given by detail::product_storage_type
+   */
+  detail::product_storage_type_t<E2> expr2;
+
+  /**
+   * Temporary to store the product of the two expressions once evaluated, allocated from the
+   * temporary resource of the thread constructing the product, see scoped_arena
+   */
+  mutable EvalReturnType temp;
+
+  /**
+   * Whether the temporary holds the product
+   */
+  mutable bool evaluated = false;
+
+  /**
+   * \brief      Evaluates a fixed-size product into the temporary with fully unrolled loops
+   */
+  inline void evaluate_fixed() const {
+    constexpr std::size_t n_rows = detail::static_rows_v<matrix_product>;
+    constexpr std::size_t n_cols = detail::static_cols_v<matrix_product>;
+    constexpr std::size_t depth = detail::static_cols_v<E1> != dynamic ? detail::static_cols_v<E1>
+                                                                       : detail::static_rows_v<E2>;
+    static_assert(depth != dynamic, "fixed-size product with a runtime-sized depth");
+    assert(expr1.num_cols() == depth && expr2.num_rows() == depth);
+    detail::static_for<n_rows * n_cols>([&](std::size_t idx) {
+      std::size_t const i = idx / n_cols;
+      std::size_t const j = idx % n_cols;
+      ElementType sum = expr1(i, 0) * expr2(0, j);
+      detail::static_for<depth - 1>(
+          [&](std::size_t k) { sum = expr1(i, k + 1) * expr2(k + 1, j) + sum; });
+      temp.set_elt(i, j, sum);
+    });
+  }
+
+public:
+  /**
+   * \brief      Constructor
+   *
+   * \param      expr1  Expression 1
+   * \param      expr2  Expression 2
+   */
+  inline matrix_product(expression<E1> const &expr1, expression<E2> const &expr2)
+      : expr1(expr1.get_const_derived()), expr2(expr2.get_const_derived()),
+        temp(detail::make_temporary<EvalReturnType>()) {}
+
+  /**
+   * \brief      Copy constructor, used when a product is an operand of another product
+   *
+   * The copy is not evaluated yet and allocates its temporary from the temporary resource of the
+   * calling thread, like a new product
+   *
+   * \param      other  The product to copy
+   */
+  inline matrix_product(matrix_product const &other)
+      : expr1(other.expr1), expr2(other.expr2), temp(detail::make_temporary<EvalReturnType>()) {}
+
+  /**
+   * \brief      Function call operator to get an element of the matrix product
+   *
+   * Evaluates the whole product on first use. Not safe to call from several threads before the
+   * product has been evaluated
+   *
+   * \param[in]  i     Row number of the element to get
+   * \param[in]  j     Column number of the element to get
+   *
+   * \return     The desired element
+   */
+  inline ElementType operator()(std::size_t i, std::size_t j) const {
+    return eval()(i, j);
+  }
+
+  /**
+   * \brief      Evaluate and return the result of this expression
+   *
+   * The product is computed into a temporary on the first call, later calls return the same
+   * temporary
+   *
+   * \return     Reference to the product
+   */
+  inline EvalReturnType const &eval() const {
+    if (evaluated) {
+      return temp;
+    }
+    if constexpr (detail::static_rows_v<matrix_product> != dynamic) {
+      evaluate_fixed();
+    } else if constexpr (detail::is_sparse<E1>::value || detail::is_sparse<E2>::value) {
+      temp = EvalReturnType(num_rows(), num_cols(), temp.get_allocator());
+      detail::evaluate_sparse_product(expr1, expr2, temp.data(), temp.row_stride(),
+                                      temp.col_stride());
+    } else if constexpr (detail::use_packed_product<E1, E2>::value) {
+      temp = EvalReturnType(num_rows(), num_cols(), temp.get_allocator());
+      detail::evaluate_product(*this, temp.data(), temp.row_stride(), temp.col_stride(),
+                               detail::store_epilogue());
+    } else if constexpr (detail::use_widened_product<E1, E2>::value) {
+      temp = EvalReturnType(num_rows(), num_cols(), temp.get_allocator());
+      detail::widened_product<accumulator_type_t<ElementType>>(expr1, expr2, temp);
+    } else {
+      temp = EvalReturnType(num_rows(), num_cols(), temp.get_allocator());
+      detail::prepare(expr1);
+      detail::prepare(expr2);
+      auto product_rows = [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+          for (std::size_t j = 0; j < num_cols(); ++j) {
+            ElementType sum = expr1(i, 0) * expr2(0, j);
+            for (std::size_t k = 1; k < expr1.num_cols(); ++k) {
+              sum = expr1(i, k) * expr2(k, j) + sum;
+            }
+            temp.set_elt(i, j, sum);
+          }
+        }
+      };
+      if (detail::use_parallel(num_rows() * num_cols() * expr1.num_cols())) {
+        detail::parallel_range(num_rows(), product_rows);
+      } else {
+        product_rows(0, num_rows());
+      }
+    }
+    evaluated = true;
+    return temp;
+  }
+
+  /**
+   * \brief      Whether the product has already been evaluated into its temporary
+   *
+   * \return     True if eval() has been called
+   */
+  inline bool is_evaluated() const {
+    return evaluated;
+  }
+
+  /**
+   * \brief      Get number of rows of this matrix product
+   *
+   * \return     Number of rows
+   */
+  inline std::size_t num_rows() const {
+    return expr1.num_rows();
+  }
+
+  /**
+   * \brief      Get number of columns of this matrix product
+   *
+   * \return     Number of columns
+   */
+  inline std::size_t num_cols() const {
+    return expr2.num_cols();
+  }
+
+  /**
+   * \brief      Get expression 1
+   *
+   * \return     Expression 1
+   */
+  inline E1 const &get_expr1() const {
+    return expr1;
+  }
+
+  /**
+   * \brief      Get expression 2
+   *
+   * \return     Expression 2
+   */
+  inline E2 const &get_expr2() const {
+    return expr2;
+  }
+};
+
+/**
+ * \brief      Operator representing element-wise matrix addition between two expressions
+ *
+ * \tparam     E1    Type of expression 1
+ * \tparam     E2    Type of expression 2
+ */
+template <typename E1, typename E2>
+struct cwise_matrix_add {
+  /**
+   * \brief      Applies the addition operator on the given elements of the given expressions
+   *
+   * \param      expr1  Expression 1
+   * \param      expr2  Expression 2
+   * \param[in]  i      Row number of the element
+   * \param[in]  j      Column number of the element
+   *
+   * \return     Sum of the two elements
+   */
+  inline static typename std::common_type_t<element_type_t<E1>, element_type_t<E2>>
+  apply(expression<E1> const &expr1, expression<E2> const &expr2, std::size_t i, std::size_t j) {
+    return expr1.get_const_derived()(i, j) + expr2.get_const_derived()(i, j);
+  }
+
+  /**
+   * \brief      Applies the addition operator on two values, used by the linear evaluation path
+   *
+   * \param[in]  lhs   Left operand, an element or a packet of elements
+   * \param[in]  rhs   Right operand, an element or a packet of elements
+   *
+   * \tparam     V     Type of the operands
+   *
+   * \return     Sum of the operands
+   */
+  template <typename V>
+  inline static V combine(V const &lhs, V const &rhs) {
+    return lhs + rhs;
+  }
+};
+
+/**
+ * \brief      Operator representing element-wise matrix multiplication between two expressions
+ *
+ * \tparam     E1    Type of expression 1
+ * \tparam     E2    Type of expression 2
+ */
+template <typename E1, typename E2>
+struct cwise_matrix_multiply {
+  /**
+   * \brief      Applies the coefficient-wise multiplication operator on the given elements of the
+   * given expressions
+   *
+   * \param      expr1  Expression 1
+   * \param      expr2  Expression 1
+   * \param[in]  i      Row number of the element
+   * \param[in]  j      Column number of the element
+   *
+   * \return     Product of the two elements
+   */
+  inline static typename std::common_type_t<element_type_t<E1>, element_type_t<E2>>
+  apply(expression<E1> const &expr1, expression<E2> const &expr2, std::size_t i, std::size_t j) {
+    return expr1.get_const_derived()(i, j) * expr2.get_const_derived()(i, j);
+  }
+
+  /**
+   * \brief      Applies the multiplication operator on two values, used by the linear evaluation path
+   *
+   * \param[in]  lhs   Left operand, an element or a packet of elements
+   * \param[in]  rhs   Right operand, an element or a packet of elements
+   *
+   * \tparam     V     Type of the operands
+   *
+   * \return     Product of the operands
+   */
+  template <typename V>
+  inline static V combine(V const &lhs, V const &rhs) {
+    return lhs * rhs;
+  }
+};
+
+/**
+ * \brief      Operator representing element-wise matrix subtraction between two expressions
+ *
+ * \tparam     E1    Type of expression 1
+ * \tparam     E2    Type of expression 2
+ */
+template <typename E1, typename E2>
+struct cwise_matrix_subtract {
+  /**
+   * \brief      Applies the subtraction operator on the given elements of the given expressions
+   *
+   * \param      expr1  Expression 1
+   * \param      expr2  Expression 2
+   * \param[in]  i      Row number of the element
+   * \param[in]  j      Column number of the element
+   *
+   * \return     Difference of the two elements
+   */
+  inline static typename std::common_type_t<element_type_t<E1>, element_type_t<E2>>
+  apply(expression<E1> const &expr1, expression<E2> const &expr2, std::size_t i, std::size_t j) {
+    return expr1.get_const_derived()(i, j) - expr2.get_const_derived()(i, j);
+  }
+
+  /**
+   * \brief      Applies the subtraction operator on two values, used by the linear evaluation path
+   *
+   * \param[in]  lhs   Left operand, an element or a packet of elements
+   * \param[in]  rhs   Right operand, an element or a packet of elements
+   *
+   * \tparam     V     Type of the operands
+   *
+   * \return     Difference of the operands
+   */
+  template <typename V>
+  inline static V combine(V const &lhs, V const &rhs) {
+    return lhs - rhs;
+  }
+};
+
+namespace detail {
+
+/**
+ * \brief      A single element behaving like a SIMD packet of width 1
+ *
+ * Used for the scalar tail of linear loops and for element types without a vector packet
+ *
+ * \tparam     T     Element type
+ */
+template <typename T>
+struct scalar_packet {
+  using element = T;
+  static constexpr std::size_t size = 1;
+  T value;
+  inline static scalar_packet load(T const *ptr) {
+    return {*ptr};
+  }
+  inline static scalar_packet broadcast(T x) {
+    return {x};
+  }
+  inline void store(T *ptr) const {
+    *ptr = value;
+  }
+  inline friend scalar_packet operator+(scalar_packet const &lhs, scalar_packet const &rhs) {
+    return {lhs.value + rhs.value};
+  }
+  inline friend scalar_packet operator-(scalar_packet const &lhs, scalar_packet const &rhs) {
+    return {lhs.value - rhs.value};
+  }
+  inline friend scalar_packet operator*(scalar_packet const &lhs, scalar_packet const &rhs) {
+    return {lhs.value * rhs.value};
+  }
+  inline friend scalar_packet min(scalar_packet const &lhs, scalar_packet const &rhs) {
+    return {rhs.value < lhs.value ? rhs.value : lhs.value};
+  }
+  inline friend scalar_packet max(scalar_packet const &lhs, scalar_packet const &rhs) {
+    return {lhs.value < rhs.value ? rhs.value : lhs.value};
+  }
+  inline friend scalar_packet abs(scalar_packet const &x) {
+    if constexpr (std::is_signed<T>::value) {
+      return {x.value < T(0) ? T(-x.value) : x.value};
+    } else {
+      return x;
+    }
+  }
+};
+
+/**
+ * \brief      SIMD packet holding as many elements of type T as the widest vector register enabled
+ * at compile time (AVX-512, AVX and AVX2, or SSE2)
+ *
+ * Only specialized for float and double. Vector add, subtract and multiply round exactly like their
+ * scalar counterparts, so results do not depend on the packet width. Min, max and abs, used by
+ * reductions, are exact
+ *
+ * \tparam     T     Element type
+ */
+template <typename T>
+struct vector_packet;
+
+/**
+ * \brief      Trait telling whether vector_packet is specialized for T on this target
+ *
+ * \tparam     T     Element type
+ */
+template <typename T>
+struct has_vector_packet : std::false_type {};
+
+#if defined(__AVX512F__)
+template <>
+struct vector_packet<float> {
+  using element = float;
+  static constexpr std::size_t size = 16;
+  __m512 value;
+  inline static vector_packet load(float const *ptr) {
+    return {_mm512_loadu_ps(ptr)};
+  }
+  inline static vector_packet broadcast(float x) {
+    return {_mm512_set1_ps(x)};
+  }
+  inline void store(float *ptr) const {
+    _mm512_storeu_ps(ptr, value);
+  }
+  inline friend vector_packet operator+(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm512_add_ps(lhs.value, rhs.value)};
+  }
+  inline friend vector_packet operator-(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm512_sub_ps(lhs.value, rhs.value)};
+  }
+  inline friend vector_packet operator*(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm512_mul_ps(lhs.value, rhs.value)};
+  }
+  // The unmasked AVX-512 min and max pass an undefined register through an all-true mask, which
+  // GCC reports as uninitialized once inlined; the masked forms pass lhs through instead
+  inline friend vector_packet min(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm512_mask_min_ps(lhs.value, __mmask16(-1), lhs.value, rhs.value)};
+  }
+  inline friend vector_packet max(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm512_mask_max_ps(lhs.value, __mmask16(-1), lhs.value, rhs.value)};
+  }
+  inline friend vector_packet abs(vector_packet const &x) {
+    return {_mm512_abs_ps(x.value)};
+  }
+};
+
+template <>
+struct vector_packet<double> {
+  using element = double;
+  static constexpr std::size_t size = 8;
+  __m512d value;
+  inline static vector_packet load(double const *ptr) {
+    return {_mm512_loadu_pd(ptr)};
+  }
+  inline static vector_packet broadcast(double x) {
+    return {_mm512_set1_pd(x)};
+  }
+  inline void store(double *ptr) const {
+    _mm512_storeu_pd(ptr, value);
+  }
+  inline friend vector_packet operator+(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm512_add_pd(lhs.value, rhs.value)};
+  }
+  inline friend vector_packet operator-(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm512_sub_pd(lhs.value, rhs.value)};
+  }
+  inline friend vector_packet operator*(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm512_mul_pd(lhs.value, rhs.value)};
+  }
+  // The unmasked AVX-512 min and max pass an undefined register through an all-true mask, which
+  // GCC reports as uninitialized once inlined; the masked forms pass lhs through instead
+  inline friend vector_packet min(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm512_mask_min_pd(lhs.value, __mmask8(-1), lhs.value, rhs.value)};
+  }
+  inline friend vector_packet max(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm512_mask_max_pd(lhs.value, __mmask8(-1), lhs.value, rhs.value)};
+  }
+  inline friend vector_packet abs(vector_packet const &x) {
+    return {_mm512_abs_pd(x.value)};
+  }
+};
+
+template <>
+struct has_vector_packet<float> : std::true_type {};
+
+template <>
+struct has_vector_packet<double> : std::true_type {};
+#elif defined(__AVX__)
+template <>
+struct vector_packet<float> {
+  using element = float;
+  static constexpr std::size_t size = 8;
+  __m256 value;
+  inline static vector_packet load(float const *ptr) {
+    return {_mm256_loadu_ps(ptr)};
+  }
+  inline static vector_packet broadcast(float x) {
+    return {_mm256_set1_ps(x)};
+  }
+  inline void store(float *ptr) const {
+    _mm256_storeu_ps(ptr, value);
+  }
+  inline friend vector_packet operator+(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm256_add_ps(lhs.value, rhs.value)};
+  }
+  inline friend vector_packet operator-(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm256_sub_ps(lhs.value, rhs.value)};
+  }
+  inline friend vector_packet operator*(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm256_mul_ps(lhs.value, rhs.value)};
+  }
+  inline friend vector_packet min(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm256_min_ps(lhs.value, rhs.value)};
+  }
+  inline friend vector_packet max(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm256_max_ps(lhs.value, rhs.value)};
+  }
+  inline friend vector_packet abs(vector_packet const &x) {
+    return {_mm256_andnot_ps(_mm256_set1_ps(-0.0f), x.value)};
+  }
+};
+
+template <>
+struct vector_packet<double> {
+  using element = double;
+  static constexpr std::size_t size = 4;
+  __m256d value;
+  inline static vector_packet load(double const *ptr) {
+    return {_mm256_loadu_pd(ptr)};
+  }
+  inline static vector_packet broadcast(double x) {
+    return {_mm256_set1_pd(x)};
+  }
+  inline void store(double *ptr) const {
+    _mm256_storeu_pd(ptr, value);
+  }
+  inline friend vector_packet operator+(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm256_add_pd(lhs.value, rhs.value)};
+  }
+  inline friend vector_packet operator-(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm256_sub_pd(lhs.value, rhs.value)};
+  }
+  inline friend vector_packet operator*(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm256_mul_pd(lhs.value, rhs.value)};
+  }
+  inline friend vector_packet min(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm256_min_pd(lhs.value, rhs.value)};
+  }
+  inline friend vector_packet max(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm256_max_pd(lhs.value, rhs.value)};
+  }
+  inline friend vector_packet abs(vector_packet const &x) {
+    return {_mm256_andnot_pd(_mm256_set1_pd(-0.0), x.value)};
+  }
+};
+
+template <>
+struct has_vector_packet<float> : std::true_type {};
+
+template <>
+struct has_vector_packet<double> : std::true_type {};
+#elif defined(__SSE2__)
+template <>
+struct vector_packet<float> {
+  using element = float;
+  static constexpr std::size_t size = 4;
+  __m128 value;
+  inline static vector_packet load(float const *ptr) {
+    return {_mm_loadu_ps(ptr)};
+  }
+  inline static vector_packet broadcast(float x) {
+    return {_mm_set1_ps(x)};
+  }
+  inline void store(float *ptr) const {
+    _mm_storeu_ps(ptr, value);
+  }
+  inline friend vector_packet operator+(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm_add_ps(lhs.value, rhs.value)};
+  }
+  inline friend vector_packet operator-(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm_sub_ps(lhs.value, rhs.value)};
+  }
+  inline friend vector_packet operator*(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm_mul_ps(lhs.value, rhs.value)};
+  }
+  inline friend vector_packet min(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm_min_ps(lhs.value, rhs.value)};
+  }
+  inline friend vector_packet max(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm_max_ps(lhs.value, rhs.value)};
+  }
+  inline friend vector_packet abs(vector_packet const &x) {
+    return {_mm_andnot_ps(_mm_set1_ps(-0.0f), x.value)};
+  }
+};
+
+template <>
+struct vector_packet<double> {
+  using element = double;
+  static constexpr std::size_t size = 2;
+  __m128d value;
+  inline static vector_packet load(double const *ptr) {
+    return {_mm_loadu_pd(ptr)};
+  }
+  inline static vector_packet broadcast(double x) {
+    return {_mm_set1_pd(x)};
+  }
+  inline void store(double *ptr) const {
+    _mm_storeu_pd(ptr, value);
+  }
+  inline friend vector_packet operator+(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm_add_pd(lhs.value, rhs.value)};
+  }
+  inline friend vector_packet operator-(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm_sub_pd(lhs.value, rhs.value)};
+  }
+  inline friend vector_packet operator*(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm_mul_pd(lhs.value, rhs.value)};
+  }
+  inline friend vector_packet min(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm_min_pd(lhs.value, rhs.value)};
+  }
+  inline friend vector_packet max(vector_packet const &lhs, vector_packet const &rhs) {
+    return {_mm_max_pd(lhs.value, rhs.value)};
+  }
+  inline friend vector_packet abs(vector_packet const &x) {
+    return {_mm_andnot_pd(_mm_set1_pd(-0.0), x.value)};
+  }
+};
+
+template <>
+struct has_vector_packet<float> : std::true_type {};
+
+template <>
+struct has_vector_packet<double> : std::true_type {};
+#endif
+
+/**
+ * Packet type used by linear loops over elements of type T
+ */
+template <typename T>
+using packet_type_t =
+    std::conditional_t<has_vector_packet<T>::value, vector_packet<T>, scalar_packet<T>>;
+
+/**
+ * \brief      Trait telling whether an element-wise operator has a linear form (a combine method)
+ *
+ * \tparam     Op    The operator
+ */
+template <typename Op>
+struct is_linear_op : std::false_type {};
+
+template <typename E1, typename E2>
+struct is_linear_op<cwise_matrix_add<E1, E2>> : std::true_type {};
+
+template <typename E1, typename E2>
+struct is_linear_op<cwise_matrix_subtract<E1, E2>> : std::true_type {};
+
+template <typename E1, typename E2>
+struct is_linear_op<cwise_matrix_multiply<E1, E2>> : std::true_type {};
+
+template <typename T, std::size_t R, std::size_t C>
+struct is_linear<matrix<T, R, C>, T> : std::is_arithmetic<T> {};
+
+template <typename U, typename T>
+struct is_linear<matrix_view<U>, T>
+    : std::integral_constant<bool, std::is_same<std::remove_const_t<U>, T>::value &&
+                                       std::is_arithmetic<T>::value> {};
+
+template <typename U, typename T>
+struct is_linear<scalar_expression<U>, T>
+    : std::integral_constant<bool, std::is_arithmetic<U>::value && std::is_arithmetic<T>::value> {};
+
+template <typename Op, typename E1, typename E2, typename T>
+struct is_linear<cwise_matrix_binary_operation<Op, E1, E2>, T>
+    : std::integral_constant<
+          bool, is_linear_op<Op>::value &&
+                    std::is_same<element_type_t<cwise_matrix_binary_operation<Op, E1, E2>>,
+                                 T>::value &&
+                    is_linear<E1, T>::value && is_linear<E2, T>::value> {};
+
+template <typename E1, typename E2, typename T>
+struct is_linear<matrix_product<E1, E2>, T>
+    : std::integral_constant<
+          bool, is_matrix<eval_return_type_t<matrix_product<E1, E2>>>::value &&
+                    std::is_same<element_type_t<matrix_product<E1, E2>>, T>::value> {};
+
+/**
+ * \brief      Flattened copy of a linear expression used by the linear evaluation loop
+ *
+ * The evaluator holds the data pointers and scalar values of the expression tree by value, so the
+ * loop keeps them in registers instead of reloading them through the tree on every iteration
+ *
+ * \tparam     E     Type of the expression, is_linear<E, T> must hold
+ * \tparam     T     Element type of the destination
+ */
+template <typename E, typename T>
+struct linear_evaluator;
+
+/**
+ * \brief      Linear evaluator of a matrix leaf
+ *
+ * \tparam     T     Element type
+ * \tparam     R     Number of rows, or dynamic
+ * \tparam     C     Number of columns, or dynamic
+ */
+template <typename T, std::size_t R, std::size_t C>
+struct linear_evaluator<matrix<T, R, C>, T> {
+  T const *ptr;
+
+  inline explicit linear_evaluator(matrix<T, R, C> const &mat) : ptr(mat.data()) {}
+
+  template <typename P>
+  inline P packet(std::size_t idx) const {
+    return P::load(ptr + idx);
+  }
+};
+
+/**
+ * \brief      Linear evaluator of a contiguous view
+ *
+ * \tparam     U     Element type of the view, possibly const
+ * \tparam     T     Element type
+ */
+template <typename U, typename T>
+struct linear_evaluator<matrix_view<U>, T> {
+  T const *ptr;
+
+  inline explicit linear_evaluator(matrix_view<U> const &view) : ptr(view.data()) {}
+
+  template <typename P>
+  inline P packet(std::size_t idx) const {
+    return P::load(ptr + idx);
+  }
+};
+
+/**
+ * \brief      Linear evaluator of a product, reading the temporary it has been evaluated into
+ *
+ * \tparam     E1    Type of expression 1
+ * \tparam     E2    Type of expression 2
+ * \tparam     T     Element type
+ */
+template <typename E1, typename E2, typename T>
+struct linear_evaluator<matrix_product<E1, E2>, T> {
+  T const *ptr;
+
+  inline explicit linear_evaluator(matrix_product<E1, E2> const &product)
+      : ptr(product.eval().data()) {}
+
+  template <typename P>
+  inline P packet(std::size_t idx) const {
+    return P::load(ptr + idx);
+  }
+};
+
+/**
+ * \brief      Linear evaluator of a scalar leaf, broadcasting the scalar
+ *
+ * \tparam     U     Type of the scalar
+ * \tparam     T     Element type of the destination
+ */
+template <typename U, typename T>
+struct linear_evaluator<scalar_expression<U>, T> {
+  T value;
+
+  inline explicit linear_evaluator(scalar_expression<U> const &scalar)
+      : value(static_cast<T>(scalar.eval())) {}
+
+  template <typename P>
+  inline P packet(std::size_t) const {
+    return P::broadcast(value);
+  }
+};
+
+/**
+ * \brief      Linear evaluator of an element-wise operation
+ *
+ * \tparam     Op    Type of the operator
+ * \tparam     E1    Type of expression 1
+ * \tparam     E2    Type of expression 2
+ * \tparam     T     Element type of the destination
+ */
+template <typename Op, typename E1, typename E2, typename T>
+struct linear_evaluator<cwise_matrix_binary_operation<Op, E1, E2>, T> {
+  linear_evaluator<E1, T> lhs;
+  linear_evaluator<E2, T> rhs;
+
+  inline explicit linear_evaluator(cwise_matrix_binary_operation<Op, E1, E2> const &expr)
+      : lhs(expr.get_expr1()), rhs(expr.get_expr2()) {}
+
+  template <typename P>
+  inline P packet(std::size_t idx) const {
+    return Op::combine(lhs.template packet<P>(idx), rhs.template packet<P>(idx));
+  }
+};
+
+/**
+ * \brief      Evaluates the flat range [begin, end) of a linear expression into dst
+ *
+ * The whole expression tree is fused into one loop of packet loads, arithmetic and stores, followed
+ * by a scalar tail
+ *
+ * \param      dst    Flat row-major storage of the destination
+ * \param      expr   The expression, is_linear<E, T> must hold
+ * \param[in]  begin  First flat index to evaluate
+ * \param[in]  end    One past the last flat index to evaluate
+ *
+ * \tparam     T      Element type of the destination
+ * \tparam     E      Type of the expression
+ */
+template <typename T, typename E>
+inline void assign_linear(T *dst, E const &expr, std::size_t begin, std::size_t end) {
+  using P = packet_type_t<T>;
+  linear_evaluator<E, T> const evaluator(expr);
+  std::size_t idx = begin;
+  for (; idx + P::size <= end; idx += P::size) {
+    evaluator.template packet<P>(idx).store(dst + idx);
+  }
+  for (; idx < end; ++idx) {
+    evaluator.template packet<scalar_packet<T>>(idx).store(dst + idx);
+  }
+}
+
+/**
+ * \brief      Trait telling whether an expression is a matrix product
+ *
+ * \tparam     E     Type of the expression
+ */
+template <typename E>
+struct is_matrix_product : std::false_type {};
+
+template <typename E1, typename E2>
+struct is_matrix_product<matrix_product<E1, E2>> : std::true_type {};
+
+/**
+ * \brief      Trait telling whether an expression is an element-wise operation
+ *
+ * \tparam     E     Type of the expression
+ */
+template <typename E>
+struct is_cwise_operation : std::false_type {};
+
+template <typename Op, typename E1, typename E2>
+struct is_cwise_operation<cwise_matrix_binary_operation<Op, E1, E2>> : std::true_type {};
+
+/**
+ * \brief      Trait telling whether an expression is a view
+ *
+ * \tparam     E     Type of the expression
+ */
+template <typename E>
+struct is_matrix_view : std::false_type {};
+
+template <typename T>
+struct is_matrix_view<matrix_view<T>> : std::true_type {};
+
+/**
+ * \brief      Trait telling whether an expression is a row-wise or column-wise reduction
+ *
+ * \tparam     E     Type of the expression
+ */
+template <typename E>
+struct is_partial_reduction : std::false_type {};
+
+template <typename Reduction, typename E, direction Dir>
+struct is_partial_reduction<partial_reduction<Reduction, E, Dir>> : std::true_type {};
+
+/**
+ * \brief      Trait telling whether an expression is backed by strided storage, a matrix or a view
+ *
+ * \tparam     E     Type of the expression
+ */
+template <typename E>
+struct is_dense : std::integral_constant<bool, is_matrix<E>::value || is_matrix_view<E>::value> {};
+
+/**
+ * \brief      Trait telling whether a product is reachable from an expression through element-wise
+ * operations only
+ *
+ * \tparam     E     Type of the expression
+ */
+template <typename E>
+struct contains_product : is_matrix_product<E> {};
+
+template <typename Op, typename E1, typename E2>
+struct contains_product<cwise_matrix_binary_operation<Op, E1, E2>>
+    : std::integral_constant<bool, contains_product<E1>::value || contains_product<E2>::value> {};
+
+/**
+ * \brief      Trait telling whether a product of element type T is part of a chain of products
+ * evaluated by the packed kernel
+ *
+ * \tparam     E     Type of the expression
+ * \tparam     T     Element type of the chain
+ */
+template <typename E, typename T>
+struct is_chain_link : std::false_type {};
+
+template <typename E1, typename E2, typename T>
+struct is_chain_link<matrix_product<E1, E2>, T>
+    : std::integral_constant<bool, use_packed_product<E1, E2>::value &&
+                                       std::is_same<element_type_t<matrix_product<E1, E2>>,
+                                                    T>::value> {};
+
+template <typename E1, typename E2, typename T>
+struct is_fusable<matrix_product<E1, E2>, T> : is_chain_link<matrix_product<E1, E2>, T> {};
+
+// The fused product is the first one found left to right, the other operands are read element by
+// element in the epilogue
+template <typename Op, typename E1, typename E2, typename T>
+struct is_fusable<cwise_matrix_binary_operation<Op, E1, E2>, T>
+    : std::integral_constant<
+          bool, is_linear_op<Op>::value &&
+                    std::is_same<element_type_t<cwise_matrix_binary_operation<Op, E1, E2>>,
+                                 T>::value &&
+                    std::conditional_t<contains_product<E1>::value, is_fusable<E1, T>,
+                                       is_fusable<E2, T>>::value> {};
+
+/**
+ * \brief      Evaluates every product and partial reduction of an expression that is not evaluated
+ * yet
+ *
+ * Products and partial reductions are evaluated lazily on first access, which must not happen
+ * concurrently. This is called before an expression is read from several threads
+ *
+ * \param      expr  The expression
+ *
+ * \tparam     E     Type of the expression
+ */
+template <typename E>
+inline void prepare(E const &expr) {
+  if constexpr (is_matrix_product<E>::value || is_partial_reduction<E>::value) {
+    expr.eval();
+  } else if constexpr (is_cwise_operation<E>::value) {
+    prepare(expr.get_expr1());
+    prepare(expr.get_expr2());
+  }
+}
+
+/**
+ * \brief      Range of addresses spanned by the elements of a matrix or a view
+ *
+ * \param      mat   The matrix or view
+ *
+ * \tparam     M     Type of the matrix or view
+ *
+ * \return     First address and one past the last address, equal for empty matrices
+ */
+template <typename M>
+inline std::pair<std::uintptr_t, std::uintptr_t> storage_span(M const &mat) {
+  std::uintptr_t const first = reinterpret_cast<std::uintptr_t>(mat.data());
+  if (mat.num_rows() == 0 || mat.num_cols() == 0) {
+    return {first, first};
+  }
+  std::size_t const last =
+      (mat.num_rows() - 1) * mat.row_stride() + (mat.num_cols() - 1) * mat.col_stride();
+  return {first, first + (last + 1) * sizeof(element_type_t<M>)};
+}
+
+/**
+ * \brief      Whether the elements of two matrices or views may share memory
+ *
+ * \param      lhs   Matrix or view 1
+ * \param      rhs   Matrix or view 2
+ *
+ * \tparam     M1    Type of matrix or view 1
+ * \tparam     M2    Type of matrix or view 2
+ *
+ * \return     False if the address ranges of their elements are disjoint
+ */
+template <typename M1, typename M2>
+inline bool storage_overlaps(M1 const &lhs, M2 const &rhs) {
+  auto const lhs_span = storage_span(lhs);
+  auto const rhs_span = storage_span(rhs);
+  return lhs_span.first < rhs_span.second && rhs_span.first < lhs_span.second;
+}
+
+/**
+ * \brief      Conservatively classifies how an expression reads a matrix or view it is assigned to
+ *
+ * Element-wise operations read their operands at the position being written, which is harmless
+ * when an operand has the layout of the destination itself. An operand sharing memory with the
+ * destination in any other way, like a transposed or shifted view of it, is not. Products and
+ * partial reductions read all of their operands, any overlap with the destination is reported as
+ * aliasing::product
+ *
+ * \param      expr  The expression
+ * \param      dst   The matrix or view
+ *
+ * \tparam     E     Type of the expression
+ * \tparam     D     Type of the matrix or view
+ *
+ * \return     The worst aliasing found in the expression
+ */
+template <typename E, typename D>
+inline aliasing alias_analysis(E const &expr, D const &dst) {
+  if constexpr (is_dense<E>::value) {
+    if (!storage_overlaps(expr, dst)) {
+      return aliasing::none;
+    }
+    bool const same_layout =
+        static_cast<void const *>(expr.data()) == static_cast<void const *>(dst.data()) &&
+        std::is_same<element_type_t<E>, element_type_t<D>>::value &&
+        (expr.row_stride() == dst.row_stride() || expr.num_rows() <= 1) &&
+        (expr.col_stride() == dst.col_stride() || expr.num_cols() <= 1);
+    return same_layout ? aliasing::same_index : aliasing::shifted;
+  } else if constexpr (is_cwise_operation<E>::value) {
+    return std::max(alias_analysis(expr.get_expr1(), dst), alias_analysis(expr.get_expr2(), dst));
+  } else if constexpr (is_matrix_product<E>::value) {
+    return alias_analysis(expr.get_expr1(), dst) == aliasing::none &&
+                   alias_analysis(expr.get_expr2(), dst) == aliasing::none
+               ? aliasing::none
+               : aliasing::product;
+  } else if constexpr (is_partial_reduction<E>::value) {
+    return alias_analysis(expr.get_expr(), dst) == aliasing::none ? aliasing::none
+                                                                  : aliasing::product;
+  } else if constexpr (is_sparse<E>::value) {
+    // sparse matrices own their storage
+    return aliasing::none;
+  } else if constexpr (std::is_same<eval_return_type_t<E>, element_type_t<E>>::value) {
+    // scalars
+    return aliasing::none;
+  } else {
+    return aliasing::shifted;
+  }
+}
+
+/**
+ * \brief      Whether a matrix or view is laid out row-major without gaps
+ *
+ * \param      mat   The matrix or view
+ *
+ * \tparam     M     Type of the matrix or view
+ *
+ * \return     True if the elements are contiguous
+ */
+template <typename M>
+inline bool is_contiguous(M const &mat) {
+  if constexpr (is_matrix<M>::value) {
+    return true;
+  } else {
+    return mat.is_contiguous();
+  }
+}
+
+/**
+ * \brief      Runtime part of the linear loop condition: every view read by the expression must be
+ * contiguous
+ *
+ * \param      expr  The expression, is_linear must hold
+ *
+ * \tparam     E     Type of the expression
+ *
+ * \return     True if the linear loop can be used
+ */
+template <typename E>
+inline bool linear_ok(E const &expr) {
+  if constexpr (is_dense<E>::value) {
+    return is_contiguous(expr);
+  } else if constexpr (is_cwise_operation<E>::value) {
+    return linear_ok(expr.get_expr1()) && linear_ok(expr.get_expr2());
+  } else {
+    return true;
+  }
+}
+
+/**
+ * \brief      Returns the product the assignment of a fusable expression is fused into
+ *
+ * \param      expr  The expression, is_fusable must hold
+ *
+ * \tparam     E1    Type of expression 1 of the product
+ * \tparam     E2    Type of expression 2 of the product
+ *
+ * \return     Reference to the product
+ */
+template <typename E1, typename E2>
+inline matrix_product<E1, E2> const &fused_product(matrix_product<E1, E2> const &expr) {
+  return expr;
+}
+
+template <typename Op, typename E1, typename E2>
+inline decltype(auto) fused_product(cwise_matrix_binary_operation<Op, E1, E2> const &expr) {
+  if constexpr (contains_product<E1>::value) {
+    return fused_product(expr.get_expr1());
+  } else {
+    return fused_product(expr.get_expr2());
+  }
+}
+
+/**
+ * \brief      Prepares the operands of a fusable expression that are read in the epilogue
+ *
+ * \param      expr  The expression, is_fusable must hold
+ */
+template <typename E1, typename E2>
+inline void prepare_fused(matrix_product<E1, E2> const &) {}
+
+template <typename Op, typename E1, typename E2>
+inline void prepare_fused(cwise_matrix_binary_operation<Op, E1, E2> const &expr) {
+  if constexpr (contains_product<E1>::value) {
+    prepare_fused(expr.get_expr1());
+    prepare(expr.get_expr2());
+  } else {
+    prepare(expr.get_expr1());
+    prepare_fused(expr.get_expr2());
+  }
+}
+
+/**
+ * \brief      Computes an element of a fusable expression given the element of its fused product
+ *
+ * \param      expr  The expression, is_fusable must hold
+ * \param[in]  acc   Element (i, j) of the fused product
+ * \param[in]  i     Row number of the element
+ * \param[in]  j     Column number of the element
+ *
+ * \tparam     T     Element type
+ *
+ * \return     Element (i, j) of the expression
+ */
+template <typename T, typename E1, typename E2>
+inline T epilogue_at(matrix_product<E1, E2> const &, T acc, std::size_t, std::size_t) {
+  return acc;
+}
+
+template <typename T, typename Op, typename E1, typename E2>
+inline T epilogue_at(cwise_matrix_binary_operation<Op, E1, E2> const &expr, T acc, std::size_t i,
+                     std::size_t j) {
+  if constexpr (contains_product<E1>::value) {
+    return Op::combine(epilogue_at(expr.get_expr1(), acc, i, j),
+                       static_cast<T>(expr.get_expr2()(i, j)));
+  } else {
+    return Op::combine(static_cast<T>(expr.get_expr1()(i, j)),
+                       epilogue_at(expr.get_expr2(), acc, i, j));
+  }
+}
+
+/**
+ * \brief      Epilogue of the packed kernel computing a whole fusable expression from its product
+ *
+ * \tparam     E           Type of the expression
+ * \tparam     SinglePass  Whether the expression reads the destination, see accumulate_epilogue
+ */
+template <typename E, bool SinglePass>
+struct expression_epilogue {
+  static constexpr bool overwrite = true;
+  static constexpr bool single_pass = SinglePass;
+
+  E const &expr;
+
+  template <typename T>
+  inline T operator()(T value, std::size_t i, std::size_t j) const {
+    return epilogue_at(expr, value, i, j);
+  }
+};
+
+/**
+ * \brief      Dense operand of a chain of products
+ *
+ * \tparam     T     Element type
+ */
+template <typename T>
+struct dense_factor {
+  T const *data;
+  std::size_t rows;
+  std::size_t cols;
+  std::size_t rs;
+  std::size_t cs;
+};
+
+/**
+ * \brief      Flattens a chain of products into its dense operands, left to right
+ *
+ * Matrices and views of any strides are read in place. Operands that are neither, nor already
+ * evaluated products, are evaluated into owned temporaries, allocated from the owner's resource
+ *
+ * \param      expr     The expression
+ * \param      factors  The operands found so far
+ * \param      owned    Storage of the evaluated operands
+ *
+ * \tparam     T        Element type of the chain
+ * \tparam     E        Type of the expression
+ */
+template <typename T, typename E>
+inline void collect_factors(E const &expr, std::pmr::vector<dense_factor<T>> &factors,
+                            std::pmr::deque<matrix<T>> &owned) {
+  matrix<T> const *mat = nullptr;
+  if constexpr (is_chain_link<E, T>::value) {
+    if (!expr.is_evaluated()) {
+      collect_factors(expr.get_expr1(), factors, owned);
+      collect_factors(expr.get_expr2(), factors, owned);
+      return;
+    }
+    mat = &expr.eval();
+  } else if constexpr (is_dense<E>::value && std::is_same<element_type_t<E>, T>::value) {
+    factors.push_back({expr.data(), expr.num_rows(), expr.num_cols(), expr.row_stride(),
+                       expr.col_stride()});
+    return;
+  } else {
+    owned.emplace_back(expr);
+    mat = &owned.back();
+  }
+  factors.push_back({mat->data(), mat->num_rows(), mat->num_cols(), mat->row_stride(),
+                     mat->col_stride()});
+}
+
+/**
+ * \brief      Multiplies the operands first to last of a chain in the order chosen by the planner
+ *
+ * \param      factors   Operands of the chain
+ * \param      split     split[first * n + last] is the operand after which the chain is split
+ * \param[in]  first     First operand to multiply
+ * \param[in]  last      Last operand to multiply
+ * \param      c         Pointer to the result
+ * \param[in]  rsc       Row stride of the result
+ * \param[in]  csc       Column stride of the result
+ * \param      epilogue  Epilogue of the last product
+ *
+ * \tparam     T         Element type
+ * \tparam     Epilogue  Type of the epilogue
+ */
+template <typename T, typename Epilogue>
+inline void multiply_chain(std::pmr::vector<dense_factor<T>> const &factors,
+                           std::pmr::vector<std::size_t> const &split, std::size_t first,
+                           std::size_t last, T *c, std::size_t rsc, std::size_t csc,
+                           Epilogue const &epilogue) {
+  std::size_t const n = factors.size();
+  auto operand = [&](std::size_t from, std::size_t to, matrix<T> &storage) {
+    if (from == to) {
+      return factors[from];
+    }
+    storage = matrix<T>(factors[from].rows, factors[to].cols, storage.get_allocator());
+    multiply_chain(factors, split, from, to, storage.data(), storage.row_stride(),
+                   storage.col_stride(), store_epilogue());
+    return dense_factor<T>{storage.data(), storage.num_rows(), storage.num_cols(),
+                           storage.row_stride(), storage.col_stride()};
+  };
+  std::size_t const mid = split[first * n + last];
+  matrix<T> lhs_storage(temporary_resource());
+  matrix<T> rhs_storage(temporary_resource());
+  dense_factor<T> const lhs = operand(first, mid, lhs_storage);
+  dense_factor<T> const rhs = operand(mid + 1, last, rhs_storage);
+  parallel_gemm(lhs.rows, rhs.cols, lhs.cols, T(1), lhs.data, lhs.rs, lhs.cs, rhs.data, rhs.rs,
+                rhs.cs, c, rsc, csc, epilogue);
+}
+
+template <typename T, typename P, typename Epilogue>
+inline void evaluate_product(P const &product, T *c, std::size_t rsc, std::size_t csc,
+                             Epilogue const &epilogue) {
+  // the bookkeeping of short chains fits on the stack, so in place updates do not allocate
+  std::byte buffer[1024];
+  std::pmr::monotonic_buffer_resource local(buffer, sizeof(buffer), temporary_resource());
+  std::pmr::memory_resource *const resource = &local;
+  std::pmr::vector<dense_factor<T>> factors(resource);
+  std::pmr::deque<matrix<T>> owned(resource);
+  collect_factors(product.get_expr1(), factors, owned);
+  collect_factors(product.get_expr2(), factors, owned);
+
+  // Classic matrix chain ordering on the number of multiply-adds. Ties keep the left to right
+  // order the chain was written in
+  std::size_t const n = factors.size();
+  std::pmr::vector<double> cost(n * n, 0.0, resource);
+  std::pmr::vector<std::size_t> split(n * n, 0, resource);
+  for (std::size_t length = 2; length <= n; ++length) {
+    for (std::size_t first = 0; first + length <= n; ++first) {
+      std::size_t const last = first + length - 1;
+      cost[first * n + last] = -1.0;
+      for (std::size_t mid = last; mid-- > first;) {
+        double const c_mid = cost[first * n + mid] + cost[(mid + 1) * n + last] +
+                             double(factors[first].rows) * factors[mid].cols * factors[last].cols;
+        if (cost[first * n + last] < 0 || c_mid < cost[first * n + last]) {
+          cost[first * n + last] = c_mid;
+          split[first * n + last] = mid;
+        }
+      }
+    }
+  }
+  multiply_chain(factors, split, 0, n - 1, c, rsc, csc, epilogue);
+}
+
+/**
+ * \brief      Evaluates a fusable expression into strided storage through the packed kernel
+ *
+ * \param      dst    Pointer to the destination
+ * \param[in]  rs     Row stride of the destination
+ * \param[in]  cs     Column stride of the destination
+ * \param      expr   The expression, is_fusable must hold
+ * \param[in]  alias  How the expression reads the destination, none or same_index
+ *
+ * \tparam     T      Element type of the destination
+ * \tparam     E      Type of the expression
+ */
+template <typename T, typename E>
+inline void assign_fused(T *dst, std::size_t rs, std::size_t cs, E const &expr, aliasing alias) {
+  prepare_fused(expr);
+  if constexpr (is_matrix_product<E>::value) {
+    evaluate_product(expr, dst, rs, cs, store_epilogue());
+  } else if (alias == aliasing::none) {
+    evaluate_product(fused_product(expr), dst, rs, cs, expression_epilogue<E, false>{expr});
+  } else {
+    evaluate_product(fused_product(expr), dst, rs, cs, expression_epilogue<E, true>{expr});
+  }
+}
+
+/**
+ * \brief      Trait telling whether an expression is a product with a sparse operand computing in T
+ *
+ * \tparam     E     Type of the expression
+ * \tparam     T     Element type of the destination
+ */
+template <typename E, typename T>
+struct is_sparse_product : std::false_type {};
+
+template <typename E1, typename E2, typename T>
+struct is_sparse_product<matrix_product<E1, E2>, T>
+    : std::integral_constant<bool, (is_sparse<E1>::value || is_sparse<E2>::value) &&
+                                       std::is_same<element_type_t<matrix_product<E1, E2>>,
+                                                    T>::value> {};
+
+/**
+ * \brief      First outer slice of a part of a sparse matrix split into parts of equal numbers of
+ * nonzeros
+ *
+ * \param      offsets  Offsets of the outer slices
+ * \param[in]  n_outer  Number of outer slices
+ * \param[in]  part     The part
+ * \param[in]  n_parts  Number of parts
+ *
+ * \return     The first slice of the part, n_outer for part n_parts
+ */
+inline std::size_t nonzero_split(std::size_t const *offsets, std::size_t n_outer,
+                                 std::size_t part, std::size_t n_parts) {
+  if (part == n_parts) {
+    return n_outer;
+  }
+  std::size_t const target = offsets[n_outer] * part / n_parts;
+  return std::lower_bound(offsets, offsets + n_outer, target) - offsets;
+}
+
+/**
+ * \brief      Runs a function on ranges of outer slices of a sparse matrix, in parallel ranges of
+ * equal numbers of nonzeros when the work is large
+ *
+ * Rows of very different lengths are common in sparse matrices, splitting by rows would leave most
+ * of the work to a few tasks
+ *
+ * \param      offsets  Offsets of the outer slices
+ * \param[in]  n_outer  Number of outer slices
+ * \param[in]  work     Amount of work, see use_parallel()
+ * \param      body     Function called with the bounds [begin, end) of every range
+ *
+ * \tparam     F        Type of the function
+ */
+template <typename F>
+inline void for_nonzero_ranges(std::size_t const *offsets, std::size_t n_outer, std::size_t work,
+                               F &&body) {
+  if (!use_parallel(work) || n_outer < 2) {
+    body(std::size_t(0), n_outer);
+    return;
+  }
+  std::size_t const n_tasks = std::min(n_outer, parallel_task_count());
+  parallel_for(n_tasks, [&](std::size_t task) {
+    std::size_t const begin = nonzero_split(offsets, n_outer, task, n_tasks);
+    std::size_t const end = nonzero_split(offsets, n_outer, task + 1, n_tasks);
+    if (begin < end) {
+      body(begin, end);
+    }
+  });
+}
+
+/**
+ * \brief      Dense matrix or view a sparse kernel reads its dense operand from, evaluating other
+ * expressions into a temporary
+ *
+ * Whether the operand is read in place is known from its type, so the temporary is a member only
+ * of the specialization that needs one and the factor is always bound on construction
+ *
+ * \tparam     T         Element type
+ * \tparam     E         Type of the expression
+ * \tparam     Borrowed  Whether the expression is read in place
+ */
+template <typename T, typename E,
+          bool Borrowed = is_dense<E>::value && std::is_same<element_type_t<E>, T>::value>
+struct dense_operand {
+  dense_factor<T> factor;
+
+  inline explicit dense_operand(E const &expr)
+      : factor{expr.data(), expr.num_rows(), expr.num_cols(), expr.row_stride(),
+               expr.col_stride()} {}
+};
+
+template <typename T, typename E>
+struct dense_operand<T, E, false> {
+  matrix<T> owned;
+  dense_factor<T> factor;
+
+  inline explicit dense_operand(E const &expr)
+      : owned(expr, typename matrix<T>::allocator_type(temporary_resource())),
+        factor{owned.data(), owned.num_rows(), owned.num_cols(), owned.row_stride(),
+               owned.col_stride()} {}
+};
+
+/**
+ * \brief      Scatters the nonzeros of a sparse matrix into zeroed strided storage
+ *
+ * \param      dst   Pointer to the destination
+ * \param[in]  rs    Row stride of the destination
+ * \param[in]  cs    Column stride of the destination
+ * \param      src   The sparse matrix
+ *
+ * \tparam     T     Element type of the destination
+ * \tparam     U     Element type of the sparse matrix
+ */
+template <typename T, typename U, sparse_format Format>
+inline void scatter_sparse(T *dst, std::size_t rs, std::size_t cs,
+                           sparse_matrix<U, Format> const &src) {
+  for (std::size_t i = 0; i < src.num_rows(); ++i) {
+    for (std::size_t j = 0; j < src.num_cols(); ++j) {
+      dst[i * rs + j * cs] = T(0);
+    }
+  }
+  std::size_t const n_outer = Format == sparse_format::csr ? src.num_rows() : src.num_cols();
+  std::size_t const *const offsets = src.outer_offsets();
+  for (std::size_t o = 0; o < n_outer; ++o) {
+    for (std::size_t p = offsets[o]; p < offsets[o + 1]; ++p) {
+      std::size_t const in = src.inner_indices()[p];
+      dst[Format == sparse_format::csr ? o * rs + in * cs : in * rs + o * cs] =
+          static_cast<T>(src.values()[p]);
+    }
+  }
+}
+
+/**
+ * \brief      C = A * B for a CSR matrix A and a dense B, rows of C split by nonzeros of A
+ *
+ * Every row of C is a combination of the rows of B selected by the nonzeros of the same row of A.
+ * A single column B, the sparse matrix-vector product, computes every element of C as a dot
+ * product with two accumulators
+ *
+ * \param      a     The sparse matrix
+ * \param      b     The dense matrix
+ * \param      c     Pointer to C
+ * \param[in]  rsc   Row stride of C
+ * \param[in]  csc   Column stride of C
+ *
+ * \tparam     T     Element type
+ */
+template <typename T>
+inline void csr_times_dense(sparse_matrix<T, sparse_format::csr> const &a,
+                            dense_factor<T> const &b, T *c, std::size_t rsc, std::size_t csc) {
+  std::size_t const *const offsets = a.outer_offsets();
+  auto const *const indices = a.inner_indices();
+  T const *const values = a.values();
+  std::size_t const n = b.cols;
+  for_nonzero_ranges(offsets, a.num_rows(), a.non_zeros() * n, [&](std::size_t begin,
+                                                                   std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i) {
+      std::size_t const first = offsets[i];
+      std::size_t const last = offsets[i + 1];
+      if (n == 1) {
+        T acc0 = T(0);
+        T acc1 = T(0);
+        std::size_t p = first;
+        for (; p + 2 <= last; p += 2) {
+          acc0 += values[p] * b.data[indices[p] * b.rs];
+          acc1 += values[p + 1] * b.data[indices[p + 1] * b.rs];
+        }
+        if (p < last) {
+          acc0 += values[p] * b.data[indices[p] * b.rs];
+        }
+        c[i * rsc] = acc0 + acc1;
+        continue;
+      }
+      T *const c_row = c + i * rsc;
+      if (csc == 1 && b.cs == 1) {
+        std::fill(c_row, c_row + n, T(0));
+        for (std::size_t p = first; p < last; ++p) {
+          T const value = values[p];
+          T const *const b_row = b.data + indices[p] * b.rs;
+          for (std::size_t j = 0; j < n; ++j) {
+            c_row[j] += value * b_row[j];
+          }
+        }
+      } else {
+        for (std::size_t j = 0; j < n; ++j) {
+          c_row[j * csc] = T(0);
+        }
+        for (std::size_t p = first; p < last; ++p) {
+          T const value = values[p];
+          T const *const b_row = b.data + indices[p] * b.rs;
+          for (std::size_t j = 0; j < n; ++j) {
+            c_row[j * csc] += value * b_row[j * b.cs];
+          }
+        }
+      }
+    }
+  });
+}
+
+/**
+ * \brief      C = A * B for a CSC matrix A and a dense B, columns of C split across threads
+ *
+ * Every column of A scatters the matching row of B into the rows of C, so threads own disjoint
+ * columns of C. Sparse matrix-vector products are serial, use CSR for parallel ones
+ *
+ * \param      a     The sparse matrix
+ * \param      b     The dense matrix
+ * \param      c     Pointer to C
+ * \param[in]  rsc   Row stride of C
+ * \param[in]  csc   Column stride of C
+ *
+ * \tparam     T     Element type
+ */
+template <typename T>
+inline void csc_times_dense(sparse_matrix<T, sparse_format::csc> const &a,
+                            dense_factor<T> const &b, T *c, std::size_t rsc, std::size_t csc) {
+  std::size_t const *const offsets = a.outer_offsets();
+  auto const *const indices = a.inner_indices();
+  T const *const values = a.values();
+  auto scatter_cols = [&](std::size_t j0, std::size_t j1) {
+    for (std::size_t i = 0; i < a.num_rows(); ++i) {
+      for (std::size_t j = j0; j < j1; ++j) {
+        c[i * rsc + j * csc] = T(0);
+      }
+    }
+    for (std::size_t k = 0; k < a.num_cols(); ++k) {
+      T const *const b_row = b.data + k * b.rs;
+      for (std::size_t p = offsets[k]; p < offsets[k + 1]; ++p) {
+        T const value = values[p];
+        T *const c_row = c + indices[p] * rsc;
+        for (std::size_t j = j0; j < j1; ++j) {
+          c_row[j * csc] += value * b_row[j * b.cs];
+        }
+      }
+    }
+  };
+  if (use_parallel(a.non_zeros() * b.cols) && b.cols > 1) {
+    parallel_range(b.cols, scatter_cols);
+  } else {
+    scatter_cols(0, b.cols);
+  }
+}
+
+/**
+ * \brief      C = A * B for a dense A and a sparse B, rows of C split across threads
+ *
+ * With CSR, every row of C accumulates the rows of B scaled by the elements of the same row of A.
+ * With CSC, every element of C is a dot product of a row of A with a column of B
+ *
+ * \param      a     The dense matrix
+ * \param      b     The sparse matrix
+ * \param      c     Pointer to C
+ * \param[in]  rsc   Row stride of C
+ * \param[in]  csc   Column stride of C
+ *
+ * \tparam     T       Element type
+ * \tparam     Format  Format of the sparse matrix
+ */
+template <typename T, sparse_format Format>
+inline void dense_times_sparse(dense_factor<T> const &a, sparse_matrix<T, Format> const &b, T *c,
+                               std::size_t rsc, std::size_t csc) {
+  std::size_t const *const offsets = b.outer_offsets();
+  auto const *const indices = b.inner_indices();
+  T const *const values = b.values();
+  std::size_t const n = b.num_cols();
+  auto product_rows = [&](std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i) {
+      T const *const a_row = a.data + i * a.rs;
+      T *const c_row = c + i * rsc;
+      if constexpr (Format == sparse_format::csr) {
+        for (std::size_t j = 0; j < n; ++j) {
+          c_row[j * csc] = T(0);
+        }
+        for (std::size_t k = 0; k < a.cols; ++k) {
+          T const scale = a_row[k * a.cs];
+          for (std::size_t p = offsets[k]; p < offsets[k + 1]; ++p) {
+            c_row[indices[p] * csc] += scale * values[p];
+          }
+        }
+      } else {
+        for (std::size_t j = 0; j < n; ++j) {
+          T acc = T(0);
+          for (std::size_t p = offsets[j]; p < offsets[j + 1]; ++p) {
+            acc += a_row[indices[p] * a.cs] * values[p];
+          }
+          c_row[j * csc] = acc;
+        }
+      }
+    }
+  };
+  if (use_parallel(b.non_zeros() * a.rows)) {
+    parallel_range(a.rows, product_rows);
+  } else {
+    product_rows(0, a.rows);
+  }
+}
+
+/**
+ * \brief      Evaluates a product with a sparse operand into strided storage
+ *
+ * The dense operand is read in place if it is a matrix or a view, evaluated into a temporary
+ * otherwise. A sparse right operand of a sparse product is made dense first
+ *
+ * \param      lhs   Left operand
+ * \param      rhs   Right operand
+ * \param      c     Pointer to the result, not read by the operands
+ * \param[in]  rsc   Row stride of the result
+ * \param[in]  csc   Column stride of the result
+ *
+ * \tparam     T     Element type of the result
+ * \tparam     E1    Type of the left operand
+ * \tparam     E2    Type of the right operand
+ */
+template <typename T, typename E1, typename E2>
+inline void evaluate_sparse_product(E1 const &lhs, E2 const &rhs, T *c, std::size_t rsc,
+                                    std::size_t csc) {
+  if constexpr (is_sparse<E1>::value && std::is_same<element_type_t<E1>, T>::value) {
+    dense_operand<T, E2> const dense(rhs);
+    if constexpr (std::is_same<E1, sparse_matrix<T, sparse_format::csr>>::value) {
+      csr_times_dense(lhs, dense.factor, c, rsc, csc);
+    } else {
+      csc_times_dense(lhs, dense.factor, c, rsc, csc);
+    }
+  } else if constexpr (is_sparse<E2>::value && std::is_same<element_type_t<E2>, T>::value) {
+    dense_operand<T, E1> const dense(lhs);
+    dense_times_sparse(dense.factor, rhs, c, rsc, csc);
+  } else {
+    // sparse operands of another element type
+    dense_operand<T, E1> const dense_lhs(lhs);
+    dense_operand<T, E2> const dense_rhs(rhs);
+    gemm(dense_lhs.factor.rows, dense_rhs.factor.cols, dense_lhs.factor.cols, T(1),
+         dense_lhs.factor.data, dense_lhs.factor.rs, dense_lhs.factor.cs, dense_rhs.factor.data,
+         dense_rhs.factor.rs, dense_rhs.factor.cs, c, rsc, csc, store_epilogue());
+  }
+}
+
+/**
+ * \brief      Assigns an expression to a runtime-sized matrix or a view, see matrix::assign
+ *
+ * Only products reading the destination and expressions reading it at shifted positions are
+ * evaluated into temporaries, everything else is written in place
+ *
+ * \param      dst    The matrix or view
+ * \param      expr   The expression, of the same shape
+ * \param[in]  alias  How the expression reads the destination, see alias_analysis()
+ *
+ * \tparam     D      Type of the matrix or view
+ * \tparam     E      Type of the expression
+ */
+template <typename D, typename E>
+inline void assign_dense(D &dst, E const &expr, aliasing alias) {
+  using T = element_type_t<D>;
+  std::size_t const n_rows = dst.num_rows();
+  std::size_t const n_cols = dst.num_cols();
+  std::size_t const rs = dst.row_stride();
+  std::size_t const cs = dst.col_stride();
+  T *const data = dst.data();
+  if constexpr (is_fusable<E, T>::value) {
+    if (alias == aliasing::none || alias == aliasing::same_index) {
+      assign_fused(data, rs, cs, expr, alias);
+      return;
+    }
+  }
+  if constexpr (is_sparse<E>::value) {
+    scatter_sparse(data, rs, cs, expr);
+    return;
+  } else if constexpr (is_sparse_product<E, T>::value) {
+    if (alias == aliasing::none) {
+      evaluate_sparse_product(expr.get_expr1(), expr.get_expr2(), data, rs, cs);
+      return;
+    }
+  }
+  if (alias == aliasing::shifted) {
+    matrix<T> const temp(expr, typename matrix<T>::allocator_type(temporary_resource()));
+    assign_dense(dst, temp, aliasing::none);
+    return;
+  }
+  prepare(expr);
+  if constexpr (is_linear<E, T>::value) {
+    if (is_contiguous(dst) && linear_ok(expr)) {
+      auto assign_range = [&](std::size_t begin, std::size_t end) {
+        assign_linear(data, expr, begin, end);
+      };
+      if (use_parallel(n_rows * n_cols)) {
+        parallel_range(n_rows * n_cols, assign_range);
+      } else {
+        assign_range(0, n_rows * n_cols);
+      }
+      return;
+    }
+  }
+  auto assign_rows = [&](std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i) {
+      for (std::size_t j = 0; j < n_cols; ++j) {
+        data[i * rs + j * cs] = expr(i, j);
+      }
+    }
+  };
+  if (use_parallel(n_rows * n_cols)) {
+    parallel_range(n_rows, assign_rows);
+  } else {
+    assign_rows(0, n_rows);
+  }
+}
+
+/**
+ * \brief      Assigns an expression to a runtime-sized matrix or a view after analysing how it reads
+ * the destination
+ *
+ * \param      dst   The matrix or view
+ * \param      expr  The expression, of the same shape
+ *
+ * \tparam     D     Type of the matrix or view
+ * \tparam     E     Type of the expression
+ */
+template <typename D, typename E>
+inline void assign_dense(D &dst, E const &expr) {
+  assign_dense(dst, expr, alias_analysis(expr, dst));
+}
+} // namespace detail
+
+// Simply arithmetic operator overloads to easily construct
+// expression classes. e.g. a + b constructs a cwise_matrix_binary_operation with cwise_matrix_add
+// as the operation
+
+template <typename E1, typename E2>
+inline auto operator+(expression<E1> const &expr1, expression<E2> const &expr2) {
+  static_assert(detail::dims_agree(detail::static_rows_v<E1>, detail::static_rows_v<E2>) &&
+                    detail::dims_agree(detail::static_cols_v<E1>, detail::static_cols_v<E2>),
+                "sum of expressions of different shapes");
+  assert(expr1.num_rows() == expr2.num_rows());
+  assert(expr1.num_cols() == expr2.num_cols());
+  return make_cwise_matrix_binary_operation<cwise_matrix_add>(expr1, expr2);
+}
+
+template <typename E, typename T, typename = enable_if_not_expression<T>>
+inline auto operator+(expression<E> const &expr, T const &scalar) {
+  return make_cwise_matrix_binary_operation<cwise_matrix_add>(expr, scalar_expression(scalar));
+}
+
+template <typename E, typename T, typename = enable_if_not_expression<T>>
+inline auto operator+(T const &scalar, expression<E> const &expr) {
+  return expr + scalar;
+}
+
+/**
+ * \brief      Product of two matrix expressions, evaluated lazily, see matrix_product
+ *
+ * The product keeps element-wise and product operands by value, so auto p = (a + b) * c is safe,
+ * but those operands still refer to their own operands. Temporaries nested deeper, like the a + b
+ * of auto p = (a + b + c) * d, do not outlive the statement: evaluate such products into a matrix
+ * before the statement ends
+ *
+ * \param      expr1  Expression 1
+ * \param      expr2  Expression 2
+ *
+ * \tparam     E1     Type of expression 1
+ * \tparam     E2     Type of expression 2
+ *
+ * \return     The product expression
+ */
+template <typename E1, typename E2>
+inline auto operator*(expression<E1> const &expr1, expression<E2> const &expr2) {
+  static_assert(detail::dims_agree(detail::static_cols_v<E1>, detail::static_rows_v<E2>),
+                "product of expressions of mismatching shapes");
+  assert(expr1.num_cols() == expr2.num_rows());
+  return matrix_product(expr1, expr2);
+}
+
+template <typename E, typename T, typename = enable_if_not_expression<T>>
+inline auto operator*(expression<E> const &expr, T const &scalar) {
+  return make_cwise_matrix_binary_operation<cwise_matrix_multiply>(expr, scalar_expression(scalar));
+}
+
+template <typename E, typename T, typename = enable_if_not_expression<T>>
+inline auto operator*(T const &scalar, expression<E> const &expr) {
+  return expr * scalar;
+}
+
+template <typename E1, typename E2>
+inline auto operator-(expression<E1> const &expr1, expression<E2> const &expr2) {
+  static_assert(detail::dims_agree(detail::static_rows_v<E1>, detail::static_rows_v<E2>) &&
+                    detail::dims_agree(detail::static_cols_v<E1>, detail::static_cols_v<E2>),
+                "difference of expressions of different shapes");
+  assert(expr1.num_rows() == expr2.num_rows());
+  assert(expr1.num_cols() == expr2.num_cols());
+  return make_cwise_matrix_binary_operation<cwise_matrix_subtract>(expr1, expr2);
+}
+
+template <typename E, typename T, typename = enable_if_not_expression<T>>
+inline auto operator-(expression<E> const &expr, T const &scalar) {
+  return make_cwise_matrix_binary_operation<cwise_matrix_subtract>(expr, scalar_expression(scalar));
+}
+
+template <typename E, typename T, typename = enable_if_not_expression<T>>
+inline auto operator-(T const &scalar, expression<E> const &expr) {
+  return expr - scalar;
+}
+
+/**
+ * \brief      Reduction summing elements
+ *
+ * A reduction maps every element, then combines the mapped elements with an associative operation
+ * starting from its identity. map and combine are applied to single elements and to SIMD packets
+ * alike
+ */
+struct sum_reduction {
+  template <typename T>
+  inline static T identity() {
+    return T(0);
+  }
+
+  template <typename V>
+  inline static V map(V const &value) {
+    return value;
+  }
+
+  template <typename V>
+  inline static V combine(V const &lhs, V const &rhs) {
+    return lhs + rhs;
+  }
+};
+
+/**
+ * \brief      Reduction summing squared elements
+ */
+struct squared_sum_reduction {
+  template <typename T>
+  inline static T identity() {
+    return T(0);
+  }
+
+  template <typename V>
+  inline static V map(V const &value) {
+    return value * value;
+  }
+
+  template <typename V>
+  inline static V combine(V const &lhs, V const &rhs) {
+    return lhs + rhs;
+  }
+};
+
+/**
+ * \brief      Reduction summing absolute values of elements
+ */
+struct abs_sum_reduction {
+  template <typename T>
+  inline static T identity() {
+    return T(0);
+  }
+
+  template <typename V>
+  inline static V map(V const &value) {
+    return abs(value);
+  }
+
+  template <typename V>
+  inline static V combine(V const &lhs, V const &rhs) {
+    return lhs + rhs;
+  }
+};
+
+/**
+ * \brief      Reduction finding the smallest element, the largest value of the element type for
+ * empty expressions
+ */
+struct min_reduction {
+  template <typename T>
+  inline static T identity() {
+    return std::numeric_limits<T>::has_infinity ? std::numeric_limits<T>::infinity()
+                                                : std::numeric_limits<T>::max();
+  }
+
+  template <typename V>
+  inline static V map(V const &value) {
+    return value;
+  }
+
+  template <typename V>
+  inline static V combine(V const &lhs, V const &rhs) {
+    return min(lhs, rhs);
+  }
+};
+
+/**
+ * \brief      Reduction finding the largest element, the lowest value of the element type for empty
+ * expressions
+ */
+struct max_reduction {
+  template <typename T>
+  inline static T identity() {
+    return std::numeric_limits<T>::has_infinity ? -std::numeric_limits<T>::infinity()
+                                                : std::numeric_limits<T>::lowest();
+  }
+
+  template <typename V>
+  inline static V map(V const &value) {
+    return value;
+  }
+
+  template <typename V>
+  inline static V combine(V const &lhs, V const &rhs) {
+    return max(lhs, rhs);
+  }
+};
+
+/**
+ * \brief      Reduction finding the largest absolute value of the elements
+ */
+struct abs_max_reduction {
+  template <typename T>
+  inline static T identity() {
+    return T(0);
+  }
+
+  template <typename V>
+  inline static V map(V const &value) {
+    return abs(value);
+  }
+
+  template <typename V>
+  inline static V combine(V const &lhs, V const &rhs) {
+    return max(lhs, rhs);
+  }
+};
+
+namespace detail {
+
+/**
+ * Number of elements reduced serially into one leaf of the tree of deterministic reductions
+ */
+inline constexpr std::size_t reduction_block = 4096;
+
+/**
+ * \brief      Combines two reduced values
+ *
+ * \param[in]  lhs        Value 1
+ * \param[in]  rhs        Value 2
+ *
+ * \tparam     Reduction  The reduction
+ * \tparam     T          Element type
+ *
+ * \return     The combined value
+ */
+template <typename Reduction, typename T>
+inline T combine_values(T lhs, T rhs) {
+  return Reduction::combine(scalar_packet<T>{lhs}, scalar_packet<T>{rhs}).value;
+}
+
+/**
+ * \brief      Reduces the flat range [begin, end) of a linear expression
+ *
+ * Four packet accumulators hide the latency of the combining operation. They are combined with
+ * each other, then lane by lane, then with the scalar tail
+ *
+ * \param      evaluator  Linear evaluator of the expression
+ * \param[in]  begin      First flat index to reduce
+ * \param[in]  end        One past the last flat index to reduce
+ *
+ * \tparam     Reduction  The reduction
+ * \tparam     T          Element type
+ * \tparam     Evaluator  Type of the evaluator
+ *
+ * \return     The reduced value
+ */
+template <typename Reduction, typename T, typename Evaluator>
+inline T reduce_linear(Evaluator const &evaluator, std::size_t begin, std::size_t end) {
+  using P = packet_type_t<T>;
+  using S = scalar_packet<T>;
+  constexpr std::size_t width = P::size;
+  P acc0 = P::broadcast(Reduction::template identity<T>());
+  P acc1 = acc0;
+  P acc2 = acc0;
+  P acc3 = acc0;
+  std::size_t idx = begin;
+  for (; idx + 4 * width <= end; idx += 4 * width) {
+    acc0 = Reduction::combine(acc0, Reduction::map(evaluator.template packet<P>(idx)));
+    acc1 = Reduction::combine(acc1, Reduction::map(evaluator.template packet<P>(idx + width)));
+    acc2 = Reduction::combine(acc2, Reduction::map(evaluator.template packet<P>(idx + 2 * width)));
+    acc3 = Reduction::combine(acc3, Reduction::map(evaluator.template packet<P>(idx + 3 * width)));
+  }
+  for (; idx + width <= end; idx += width) {
+    acc0 = Reduction::combine(acc0, Reduction::map(evaluator.template packet<P>(idx)));
+  }
+  acc0 = Reduction::combine(Reduction::combine(acc0, acc1), Reduction::combine(acc2, acc3));
+  T lanes[width];
+  acc0.store(lanes);
+  S result{lanes[0]};
+  for (std::size_t lane = 1; lane < width; ++lane) {
+    result = Reduction::combine(result, S{lanes[lane]});
+  }
+  for (; idx < end; ++idx) {
+    result = Reduction::combine(result, Reduction::map(evaluator.template packet<S>(idx)));
+  }
+  return result.value;
+}
+
+/**
+ * \brief      Reduces the elements of the flat range [begin, end) of any expression, in row-major
+ * order
+ *
+ * \param      expr       The expression
+ * \param[in]  begin      First flat index to reduce
+ * \param[in]  end        One past the last flat index to reduce
+ *
+ * \tparam     Reduction  The reduction
+ * \tparam     T          Element type
+ * \tparam     E          Type of the expression
+ *
+ * \return     The reduced value
+ */
+template <typename Reduction, typename T, typename E>
+inline T reduce_elements(E const &expr, std::size_t begin, std::size_t end) {
+  using S = scalar_packet<T>;
+  std::size_t const n_cols = expr.num_cols();
+  std::size_t i = begin / n_cols;
+  std::size_t j = begin % n_cols;
+  auto next = [&] {
+    S const value = Reduction::map(S{static_cast<T>(expr(i, j))});
+    if (++j == n_cols) {
+      j = 0;
+      ++i;
+    }
+    return value;
+  };
+  S acc0{Reduction::template identity<T>()};
+  S acc1 = acc0;
+  S acc2 = acc0;
+  S acc3 = acc0;
+  std::size_t idx = begin;
+  for (; idx + 4 <= end; idx += 4) {
+    acc0 = Reduction::combine(acc0, next());
+    acc1 = Reduction::combine(acc1, next());
+    acc2 = Reduction::combine(acc2, next());
+    acc3 = Reduction::combine(acc3, next());
+  }
+  for (; idx < end; ++idx) {
+    acc0 = Reduction::combine(acc0, next());
+  }
+  return Reduction::combine(Reduction::combine(acc0, acc1), Reduction::combine(acc2, acc3)).value;
+}
+
+/**
+ * \brief      Reduces the flat range [begin, end) of an expression, through the linear loop when
+ * possible
+ *
+ * \param      expr       The expression, prepared
+ * \param[in]  begin      First flat index to reduce
+ * \param[in]  end        One past the last flat index to reduce
+ *
+ * \tparam     Reduction  The reduction
+ * \tparam     T          Element type
+ * \tparam     E          Type of the expression
+ *
+ * \return     The reduced value
+ */
+template <typename Reduction, typename T, typename E>
+inline T reduce_range(E const &expr, std::size_t begin, std::size_t end) {
+  if constexpr (is_linear<E, T>::value) {
+    if (linear_ok(expr)) {
+      return reduce_linear<Reduction, T>(linear_evaluator<E, T>(expr), begin, end);
+    }
+  }
+  return reduce_elements<Reduction, T>(expr, begin, end);
+}
+
+/**
+ * \brief      Reduces all elements of an expression, in parallel for large expressions, see
+ * set_deterministic_reductions()
+ *
+ * \param      expr       The expression, prepared
+ *
+ * \tparam     Reduction  The reduction
+ * \tparam     T          Element type
+ * \tparam     E          Type of the expression
+ *
+ * \return     The reduced value
+ */
+template <typename Reduction, typename T, typename E>
+inline T reduce_all(E const &expr) {
+  std::size_t const n = expr.num_rows() * expr.num_cols();
+  bool const parallel = use_parallel(n);
+  if (!get_parallel_settings().deterministic_reductions) {
+    if (!parallel) {
+      return reduce_range<Reduction, T>(expr, 0, n);
+    }
+    std::size_t const n_tasks = std::min(n, parallel_task_count());
+    std::pmr::vector<T> partials(n_tasks, temporary_resource());
+    parallel_for(n_tasks, [&](std::size_t task) {
+      partials[task] =
+          reduce_range<Reduction, T>(expr, n * task / n_tasks, n * (task + 1) / n_tasks);
+    });
+    T result = partials[0];
+    for (std::size_t task = 1; task < n_tasks; ++task) {
+      result = combine_values<Reduction>(result, partials[task]);
+    }
+    return result;
+  }
+
+  if (n <= reduction_block) {
+    return reduce_range<Reduction, T>(expr, 0, n);
+  }
+  std::size_t const n_blocks = (n + reduction_block - 1) / reduction_block;
+  std::pmr::vector<T> partials(n_blocks, temporary_resource());
+  auto reduce_blocks = [&](std::size_t begin, std::size_t end) {
+    for (std::size_t block = begin; block < end; ++block) {
+      partials[block] = reduce_range<Reduction, T>(expr, block * reduction_block,
+                                                   std::min(n, (block + 1) * reduction_block));
+    }
+  };
+  if (parallel) {
+    parallel_range(n_blocks, reduce_blocks);
+  } else {
+    reduce_blocks(0, n_blocks);
+  }
+  // pairwise tree whose shape only depends on the number of blocks
+  for (std::size_t stride = 1; stride < n_blocks; stride *= 2) {
+    for (std::size_t block = 0; block + stride < n_blocks; block += 2 * stride) {
+      partials[block] = combine_values<Reduction>(partials[block], partials[block + stride]);
+    }
+  }
+  return partials[0];
+}
+
+/**
+ * \brief      Reduces the columns [begin, end) of an expression into out[begin, end), row by row
+ *
+ * Every element of out is combined with the rows in order, so the result does not depend on how
+ * the columns are split
+ *
+ * \param      expr       The expression, prepared
+ * \param      out        Contiguous result, one element per column
+ * \param[in]  begin      First column to reduce
+ * \param[in]  end        One past the last column to reduce
+ *
+ * \tparam     Reduction  The reduction
+ * \tparam     T          Element type
+ * \tparam     E          Type of the expression
+ */
+template <typename Reduction, typename T, typename E>
+inline void reduce_columns(E const &expr, T *out, std::size_t begin, std::size_t end) {
+  using S = scalar_packet<T>;
+  std::size_t const n_rows = expr.num_rows();
+  std::size_t const n_cols = expr.num_cols();
+  std::fill(out + begin, out + end, Reduction::template identity<T>());
+  if constexpr (is_linear<E, T>::value) {
+    if (linear_ok(expr)) {
+      using P = packet_type_t<T>;
+      linear_evaluator<E, T> const evaluator(expr);
+      for (std::size_t i = 0; i < n_rows; ++i) {
+        std::size_t j = begin;
+        for (; j + P::size <= end; j += P::size) {
+          Reduction::combine(P::load(out + j),
+                             Reduction::map(evaluator.template packet<P>(i * n_cols + j)))
+              .store(out + j);
+        }
+        for (; j < end; ++j) {
+          out[j] = Reduction::combine(S{out[j]},
+                                      Reduction::map(evaluator.template packet<S>(i * n_cols + j)))
+                       .value;
+        }
+      }
+      return;
+    }
+  }
+  for (std::size_t i = 0; i < n_rows; ++i) {
+    for (std::size_t j = begin; j < end; ++j) {
+      out[j] = Reduction::combine(S{out[j]}, Reduction::map(S{static_cast<T>(expr(i, j))})).value;
+    }
+  }
+}
+} // namespace detail
+
+/**
+ * \brief      Row-wise or column-wise reduction of an expression
+ *
+ * Evaluated lazily into a temporary column (rowwise) or row (colwise) on first access, like a
+ * product. Every element is reduced in a fixed order, so the result does not depend on the number
+ * of threads
+ *
+ * \tparam     Reduction  The reduction, e.g. sum_reduction
+ * \tparam     E          Type of the reduced expression
+ * \tparam     Dir        Reduce every row or every column
+ */
+template <typename Reduction, typename E, direction Dir>
+class partial_reduction : public expression<partial_reduction<Reduction, E, Dir>> {
+public:
+  /**
+   * Type of an element in this reduction
+   */
+  using ElementType = element_type_t<E>;
+
+  /**
+   * Return type of eval() method
+   */
+  using EvalReturnType = std::conditional_t<
+      Dir == direction::rowwise, detail::shaped_matrix_t<ElementType, detail::static_rows_v<E>, 1>,
+      detail::shaped_matrix_t<ElementType, 1, detail::static_cols_v<E>>>;
+
+private:
+  /**
+   * The reduced expression
+   */
+  E const &expr;
+
+  /**
+   * Temporary to store the reduction once evaluated
+   */
+  mutable EvalReturnType temp;
+
+  /**
+   * Whether the temporary holds the reduction
+   */
+  mutable bool evaluated = false;
+
+public:
+  /**
+   * \brief      Constructor
+   *
+   * \param      expr  The expression to reduce
+   */
+  inline explicit partial_reduction(expression<E> const &expr)
+      : expr(expr.get_const_derived()), temp(detail::make_temporary<EvalReturnType>()) {}
+
+  /**
+   * \brief      Function call operator to get an element of the reduction
+   *
+   * Evaluates the whole reduction on first use. Not safe to call from several threads before the
+   * reduction has been evaluated
+   *
+   * \param[in]  i     Row number of the element to get
+   * \param[in]  j     Column number of the element to get
+   *
+   * \return     The desired element
+   */
+  inline ElementType operator()(std::size_t i, std::size_t j) const {
+    return eval()(i, j);
+  }
+
+  /**
+   * \brief      Evaluate and return the result of this expression
+   *
+   * Rows are reduced by the linear loop of full reductions when the expression allows it. Columns
+   * are reduced by combining whole rows into the result, packet by packet. Large reductions are
+   * split into ranges of rows or columns evaluated in parallel
+   *
+   * \return     Reference to the reduction
+   */
+  inline EvalReturnType const &eval() const {
+    if (evaluated) {
+      return temp;
+    }
+    if constexpr (std::is_same<EvalReturnType, matrix<ElementType>>::value) {
+      temp = EvalReturnType(num_rows(), num_cols(), temp.get_allocator());
+    }
+    detail::prepare(expr);
+    ElementType *const out = temp.data();
+    std::size_t const n_cols = expr.num_cols();
+    bool const parallel = detail::use_parallel(expr.num_rows() * n_cols);
+    if constexpr (Dir == direction::rowwise) {
+      auto reduce_rows = [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+          out[i] = detail::reduce_range<Reduction, ElementType>(expr, i * n_cols, (i + 1) * n_cols);
+        }
+      };
+      if (parallel) {
+        detail::parallel_range(num_rows(), reduce_rows);
+      } else {
+        reduce_rows(0, num_rows());
+      }
+    } else {
+      auto reduce_cols = [&](std::size_t begin, std::size_t end) {
+        detail::reduce_columns<Reduction, ElementType>(expr, out, begin, end);
+      };
+      if (parallel) {
+        detail::parallel_range(n_cols, reduce_cols);
+      } else {
+        reduce_cols(0, n_cols);
+      }
+    }
+    evaluated = true;
+    return temp;
+  }
+
+  /**
+   * \brief      Get number of rows of this reduction
+   *
+   * \return     Number of rows
+   */
+  inline std::size_t num_rows() const {
+    return Dir == direction::rowwise ? expr.num_rows() : 1;
+  }
+
+  /**
+   * \brief      Get number of columns of this reduction
+   *
+   * \return     Number of columns
+   */
+  inline std::size_t num_cols() const {
+    return Dir == direction::rowwise ? 1 : expr.num_cols();
+  }
+
+  /**
+   * \brief      Get the reduced expression
+   *
+   * \return     The expression
+   */
+  inline E const &get_expr() const {
+    return expr;
+  }
+};
+
+namespace detail {
+
+template <typename Reduction, typename E, direction Dir, typename T>
+struct is_linear<partial_reduction<Reduction, E, Dir>, T>
+    : std::integral_constant<
+          bool, is_matrix<eval_return_type_t<partial_reduction<Reduction, E, Dir>>>::value &&
+                    std::is_same<element_type_t<partial_reduction<Reduction, E, Dir>>, T>::value &&
+                    std::is_arithmetic<T>::value> {};
+
+/**
+ * \brief      Linear evaluator of a partial reduction, reading the temporary it has been evaluated
+ * into
+ *
+ * \tparam     Reduction  The reduction
+ * \tparam     E          Type of the reduced expression
+ * \tparam     Dir        Direction of the reduction
+ * \tparam     T          Element type
+ */
+template <typename Reduction, typename E, direction Dir, typename T>
+struct linear_evaluator<partial_reduction<Reduction, E, Dir>, T> {
+  T const *ptr;
+
+  inline explicit linear_evaluator(partial_reduction<Reduction, E, Dir> const &reduction)
+      : ptr(reduction.eval().data()) {}
+
+  template <typename P>
+  inline P packet(std::size_t idx) const {
+    return P::load(ptr + idx);
+  }
+};
+} // namespace detail
+
+/**
+ * \brief      Reduces all elements of an expression in a single pass, without evaluating it
+ *
+ * Products in the expression are evaluated first. Sums, differences and products of contiguous
+ * matrices, views and scalars are reduced by a SIMD loop with several accumulators, other
+ * expressions element by element. Large expressions are reduced in parallel, see
+ * set_deterministic_reductions()
+ *
+ * \param      expr       The expression
+ *
+ * \tparam     Reduction  The reduction, e.g. sum_reduction
+ * \tparam     E          Type of the expression
+ *
+ * \return     The reduced value, the identity of the reduction for empty expressions
+ */
+template <typename Reduction, typename E>
+inline element_type_t<E> reduce(expression<E> const &expr) {
+  E const &derived = expr.get_const_derived();
+  detail::prepare(derived);
+  return detail::reduce_all<Reduction, element_type_t<E>>(derived);
+}
+
+/**
+ * \brief      Sum of the elements of an expression
+ *
+ * \param      expr  The expression
+ *
+ * \tparam     E     Type of the expression
+ *
+ * \return     The sum
+ */
+template <typename E>
+inline element_type_t<E> sum(expression<E> const &expr) {
+  return reduce<sum_reduction>(expr);
+}
+
+/**
+ * \brief      Smallest element of an expression
+ *
+ * \param      expr  The expression
+ *
+ * \tparam     E     Type of the expression
+ *
+ * \return     The smallest element
+ */
+template <typename E>
+inline element_type_t<E> min_coeff(expression<E> const &expr) {
+  return reduce<min_reduction>(expr);
+}
+
+/**
+ * \brief      Largest element of an expression
+ *
+ * \param      expr  The expression
+ *
+ * \tparam     E     Type of the expression
+ *
+ * \return     The largest element
+ */
+template <typename E>
+inline element_type_t<E> max_coeff(expression<E> const &expr) {
+  return reduce<max_reduction>(expr);
+}
+
+/**
+ * \brief      Sum of the element-wise products of two expressions of the same shape
+ *
+ * \param      expr1  Expression 1
+ * \param      expr2  Expression 2
+ *
+ * \tparam     E1     Type of expression 1
+ * \tparam     E2     Type of expression 2
+ *
+ * \return     The dot product
+ */
+template <typename E1, typename E2>
+inline auto dot(expression<E1> const &expr1, expression<E2> const &expr2) {
+  static_assert(detail::dims_agree(detail::static_rows_v<E1>, detail::static_rows_v<E2>) &&
+                    detail::dims_agree(detail::static_cols_v<E1>, detail::static_cols_v<E2>),
+                "dot product of expressions of different shapes");
+  assert(expr1.num_rows() == expr2.num_rows());
+  assert(expr1.num_cols() == expr2.num_cols());
+  return reduce<sum_reduction>(
+      make_cwise_matrix_binary_operation<cwise_matrix_multiply>(expr1, expr2));
+}
+
+/**
+ * \brief      Sum of the squared elements of an expression
+ *
+ * \param      expr  The expression
+ *
+ * \tparam     E     Type of the expression
+ *
+ * \return     The squared Frobenius norm
+ */
+template <typename E>
+inline element_type_t<E> squared_norm(expression<E> const &expr) {
+  return reduce<squared_sum_reduction>(expr);
+}
+
+/**
+ * \brief      Frobenius norm of an expression, the Euclidean norm for vectors
+ *
+ * \param      expr  The expression
+ *
+ * \tparam     E     Type of the expression
+ *
+ * \return     The norm
+ */
+template <typename E>
+inline auto norm2(expression<E> const &expr) {
+  return std::sqrt(squared_norm(expr));
+}
+
+/**
+ * \brief      Sum of the absolute values of the elements of an expression
+ *
+ * \param      expr  The expression
+ *
+ * \tparam     E     Type of the expression
+ *
+ * \return     The entry-wise 1-norm
+ */
+template <typename E>
+inline element_type_t<E> norm1(expression<E> const &expr) {
+  return reduce<abs_sum_reduction>(expr);
+}
+
+/**
+ * \brief      Largest absolute value of the elements of an expression
+ *
+ * \param      expr  The expression
+ *
+ * \tparam     E     Type of the expression
+ *
+ * \return     The entry-wise infinity norm, 0 for empty expressions
+ */
+template <typename E>
+inline element_type_t<E> norm_inf(expression<E> const &expr) {
+  return reduce<abs_max_reduction>(expr);
+}
+
+/**
+ * \brief      Reduces every row of an expression
+ *
+ * \param      expr       The expression
+ *
+ * \tparam     Reduction  The reduction, e.g. sum_reduction
+ * \tparam     E          Type of the expression
+ *
+ * \return     Expression of a column holding the reduction of every row
+ */
+template <typename Reduction, typename E>
+inline auto rowwise(expression<E> const &expr) {
+  return partial_reduction<Reduction, E, direction::rowwise>(expr);
+}
+
+/**
+ * \brief      Reduces every column of an expression
+ *
+ * \param      expr       The expression
+ *
+ * \tparam     Reduction  The reduction, e.g. sum_reduction
+ * \tparam     E          Type of the expression
+ *
+ * \return     Expression of a row holding the reduction of every column
+ */
+template <typename Reduction, typename E>
+inline auto colwise(expression<E> const &expr) {
+  return partial_reduction<Reduction, E, direction::colwise>(expr);
+}
+
+/**
+ * \brief      Sums of the rows of an expression
+ *
+ * \param      expr  The expression
+ *
+ * \tparam     E     Type of the expression
+ *
+ * \return     Expression of a column holding the sum of every row
+ */
+template <typename E>
+inline auto row_sums(expression<E> const &expr) {
+  return rowwise<sum_reduction>(expr);
+}
+
+/**
+ * \brief      Sums of the columns of an expression
+ *
+ * \param      expr  The expression
+ *
+ * \tparam     E     Type of the expression
+ *
+ * \return     Expression of a row holding the sum of every column
+ */
+template <typename E>
+inline auto col_sums(expression<E> const &expr) {
+  return colwise<sum_reduction>(expr);
+}
+
+/**
+ * \brief      Triangle of a matrix referenced by the triangular solves
+ */
+enum class triangle { lower, upper };
+
+namespace detail {
+/**
+ * \brief      Strided block of a dense matrix the factorizations work on in place
+ *
+ * \tparam     T     Element type, const for read-only blocks
+ */
+template <typename T>
+struct strided_block {
+  T *data;
+  std::size_t rows;
+  std::size_t cols;
+  std::size_t rs;
+  std::size_t cs;
+
+  /**
+   * \brief      Element access
+   *
+   * \param[in]  i     Row
+   * \param[in]  j     Column
+   *
+   * \return     Reference to the element
+   */
+  inline T &operator()(std::size_t i, std::size_t j) const {
+    return data[i * rs + j * cs];
+  }
+
+  /**
+   * \brief      Sub-block starting at row i and column j
+   *
+   * \param[in]  i     First row
+   * \param[in]  j     First column
+   * \param[in]  r     Number of rows
+   * \param[in]  c     Number of columns
+   *
+   * \return     The sub-block
+   */
+  inline strided_block block(std::size_t i, std::size_t j, std::size_t r, std::size_t c) const {
+    return {data + i * rs + j * cs, r, c, rs, cs};
+  }
+
+  /**
+   * \brief      Transposed block, swapping the strides
+   *
+   * \return     The transposed block
+   */
+  inline strided_block transpose() const {
+    return {data, cols, rows, cs, rs};
+  }
+};
+
+/**
+ * \brief      Strided block covering a whole matrix or view
+ *
+ * \param      mat   The matrix or view
+ *
+ * \tparam     M     Type of the matrix or view
+ *
+ * \return     The block, read-only if mat is
+ */
+template <typename M>
+inline auto make_strided_block(M &mat) {
+  using T = std::remove_pointer_t<decltype(mat.data())>;
+  return strided_block<T>{mat.data(), mat.num_rows(), mat.num_cols(), mat.row_stride(),
+                          mat.col_stride()};
+}
+
+/**
+ * \brief      Panel width of the blocked factorizations, also the depth of their product updates
+ */
+inline constexpr std::size_t factorization_block = 64;
+
+/**
+ * \brief      C -= A * B through the packed kernel, split across threads if large enough
+ *
+ * \param      a     Block A
+ * \param      b     Block B
+ * \param      c     Block C, must not overlap A or B
+ *
+ * \tparam     T     Element type
+ * \tparam     U     Element type of A, T or T const
+ * \tparam     V     Element type of B, T or T const
+ */
+template <typename T, typename U, typename V>
+inline void subtract_product(strided_block<U> a, strided_block<V> b, strided_block<T> c) {
+  parallel_gemm<T>(c.rows, c.cols, a.cols, T(-1), a.data, a.rs, a.cs, b.data, b.rs, b.cs, c.data,
+                   c.rs, c.cs);
+}
+
+/**
+ * \brief      Solves T X = B in place for the columns [j0, j1) of B by substitution, row by row
+ *
+ * \param      t              Square triangular block
+ * \param      b              Right-hand sides, overwritten by the solution
+ * \param[in]  j0             First column of B
+ * \param[in]  j1             End of the columns of B
+ * \param[in]  uplo           Triangle of T referenced
+ * \param[in]  unit_diagonal  Whether the diagonal of T is taken as ones
+ *
+ * \tparam     T              Element type of B
+ * \tparam     U              Element type of T
+ */
+template <typename T, typename U>
+inline void substitute(strided_block<U> t, strided_block<T> b, std::size_t j0, std::size_t j1,
+                       triangle uplo, bool unit_diagonal) {
+  std::size_t const n = t.rows;
+  auto eliminate = [&](std::size_t i, std::size_t r) {
+    T const factor = t(r, i);
+    if (factor != T(0)) {
+      for (std::size_t j = j0; j < j1; ++j) {
+        b(r, j) -= factor * b(i, j);
+      }
+    }
+  };
+  auto scale = [&](std::size_t i) {
+    if (!unit_diagonal) {
+      T const inverse = T(1) / t(i, i);
+      for (std::size_t j = j0; j < j1; ++j) {
+        b(i, j) *= inverse;
+      }
+    }
+  };
+  if (uplo == triangle::lower) {
+    for (std::size_t i = 0; i < n; ++i) {
+      scale(i);
+      for (std::size_t r = i + 1; r < n; ++r) {
+        eliminate(i, r);
+      }
+    }
+  } else {
+    for (std::size_t i = n; i-- > 0;) {
+      scale(i);
+      for (std::size_t r = 0; r < i; ++r) {
+        eliminate(i, r);
+      }
+    }
+  }
+}
+
+/**
+ * \brief      Solves T X = B in place with a blocked substitution
+ *
+ * Diagonal blocks are solved by substitution with the columns of B split across threads, the
+ * remaining rows of B are updated through the packed kernel
+ *
+ * \param      t              Square triangular matrix
+ * \param      b              Right-hand sides, overwritten by the solution
+ * \param[in]  uplo           Triangle of T referenced
+ * \param[in]  unit_diagonal  Whether the diagonal of T is taken as ones
+ *
+ * \tparam     T              Element type of B
+ * \tparam     U              Element type of T
+ */
+template <typename T, typename U>
+inline void solve_triangular(strided_block<U> t, strided_block<T> b, triangle uplo,
+                             bool unit_diagonal) {
+  std::size_t const n = t.rows;
+  std::size_t const nb = factorization_block;
+  auto solve_diagonal = [&](std::size_t k, std::size_t kb) {
+    strided_block<U> const diagonal = t.block(k, k, kb, kb);
+    strided_block<T> const rows = b.block(k, 0, kb, b.cols);
+    if (use_parallel(kb * kb * b.cols)) {
+      parallel_range(b.cols, [&](std::size_t j0, std::size_t j1) {
+        substitute(diagonal, rows, j0, j1, uplo, unit_diagonal);
+      });
+    } else {
+      substitute(diagonal, rows, 0, b.cols, uplo, unit_diagonal);
+    }
+  };
+  if (uplo == triangle::lower) {
+    for (std::size_t k = 0; k < n; k += nb) {
+      std::size_t const kb = std::min(nb, n - k);
+      solve_diagonal(k, kb);
+      subtract_product(t.block(k + kb, k, n - k - kb, kb), b.block(k, 0, kb, b.cols),
+                       b.block(k + kb, 0, n - k - kb, b.cols));
+    }
+  } else {
+    for (std::size_t end = n; end > 0;) {
+      std::size_t const k = end > nb ? end - nb : 0;
+      std::size_t const kb = end - k;
+      solve_diagonal(k, kb);
+      subtract_product(t.block(0, k, k, kb), b.block(k, 0, kb, b.cols), b.block(0, 0, k, b.cols));
+      end = k;
+    }
+  }
+}
+
+/**
+ * \brief      Swaps two rows of a block
+ *
+ * \param      a     The block
+ * \param[in]  i     First row
+ * \param[in]  j     Second row
+ *
+ * \tparam     T     Element type
+ */
+template <typename T>
+inline void swap_rows(strided_block<T> a, std::size_t i, std::size_t j) {
+  for (std::size_t c = 0; c < a.cols; ++c) {
+    std::swap(a(i, c), a(j, c));
+  }
+}
+
+/**
+ * \brief      Blocked right-looking LU factorization with partial pivoting, in place
+ *
+ * Panels are factorized column by column with row interchanges applied to the full rows. The row
+ * block of U is solved against the unit lower triangle of the panel and the trailing matrix is
+ * updated through the packed kernel
+ *
+ * \param      a       The matrix, overwritten by L and U
+ * \param      pivots  Row interchanges, row i was swapped with row pivots[i]
+ *
+ * \tparam     T       Element type
+ *
+ * \return     False if a pivot is exactly zero
+ */
+template <typename T>
+inline bool lu_factor(strided_block<T> a, std::size_t *pivots) {
+  std::size_t const m = a.rows;
+  std::size_t const n = a.cols;
+  std::size_t const steps = std::min(m, n);
+  bool regular = true;
+  for (std::size_t k = 0; k < steps; k += factorization_block) {
+    std::size_t const kb = std::min(factorization_block, steps - k);
+    for (std::size_t j = k; j < k + kb; ++j) {
+      std::size_t pivot = j;
+      for (std::size_t r = j + 1; r < m; ++r) {
+        if (std::abs(a(r, j)) > std::abs(a(pivot, j))) {
+          pivot = r;
+        }
+      }
+      pivots[j] = pivot;
+      if (a(pivot, j) == T(0)) {
+        regular = false;
+        continue;
+      }
+      if (pivot != j) {
+        swap_rows(a, j, pivot);
+      }
+      T const inverse = T(1) / a(j, j);
+      for (std::size_t r = j + 1; r < m; ++r) {
+        T const l = a(r, j) *= inverse;
+        for (std::size_t c = j + 1; c < k + kb; ++c) {
+          a(r, c) -= l * a(j, c);
+        }
+      }
+    }
+    if (k + kb < n) {
+      solve_triangular(a.block(k, k, kb, kb), a.block(k, k + kb, kb, n - k - kb), triangle::lower,
+                       true);
+      subtract_product(a.block(k + kb, k, m - k - kb, kb), a.block(k, k + kb, kb, n - k - kb),
+                       a.block(k + kb, k + kb, m - k - kb, n - k - kb));
+    }
+  }
+  return regular;
+}
+
+/**
+ * \brief      Blocked right-looking Cholesky factorization A = L L^T, in place
+ *
+ * Only the lower triangle is read and written. The panel below every diagonal block is solved row
+ * by row in parallel, the trailing lower triangle is updated column block by column block through
+ * the packed kernel
+ *
+ * \param      a     The symmetric matrix, its lower triangle overwritten by L
+ *
+ * \tparam     T     Element type
+ *
+ * \return     False if the matrix is not positive definite
+ */
+template <typename T>
+inline bool cholesky_factor(strided_block<T> a) {
+  std::size_t const n = a.rows;
+  std::size_t const nb = factorization_block;
+  for (std::size_t k = 0; k < n; k += nb) {
+    std::size_t const kb = std::min(nb, n - k);
+    for (std::size_t j = k; j < k + kb; ++j) {
+      T diagonal = a(j, j);
+      for (std::size_t i = k; i < j; ++i) {
+        diagonal -= a(j, i) * a(j, i);
+      }
+      if (!(diagonal > T(0))) {
+        return false;
+      }
+      a(j, j) = std::sqrt(diagonal);
+      for (std::size_t r = j + 1; r < k + kb; ++r) {
+        T value = a(r, j);
+        for (std::size_t i = k; i < j; ++i) {
+          value -= a(r, i) * a(j, i);
+        }
+        a(r, j) = value / a(j, j);
+      }
+    }
+    std::size_t const rest = n - k - kb;
+    if (rest == 0) {
+      break;
+    }
+    strided_block<T> const l11 = a.block(k, k, kb, kb);
+    strided_block<T> const l21 = a.block(k + kb, k, rest, kb);
+    auto solve_rows = [&](std::size_t r0, std::size_t r1) {
+      for (std::size_t r = r0; r < r1; ++r) {
+        for (std::size_t j = 0; j < kb; ++j) {
+          T value = l21(r, j);
+          for (std::size_t i = 0; i < j; ++i) {
+            value -= l21(r, i) * l11(j, i);
+          }
+          l21(r, j) = value / l11(j, j);
+        }
+      }
+    };
+    if (use_parallel(rest * kb * kb)) {
+      parallel_range(rest, solve_rows);
+    } else {
+      solve_rows(0, rest);
+    }
+    std::size_t const col_blocks = (rest + nb - 1) / nb;
+    auto update_block = [&](std::size_t block) {
+      std::size_t const j0 = block * nb;
+      std::size_t const jb = std::min(nb, rest - j0);
+      strided_block<T> const trailing = a.block(k + kb, k + kb, rest, rest);
+      for (std::size_t j = j0; j < j0 + jb; ++j) {
+        for (std::size_t r = j; r < j0 + jb; ++r) {
+          T value = T(0);
+          for (std::size_t i = 0; i < kb; ++i) {
+            value += l21(r, i) * l21(j, i);
+          }
+          trailing(r, j) -= value;
+        }
+      }
+      std::size_t const below = rest - j0 - jb;
+      gemm<T>(below, jb, kb, T(-1), &l21(j0 + jb, 0), l21.rs, l21.cs, &l21(j0, 0), l21.cs, l21.rs,
+              &trailing(j0 + jb, j0), trailing.rs, trailing.cs);
+    };
+    if (use_parallel(rest * rest * kb / 2)) {
+      parallel_for(col_blocks, update_block);
+    } else {
+      for (std::size_t block = 0; block < col_blocks; ++block) {
+        update_block(block);
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * \brief      Explicit Householder vectors and triangular factor T of one panel of a QR
+ * factorization, such that H_k ... H_(k+kb-1) = I - V T V^T
+ *
+ * \param      qr    The factorized matrix
+ * \param      tau   Scalar factors of the reflectors
+ * \param[in]  k     First column of the panel
+ * \param[in]  kb    Width of the panel
+ * \param      v     Storage of V, (rows - k) x kb
+ * \param      t     Storage of T, kb x kb
+ *
+ * \tparam     T     Element type
+ * \tparam     U     Element type of the factorized matrix
+ */
+template <typename T, typename U>
+inline void form_block_reflector(strided_block<U> qr, T const *tau, std::size_t k, std::size_t kb,
+                                 matrix<T> &v, matrix<T> &t) {
+  std::size_t const m = qr.rows - k;
+  assert(v.num_rows() == m && v.num_cols() == kb);
+  assert(t.num_rows() == kb && t.num_cols() == kb);
+  strided_block<T> const vb = make_strided_block(v);
+  strided_block<T> const tb = make_strided_block(t);
+  for (std::size_t r = 0; r < m; ++r) {
+    for (std::size_t c = 0; c < kb; ++c) {
+      vb(r, c) = r > c ? qr(k + r, k + c) : T(r == c);
+    }
+  }
+  // the strict lower triangle of T first holds V^T V
+  std::fill(t.data(), t.data() + kb * kb, T(0));
+  for (std::size_t r = 0; r < m; ++r) {
+    for (std::size_t i = 1; i < kb && i <= r; ++i) {
+      for (std::size_t j = 0; j < i; ++j) {
+        tb(i, j) += vb(r, j) * vb(r, i);
+      }
+    }
+  }
+  for (std::size_t i = 0; i < kb; ++i) {
+    for (std::size_t j = 0; j < i; ++j) {
+      T value = T(0);
+      for (std::size_t l = j; l < i; ++l) {
+        value += tb(j, l) * tb(i, l);
+      }
+      tb(j, i) = -tau[k + i] * value;
+    }
+    tb(i, i) = tau[k + i];
+  }
+  for (std::size_t i = 0; i < kb; ++i) {
+    for (std::size_t j = 0; j < i; ++j) {
+      tb(i, j) = T(0);
+    }
+  }
+}
+
+/**
+ * \brief      C = (I - V T V^T)^T C, the transposed block reflector applied from the left
+ *
+ * \param      v     Householder vectors
+ * \param      t     Upper triangular factor
+ * \param      c     The block, with as many rows as V
+ *
+ * \tparam     T     Element type
+ */
+template <typename T>
+inline void apply_block_reflector(matrix<T> const &v, matrix<T> const &t, strided_block<T> c) {
+  std::size_t const kb = v.num_cols();
+  matrix<T> w(kb, c.cols, temporary_resource());
+  strided_block<T> const wb = make_strided_block(w);
+  parallel_gemm<T>(kb, c.cols, v.num_rows(), T(1), v.data(), 1, kb, c.data, c.rs, c.cs, w.data(),
+                   c.cols, 1, store_epilogue());
+  for (std::size_t i = kb; i-- > 0;) {
+    for (std::size_t j = 0; j < c.cols; ++j) {
+      T value = T(0);
+      for (std::size_t l = 0; l <= i; ++l) {
+        value += t(l, i) * wb(l, j);
+      }
+      wb(i, j) = value;
+    }
+  }
+  parallel_gemm<T>(c.rows, c.cols, kb, T(-1), v.data(), kb, 1, w.data(), c.cols, 1, c.data, c.rs,
+                   c.cs);
+}
+
+/**
+ * \brief      Blocked Householder QR factorization, in place
+ *
+ * Panels are factorized column by column, the trailing matrix is updated with the compact WY form
+ * of the panel's reflectors through the packed kernel
+ *
+ * \param      a     The matrix, overwritten by R and the Householder vectors below the diagonal
+ * \param      tau   Scalar factors of the min(rows, cols) reflectors
+ *
+ * \tparam     T     Element type
+ */
+template <typename T>
+inline void qr_factor(strided_block<T> a, T *tau) {
+  std::size_t const m = a.rows;
+  std::size_t const n = a.cols;
+  std::size_t const steps = std::min(m, n);
+  for (std::size_t k = 0; k < steps; k += factorization_block) {
+    std::size_t const kb = std::min(factorization_block, steps - k);
+    for (std::size_t j = k; j < k + kb; ++j) {
+      T const alpha = a(j, j);
+      T sigma = T(0);
+      for (std::size_t r = j + 1; r < m; ++r) {
+        sigma += a(r, j) * a(r, j);
+      }
+      if (sigma == T(0)) {
+        tau[j] = T(0);
+        continue;
+      }
+      T const norm = std::sqrt(alpha * alpha + sigma);
+      T const beta = alpha > T(0) ? -norm : norm;
+      tau[j] = (beta - alpha) / beta;
+      T const inverse = T(1) / (alpha - beta);
+      for (std::size_t r = j + 1; r < m; ++r) {
+        a(r, j) *= inverse;
+      }
+      a(j, j) = beta;
+      // H_j applied to the rest of the panel, sweeping the rows so row-major storage is read in
+      // order
+      std::size_t const width = k + kb - j - 1;
+      T w[factorization_block];
+      for (std::size_t c = 0; c < width; ++c) {
+        w[c] = a(j, j + 1 + c);
+      }
+      for (std::size_t r = j + 1; r < m; ++r) {
+        T const v = a(r, j);
+        for (std::size_t c = 0; c < width; ++c) {
+          w[c] += v * a(r, j + 1 + c);
+        }
+      }
+      for (std::size_t c = 0; c < width; ++c) {
+        w[c] *= tau[j];
+        a(j, j + 1 + c) -= w[c];
+      }
+      for (std::size_t r = j + 1; r < m; ++r) {
+        T const v = a(r, j);
+        for (std::size_t c = 0; c < width; ++c) {
+          a(r, j + 1 + c) -= w[c] * v;
+        }
+      }
+    }
+    if (k + kb < n) {
+      matrix<T> v(m - k, kb, temporary_resource());
+      matrix<T> t(kb, kb, temporary_resource());
+      form_block_reflector(a, tau, k, kb, v, t);
+      apply_block_reflector(v, t, a.block(k, k + kb, m - k, n - k - kb));
+    }
+  }
+}
+} // namespace detail
+
+/**
+ * \brief      Solves T X = B in place for a triangular matrix T
+ *
+ * Pass a transposed view of T to solve T^T X = B
+ *
+ * \param      t              Square matrix or view, only the triangle uplo is read
+ * \param      b              Matrix or view of the right-hand sides, overwritten by the solution
+ * \param[in]  uplo           Triangle of T
+ * \param[in]  unit_diagonal  Whether the diagonal of T is taken as ones instead of being read
+ *
+ * \tparam     M              Type of T
+ * \tparam     B              Type of B
+ */
+template <typename M, typename B>
+inline void triangular_solve(M const &t, B &&b, triangle uplo, bool unit_diagonal = false) {
+  assert(t.num_rows() == t.num_cols());
+  assert(t.num_rows() == b.num_rows());
+  detail::solve_triangular(detail::make_strided_block(t), detail::make_strided_block(b), uplo,
+                           unit_diagonal);
+}
+
+/**
+ * \brief      LU factorization with partial pivoting P A = L U, in place
+ *
+ * The strict lower triangle of a is overwritten by L, whose diagonal is ones, the upper triangle
+ * by U. The factorization runs to completion on singular matrices
+ *
+ * \param      a       Matrix or view to factorize
+ * \param      pivots  Row interchanges, row i was swapped with row pivots[i], resized to
+ *                     min(rows, cols)
+ *
+ * \tparam     M       Type of the matrix or view
+ *
+ * \return     False if U has a zero on its diagonal
+ */
+template <typename M>
+inline bool lu_factor(M &&a, std::vector<std::size_t> &pivots) {
+  pivots.resize(std::min(a.num_rows(), a.num_cols()));
+  return detail::lu_factor(detail::make_strided_block(a), pivots.data());
+}
+
+/**
+ * \brief      Solves A X = B in place from the LU factorization of A
+ *
+ * \param      lu      Square matrix or view factorized by lu_factor
+ * \param      pivots  Row interchanges returned by lu_factor
+ * \param      b       Matrix or view of the right-hand sides, overwritten by the solution
+ *
+ * \tparam     M       Type of the factorization
+ * \tparam     B       Type of the right-hand sides
+ */
+template <typename M, typename B>
+inline void lu_solve(M const &lu, std::vector<std::size_t> const &pivots, B &&b) {
+  assert(lu.num_rows() == lu.num_cols());
+  assert(pivots.size() == lu.num_rows());
+  auto rhs = detail::make_strided_block(b);
+  for (std::size_t i = 0; i < pivots.size(); ++i) {
+    if (pivots[i] != i) {
+      detail::swap_rows(rhs, i, pivots[i]);
+    }
+  }
+  triangular_solve(lu, b, triangle::lower, true);
+  triangular_solve(lu, b, triangle::upper);
+}
+
+/**
+ * \brief      Cholesky factorization A = L L^T of a symmetric positive definite matrix, in place
+ *
+ * Only the lower triangle of a is read and overwritten by L, the strict upper triangle is left
+ * untouched
+ *
+ * \param      a     Square matrix or view to factorize
+ *
+ * \tparam     M     Type of the matrix or view
+ *
+ * \return     False if the matrix is not positive definite, a is then partially overwritten
+ */
+template <typename M>
+inline bool cholesky_factor(M &&a) {
+  assert(a.num_rows() == a.num_cols());
+  return detail::cholesky_factor(detail::make_strided_block(a));
+}
+
+/**
+ * \brief      Solves A X = B in place from the Cholesky factorization of A
+ *
+ * \param      l     Matrix or view factorized by cholesky_factor
+ * \param      b     Matrix or view of the right-hand sides, overwritten by the solution
+ *
+ * \tparam     M     Type of the factorization
+ * \tparam     B     Type of the right-hand sides
+ */
+template <typename M, typename B>
+inline void cholesky_solve(M const &l, B &&b) {
+  assert(l.num_rows() == l.num_cols());
+  assert(l.num_rows() == b.num_rows());
+  auto const factor = detail::make_strided_block(l);
+  auto const rhs = detail::make_strided_block(b);
+  detail::solve_triangular(factor, rhs, triangle::lower, false);
+  detail::solve_triangular(factor.transpose(), rhs, triangle::upper, false);
+}
+
+/**
+ * \brief      Householder QR factorization A = Q R, in place
+ *
+ * The upper triangle of a is overwritten by R, the Householder vectors, without their leading
+ * ones, are stored below the diagonal
+ *
+ * \param      a     Matrix or view to factorize
+ * \param      tau   Scalar factors of the reflectors, resized to min(rows, cols)
+ *
+ * \tparam     M     Type of the matrix or view
+ */
+template <typename M>
+inline void qr_factor(M &&a, std::vector<element_type_t<std::decay_t<M>>> &tau) {
+  tau.resize(std::min(a.num_rows(), a.num_cols()));
+  detail::qr_factor(detail::make_strided_block(a), tau.data());
+}
+
+/**
+ * \brief      Solves the least squares problem min ||A X - B|| in place from the QR factorization
+ * of A, for A with at least as many rows as columns and of full rank
+ *
+ * \param      qr    Matrix or view factorized by qr_factor
+ * \param      tau   Scalar factors returned by qr_factor
+ * \param      b     Matrix or view of the right-hand sides, overwritten by Q^T B, the solution in
+ *                   its first cols rows
+ *
+ * \tparam     M     Type of the factorization
+ * \tparam     B     Type of the right-hand sides
+ * \tparam     T     Element type
+ */
+template <typename M, typename B, typename T>
+inline void qr_solve(M const &qr, std::vector<T> const &tau, B &&b) {
+  std::size_t const n = qr.num_cols();
+  assert(qr.num_rows() >= n);
+  assert(qr.num_rows() == b.num_rows());
+  assert(tau.size() == n);
+  auto const factor = detail::make_strided_block(qr);
+  auto const rhs = detail::make_strided_block(b);
+  for (std::size_t k = 0; k < n; k += detail::factorization_block) {
+    std::size_t const kb = std::min(detail::factorization_block, n - k);
+    matrix<T> v(rhs.rows - k, kb, detail::temporary_resource());
+    matrix<T> t(kb, kb, detail::temporary_resource());
+    detail::form_block_reflector(factor, tau.data(), k, kb, v, t);
+    detail::apply_block_reflector(v, t, rhs.block(k, 0, rhs.rows - k, rhs.cols));
+  }
+  detail::solve_triangular(factor.block(0, 0, n, n), rhs.block(0, 0, n, rhs.cols), triangle::upper,
+                           false);
+}
+
+/**
+ * \brief      Batch of independent matrices of the same shape, stored interleaved so the lanes of a
+ * SIMD packet span consecutive matrices of the batch
+ *
+ * Matrices are stored in groups of as many matrices as a packet of T holds. Within a group, the
+ * element (i, j) of every matrix is stored contiguously, one matrix per lane, so batched kernels
+ * process a whole group with the same vector instructions a single matrix would take in scalar
+ * code. The lanes of the last group past the end of the batch are padding
+ *
+ * \tparam     T     Element type
+ */
+template <typename T>
+class matrix_batch {
+public:
+  /**
+   * Type of elements of this batch
+   */
+  using ElementType = T;
+
+  /**
+   * Type of allocators of this batch
+   */
+  using allocator_type = std::pmr::polymorphic_allocator<T>;
+
+  /**
+   * Number of matrices in a group, the width of a packet of T
+   */
+  static constexpr std::size_t lanes = detail::packet_type_t<T>::size;
+
+private:
+  /**
+   * The interleaved elements, including the padding of the last group
+   */
+  std::pmr::vector<T> container;
+
+  /**
+   * Number of matrices of this batch
+   */
+  std::size_t n_matrices;
+
+  /**
+   * Number of rows of every matrix
+   */
+  std::size_t n_rows;
+
+  /**
+   * Number of columns of every matrix
+   */
+  std::size_t n_cols;
+
+  /**
+   * \brief      Position of an element in the container
+   *
+   * \param[in]  k     Index of the matrix
+   * \param[in]  i     Row
+   * \param[in]  j     Column
+   *
+   * \return     The position
+   */
+  inline std::size_t index(std::size_t k, std::size_t i, std::size_t j) const {
+    return ((k / lanes * n_rows + i) * n_cols + j) * lanes + k % lanes;
+  }
+
+public:
+  /**
+   * \brief      Constructor
+   *
+   * The elements, padding included, are zero
+   *
+   * \param[in]  n_matrices  The number of matrices
+   * \param[in]  n_rows      The number of rows of every matrix
+   * \param[in]  n_cols      The number of columns of every matrix
+   * \param[in]  alloc       The allocator, the default memory resource if omitted
+   */
+  inline matrix_batch(std::size_t n_matrices, std::size_t n_rows, std::size_t n_cols,
+                      allocator_type alloc = {})
+      : container((n_matrices + lanes - 1) / lanes * lanes * n_rows * n_cols, T(0), alloc),
+        n_matrices(n_matrices), n_rows(n_rows), n_cols(n_cols) {}
+
+  /**
+   * \brief      Constructor gathering a strided batch of row-major matrices
+   *
+   * \param[in]  n_matrices  The number of matrices
+   * \param[in]  n_rows      The number of rows of every matrix
+   * \param[in]  n_cols      The number of columns of every matrix
+   * \param[in]  src         Pointer to the first element of the first matrix
+   * \param[in]  stride      Distance in elements between the first elements of two consecutive
+   *                         matrices, at least n_rows * n_cols
+   * \param[in]  alloc       The allocator, the default memory resource if omitted
+   */
+  inline matrix_batch(std::size_t n_matrices, std::size_t n_rows, std::size_t n_cols,
+                      T const *src, std::size_t stride, allocator_type alloc = {})
+      : matrix_batch(n_matrices, n_rows, n_cols, alloc) {
+    load(src, stride);
+  }
+
+  matrix_batch(matrix_batch const &) = delete;
+  matrix_batch &operator=(matrix_batch const &) = delete;
+
+  /**
+   * \brief      Move constructor
+   *
+   * \param[in]  other  The batch to construct from
+   */
+  inline matrix_batch(matrix_batch &&other) = default;
+
+  /**
+   * \brief      Move assignment
+   *
+   * \param[in]  other  The batch to assign from
+   *
+   * \return     This batch
+   */
+  inline matrix_batch &operator=(matrix_batch &&other) = default;
+
+  /**
+   * \brief      Number of matrices of the batch
+   *
+   * \return     The number of matrices
+   */
+  inline std::size_t size() const {
+    return n_matrices;
+  }
+
+  /**
+   * \brief      Returns the number of rows of every matrix
+   *
+   * \return     Number of rows
+   */
+  inline std::size_t num_rows() const {
+    return n_rows;
+  }
+
+  /**
+   * \brief      Returns the number of columns of every matrix
+   *
+   * \return     Number of columns
+   */
+  inline std::size_t num_cols() const {
+    return n_cols;
+  }
+
+  /**
+   * \brief      Number of groups of lanes matrices, the last one possibly padded
+   *
+   * \return     The number of groups
+   */
+  inline std::size_t num_groups() const {
+    return (n_matrices + lanes - 1) / lanes;
+  }
+
+  /**
+   * \brief      Pointer to the first element of a group
+   *
+   * \param[in]  group  Index of the group
+   *
+   * \return     The pointer
+   */
+  inline T *group_data(std::size_t group) {
+    return container.data() + group * n_rows * n_cols * lanes;
+  }
+
+  /**
+   * \brief      Pointer to the first element of a group
+   *
+   * \param[in]  group  Index of the group
+   *
+   * \return     The pointer
+   */
+  inline T const *group_data(std::size_t group) const {
+    return container.data() + group * n_rows * n_cols * lanes;
+  }
+
+  /**
+   * \brief      Function call operator to get an element of a matrix
+   *
+   * \param[in]  k     Index of the matrix
+   * \param[in]  i     Row number of the element to get
+   * \param[in]  j     Column number of the element to get
+   *
+   * \return     The element
+   */
+  inline T operator()(std::size_t k, std::size_t i, std::size_t j) const {
+    assert(k < n_matrices && i < n_rows && j < n_cols);
+    return container[index(k, i, j)];
+  }
+
+  /**
+   * \brief      Sets the value of an element of a matrix
+   *
+   * \param[in]  k      Index of the matrix
+   * \param[in]  i      Row number of the element to set
+   * \param[in]  j      Column number of this element to set
+   * \param[in]  value  The new value of the element
+   */
+  inline void set_elt(std::size_t k, std::size_t i, std::size_t j, T value) {
+    assert(k < n_matrices && i < n_rows && j < n_cols);
+    container[index(k, i, j)] = value;
+  }
+
+  /**
+   * \brief      Copies a matrix of the batch out
+   *
+   * \param[in]  k     Index of the matrix
+   *
+   * \return     The matrix
+   */
+  inline matrix<T> get(std::size_t k) const {
+    matrix<T> result(n_rows, n_cols);
+    for (std::size_t i = 0; i < n_rows; ++i) {
+      for (std::size_t j = 0; j < n_cols; ++j) {
+        result.data()[i * n_cols + j] = container[index(k, i, j)];
+      }
+    }
+    return result;
+  }
+
+  /**
+   * \brief      Evaluates an expression into a matrix of the batch
+   *
+   * \param[in]  k     Index of the matrix
+   * \param      expr  The expression, of the shape of the matrices of the batch
+   *
+   * \tparam     E     Type of the expression
+   */
+  template <typename E>
+  inline void set(std::size_t k, expression<E> const &expr) {
+    assert(expr.num_rows() == n_rows && expr.num_cols() == n_cols);
+    matrix<T> const value(expr, typename matrix<T>::allocator_type(detail::temporary_resource()));
+    for (std::size_t i = 0; i < n_rows; ++i) {
+      for (std::size_t j = 0; j < n_cols; ++j) {
+        container[index(k, i, j)] = value.data()[i * n_cols + j];
+      }
+    }
+  }
+
+  /**
+   * \brief      Gathers a strided batch of row-major matrices into this batch
+   *
+   * \param[in]  src     Pointer to the first element of the first matrix
+   * \param[in]  stride  Distance in elements between the first elements of two consecutive
+   *                     matrices
+   */
+  inline void load(T const *src, std::size_t stride) {
+    std::size_t const size = n_rows * n_cols;
+    auto const run = [&](std::size_t begin, std::size_t end) {
+      for (std::size_t group = begin; group < end; ++group) {
+        T *const dst = group_data(group);
+        std::size_t const count = std::min(lanes, n_matrices - group * lanes);
+        for (std::size_t lane = 0; lane < count; ++lane) {
+          T const *const matrix_src = src + (group * lanes + lane) * stride;
+          for (std::size_t e = 0; e < size; ++e) {
+            dst[e * lanes + lane] = matrix_src[e];
+          }
+        }
+      }
+    };
+    if (detail::use_parallel(num_groups() * lanes * size)) {
+      detail::parallel_range(num_groups(), run);
+    } else {
+      run(0, num_groups());
+    }
+  }
+
+  /**
+   * \brief      Scatters this batch into a strided batch of row-major matrices
+   *
+   * \param      dst     Pointer to the first element of the first matrix
+   * \param[in]  stride  Distance in elements between the first elements of two consecutive
+   *                     matrices
+   */
+  inline void store(T *dst, std::size_t stride) const {
+    std::size_t const size = n_rows * n_cols;
+    auto const run = [&](std::size_t begin, std::size_t end) {
+      for (std::size_t group = begin; group < end; ++group) {
+        T const *const src = group_data(group);
+        std::size_t const count = std::min(lanes, n_matrices - group * lanes);
+        for (std::size_t lane = 0; lane < count; ++lane) {
+          T *const matrix_dst = dst + (group * lanes + lane) * stride;
+          for (std::size_t e = 0; e < size; ++e) {
+            matrix_dst[e] = src[e * lanes + lane];
+          }
+        }
+      }
+    };
+    if (detail::use_parallel(num_groups() * lanes * size)) {
+      detail::parallel_range(num_groups(), run);
+    } else {
+      run(0, num_groups());
+    }
+  }
+
+  /**
+   * \brief      View of the whole interleaved storage as a single row, padding included
+   *
+   * Batches of the same shape share their layout, so an element-wise expression of the flat views
+   * of several batches, assigned to the flat view of another, applies to every matrix of the batch.
+   * Reductions of a flat view include the padding lanes
+   *
+   * \return     The view
+   */
+  inline matrix_view<T> flat() {
+    return matrix_view<T>(container.data(), 1, container.size(), container.size(), 1);
+  }
+
+  /**
+   * \brief      Read-only view of the whole interleaved storage as a single row, padding included
+   *
+   * \return     The view
+   */
+  inline matrix_view<T const> flat() const {
+    return matrix_view<T const>(container.data(), 1, container.size(), container.size(), 1);
+  }
+
+  /**
+   * \brief      Returns the allocator of the batch
+   *
+   * \return     The allocator
+   */
+  inline allocator_type get_allocator() const {
+    return container.get_allocator();
+  }
+};
+
+namespace detail {
+/**
+ * \brief      Rows [i0, i0 + MR) and columns [j0, j0 + NR) of the products of one group of a batch,
+ * accumulated in registers
+ *
+ * \param      a     Group of the left operands, m x k
+ * \param      b     Group of the right operands, k x n
+ * \param      c     Group of the results, m x n
+ * \param[in]  k     Depth of the products
+ * \param[in]  n     Number of columns of the results
+ * \param[in]  i0    First row
+ * \param[in]  j0    First column
+ *
+ * \tparam     MR    Number of rows of the tile
+ * \tparam     NR    Number of columns of the tile
+ * \tparam     P     Packet type, one lane per matrix of the group
+ * \tparam     T     Element type
+ */
+template <std::size_t MR, std::size_t NR, typename P, typename T>
+inline void batch_product_tile(T const *a, T const *b, T *c, std::size_t k, std::size_t n,
+                               std::size_t i0, std::size_t j0) {
+  constexpr std::size_t w = P::size;
+  P acc[MR][NR];
+  for (std::size_t i = 0; i < MR; ++i) {
+    for (std::size_t j = 0; j < NR; ++j) {
+      acc[i][j] = P::broadcast(T(0));
+    }
+  }
+  for (std::size_t p = 0; p < k; ++p) {
+    P rhs[NR];
+    for (std::size_t j = 0; j < NR; ++j) {
+      rhs[j] = P::load(b + (p * n + j0 + j) * w);
+    }
+    for (std::size_t i = 0; i < MR; ++i) {
+      P const lhs = P::load(a + ((i0 + i) * k + p) * w);
+      for (std::size_t j = 0; j < NR; ++j) {
+        acc[i][j] = acc[i][j] + lhs * rhs[j];
+      }
+    }
+  }
+  for (std::size_t i = 0; i < MR; ++i) {
+    for (std::size_t j = 0; j < NR; ++j) {
+      acc[i][j].store(c + ((i0 + i) * n + j0 + j) * w);
+    }
+  }
+}
+
+/**
+ * \brief      Products of one group of a batch, in register tiles of 4 x 4
+ *
+ * \param      a     Group of the left operands, m x k
+ * \param      b     Group of the right operands, k x n
+ * \param      c     Group of the results, m x n
+ * \param[in]  m     Number of rows of the results
+ * \param[in]  n     Number of columns of the results
+ * \param[in]  k     Depth of the products
+ *
+ * \tparam     P     Packet type, one lane per matrix of the group
+ * \tparam     T     Element type
+ */
+template <typename P, typename T>
+inline void batch_product_group(T const *a, T const *b, T *c, std::size_t m, std::size_t n,
+                                std::size_t k) {
+  std::size_t i = 0;
+  for (; i + 4 <= m; i += 4) {
+    std::size_t j = 0;
+    for (; j + 4 <= n; j += 4) {
+      batch_product_tile<4, 4, P>(a, b, c, k, n, i, j);
+    }
+    for (; j < n; ++j) {
+      batch_product_tile<4, 1, P>(a, b, c, k, n, i, j);
+    }
+  }
+  for (; i < m; ++i) {
+    std::size_t j = 0;
+    for (; j + 4 <= n; j += 4) {
+      batch_product_tile<1, 4, P>(a, b, c, k, n, i, j);
+    }
+    for (; j < n; ++j) {
+      batch_product_tile<1, 1, P>(a, b, c, k, n, i, j);
+    }
+  }
+}
+} // namespace detail
+
+/**
+ * \brief      Computes C_k = A_k * B_k for every matrix of three batches, groups split across
+ * threads
+ *
+ * Allocates nothing. C must be distinct from A and B
+ *
+ * \param      a     The left operands
+ * \param      b     The right operands
+ * \param      c     The results, of as many matrices as A and B, with the rows of A and the
+ *                   columns of B
+ *
+ * \tparam     T     Element type
+ */
+template <typename T>
+inline void batch_product(matrix_batch<T> const &a, matrix_batch<T> const &b, matrix_batch<T> &c) {
+  assert(a.size() == b.size() && a.size() == c.size());
+  assert(a.num_cols() == b.num_rows());
+  assert(c.num_rows() == a.num_rows() && c.num_cols() == b.num_cols());
+  assert(&c != &a && &c != &b);
+  using P = detail::packet_type_t<T>;
+  std::size_t const m = a.num_rows();
+  std::size_t const n = b.num_cols();
+  std::size_t const k = a.num_cols();
+  auto run = [&](std::size_t begin, std::size_t end) {
+    for (std::size_t group = begin; group < end; ++group) {
+      detail::batch_product_group<P>(a.group_data(group), b.group_data(group), c.group_data(group),
+                                     m, n, k);
+    }
+  };
+  if (detail::use_parallel(c.num_groups() * P::size * m * n * k)) {
+    detail::parallel_range(c.num_groups(), run);
+  } else {
+    run(0, c.num_groups());
+  }
+}
+
+/**
+ * \brief      Computes C_k = A_k^T for every matrix of two batches, groups split across threads
+ *
+ * \param      a     The matrices to transpose
+ * \param      c     The results, of as many matrices as A, with the columns of A as rows and its
+ *                   rows as columns. Must be distinct from A
+ *
+ * \tparam     T     Element type
+ */
+template <typename T>
+inline void batch_transpose(matrix_batch<T> const &a, matrix_batch<T> &c) {
+  assert(a.size() == c.size());
+  assert(c.num_rows() == a.num_cols() && c.num_cols() == a.num_rows());
+  assert(&c != &a);
+  using P = detail::packet_type_t<T>;
+  std::size_t const m = a.num_rows();
+  std::size_t const n = a.num_cols();
+  auto run = [&](std::size_t begin, std::size_t end) {
+    for (std::size_t group = begin; group < end; ++group) {
+      T const *const src = a.group_data(group);
+      T *const dst = c.group_data(group);
+      for (std::size_t i = 0; i < m; ++i) {
+        for (std::size_t j = 0; j < n; ++j) {
+          P::load(src + (i * n + j) * P::size).store(dst + (j * m + i) * P::size);
+        }
+      }
+    }
+  };
+  if (detail::use_parallel(c.num_groups() * P::size * m * n)) {
+    detail::parallel_range(c.num_groups(), run);
+  } else {
+    run(0, c.num_groups());
+  }
+}
+
+namespace detail {
+/**
+ * \brief      C = A * B through the packed kernel, accumulating in a type of its own
+ *
+ * Dense operands are read in place in their element type and widened while they are packed, other
+ * expressions are evaluated into temporaries first
+ *
+ * \param[in]  expr1  Expression A
+ * \param[in]  expr2  Expression B
+ * \param      c      Pointer to the result
+ * \param[in]  rsc    Row stride of the result
+ * \param[in]  csc    Column stride of the result
+ *
+ * \tparam     Accumulator  Type the product is accumulated in, an arithmetic type
+ * \tparam     E1           Type of expression A
+ * \tparam     E2           Type of expression B
+ */
+template <typename Accumulator, typename E1, typename E2>
+inline void multiply_into(E1 const &expr1, E2 const &expr2, Accumulator *c, std::size_t rsc,
+                          std::size_t csc) {
+  assert(expr1.num_cols() == expr2.num_rows());
+  dense_operand<element_type_t<E1>, E1> const lhs(expr1);
+  dense_operand<element_type_t<E2>, E2> const rhs(expr2);
+  parallel_gemm(lhs.factor.rows, rhs.factor.cols, lhs.factor.cols, Accumulator(1), lhs.factor.data,
+                lhs.factor.rs, lhs.factor.cs, rhs.factor.data, rhs.factor.rs, rhs.factor.cs, c,
+                rsc, csc, store_epilogue());
+}
+
+template <typename Accumulator, typename E1, typename E2, typename M>
+inline void widened_product(E1 const &expr1, E2 const &expr2, M &dst) {
+  using T = element_type_t<M>;
+  matrix<Accumulator> wide(dst.num_rows(), dst.num_cols(), temporary_resource());
+  multiply_into(expr1, expr2, wide.data(), wide.row_stride(), wide.col_stride());
+  Accumulator const *const src = wide.data();
+  T *const out = dst.data();
+  auto round_rows = [&](std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i) {
+      for (std::size_t j = 0; j < dst.num_cols(); ++j) {
+        out[i * dst.row_stride() + j * dst.col_stride()] =
+            static_cast<T>(src[i * wide.row_stride() + j * wide.col_stride()]);
+      }
+    }
+  };
+  if (use_parallel(dst.num_rows() * dst.num_cols())) {
+    parallel_range(dst.num_rows(), round_rows);
+  } else {
+    round_rows(0, dst.num_rows());
+  }
+}
+} // namespace detail
+
+/**
+ * \brief      Computes the product of two expressions into a matrix of the accumulator type
+ *
+ * Unlike operator*, whose result has the common element type of its operands, the product is kept
+ * in the type it is accumulated in, chosen by a policy independently of the storage types. Narrow
+ * operands are widened while the packed kernel reads them, so products of int8 or bfloat16
+ * matrices move a quarter or half the bytes of float ones
+ *
+ * \code
+ *   matrix<std::int8_t> a = ..., b = ...;
+ *   matrix<std::int32_t> c = product(a, b);
+ *   matrix<bfloat16> x = ..., y = ...;
+ *   matrix<float> z = product(x, y);
+ *   matrix<double> w = product<accumulate_in<double>>(x, y);
+ * \endcode
+ *
+ * \param[in]  lhs   The left operand
+ * \param[in]  rhs   The right operand
+ *
+ * \tparam     Policy  Accumulation policy, with a member template type<T1, T2> giving the
+ *                     accumulator for element types T1 and T2, see default_accumulation and
+ *                     accumulate_in
+ * \tparam     E1      Type of the left operand
+ * \tparam     E2      Type of the right operand
+ *
+ * \return     The product, a runtime-sized matrix of the accumulator type
+ */
+template <typename Policy = default_accumulation, typename E1, typename E2>
+inline auto product(expression<E1> const &lhs, expression<E2> const &rhs) {
+  using Accumulator =
+      typename Policy::template type<element_type_t<E1>, element_type_t<E2>>;
+  static_assert(std::is_arithmetic<Accumulator>::value, "products accumulate in arithmetic types");
+  E1 const &expr1 = lhs.get_const_derived();
+  E2 const &expr2 = rhs.get_const_derived();
+  matrix<Accumulator> result(expr1.num_rows(), expr2.num_cols());
+  detail::multiply_into(expr1, expr2, result.data(), result.row_stride(), result.col_stride());
+  return result;
+}
+
+namespace detail {
+/**
+ * \brief      Trait telling whether an expression is an inner node of an evaluation plan, an
+ * element-wise operation or a product. Every other expression is a leaf of the plan
+ *
+ * \tparam     E     Type of the expression
+ */
+template <typename E>
+struct is_plan_node
+    : std::integral_constant<bool, is_cwise_operation<E>::value || is_matrix_product<E>::value> {};
+
+/**
+ * \brief      Trait returning the types of the two operands of an inner node of a plan, and the
+ * operation of element-wise nodes
+ *
+ * \tparam     E     Type of the node
+ */
+template <typename E>
+struct plan_operands;
+
+template <typename Op, typename E1, typename E2>
+struct plan_operands<cwise_matrix_binary_operation<Op, E1, E2>> {
+  using operation = Op;
+  using lhs = E1;
+  using rhs = E2;
+};
+
+template <typename E1, typename E2>
+struct plan_operands<matrix_product<E1, E2>> {
+  using lhs = E1;
+  using rhs = E2;
+};
+
+/**
+ * \brief      Number of nodes of an expression tree, leaves included
+ *
+ * Nodes are numbered in post-order: the operands of a node, left then right, come before it and the
+ * root is the last node
+ *
+ * \tparam     E     Type of the expression
+ */
+template <typename E, typename = void>
+struct tree_size : std::integral_constant<std::size_t, 1> {};
+
+template <typename E>
+struct tree_size<E, std::enable_if_t<is_plan_node<E>::value>>
+    : std::integral_constant<std::size_t, 1 + tree_size<typename plan_operands<E>::lhs>::value +
+                                              tree_size<typename plan_operands<E>::rhs>::value> {};
+
+template <typename E>
+inline constexpr std::size_t tree_size_v = tree_size<E>::value;
+
+/**
+ * \brief      Trait returning the type of node P of an expression tree
+ *
+ * \tparam     E     Type of the expression
+ * \tparam     P     Post-order number of the node
+ */
+template <typename E, std::size_t P, typename = void>
+struct tree_node {
+  using type = E;
+};
+
+template <typename E, std::size_t P>
+struct tree_node<E, P, std::enable_if_t<is_plan_node<E>::value && P + 1 != tree_size_v<E>>> {
+  using lhs = typename plan_operands<E>::lhs;
+  using rhs = typename plan_operands<E>::rhs;
+  using type = typename std::conditional_t<(P < tree_size_v<lhs>), tree_node<lhs, P>,
+                                           tree_node<rhs, P - tree_size_v<lhs>>>::type;
+};
+
+template <typename E, std::size_t P>
+using tree_node_t = typename tree_node<E, P>::type;
+
+/**
+ * \brief      Gets node P of an expression tree
+ *
+ * \param      expr  The expression
+ *
+ * \tparam     P     Post-order number of the node
+ * \tparam     E     Type of the expression
+ *
+ * \return     Reference to the node
+ */
+template <std::size_t P, typename E>
+inline tree_node_t<E, P> const &get_tree_node(E const &expr) {
+  if constexpr (P + 1 == tree_size_v<E>) {
+    return expr;
+  } else if constexpr (P < tree_size_v<typename plan_operands<E>::lhs>) {
+    return get_tree_node<P>(expr.get_expr1());
+  } else {
+    return get_tree_node<P - tree_size_v<typename plan_operands<E>::lhs>>(expr.get_expr2());
+  }
+}
+
+/**
+ * \brief      Number of nodes of type N in an expression tree
+ *
+ * \tparam     E     Type of the expression
+ * \tparam     N     Type of the nodes to count
+ */
+template <typename E, typename N, typename = void>
+struct tree_count : std::integral_constant<std::size_t, std::is_same<E, N>::value> {};
+
+template <typename E, typename N>
+struct tree_count<E, N, std::enable_if_t<is_plan_node<E>::value>>
+    : std::integral_constant<std::size_t,
+                             std::is_same<E, N>::value +
+                                 tree_count<typename plan_operands<E>::lhs, N>::value +
+                                 tree_count<typename plan_operands<E>::rhs, N>::value> {};
+
+/**
+ * \brief      Whether an evaluation plan evaluates node P of an expression tree into a temporary
+ * its parent reads instead of evaluating it as part of its parent
+ *
+ * These are products whose parent is not a product, so chains of products are still reordered as
+ * a whole, element-wise operands of products, which the product kernel would evaluate into a
+ * temporary anyway, and element-wise operations whose type occurs more than once in the tree, the
+ * candidates for sharing. The root and the leaves never are
+ *
+ * \tparam     Root    Type of the whole expression
+ * \tparam     E       Type of the subtree node P is in
+ * \tparam     Parent  Type of the parent of the subtree, void for the root
+ * \tparam     P       Post-order number of the node in the subtree
+ *
+ * \return     True if the node is materialized
+ */
+template <typename Root, typename E, typename Parent, std::size_t P>
+constexpr bool is_materialized_node() {
+  if constexpr (P + 1 == tree_size_v<E>) {
+    if constexpr (std::is_void<Parent>::value || !is_plan_node<E>::value) {
+      return false;
+    } else if constexpr (is_matrix_product<E>::value) {
+      return !is_matrix_product<Parent>::value;
+    } else {
+      return is_matrix_product<Parent>::value || tree_count<Root, E>::value > 1;
+    }
+  } else if constexpr (P < tree_size_v<typename plan_operands<E>::lhs>) {
+    return is_materialized_node<Root, typename plan_operands<E>::lhs, E, P>();
+  } else {
+    return is_materialized_node<Root, typename plan_operands<E>::rhs, E,
+                                P - tree_size_v<typename plan_operands<E>::lhs>>();
+  }
+}
+
+template <typename E, std::size_t P>
+inline constexpr bool is_materialized_v = is_materialized_node<E, E, void, P>();
+
+/**
+ * \brief      Whether two expression trees of the same type compute the same thing: their matrix
+ * leaves are the same objects, their views look at the same elements and their scalars are equal
+ *
+ * \param      a     Tree a
+ * \param      b     Tree b
+ *
+ * \tparam     E     Type of the trees
+ *
+ * \return     True if they are identical
+ */
+template <typename E>
+inline bool same_subtree(E const &a, E const &b) {
+  if constexpr (is_plan_node<E>::value) {
+    return same_subtree(a.get_expr1(), b.get_expr1()) && same_subtree(a.get_expr2(), b.get_expr2());
+  } else if constexpr (is_matrix_view<E>::value) {
+    return a.data() == b.data() && a.num_rows() == b.num_rows() && a.num_cols() == b.num_cols() &&
+           a.row_stride() == b.row_stride() && a.col_stride() == b.col_stride();
+  } else if constexpr (std::is_same<E, scalar_expression<element_type_t<E>>>::value) {
+    return a.eval() == b.eval();
+  } else {
+    return &a == &b;
+  }
+}
+
+/**
+ * \brief      Rebinds an element-wise operation to other operand types
+ *
+ * \tparam     Op    The operation
+ * \tparam     L     New type of operand 1
+ * \tparam     R     New type of operand 2
+ */
+template <typename Op, typename L, typename R>
+struct rebind_operation;
+
+template <template <typename, typename> typename Op, typename E1, typename E2, typename L,
+          typename R>
+struct rebind_operation<Op<E1, E2>, L, R> {
+  using type = Op<L, R>;
+};
+
+/**
+ * \brief      Calls f with every index of a sequence as a std::integral_constant
+ *
+ * \param      f     The function
+ *
+ * \tparam     N     Length of the sequence
+ * \tparam     F     Type of the function
+ */
+template <std::size_t N, typename F>
+inline void for_each_position(F &&f) {
+  static_for_impl(f, std::make_index_sequence<N>());
+}
+} // namespace detail
+
+/**
+ * \brief      One step of an evaluation plan, the evaluation of a node into a pooled temporary
+ */
+struct plan_step {
+  /**
+   * Post-order number of the node in the expression tree
+   */
+  std::size_t node;
+
+  /**
+   * Temporary of the pool the node is evaluated into
+   */
+  std::size_t slot;
+
+  /**
+   * Size of the result in bytes
+   */
+  std::size_t bytes;
+
+  /**
+   * Number of reads of the result by later steps and the final assignment
+   */
+  std::size_t uses;
+};
+
+/**
+ * \brief      Evaluation plan of an expression, eliminating common subexpressions
+ *
+ * The plan is worked out at compile time from the type of the expression tree, numbering its nodes
+ * in post-order. Nodes worth evaluating on their own are chosen then, see
+ * detail::is_materialized_node(): products outside chains of products, element-wise operands of
+ * products and element-wise operations whose type occurs several times. When the plan is made, the
+ * candidates of the same type are compared and those reading the same operands, like both a - b in
+ * x * (a - b) + y * (a - b), are evaluated once. Each evaluated node is written to a temporary of
+ * a pool its readers see as a plain view, so the assignment of the rest of the expression keeps the
+ * SIMD, fused and packed paths
+ *
+ * Operands of a node are evaluated largest peak first, the order of Sethi and Ullman, and a
+ * temporary returns to the pool once its last reader is done, so the pool is as small as that
+ * order allows. If no subexpression turns out to be repeated, the expression is assigned as usual
+ *
+ * The plan only depends on the shapes of the operands and on which of them are the same, it can be
+ * inspected after the expression is gone and reused for expressions reading the same operands
+ *
+ * \code
+ *   evaluation_plan const plan((a + b) * (a + b));
+ *   plan.num_steps();                  // 1, a + b is evaluated once
+ *   plan.assign(c, (a + b) * (a + b));
+ *   assign_planned(c, x * (a - b) + y * (a - b));
+ * \endcode
+ *
+ * \tparam     E     Type of the expression
+ */
+template <typename E>
+class evaluation_plan {
+private:
+  /**
+   * Number of nodes of the expression tree
+   */
+  static constexpr std::size_t n_nodes = detail::tree_size_v<E>;
+
+  /**
+   * Post-order number of the root
+   */
+  static constexpr std::size_t root = n_nodes - 1;
+
+  /**
+   * First node computing the same thing as each node, itself if none
+   */
+  std::array<std::size_t, n_nodes> canonical;
+
+  /**
+   * Size in bytes of the result of each materialized node
+   */
+  std::array<std::size_t, n_nodes> sizes{};
+
+  /**
+   * Peak bytes of temporaries needed to evaluate each materialized node, 0 until computed
+   */
+  std::array<std::size_t, n_nodes> needs{};
+
+  /**
+   * Steps in evaluation order
+   */
+  std::array<plan_step, n_nodes> schedule;
+
+  /**
+   * Number of steps
+   */
+  std::size_t n_steps = 0;
+
+  /**
+   * Capacity in bytes of each temporary of the pool
+   */
+  std::array<std::size_t, n_nodes> capacities{};
+
+  /**
+   * Number of temporaries of the pool
+   */
+  std::size_t n_slots = 0;
+
+  /**
+   * Largest number of bytes of temporaries in use at once
+   */
+  std::size_t peak = 0;
+
+  /**
+   * Number of occurrences of nodes reusing the result of an identical node
+   */
+  std::size_t n_shared = 0;
+
+  /**
+   * \brief      Calls f with the compile-time post-order number of a node
+   *
+   * \param[in]  node  The node
+   * \param      f     The function, taking a std::integral_constant
+   *
+   * \tparam     F     Type of the function
+   */
+  template <typename F>
+  inline static void visit_node(std::size_t node, F &&f) {
+    detail::for_each_position<n_nodes>([&](auto p) {
+      if (p == node) {
+        f(p);
+      }
+    });
+  }
+
+  /**
+   * \brief      Collects the materialized nodes node P reads, through the nodes evaluated as part
+   * of it
+   *
+   * \param      inputs    The inputs, as their canonical nodes, without duplicates
+   * \param      n_inputs  Number of inputs collected so far
+   * \param      n_reads   Number of materialized nodes read so far, duplicates included
+   *
+   * \tparam     P         Post-order number of the node, an inner node
+   */
+  template <std::size_t P>
+  inline void collect_inputs(std::array<std::size_t, n_nodes> &inputs, std::size_t &n_inputs,
+                             std::size_t &n_reads) const {
+    using operands = detail::plan_operands<detail::tree_node_t<E, P>>;
+    constexpr std::size_t rhs = P - 1;
+    constexpr std::size_t lhs = rhs - detail::tree_size_v<typename operands::rhs>;
+    auto collect = [&](auto p) {
+      if constexpr (detail::is_materialized_v<E, p>) {
+        std::size_t const input = canonical[p];
+        ++n_reads;
+        if (std::find(inputs.begin(), inputs.begin() + n_inputs, input) ==
+            inputs.begin() + n_inputs) {
+          inputs[n_inputs++] = input;
+        }
+      } else if constexpr (detail::is_plan_node<detail::tree_node_t<E, p>>::value) {
+        collect_inputs<p>(inputs, n_inputs, n_reads);
+      }
+    };
+    collect(std::integral_constant<std::size_t, lhs>());
+    collect(std::integral_constant<std::size_t, rhs>());
+  }
+
+  /**
+   * \brief      Materialized nodes read by a node, in the order they are best evaluated
+   *
+   * Sorted by decreasing difference between the peak needed to evaluate them and the size of their
+   * result, which minimizes the peak of the whole evaluation of a tree
+   *
+   * \param[in]  node     The node, an inner node
+   * \param      inputs   The inputs
+   * \param      n_reads  Incremented by the number of materialized nodes read, duplicates
+   *                      included
+   *
+   * \return     Number of inputs
+   */
+  inline std::size_t sorted_inputs(std::size_t node, std::array<std::size_t, n_nodes> &inputs,
+                                   std::size_t &n_reads) {
+    std::size_t n_inputs = 0;
+    visit_node(node, [&](auto p) {
+      if constexpr (detail::is_plan_node<detail::tree_node_t<E, p>>::value) {
+        collect_inputs<p>(inputs, n_inputs, n_reads);
+      }
+    });
+    for (std::size_t i = 0; i < n_inputs; ++i) {
+      need(inputs[i]);
+    }
+    std::sort(inputs.begin(), inputs.begin() + n_inputs, [&](std::size_t x, std::size_t y) {
+      std::size_t const released_x = needs[x] - sizes[x];
+      std::size_t const released_y = needs[y] - sizes[y];
+      return released_x != released_y ? released_x > released_y : x < y;
+    });
+    return n_inputs;
+  }
+
+  /**
+   * \brief      Peak bytes of temporaries needed to evaluate a node, its result included
+   *
+   * \param[in]  node  The node, materialized or the root
+   *
+   * \return     The peak
    */
-  using EvalReturnType = std::common_type_t<eval_return_type_t<E1>, eval_return_type_t<E2>>;
+  inline std::size_t need(std::size_t node) {
+    if (needs[node] != 0) {
+      return needs[node];
+    }
+    std::array<std::size_t, n_nodes> inputs;
+    std::size_t n_reads = 0;
+    std::size_t const n_inputs = sorted_inputs(node, inputs, n_reads);
+    std::size_t held = 0;
+    std::size_t result = 0;
+    for (std::size_t i = 0; i < n_inputs; ++i) {
+      result = std::max(result, held + needs[inputs[i]]);
+      held += sizes[inputs[i]];
+    }
+    needs[node] = std::max({result, held + sizes[node], std::size_t(1)});
+    return needs[node];
+  }
 
   /**
-   * Type of an element in this matrix product
+   * \brief      Appends the steps evaluating a node and the nodes it reads
+   *
+   * \param[in]  node       The node, materialized or the root
+   * \param      scheduled  Whether each node has a step already
+   * \param      n_reads    Incremented by the number of materialized nodes read by the steps,
+   *                        duplicates included
    */
-  using ElementType = std::common_type_t<element_type_t<E1>, element_type_t<E2>>;
+  inline void add_steps(std::size_t node, std::array<bool, n_nodes> &scheduled,
+                        std::size_t &n_reads) {
+    std::array<std::size_t, n_nodes> inputs;
+    std::size_t const n_inputs = sorted_inputs(node, inputs, n_reads);
+    for (std::size_t i = 0; i < n_inputs; ++i) {
+      if (!scheduled[inputs[i]]) {
+        scheduled[inputs[i]] = true;
+        add_steps(inputs[i], scheduled, n_reads);
+      }
+    }
+    if (node != root) {
+      schedule[n_steps++] = {node, 0, sizes[node], 0};
+    }
+  }
 
-private:
   /**
-   * Expression 1
+   * \brief      Assigns pooled temporaries to the steps, reusing those whose readers are done
    */
-  E1 const &expr1;
+  inline void assign_slots() {
+    std::array<std::size_t, n_nodes> uses{};
+    std::array<std::size_t, n_nodes> step_of{};
+    std::array<std::size_t, n_nodes> inputs;
+    std::size_t n_reads = 0;
+    for (std::size_t s = 0; s <= n_steps; ++s) {
+      std::size_t const node = s < n_steps ? schedule[s].node : root;
+      std::size_t const n_inputs = sorted_inputs(node, inputs, n_reads);
+      for (std::size_t i = 0; i < n_inputs; ++i) {
+        ++uses[inputs[i]];
+      }
+      if (s < n_steps) {
+        step_of[node] = s;
+      }
+    }
+    std::array<bool, n_nodes> slot_free{};
+    std::array<std::size_t, n_nodes> remaining = uses;
+    std::size_t live = 0;
+    for (std::size_t s = 0; s < n_steps; ++s) {
+      plan_step &step = schedule[s];
+      step.uses = uses[step.node];
+      std::size_t best = n_slots;
+      for (std::size_t slot = 0; slot < n_slots; ++slot) {
+        if (slot_free[slot] && capacities[slot] >= step.bytes &&
+            (best == n_slots || capacities[slot] < capacities[best])) {
+          best = slot;
+        }
+      }
+      if (best == n_slots) {
+        capacities[n_slots++] = step.bytes;
+      }
+      slot_free[best] = false;
+      step.slot = best;
+      live += step.bytes;
+      peak = std::max(peak, live);
+      std::size_t const n_inputs = sorted_inputs(step.node, inputs, n_reads);
+      for (std::size_t i = 0; i < n_inputs; ++i) {
+        if (--remaining[inputs[i]] == 0) {
+          plan_step const &input = schedule[step_of[inputs[i]]];
+          slot_free[input.slot] = true;
+          live -= input.bytes;
+        }
+      }
+    }
+  }
 
   /**
-   * Expression 2
+   * \brief      Calls f with node P rewritten to read materialized nodes from their temporaries
+   *
+   * \param      node  Node P
+   * \param      data  Temporary holding the result of each materialized node
+   * \param      f     The function
+   *
+   * \tparam     P     Post-order number of the node
+   * \tparam     N     Type of the node
+   * \tparam     F     Type of the function
    */
-  E2 const &expr2;
+  template <std::size_t P, typename N, typename F>
+  inline void with_rewritten(N const &node, std::array<void *, n_nodes> const &data, F &&f) const {
+    if constexpr (detail::is_materialized_v<E, P>) {
+      using T = element_type_t<N>;
+      f(matrix_view<T const>(static_cast<T const *>(data[canonical[P]]), node.num_rows(),
+                             node.num_cols(), node.num_cols(), 1));
+    } else if constexpr (detail::is_plan_node<N>::value) {
+      with_rewritten_operands<P>(node, data, f);
+    } else {
+      f(node);
+    }
+  }
 
   /**
-   * Temporary to store the product of the two expressions
+   * \brief      Calls f with inner node P whose operands are rewritten to read materialized nodes
+   * from their temporaries
+   *
+   * \param      node  Node P
+   * \param      data  Temporary holding the result of each materialized node
+   * \param      f     The function
+   *
+   * \tparam     P     Post-order number of the node
+   * \tparam     N     Type of the node
+   * \tparam     F     Type of the function
    */
-  EvalReturnType temp;
+  template <std::size_t P, typename N, typename F>
+  inline void with_rewritten_operands(N const &node, std::array<void *, n_nodes> const &data,
+                                      F &&f) const {
+    constexpr std::size_t rhs = P - 1;
+    constexpr std::size_t lhs = rhs - detail::tree_size_v<typename detail::plan_operands<N>::rhs>;
+    with_rewritten<lhs>(node.get_expr1(), data, [&](auto const &expr1) {
+      with_rewritten<rhs>(node.get_expr2(), data, [&](auto const &expr2) {
+        using E1 = std::decay_t<decltype(expr1)>;
+        using E2 = std::decay_t<decltype(expr2)>;
+        if constexpr (detail::is_matrix_product<N>::value) {
+          f(matrix_product<E1, E2>(expr1, expr2));
+        } else {
+          using Op = typename detail::rebind_operation<typename detail::plan_operands<N>::operation,
+                                                       E1, E2>::type;
+          f(cwise_matrix_binary_operation<Op, E1, E2>(expr1, expr2));
+        }
+      });
+    });
+  }
 
 public:
   /**
-   * \brief      Constructor
+   * \brief      Constructor, making the plan of an expression
    *
-   * Evaluates the matrix product of the two given expressions and stores it in a temporary
-   *
-   * \param      expr1  Expression 1
-   * \param      expr2  Expression 2
+   * \param      expr  The expression
    */
-  inline matrix_product(expression<E1> const &expr1, expression<E2> const &expr2)
-      : expr1(expr1.get_const_derived()), expr2(expr2.get_const_derived()),
-        temp(expr1.num_rows(), expr2.num_cols()) {
-    for (std::size_t i = 0; i < num_rows(); ++i) {
-      for (std::size_t j = 0; j < num_cols(); ++j) {
-        temp.set_elt(i, j, expr1.get_const_derived()(i, 0) * expr2.get_const_derived()(0, j));
-        for (std::size_t k = 1; k < expr1.num_cols(); ++k) {
-          temp.set_elt(
-              i, j, expr1.get_const_derived()(i, k) * expr2.get_const_derived()(k, j) + temp(i, j));
-        }
+  inline explicit evaluation_plan(expression<E> const &expr) {
+    E const &tree = expr.get_const_derived();
+    for (std::size_t p = 0; p < n_nodes; ++p) {
+      canonical[p] = p;
+    }
+    detail::for_each_position<n_nodes>([&](auto p) {
+      if constexpr (detail::is_materialized_v<E, p>) {
+        using node = detail::tree_node_t<E, p>;
+        node const &current = detail::get_tree_node<p>(tree);
+        sizes[p] = current.num_rows() * current.num_cols() * sizeof(element_type_t<node>);
+        bool found = false;
+        detail::for_each_position<p>([&](auto q) {
+          if constexpr (detail::is_materialized_v<E, q> &&
+                        std::is_same<detail::tree_node_t<E, q>, node>::value) {
+            if (!found && detail::same_subtree(detail::get_tree_node<q>(tree), current)) {
+              canonical[p] = canonical[q];
+              found = true;
+            }
+          }
+        });
       }
+    });
+    if constexpr (detail::is_plan_node<E>::value) {
+      std::array<bool, n_nodes> scheduled{};
+      std::size_t n_reads = 0;
+      add_steps(root, scheduled, n_reads);
+      n_shared = n_reads - n_steps;
+    }
+    if (n_shared == 0) {
+      n_steps = 0;
+    } else {
+      assign_slots();
     }
   }
 
   /**
-   * \brief      Function call operator to get an element of the matrix product
+   * \brief      Number of nodes of the expression tree, leaves included
    *
-   * \param[in]  i     Row number of the element to get
-   * \param[in]  j     Column number of the element to get
+   * \return     Number of nodes
+   */
+  inline static constexpr std::size_t num_nodes() {
+    return n_nodes;
+  }
+
+  /**
+   * \brief      Whether a node of the expression tree is evaluated by a step of its own when it is
+   * not a repeat of an earlier one, see detail::is_materialized_node()
    *
-   * \return     The desired element
+   * \param[in]  node  Post-order number of the node
+   *
+   * \return     True if the node is materialized
    */
-  inline ElementType operator()(std::size_t i, std::size_t j) const {
-    return temp(i, j);
+  inline static bool is_materialized(std::size_t node) {
+    bool result = false;
+    visit_node(node, [&](auto p) { result = detail::is_materialized_v<E, p>; });
+    return result;
   }
 
   /**
-   * \brief      Evaluate and return the result of this expression
+   * \brief      First node of the expression tree computing the same thing as a node
    *
-   * Since the matrix product expression is eagerly evaluated as soon as it is constructed, this
-   * method simply returns a const reference to the temporary in which the result has been stored
+   * \param[in]  node  Post-order number of the node
    *
-   * \return     Reference to the product
+   * \return     Post-order number of the first identical node, node itself if it has none
    */
-  inline EvalReturnType const &eval() const {
-    return temp;
+  inline std::size_t canonical_node(std::size_t node) const {
+    return canonical[node];
   }
 
   /**
-   * \brief      Get number of rows of this matrix product
+   * \brief      Number of steps evaluating nodes into temporaries before the final assignment, 0
+   * if the expression is assigned as usual
    *
-   * \return     Number of rows
+   * \return     Number of steps
    */
-  inline std::size_t num_rows() const {
-    return expr1.num_rows();
+  inline std::size_t num_steps() const {
+    return n_steps;
   }
 
   /**
-   * \brief      Get number of columns of this matrix product
+   * \brief      Gets a step
    *
-   * \return     Number of columns
+   * \param[in]  s     Index of the step, in evaluation order
+   *
+   * \return     The step
    */
-  inline std::size_t num_cols() const {
-    return expr2.num_cols();
+  inline plan_step const &step(std::size_t s) const {
+    assert(s < n_steps);
+    return schedule[s];
   }
-};
 
-/**
- * \brief      Operator representing element-wise matrix addition between two expressions
- *
- * \tparam     E1    Type of expression 1
- * \tparam     E2    Type of expression 2
- */
-template <typename E1, typename E2>
-struct cwise_matrix_add {
   /**
-   * \brief      Applies the addition operator on the given elements of the given expressions
+   * \brief      Number of node occurrences that reuse the result of an identical node
    *
-   * \param      expr1  Expression 1
-   * \param      expr2  Expression 2
-   * \param[in]  i      Row number of the element
-   * \param[in]  j      Column number of the element
+   * \return     Number of eliminated evaluations
+   */
+  inline std::size_t num_shared() const {
+    return n_shared;
+  }
+
+  /**
+   * \brief      Number of temporaries of the pool
    *
-   * \return     Sum of the two elements
+   * \return     Number of temporaries
    */
-  inline static typename std::common_type_t<element_type_t<E1>, element_type_t<E2>>
-  apply(expression<E1> const &expr1, expression<E2> const &expr2, std::size_t i, std::size_t j) {
-    return expr1.get_const_derived()(i, j) + expr2.get_const_derived()(i, j);
+  inline std::size_t num_temporaries() const {
+    return n_slots;
   }
-};
 
-/**
- * \brief      Operator representing element-wise matrix multiplication between two expressions
- *
- * \tparam     E1    Type of expression 1
- * \tparam     E2    Type of expression 2
- */
-template <typename E1, typename E2>
-struct cwise_matrix_multiply {
   /**
-   * \brief      Applies the coefficient-wise multiplication operator on the given elements of the
-   * given expressions
+   * \brief      Total size of the temporaries of the pool
    *
-   * \param      expr1  Expression 1
-   * \param      expr2  Expression 1
-   * \param[in]  i      Row number of the element
-   * \param[in]  j      Column number of the element
+   * \return     Size in bytes
+   */
+  inline std::size_t pool_bytes() const {
+    std::size_t total = 0;
+    for (std::size_t slot = 0; slot < n_slots; ++slot) {
+      total += capacities[slot];
+    }
+    return total;
+  }
+
+  /**
+   * \brief      Largest size of the temporaries holding results still to be read at any time
    *
-   * \return     Product of the two elements
+   * \return     Size in bytes
    */
-  inline static typename std::common_type_t<element_type_t<E1>, element_type_t<E2>>
-  apply(expression<E1> const &expr1, expression<E2> const &expr2, std::size_t i, std::size_t j) {
-    return expr1.get_const_derived()(i, j) * expr2.get_const_derived()(i, j);
+  inline std::size_t peak_bytes() const {
+    return peak;
   }
-};
 
-/**
- * \brief      Operator representing element-wise matrix subtraction between two expressions
- *
- * \tparam     E1    Type of expression 1
- * \tparam     E2    Type of expression 2
- */
-template <typename E1, typename E2>
-struct cwise_matrix_subtract {
   /**
-   * \brief      Applies the subtraction operator on the given elements of the given expressions
+   * \brief      Assigns an expression to a matrix or a view following the plan
    *
-   * \param      expr1  Expression 1
-   * \param      expr2  Expression 2
-   * \param[in]  i      Row number of the element
-   * \param[in]  j      Column number of the element
+   * The pool is allocated from the temporary resource of the calling thread, see scoped_arena.
+   * Every step reads the operands before the destination is written, so the destination may be
+   * an operand
    *
-   * \return     Difference of the two elements
+   * \param      dst   The matrix or view
+   * \param[in]  expr  The expression the plan was made for, or one reading the same operands
+   *
+   * \tparam     D     Type of the matrix or view
    */
-  inline static typename std::common_type_t<element_type_t<E1>, element_type_t<E2>>
-  apply(expression<E1> const &expr1, expression<E2> const &expr2, std::size_t i, std::size_t j) {
-    return expr1.get_const_derived()(i, j) - expr2.get_const_derived()(i, j);
+  template <typename D>
+  inline void assign(D &&dst, expression<E> const &expr) const {
+    E const &tree = expr.get_const_derived();
+    if constexpr (detail::is_plan_node<E>::value) {
+      if (n_steps != 0) {
+        std::pmr::memory_resource *const resource = detail::temporary_resource();
+        std::array<void *, n_nodes> slots{};
+        for (std::size_t slot = 0; slot < n_slots; ++slot) {
+          slots[slot] = resource->allocate(capacities[slot], 64);
+        }
+        std::array<void *, n_nodes> data{};
+        for (std::size_t s = 0; s < n_steps; ++s) {
+          data[schedule[s].node] = slots[schedule[s].slot];
+          visit_node(schedule[s].node, [&](auto p) {
+            if constexpr (detail::is_materialized_v<E, p>) {
+              using node = detail::tree_node_t<E, p>;
+              using T = element_type_t<node>;
+              node const &current = detail::get_tree_node<p>(tree);
+              matrix_view<T> result(static_cast<T *>(data[p]), current.num_rows(),
+                                    current.num_cols(), current.num_cols(), 1);
+              with_rewritten_operands<p>(current, data, [&](auto const &rewritten) {
+                result = rewritten;
+              });
+            }
+          });
+        }
+        with_rewritten_operands<root>(tree, data, [&](auto const &rewritten) { dst = rewritten; });
+        for (std::size_t slot = 0; slot < n_slots; ++slot) {
+          resource->deallocate(slots[slot], capacities[slot], 64);
+        }
+        return;
+      }
+    }
+    dst = tree;
   }
 };
 
-// Simply arithmetic operator overloads to easily construct
-// expression classes. e.g. a + b constructs a cwise_matrix_binary_operation with cwise_matrix_add
-// as the operation
+/**
+ * \brief      Assigns an expression to a matrix or a view, evaluating repeated subexpressions once,
+ * see evaluation_plan
+ *
+ * \param      dst   The matrix or view
+ * \param[in]  expr  The expression
+ *
+ * \tparam     D     Type of the matrix or view
+ * \tparam     E     Type of the expression
+ */
+template <typename D, typename E>
+inline void assign_planned(D &&dst, expression<E> const &expr) {
+  evaluation_plan<E>(expr).assign(dst, expr);
+}
 
-template <typename E1, typename E2>
-inline auto operator+(expression<E1> const &expr1, expression<E2> const &expr2) {
-  assert(expr1.num_rows() == expr2.num_rows());
-  assert(expr1.num_cols() == expr2.num_cols());
-  return make_cwise_matrix_binary_operation<cwise_matrix_add>(expr1, expr2);
+template <typename T>
+template <typename E>
+inline matrix<T> &matrix<T>::operator+=(expression<E> const &expr) {
+  assert(n_rows == expr.num_rows());
+  assert(n_cols == expr.num_cols());
+  assign(make_cwise_matrix_binary_operation<cwise_matrix_add>(*this, expr));
+  return *this;
 }
 
-template <typename E, typename T, typename = enable_if_not_expression<T>>
-inline auto operator+(expression<E> const &expr, T const &scalar) {
-  return make_cwise_matrix_binary_operation<cwise_matrix_add>(expr, scalar_expression(scalar));
+template <typename T>
+template <typename Scalar, typename>
+inline matrix<T> &matrix<T>::operator+=(Scalar const &scalar) {
+  assign(make_cwise_matrix_binary_operation<cwise_matrix_add>(*this, scalar_expression(scalar)));
+  return *this;
 }
 
-template <typename E, typename T, typename = enable_if_not_expression<T>>
-inline auto operator+(T const &scalar, expression<E> const &expr) {
-  return expr + scalar;
+template <typename T>
+template <typename E>
+inline matrix<T> &matrix<T>::operator*=(expression<E> const &expr) {
+  assert(n_rows == expr.num_cols());
+  assign(matrix_product(*this, expr));
+  return *this;
 }
 
-template <typename E1, typename E2>
-inline auto operator*(expression<E1> const &expr1, expression<E2> const &expr2) {
-  assert(expr1.num_cols() == expr2.num_rows());
-  return matrix_product(expr1, expr2);
+template <typename T>
+template <typename Scalar, typename>
+inline matrix<T> &matrix<T>::operator*=(Scalar const &scalar) {
+  assign(
+      make_cwise_matrix_binary_operation<cwise_matrix_multiply>(*this, scalar_expression(scalar)));
+  return *this;
 }
 
-template <typename E, typename T, typename = enable_if_not_expression<T>>
-inline auto operator*(expression<E> const &expr, T const &scalar) {
-  return make_cwise_matrix_binary_operation<cwise_matrix_multiply>(expr, scalar_expression(scalar));
+template <typename T>
+template <typename E>
+inline matrix<T> &matrix<T>::operator-=(expression<E> const &expr) {
+  assert(n_rows == expr.num_rows());
+  assert(n_cols == expr.num_cols());
+  assign(make_cwise_matrix_binary_operation<cwise_matrix_subtract>(*this, expr));
+  return *this;
 }
 
-template <typename E, typename T, typename = enable_if_not_expression<T>>
-inline auto operator*(T const &scalar, expression<E> const &expr) {
-  return expr * scalar;
+template <typename T>
+template <typename Scalar, typename>
+inline matrix<T> &matrix<T>::operator-=(Scalar const &scalar) {
+  assign(
+      make_cwise_matrix_binary_operation<cwise_matrix_subtract>(*this, scalar_expression(scalar)));
+  return *this;
 }
 
-template <typename E1, typename E2>
-inline auto operator-(expression<E1> const &expr1, expression<E2> const &expr2) {
-  assert(expr1.num_rows() == expr2.num_rows());
-  assert(expr1.num_cols() == expr2.num_cols());
-  return make_cwise_matrix_binary_operation<cwise_matrix_subtract>(expr1, expr2);
+template <typename T, std::size_t R, std::size_t C>
+template <typename E>
+inline matrix<T, R, C> &matrix<T, R, C>::operator+=(expression<E> const &expr) {
+  assign(make_cwise_matrix_binary_operation<cwise_matrix_add>(*this, expr));
+  return *this;
 }
 
-template <typename E, typename T, typename = enable_if_not_expression<T>>
-inline auto operator-(expression<E> const &expr, T const &scalar) {
-  return make_cwise_matrix_binary_operation<cwise_matrix_subtract>(expr, scalar_expression(scalar));
+template <typename T, std::size_t R, std::size_t C>
+template <typename Scalar, typename>
+inline matrix<T, R, C> &matrix<T, R, C>::operator+=(Scalar const &scalar) {
+  assign(make_cwise_matrix_binary_operation<cwise_matrix_add>(*this, scalar_expression(scalar)));
+  return *this;
 }
 
-template <typename E, typename T, typename = enable_if_not_expression<T>>
-inline auto operator-(T const &scalar, expression<E> const &expr) {
-  return expr - scalar;
+template <typename T, std::size_t R, std::size_t C>
+template <typename E>
+inline matrix<T, R, C> &matrix<T, R, C>::operator*=(expression<E> const &expr) {
+  static_assert(detail::dims_agree(C, detail::static_rows_v<E>) &&
+                    detail::dims_agree(C, detail::static_cols_v<E>),
+                "in-place product with a non-square or mismatching matrix");
+  assert(expr.num_rows() == C && expr.num_cols() == C);
+  assign(matrix_product(*this, expr));
+  return *this;
 }
 
-template <typename T>
+template <typename T, std::size_t R, std::size_t C>
+template <typename Scalar, typename>
+inline matrix<T, R, C> &matrix<T, R, C>::operator*=(Scalar const &scalar) {
+  assign(
+      make_cwise_matrix_binary_operation<cwise_matrix_multiply>(*this, scalar_expression(scalar)));
+  return *this;
+}
+
+template <typename T, std::size_t R, std::size_t C>
 template <typename E>
-inline matrix<T> &matrix<T>::operator+=(expression<E> const &expr) {
-  assert(n_rows == expr.num_rows());
-  assert(n_cols == expr.num_cols());
-  assign(make_cwise_matrix_binary_operation<cwise_matrix_add>(*this, expr));
+inline matrix<T, R, C> &matrix<T, R, C>::operator-=(expression<E> const &expr) {
+  assign(make_cwise_matrix_binary_operation<cwise_matrix_subtract>(*this, expr));
   return *this;
 }
 
-template <typename T>
+template <typename T, std::size_t R, std::size_t C>
 template <typename Scalar, typename>
-inline matrix<T> &matrix<T>::operator+=(Scalar const &scalar) {
-  assign(make_cwise_matrix_binary_operation<cwise_matrix_add>(*this, scalar_expression(scalar)));
+inline matrix<T, R, C> &matrix<T, R, C>::operator-=(Scalar const &scalar) {
+  assign(
+      make_cwise_matrix_binary_operation<cwise_matrix_subtract>(*this, scalar_expression(scalar)));
   return *this;
 }
 
 template <typename T>
 template <typename E>
-inline matrix<T> &matrix<T>::operator*=(expression<E> const &expr) {
-  assert(n_rows == expr.num_cols());
-  assign(matrix_product(*this, expr));
+inline matrix_view<T> &matrix_view<T>::operator+=(expression<E> const &expr) {
+  assign(make_cwise_matrix_binary_operation<cwise_matrix_add>(*this, expr));
   return *this;
 }
 
 template <typename T>
 template <typename Scalar, typename>
-inline matrix<T> &matrix<T>::operator*=(Scalar const &scalar) {
+inline matrix_view<T> &matrix_view<T>::operator+=(Scalar const &scalar) {
+  assign(make_cwise_matrix_binary_operation<cwise_matrix_add>(*this, scalar_expression(scalar)));
+  return *this;
+}
+
+template <typename T>
+template <typename Scalar, typename>
+inline matrix_view<T> &matrix_view<T>::operator*=(Scalar const &scalar) {
   assign(
       make_cwise_matrix_binary_operation<cwise_matrix_multiply>(*this, scalar_expression(scalar)));
   return *this;
@@ -892,16 +8229,14 @@ inline matrix<T> &matrix<T>::operator*=(Scalar const &scalar) {
 
 template <typename T>
 template <typename E>
-inline matrix<T> &matrix<T>::operator-=(expression<E> const &expr) {
-  assert(n_rows == expr.num_rows());
-  assert(n_cols == expr.num_cols());
+inline matrix_view<T> &matrix_view<T>::operator-=(expression<E> const &expr) {
   assign(make_cwise_matrix_binary_operation<cwise_matrix_subtract>(*this, expr));
   return *this;
 }
 
 template <typename T>
 template <typename Scalar, typename>
-inline matrix<T> &matrix<T>::operator-=(Scalar const &scalar) {
+inline matrix_view<T> &matrix_view<T>::operator-=(Scalar const &scalar) {
   assign(
       make_cwise_matrix_binary_operation<cwise_matrix_subtract>(*this, scalar_expression(scalar)));
   return *this;
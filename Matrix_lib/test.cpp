@@ -1,9 +1,18 @@
+#include "mapped_matrix.hpp"
 #include "shizmatrix.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
 
 using namespace shizmatrix;
 
-int main () {
+// Walk through of the basic interface
+void demo() {
 	// Make a 3x3 matrix filled with 0.5
 	matrix<float> a(3, 3, 0.5); // (row, col, value)
 	matrix<float> b(3, 3, 0.4);
@@ -36,5 +45,512 @@ int main () {
 
 	// Print
 	std::cout << result << '\n';
-	return 0;
+}
+
+// Self-checks of every evaluation path against naive loops over operator()(i, j). They run after the
+// demo, print every failed check and make the program exit with 1, so `ctest` catches them
+
+int failures = 0;
+
+void check(bool condition, char const *what) {
+	if (!condition) {
+		++failures;
+		std::printf("FAIL %s\n", what);
+	}
+}
+
+// Matrix with elements uniform in [-1, 1]
+template <typename T>
+matrix<T> random(std::size_t rows, std::size_t cols, unsigned seed) {
+	std::mt19937 gen(seed);
+	std::uniform_real_distribution<double> dist(-1.0, 1.0);
+	matrix<T> m(rows, cols);
+	for (std::size_t i = 0; i < rows; ++i) {
+		for (std::size_t j = 0; j < cols; ++j) {
+			m.set_elt(i, j, static_cast<T>(dist(gen)));
+		}
+	}
+	return m;
+}
+
+// Copy of an expression through operator()(i, j) only
+template <typename T, typename E>
+matrix<T> reference(expression<E> const &expr) {
+	E const &e = expr.get_const_derived();
+	matrix<T> m(e.num_rows(), e.num_cols());
+	for (std::size_t i = 0; i < e.num_rows(); ++i) {
+		for (std::size_t j = 0; j < e.num_cols(); ++j) {
+			m.set_elt(i, j, static_cast<T>(e(i, j)));
+		}
+	}
+	return m;
+}
+
+template <typename T, typename E1, typename E2>
+matrix<T> naive_product(expression<E1> const &lhs, expression<E2> const &rhs) {
+	E1 const &a = lhs.get_const_derived();
+	E2 const &b = rhs.get_const_derived();
+	matrix<T> c(a.num_rows(), b.num_cols());
+	for (std::size_t i = 0; i < a.num_rows(); ++i) {
+		for (std::size_t j = 0; j < b.num_cols(); ++j) {
+			double sum = 0;
+			for (std::size_t k = 0; k < a.num_cols(); ++k) {
+				sum += static_cast<double>(a(i, k)) * static_cast<double>(b(k, j));
+			}
+			c.set_elt(i, j, static_cast<T>(sum));
+		}
+	}
+	return c;
+}
+
+// Largest element-wise difference, infinite when the shapes differ
+template <typename E1, typename E2>
+double max_diff(expression<E1> const &lhs, expression<E2> const &rhs) {
+	E1 const &a = lhs.get_const_derived();
+	E2 const &b = rhs.get_const_derived();
+	if (a.num_rows() != b.num_rows() || a.num_cols() != b.num_cols()) {
+		return INFINITY;
+	}
+	double diff = 0;
+	for (std::size_t i = 0; i < a.num_rows(); ++i) {
+		for (std::size_t j = 0; j < a.num_cols(); ++j) {
+			diff = std::max(diff, std::abs(static_cast<double>(a(i, j)) - static_cast<double>(b(i, j))));
+		}
+	}
+	return diff;
+}
+
+// Rounding tolerance of sums of n products of elements in [-1, 1]
+template <typename T>
+double tolerance(std::size_t n) {
+	return 4.0 * (n + 1) * std::numeric_limits<T>::epsilon();
+}
+
+// Whether a reduced value agrees with its reference up to the rounding of n terms
+template <typename T>
+bool close(double value, double expected, std::size_t n) {
+	return std::abs(value - expected) <= tolerance<T>(n) * std::max(1.0, std::abs(expected));
+}
+
+// Odd shapes straddling the blocking and SIMD widths of the kernels
+std::size_t const odd_sizes[] = {1, 3, 7, 17, 33, 67, 129, 257};
+
+template <typename T>
+void check_products() {
+	unsigned seed = 1;
+	for (std::size_t m : odd_sizes) {
+		std::size_t const k = odd_sizes[(m + 3) % 8];
+		std::size_t const n = odd_sizes[(m + 5) % 8];
+		matrix<T> const a = random<T>(m, k, seed++);
+		matrix<T> const b = random<T>(k, n, seed++);
+		matrix<T> const c = random<T>(m, n, seed++);
+		matrix<T> const v = random<T>(n, 3, seed++);
+		matrix<T> const expected = naive_product<T>(a, b);
+		matrix<T> result = a * b;
+		check(max_diff(result, expected) <= tolerance<T>(k), "packed product");
+		result = a * b + c;
+		check(max_diff(result, expected + c) <= tolerance<T>(k), "product with fused epilogue");
+		result = c - a * b * T(2);
+		check(max_diff(result, c - expected * T(2)) <= 2 * tolerance<T>(k), "scaled product epilogue");
+		matrix<T> chain = a * b * v;
+		check(max_diff(chain, naive_product<T>(expected, v)) <= tolerance<T>(k * n), "reordered chain");
+		// lazy products of temporaries, evaluated after the statement building them
+		auto lazy = (a + T(1)) * b;
+		auto nested = a * b * v;
+		matrix<T> const lazy_result(lazy);
+		matrix<T> const nested_result(nested);
+		check(max_diff(lazy_result, naive_product<T>(reference<T>(a + T(1)), b)) <= 2 * tolerance<T>(k),
+		      "lazy product of a temporary");
+		check(max_diff(nested_result, chain) <= tolerance<T>(k * n), "lazy product chain");
+	}
+}
+
+template <typename T>
+void check_cwise() {
+	for (std::size_t n : odd_sizes) {
+		matrix<T> const a = random<T>(n, n + 2, 1);
+		matrix<T> const b = random<T>(n, n + 2, 2);
+		matrix<T> const c = random<T>(n, n + 2, 3);
+		matrix<T> result(n, n + 2);
+		result = a * T(2) + b - c;
+		check(max_diff(result, reference<T>(a * T(2) + b - c)) == 0, "linear element-wise loop");
+		result = T(3) - a;
+		check(max_diff(result, reference<T>(T(3) - a)) == 0, "scalar on the left");
+	}
+}
+
+template <typename T>
+void check_parallel() {
+	std::size_t const threads = get_num_threads();
+	set_num_threads(4);
+	set_parallel_threshold(1);
+	matrix<T> const a = random<T>(131, 97, 1);
+	matrix<T> const b = random<T>(97, 61, 2);
+	matrix<T> const c = random<T>(131, 61, 3);
+	matrix<T> const d = random<T>(131, 61, 4);
+	matrix<T> result = c + a * b;
+	check(max_diff(result, c + naive_product<T>(a, b)) <= tolerance<T>(97), "parallel product");
+	result = c * T(2) - d;
+	check(max_diff(result, reference<T>(c * T(2) - d)) == 0, "parallel element-wise loop");
+	check(close<T>(sum(c), sum(reference<T>(c)), c.num_rows() * c.num_cols()), "parallel sum");
+	set_parallel_threshold(std::size_t(1) << 18);
+	set_num_threads(threads);
+}
+
+template <typename T>
+void check_fixed() {
+	matrix<T, 3, 5> a;
+	matrix<T, 5, 2> b;
+	matrix<T, 3, 2> c(T(1));
+	for (std::size_t i = 0; i < 5; ++i) {
+		for (std::size_t j = 0; j < 3; ++j) {
+			a.set_elt(j, i, static_cast<T>(i + 2 * j));
+		}
+		for (std::size_t j = 0; j < 2; ++j) {
+			b.set_elt(i, j, static_cast<T>(i) - static_cast<T>(j));
+		}
+	}
+	matrix<T, 3, 2> const result = a * b + c;
+	check(max_diff(result, naive_product<T>(a, b) + c) == 0, "fixed-size product");
+	matrix<T> const dynamic = reference<T>(a) * reference<T>(b);
+	check(max_diff(result - c, dynamic) == 0, "fixed-size against runtime-sized product");
+}
+
+template <typename T>
+void check_arena() {
+	matrix<T> const a = random<T>(45, 45, 1);
+	matrix<T> const b = random<T>(45, 45, 2);
+	matrix<T> const c = random<T>(45, 45, 3);
+	matrix<T> heap = (a + b) * (c - a) + a * b * c;
+	arena temporaries;
+	matrix<T> from_arena(45, 45);
+	for (int r = 0; r < 3; ++r) {
+		scoped_arena scope(temporaries);
+		from_arena = (a + b) * (c - a) + a * b * c;
+	}
+	check(max_diff(heap, from_arena) == 0, "temporaries from an arena");
+	check(temporaries.capacity() > 0, "arena used");
+}
+
+template <typename T>
+void check_views() {
+	matrix<T> a = random<T>(23, 19, 1);
+	matrix<T> const b = random<T>(19, 23, 2);
+	matrix<T> const a0 = reference<T>(a);
+
+	matrix<T> const block = a.block(3, 4, 9, 7);
+	bool same = block.num_rows() == 9 && block.num_cols() == 7;
+	for (std::size_t i = 0; same && i < 9; ++i) {
+		for (std::size_t j = 0; j < 7; ++j) {
+			same = same && block(i, j) == a0(i + 3, j + 4);
+		}
+	}
+	check(same, "block view");
+	matrix<T> const at = a.transpose();
+	same = at.num_rows() == 19 && at.num_cols() == 23;
+	for (std::size_t i = 0; same && i < 19; ++i) {
+		for (std::size_t j = 0; j < 23; ++j) {
+			same = same && at(i, j) == a0(j, i);
+		}
+	}
+	check(same, "transpose view");
+	check(max_diff(a.row(5), reference<T>(a0.block(5, 0, 1, 19))) == 0, "row view");
+	check(max_diff(a.col(7), reference<T>(a0.block(0, 7, 23, 1))) == 0, "column view");
+
+	matrix<T> const product = a.transpose() * b.transpose();
+	check(max_diff(product, naive_product<T>(at, reference<T>(b.transpose()))) <= tolerance<T>(23),
+	      "product of transposed views");
+	a.block(2, 3, 5, 6) = b.block(1, 1, 5, 6) * T(2) + T(1);
+	a.col(0) = b.row(0).transpose();
+	same = true;
+	for (std::size_t i = 0; i < 23; ++i) {
+		for (std::size_t j = 0; j < 19; ++j) {
+			T expected = a0(i, j);
+			if (j == 0) {
+				expected = b(0, i);
+			} else if (i >= 2 && i < 7 && j >= 3 && j < 9) {
+				expected = b(i - 1, j - 2) * T(2) + T(1);
+			}
+			same = same && a(i, j) == expected;
+		}
+	}
+	check(same, "assignment to views");
+}
+
+// Assignments reading their destination, at the same element, through a product or shifted
+template <typename T>
+void check_aliasing() {
+	std::size_t const n = 37;
+	matrix<T> const a = random<T>(n, n, 1);
+	matrix<T> const d = random<T>(n, n, 2);
+	matrix<T> x = random<T>(n, n, 3);
+	matrix<T> expected = naive_product<T>(x, a);
+	x = x * a;
+	check(max_diff(x, expected) <= tolerance<T>(n), "x = x * a");
+	expected = naive_product<T>(a, x) + x;
+	x = a * x + x;
+	check(max_diff(x, expected) <= 2 * tolerance<T>(n), "x = a * x + x");
+	expected = reference<T>(x * T(0.5) - d);
+	x = x * T(0.5) - d;
+	check(max_diff(x, expected) == 0, "x = x * 0.5 - d");
+	expected = reference<T>(x.transpose());
+	x = x.transpose();
+	check(max_diff(x, expected) == 0, "x = transpose of x");
+	expected = reference<T>(x.block(1, 0, n - 1, n));
+	x.block(0, 0, n - 1, n) = x.block(1, 0, n - 1, n);
+	check(max_diff(x.block(0, 0, n - 1, n), expected) == 0, "block shifted up over itself");
+	expected = reference<T>(x.block(0, 0, n - 1, n) + T(1));
+	x.block(1, 0, n - 1, n) = x.block(0, 0, n - 1, n) + T(1);
+	check(max_diff(x.block(1, 0, n - 1, n), expected) == 0, "block shifted down over itself");
+}
+
+template <typename T>
+void check_reductions() {
+	for (std::size_t n : odd_sizes) {
+		matrix<T> const a = random<T>(n, n + 4, 1);
+		matrix<T> const b = random<T>(n, n + 4, 2);
+		double total = 0, squares = 0, abs_total = 0, abs_max = 0, products = 0;
+		T low = a(0, 0), high = a(0, 0);
+		matrix<T> rows(n, 1, T(0));
+		matrix<T> cols(1, n + 4, T(0));
+		for (std::size_t i = 0; i < n; ++i) {
+			for (std::size_t j = 0; j < n + 4; ++j) {
+				T const x = a(i, j);
+				total += x - b(i, j);
+				squares += double(x) * x;
+				abs_total += std::abs(x);
+				abs_max = std::max<double>(abs_max, std::abs(x));
+				products += double(x) * b(i, j);
+				low = std::min(low, x);
+				high = std::max(high, x);
+				rows.set_elt(i, 0, rows(i, 0) + x);
+				cols.set_elt(0, j, cols(0, j) + x);
+			}
+		}
+		std::size_t const terms = n * (n + 4);
+		// row and column sums reach n + 4 and n
+		double const tol = tolerance<T>(n + 4) * (n + 4);
+		check(close<T>(sum(a - b), total, terms), "sum");
+		check(min_coeff(a) == low && max_coeff(a) == high, "min_coeff and max_coeff");
+		check(close<T>(dot(a, b), products, terms), "dot");
+		check(close<T>(norm2(a), std::sqrt(squares), terms), "norm2");
+		check(close<T>(norm1(a), abs_total, terms), "norm1");
+		check(norm_inf(a) == abs_max, "norm_inf");
+		check(max_diff(row_sums(a), rows) <= tol && max_diff(col_sums(a), cols) <= tol,
+		      "row_sums and col_sums");
+		bool const deterministic = get_deterministic_reductions();
+		set_deterministic_reductions(true);
+		check(close<T>(sum(a - b), total, terms), "deterministic sum");
+		set_deterministic_reductions(deterministic);
+	}
+}
+
+template <typename T>
+void check_sparse() {
+	std::mt19937 gen(7);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	matrix<T> dense(61, 43, T(0));
+	for (std::size_t i = 0; i < 61; ++i) {
+		for (std::size_t j = 0; j < 43; ++j) {
+			if (uniform(gen) < 0.1) {
+				dense.set_elt(i, j, static_cast<T>(uniform(gen)));
+			}
+		}
+	}
+	matrix<T> const b = random<T>(43, 9, 1);
+	matrix<T> const l = random<T>(5, 61, 2);
+	matrix<T> const expected = naive_product<T>(dense, b);
+	csr_matrix<T> const csr(dense);
+	csc_matrix<T> const csc(dense);
+	matrix<T> result = csr * b;
+	check(max_diff(result, expected) <= tolerance<T>(43), "csr times dense");
+	result = csc * b;
+	check(max_diff(result, expected) <= tolerance<T>(43), "csc times dense");
+	matrix<T> const left = l * csr;
+	check(max_diff(left, naive_product<T>(l, dense)) <= tolerance<T>(61), "dense times csr");
+	matrix<T> const back = csr;
+	check(max_diff(back, dense) == 0, "csr round trip");
+
+	std::vector<sparse_entry<T>> entries = {{0, 1, T(1)}, {2, 0, T(2)}, {0, 1, T(3)}};
+	csr_matrix<T> const summed(3, 2, entries);
+	check(summed(0, 1) == T(4) && summed(2, 0) == T(2) && summed(1, 1) == T(0), "duplicate entries");
+}
+
+template <typename T>
+void check_factorizations() {
+	std::size_t const n = 77;
+	matrix<T> const a = random<T>(n, n, 1);
+	matrix<T> spd = a.transpose() * a;
+	for (std::size_t i = 0; i < n; ++i) {
+		spd.set_elt(i, i, spd(i, i) + static_cast<T>(n));
+	}
+	matrix<T> const b = random<T>(n, 3, 2);
+	double const tol = std::is_same<T, float>::value ? 1e-2 : 1e-9;
+
+	std::vector<std::size_t> pivots;
+	matrix<T> lu = a + T(0);
+	check(lu_factor(lu, pivots), "lu_factor");
+	matrix<T> x = b + T(0);
+	lu_solve(lu, pivots, x);
+	check(norm_inf(a * x - b) <= tol, "lu_solve residual");
+
+	matrix<T> l = spd + T(0);
+	check(cholesky_factor(l), "cholesky_factor");
+	x = b + T(0);
+	cholesky_solve(l, x);
+	check(norm_inf(spd * x - b) <= tol, "cholesky_solve residual");
+
+	std::vector<T> tau;
+	matrix<T> qr = a + T(0);
+	qr_factor(qr, tau);
+	x = b + T(0);
+	qr_solve(qr, tau, x);
+	check(norm_inf(a * x - b) <= tol, "qr_solve residual");
+
+	matrix<T> singular(4, 4, T(1));
+	check(!lu_factor(singular, pivots), "singular lu_factor");
+}
+
+template <typename T>
+void check_mapped() {
+	char const *path = "matrix_test_mapped.shz";
+	matrix<T> const a = random<T>(29, 31, 1);
+	check(save_mapped(path, a * T(2)), "save_mapped");
+	{
+		mapped_matrix<T> const mapped(path);
+		check(max_diff(mapped.view(), a * T(2)) == 0, "mapped round trip");
+	}
+	{
+		// a mapping saved over the file it maps
+		mapped_matrix<T> const mapped(path);
+		check(save_mapped(path, mapped.view().transpose()), "save_mapped over its source");
+	}
+	mapped_matrix<T> const transposed(path);
+	check(max_diff(transposed.view(), (a * T(2)).eval().transpose()) == 0, "mapped transpose");
+	std::remove(path);
+}
+
+template <typename T>
+void check_batches() {
+	for (std::size_t count : {1, 5, 19}) {
+		std::size_t const rows = 5, inner = 7, cols = 3;
+		matrix_batch<T> a(count, rows, inner);
+		matrix_batch<T> b(count, inner, cols);
+		matrix_batch<T> c(count, rows, cols);
+		matrix_batch<T> t(count, cols, rows);
+		std::vector<T> flat(count * rows * inner);
+		for (std::size_t k = 0; k < count; ++k) {
+			b.set(k, random<T>(inner, cols, 100 + k));
+			matrix<T> const m = random<T>(rows, inner, k);
+			for (std::size_t e = 0; e < rows * inner; ++e) {
+				flat[k * rows * inner + e] = m(e / inner, e % inner);
+			}
+		}
+		a.load(flat.data(), rows * inner);
+		std::vector<T> stored(flat.size());
+		a.store(stored.data(), rows * inner);
+		check(stored == flat, "batch load and store");
+		batch_product(a, b, c);
+		batch_transpose(c, t);
+		double diff = 0;
+		for (std::size_t k = 0; k < count; ++k) {
+			matrix<T> const expected = naive_product<T>(a.get(k), b.get(k));
+			diff = std::max(diff, max_diff(c.get(k), expected));
+			diff = std::max(diff, max_diff(t.get(k), expected.transpose()));
+		}
+		check(diff <= tolerance<T>(inner), "batch product and transpose");
+	}
+}
+
+// Products of storage only and integer types, against float products of the same values
+void check_low_precision() {
+	matrix<float> const a = random<float>(19, 45, 1);
+	matrix<float> const b = random<float>(45, 13, 2);
+	matrix<float16> a16(19, 45);
+	matrix<float16> b16(45, 13);
+	matrix<bfloat16> ab(19, 45);
+	matrix<bfloat16> bb(45, 13);
+	matrix<float> a16_values(19, 45), b16_values(45, 13), ab_values(19, 45), bb_values(45, 13);
+	for (std::size_t i = 0; i < 19; ++i) {
+		for (std::size_t j = 0; j < 45; ++j) {
+			a16.set_elt(i, j, float16(a(i, j)));
+			ab.set_elt(i, j, bfloat16(a(i, j)));
+			a16_values.set_elt(i, j, float(a16(i, j)));
+			ab_values.set_elt(i, j, float(ab(i, j)));
+		}
+	}
+	for (std::size_t i = 0; i < 45; ++i) {
+		for (std::size_t j = 0; j < 13; ++j) {
+			b16.set_elt(i, j, float16(b(i, j)));
+			bb.set_elt(i, j, bfloat16(b(i, j)));
+			b16_values.set_elt(i, j, float(b16(i, j)));
+			bb_values.set_elt(i, j, float(bb(i, j)));
+		}
+	}
+	check(float(float16(0.5f)) == 0.5f && float(bfloat16(-3.0f)) == -3.0f, "exact conversions");
+	check(std::abs(float(float16(a(0, 0))) - a(0, 0)) <= 1e-3f, "float16 rounding");
+	matrix<float> result = product(a16, b16);
+	check(max_diff(result, naive_product<float>(a16_values, b16_values)) <= tolerance<float>(45),
+	      "float16 product");
+	result = product(ab, bb);
+	check(max_diff(result, naive_product<float>(ab_values, bb_values)) <= tolerance<float>(45),
+	      "bfloat16 product");
+
+	matrix<std::int8_t> a8(19, 45);
+	matrix<std::int8_t> b8(45, 13);
+	for (std::size_t i = 0; i < 19; ++i) {
+		for (std::size_t j = 0; j < 45; ++j) {
+			a8.set_elt(i, j, static_cast<std::int8_t>(a(i, j) * 127));
+		}
+	}
+	for (std::size_t i = 0; i < 45; ++i) {
+		for (std::size_t j = 0; j < 13; ++j) {
+			b8.set_elt(i, j, static_cast<std::int8_t>(b(i, j) * 127));
+		}
+	}
+	matrix<std::int32_t> const c32 = product(a8, b8);
+	check(max_diff(c32, naive_product<std::int32_t>(a8, b8)) == 0, "int8 product");
+}
+
+template <typename T>
+void check_plans() {
+	matrix<T> const a = random<T>(33, 33, 1);
+	matrix<T> const b = random<T>(33, 33, 2);
+	matrix<T> const x = random<T>(33, 33, 3);
+	matrix<T> const y = random<T>(33, 33, 4);
+	matrix<T> usual = (a + b) * (a + b);
+	matrix<T> planned(33, 33);
+	evaluation_plan const plan((a + b) * (a + b));
+	check(plan.num_steps() == 1, "repeated a + b evaluated once");
+	plan.assign(planned, (a + b) * (a + b));
+	check(max_diff(usual, planned) <= tolerance<T>(33), "planned (a + b) * (a + b)");
+	usual = x * (a - b) + y * (a - b);
+	assign_planned(planned, x * (a - b) + y * (a - b));
+	check(max_diff(usual, planned) <= tolerance<T>(33), "planned x * (a - b) + y * (a - b)");
+}
+
+template <typename T>
+void check_all() {
+	check_products<T>();
+	check_cwise<T>();
+	check_parallel<T>();
+	check_fixed<T>();
+	check_arena<T>();
+	check_views<T>();
+	check_aliasing<T>();
+	check_reductions<T>();
+	check_sparse<T>();
+	check_factorizations<T>();
+	check_mapped<T>();
+	check_batches<T>();
+	check_plans<T>();
+}
+
+int main() {
+	demo();
+	check_all<float>();
+	check_all<double>();
+	check_low_precision();
+	std::printf("%d check%s failed\n", failures, failures == 1 ? "" : "s");
+	return failures == 0 ? 0 : 1;
 }
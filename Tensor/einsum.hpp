@@ -0,0 +1,444 @@
+//
+// Created by cppshizoid on 4/14/24.
+//
+#ifndef EINSUM_HPP
+#define EINSUM_HPP
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "tensor.hpp"
+
+namespace tensor {
+/**
+ * String usable as a template argument, einsum specifications are passed as
+ * one so that they are parsed at compile time
+ */
+template <size_t N>
+struct const_string : std::array<char, N> {
+  constexpr const_string(const char (&chars)[N]) {
+    std::copy_n(chars, N, std::array<char, N>::begin());
+  }
+
+  [[nodiscard]] constexpr auto str() const -> std::string_view {
+    return std::string_view(std::array<char, N>::data(), N - 1);
+  }
+};
+
+template <size_t N>
+const_string(const char (&)[N]) -> const_string<N>;
+
+/**
+ * Tensor or view, the operands of einsum, which need strided storage
+ */
+template <typename E>
+concept strided_operand =
+    detail::is_tensor<std::remove_cvref_t<E>>::value ||
+    (expression<E> && requires(const E& e) { e.strides(); });
+
+namespace detail {
+/**
+ * Parsed einsum specification such as "bij,bjk->bik": the labels of the axes
+ * of every input and of the output, labels numbered in order of appearance
+ */
+struct einsum_spec {
+  static constexpr size_t max_axes = 16;
+  static constexpr size_t max_inputs = 2;
+  static constexpr size_t max_labels = 52;
+
+  bool valid = false;
+  size_t n_inputs = 0;
+  std::array<size_t, max_inputs> input_rank{};
+  std::array<std::array<size_t, max_axes>, max_inputs> input_labels{};
+  size_t output_rank = 0;
+  std::array<size_t, max_axes> output_labels{};
+  size_t n_labels = 0;
+  std::array<char, max_labels> labels{};
+
+  [[nodiscard]] constexpr bool in_input(size_t k, size_t label) const {
+    for (size_t axis = 0; axis < input_rank[k]; ++axis)
+      if (input_labels[k][axis] == label) return true;
+    return false;
+  }
+
+  [[nodiscard]] constexpr bool in_output(size_t label) const {
+    for (size_t axis = 0; axis < output_rank; ++axis)
+      if (output_labels[axis] == label) return true;
+    return false;
+  }
+
+  [[nodiscard]] constexpr bool repeats_label() const {
+    for (size_t k = 0; k < n_inputs; ++k)
+      for (size_t a = 0; a < input_rank[k]; ++a)
+        for (size_t b = a + 1; b < input_rank[k]; ++b)
+          if (input_labels[k][a] == input_labels[k][b]) return true;
+    return false;
+  }
+
+  // Two inputs whose labels are each batch (in both inputs and the output), row (first input
+  // and output), column (second input and output) or contracted (both inputs only), with at
+  // least one contracted label: a batch of matrix products
+  [[nodiscard]] constexpr bool is_matmul() const {
+    if (n_inputs != 2 || repeats_label()) return false;
+    bool contracted = false;
+    for (size_t label = 0; label < n_labels; ++label) {
+      const bool a = in_input(0, label);
+      const bool b = in_input(1, label);
+      const bool out = in_output(label);
+      if (!out && !(a && b)) return false;
+      contracted |= a && b && !out;
+    }
+    return contracted;
+  }
+};
+
+constexpr bool is_label(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+
+// Parses "<labels>[,<labels>][-><labels>]". Without an arrow the output holds the labels seen
+// exactly once, in alphabetical order, as in NumPy
+constexpr einsum_spec parse_einsum(std::string_view text) {
+  einsum_spec spec;
+  auto label_of = [&](char c) {
+    for (size_t label = 0; label < spec.n_labels; ++label)
+      if (spec.labels[label] == c) return label;
+    spec.labels[spec.n_labels] = c;
+    return spec.n_labels++;
+  };
+
+  bool output = false;
+  bool arrow = false;
+  spec.n_inputs = 1;
+  for (size_t i = 0; i < text.size(); ++i) {
+    const char c = text[i];
+    if (c == ' ') continue;
+    if (is_label(c)) {
+      const size_t label = label_of(c);
+      if (output) {
+        if (spec.output_rank == einsum_spec::max_axes || spec.in_output(label)) return {};
+        spec.output_labels[spec.output_rank++] = label;
+      } else {
+        size_t& rank = spec.input_rank[spec.n_inputs - 1];
+        if (rank == einsum_spec::max_axes) return {};
+        spec.input_labels[spec.n_inputs - 1][rank++] = label;
+      }
+    } else if (c == ',' && !output) {
+      if (spec.n_inputs == einsum_spec::max_inputs) return {};
+      ++spec.n_inputs;
+    } else if (c == '-' && !output && i + 1 < text.size() && text[i + 1] == '>') {
+      output = arrow = true;
+      ++i;
+    } else {
+      return {};
+    }
+  }
+
+  size_t seen[einsum_spec::max_labels]{};
+  for (size_t k = 0; k < spec.n_inputs; ++k)
+    for (size_t axis = 0; axis < spec.input_rank[k]; ++axis) ++seen[spec.input_labels[k][axis]];
+  if (!arrow) {
+    for (char c = 'A'; c <= 'z'; ++c) {
+      for (size_t label = 0; label < spec.n_labels; ++label)
+        if (spec.labels[label] == c && seen[label] == 1)
+          spec.output_labels[spec.output_rank++] = label;
+      if (c == 'Z') c = 'a' - 1;
+    }
+  }
+  for (size_t axis = 0; axis < spec.output_rank; ++axis)
+    if (seen[spec.output_labels[axis]] == 0) return {};
+  spec.valid = spec.n_labels > 0;
+  return spec;
+}
+
+template <typename E>
+constexpr auto as_strided(const E& operand) {
+  if constexpr (is_tensor<E>::value)
+    return operand.view();
+  else
+    return tensor_view<const typename E::value_type, E::rank>(operand);
+}
+
+// A view of an input indexed by label: labels the input lacks get extent 1 and stride 0, labels
+// repeated in the input, a diagonal, get the sum of their strides
+template <size_t L, typename T, size_t N>
+constexpr tensor_view<const T, L> label_view(const tensor_view<const T, N>& view,
+                                             const std::array<size_t, einsum_spec::max_axes>& axes,
+                                             const std::array<size_t, L>& label_extents) {
+  std::array<size_t, L> extents{};
+  std::array<std::ptrdiff_t, L> strides{};
+  extents.fill(1);
+  for (size_t axis = 0; axis < N; ++axis) {
+    extents[axes[axis]] = label_extents[axes[axis]];
+    strides[axes[axis]] += view.strides()[axis];
+  }
+  return tensor_view<const T, L>(view.data(), extents, strides);
+}
+
+// Rows and columns of the register tile of gemm, and the cache blocking of its operands
+inline constexpr size_t gemm_mr = 6;
+inline constexpr size_t gemm_nr = 16;
+inline constexpr size_t gemm_kc = 256;
+inline constexpr size_t gemm_mc = 96;
+inline constexpr size_t gemm_nc = 512;
+
+// Product of a packed gemm_mr row panel of A and a packed gemm_nr column panel of B, summed in
+// a local tile the compiler keeps in vector registers. The rows are unrolled in the source so
+// that only the loop over the columns is left to vectorize
+template <typename T>
+void gemm_tile(size_t kb, const T* __restrict ap, const T* __restrict bp,
+               T (&__restrict tile)[gemm_mr][gemm_nr]) {
+  T sum[gemm_mr][gemm_nr]{};
+  for (size_t p = 0; p < kb; ++p) {
+    const T* b = bp + p * gemm_nr;
+    [&]<size_t... Rows>(std::index_sequence<Rows...>) {
+      (
+          [&] {
+            const T a = ap[p * gemm_mr + Rows];
+            for (size_t col = 0; col < gemm_nr; ++col) sum[Rows][col] += a * b[col];
+          }(),
+          ...);
+    }(std::make_index_sequence<gemm_mr>());
+  }
+  std::copy(&sum[0][0], &sum[0][0] + gemm_mr * gemm_nr, &tile[0][0]);
+}
+
+/**
+ * C += A B for strided m x k A, k x n B and m x n C, accumulated in T.
+ *
+ * Blocked like GotoBLAS: k x n panels of B and m x k blocks of A are packed
+ * into contiguous zero-padded panels of gemm_nr columns and gemm_mr rows, and
+ * a gemm_mr x gemm_nr register tile is accumulated over each packed panel. The
+ * row blocks of A run in parallel when allowed.
+ */
+template <typename T, typename TA, typename TB, typename TC>
+void gemm(size_t m, size_t n, size_t k, const TA* a, std::ptrdiff_t rsa, std::ptrdiff_t csa,
+          const TB* b, std::ptrdiff_t rsb, std::ptrdiff_t csb, TC* c, std::ptrdiff_t rsc,
+          std::ptrdiff_t csc, bool parallel) {
+  constexpr size_t mr = gemm_mr;
+  constexpr size_t nr = gemm_nr;
+  std::vector<T> packed_b(gemm_kc * ((gemm_nc + nr - 1) / nr * nr));
+  for (size_t jc = 0; jc < n; jc += gemm_nc) {
+    const size_t nb = std::min(gemm_nc, n - jc);
+    const size_t n_panels = (nb + nr - 1) / nr;
+    for (size_t pc = 0; pc < k; pc += gemm_kc) {
+      const size_t kb = std::min(gemm_kc, k - pc);
+      for (size_t panel = 0; panel < n_panels; ++panel) {
+        T* dst = packed_b.data() + panel * kb * nr;
+        for (size_t p = 0; p < kb; ++p) {
+          for (size_t col = 0; col < nr; ++col) {
+            const size_t j = panel * nr + col;
+            dst[p * nr + col] =
+                j < nb ? static_cast<T>(b[static_cast<std::ptrdiff_t>(pc + p) * rsb +
+                                          static_cast<std::ptrdiff_t>(jc + j) * csb])
+                       : T{};
+          }
+        }
+      }
+
+      auto row_blocks = [&](size_t first, size_t last) {
+        std::vector<T> packed_a(gemm_mc * kb);
+        for (size_t block = first; block < last; ++block) {
+          const size_t ic = block * gemm_mc;
+          const size_t mb = std::min(gemm_mc, m - ic);
+          const size_t m_panels = (mb + mr - 1) / mr;
+          for (size_t panel = 0; panel < m_panels; ++panel) {
+            T* dst = packed_a.data() + panel * kb * mr;
+            for (size_t p = 0; p < kb; ++p) {
+              for (size_t row = 0; row < mr; ++row) {
+                const size_t i = panel * mr + row;
+                dst[p * mr + row] =
+                    i < mb ? static_cast<T>(a[static_cast<std::ptrdiff_t>(ic + i) * rsa +
+                                              static_cast<std::ptrdiff_t>(pc + p) * csa])
+                           : T{};
+              }
+            }
+          }
+          for (size_t jp = 0; jp < n_panels; ++jp) {
+            const T* bp = packed_b.data() + jp * kb * nr;
+            const size_t cols = std::min(nr, nb - jp * nr);
+            for (size_t ip = 0; ip < m_panels; ++ip) {
+              const T* ap = packed_a.data() + ip * kb * mr;
+              const size_t rows = std::min(mr, mb - ip * mr);
+              T tile[mr][nr];
+              gemm_tile(kb, ap, bp, tile);
+              for (size_t row = 0; row < rows; ++row) {
+                TC* out = c + static_cast<std::ptrdiff_t>(ic + ip * mr + row) * rsc +
+                          static_cast<std::ptrdiff_t>(jc + jp * nr) * csc;
+                for (size_t col = 0; col < cols; ++col)
+                  out[static_cast<std::ptrdiff_t>(col) * csc] += static_cast<TC>(tile[row][col]);
+              }
+            }
+          }
+        }
+      };
+      const size_t m_blocks = (m + gemm_mc - 1) / gemm_mc;
+      if (parallel)
+        parallel_for(m_blocks, gemm_mc * kb * nb, row_blocks);
+      else
+        row_blocks(0, m_blocks);
+    }
+  }
+}
+
+// Extent and stride of a group of labels seen as a single axis of a view, when its axes are
+// nested in the given order; extent 0 when they are not
+template <size_t L, typename T>
+constexpr std::pair<size_t, std::ptrdiff_t> collapse(const tensor_view<const T, L>& view,
+                                                     const std::array<size_t, L>& group,
+                                                     size_t size) {
+  size_t extent = 1;
+  std::ptrdiff_t stride = 0;
+  bool first = true;
+  for (size_t g = size; g-- > 0;) {
+    const size_t label = group[g];
+    if (view.extent(label) == 1) continue;
+    if (first) {
+      stride = view.strides()[label];
+      first = false;
+    } else if (view.strides()[label] != stride * static_cast<std::ptrdiff_t>(extent)) {
+      return {0, 0};
+    }
+    extent *= view.extent(label);
+  }
+  return {extent, stride};
+}
+
+// Evaluates a matmul shaped contraction as a loop over the batch labels of blocked products,
+// false when a group of labels cannot be collapsed into a single axis of every view holding it
+// or the products are too narrow
+template <const einsum_spec& Spec, size_t L, typename V, typename TA, typename TB>
+bool contract_gemm(const tensor_view<const TA, L>& a, const tensor_view<const TB, L>& b,
+                   const tensor_view<V, L>& c, const std::array<size_t, L>& label_extents) {
+  std::array<size_t, L> batch{}, rows{}, cols{}, inner{};
+  size_t n_batch = 0, n_rows = 0, n_cols = 0, n_inner = 0;
+  // groups in the axis order of the view that decides their layout
+  auto add_group = [&](size_t k, auto keep, std::array<size_t, L>& group, size_t& size) {
+    const size_t rank = k < 2 ? Spec.input_rank[k] : Spec.output_rank;
+    for (size_t axis = 0; axis < rank; ++axis) {
+      const size_t label = k < 2 ? Spec.input_labels[k][axis] : Spec.output_labels[axis];
+      if (keep(label)) group[size++] = label;
+    }
+  };
+  add_group(2, [&](size_t l) { return Spec.in_input(0, l) && Spec.in_input(1, l); }, batch,
+            n_batch);
+  add_group(0, [&](size_t l) { return Spec.in_output(l) && !Spec.in_input(1, l); }, rows,
+            n_rows);
+  add_group(1, [&](size_t l) { return Spec.in_output(l) && !Spec.in_input(0, l); }, cols,
+            n_cols);
+  add_group(0, [&](size_t l) { return !Spec.in_output(l); }, inner, n_inner);
+
+  const auto [m, rsa] = collapse(a, rows, n_rows);
+  const auto [k, csa] = collapse(a, inner, n_inner);
+  const auto [kb, rsb] = collapse(b, inner, n_inner);
+  const auto [n, csb] = collapse(b, cols, n_cols);
+  const auto [mc, rsc] = collapse(tensor_view<const V, L>(c), rows, n_rows);
+  const auto [nc, csc] = collapse(tensor_view<const V, L>(c), cols, n_cols);
+  if (m == 0 || k == 0 || kb == 0 || n == 0 || mc == 0 || nc == 0) return false;
+  // products narrower than the register tile, such as matrix-vector ones, waste most of it
+  if (m < gemm_mr || n < gemm_nr) return false;
+
+  size_t batches = 1;
+  for (size_t g = 0; g < n_batch; ++g) batches *= label_extents[batch[g]];
+  parallel_for(batches, m * n * k, [&](size_t first, size_t last) {
+    for (size_t index = first; index < last; ++index) {
+      std::ptrdiff_t oa = 0, ob = 0, oc = 0;
+      for (size_t g = n_batch, rest = index; g-- > 0;) {
+        const size_t label = batch[g];
+        const auto i = static_cast<std::ptrdiff_t>(rest % label_extents[label]);
+        rest /= label_extents[label];
+        oa += i * a.strides()[label];
+        ob += i * b.strides()[label];
+        oc += i * c.strides()[label];
+      }
+      gemm<V>(m, n, k, a.data() + oa, rsa, csa, b.data() + ob, rsb, csb, c.data() + oc, rsc,
+              csc, batches == 1);
+    }
+  });
+  return true;
+}
+
+template <const_string Spec>
+inline constexpr einsum_spec parsed_einsum = parse_einsum(Spec.str());
+}  // namespace detail
+
+/**
+ * Einstein summation over one or two tensors or views, e.g.
+ * einsum<"ij,jk->ik">(a, b), einsum<"bij,bjk->bik">(a, b), einsum<"ii->">(a).
+ *
+ * The specification is parsed at compile time. Every label becomes an axis of
+ * a fused loop nest whose order is chosen from the strides of the operands and
+ * the result, so that the innermost loop has unit stride where possible.
+ * Contractions shaped like a batch of matrix products go to a blocked GEMM
+ * instead when the labels of each matrix dimension are nested in memory. The
+ * result is a tensor of the output labels, or a scalar when there are none.
+ */
+template <const_string Spec, strided_operand... Operands>
+constexpr auto einsum(const Operands&... operands) {
+  constexpr const detail::einsum_spec& spec = detail::parsed_einsum<Spec>;
+  static_assert(spec.valid, "malformed einsum specification");
+  static_assert(spec.n_inputs == sizeof...(Operands),
+                "number of operands differs from the specification");
+  constexpr size_t L = spec.n_labels;
+  constexpr size_t R = spec.output_rank;
+  using V = std::common_type_t<typename std::remove_cvref_t<Operands>::value_type...>;
+
+  const auto views = std::tuple(detail::as_strided(operands)...);
+  std::array<size_t, L> label_extents{};
+  label_extents.fill(0);
+  [&]<size_t... K>(std::index_sequence<K...>) {
+    (
+        [&] {
+          const auto& view = std::get<K>(views);
+          static_assert(std::remove_cvref_t<decltype(view)>::rank == spec.input_rank[K],
+                        "operand rank differs from the specification");
+          for (size_t axis = 0; axis < spec.input_rank[K]; ++axis) {
+            size_t& extent = label_extents[spec.input_labels[K][axis]];
+            assert(extent == 0 || extent == view.extent(axis));
+            extent = view.extent(axis);
+          }
+        }(),
+        ...);
+  }(std::index_sequence_for<Operands...>());
+
+  auto product = [&]<size_t... K>(std::index_sequence<K...>) {
+    if constexpr (sizeof...(K) == 1)
+      return detail::label_view<L>(std::get<0>(views), spec.input_labels[0], label_extents);
+    else
+      return detail::label_view<L>(std::get<0>(views), spec.input_labels[0], label_extents) *
+             detail::label_view<L>(std::get<1>(views), spec.input_labels[1], label_extents);
+  }(std::index_sequence_for<Operands...>());
+
+  if constexpr (R == 0) {
+    return detail::reduce_all(product, V{}, detail::add_element{});
+  } else {
+    std::array<size_t, R> extents{};
+    for (size_t axis = 0; axis < R; ++axis) extents[axis] = label_extents[spec.output_labels[axis]];
+    tensor<V, R> result(extents);
+    const auto strides = result.strides();
+    std::array<size_t, L> out_extents{};
+    std::array<std::ptrdiff_t, L> out_strides{};
+    out_extents.fill(1);
+    for (size_t axis = 0; axis < R; ++axis) {
+      out_extents[spec.output_labels[axis]] = extents[axis];
+      out_strides[spec.output_labels[axis]] = strides[axis];
+    }
+
+    if constexpr (spec.is_matmul() && std::is_arithmetic_v<V>) {
+      if !consteval {
+        const tensor_view<V, L> out(result.data(), out_extents, out_strides);
+        if (detail::contract_gemm<spec>(product.lhs(), product.rhs(), out, label_extents))
+          return result;
+      }
+    }
+    detail::evaluate(label_extents, result.data(), out_strides, product, detail::add_element{});
+    return result;
+  }
+}
+}  // namespace tensor
+
+#endif
@@ -0,0 +1,300 @@
+//
+// Created by cppshizoid on 4/14/24.
+//
+#ifndef FIXED_TENSOR_HPP
+#define FIXED_TENSOR_HPP
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+#include "einsum.hpp"
+#include "tensor.hpp"
+
+namespace tensor {
+/**
+ * Dense tensor whose extents are template parameters, stored inline in a
+ * std::array.
+ *
+ * It is a literal and structural type: every operation is constexpr, so
+ * tables computed from fixed tensors can be constexpr variables that live in
+ * the read-only data of the binary, or template arguments. Indexing with
+ * t[i, j, k] folds the offset computation into constants, and the element-wise
+ * operators and einsum on fixed tensors are unrolled over the elements.
+ */
+template <typename T, size_t... Extents>
+  requires(sizeof...(Extents) >= 1)
+struct fixed_tensor {
+  using value_type = T;
+  static constexpr size_t rank = sizeof...(Extents);
+  static constexpr std::array<size_t, rank> static_extents{Extents...};
+  static constexpr std::array<std::ptrdiff_t, rank> static_strides =
+      detail::contiguous_strides(static_extents);
+  static constexpr size_t count = (Extents * ...);
+
+  std::array<T, count> elements{};
+
+  template <typename... Args>
+    requires(sizeof...(Args) == rank) && (std::convertible_to<Args, size_t> && ...)
+  constexpr T& operator[](Args... indices) {
+    return elements[offset(indices...)];
+  }
+
+  template <typename... Args>
+    requires(sizeof...(Args) == rank) && (std::convertible_to<Args, size_t> && ...)
+  constexpr const T& operator[](Args... indices) const {
+    return elements[offset(indices...)];
+  }
+
+  [[nodiscard]] constexpr tensor_view<T, rank> view() {
+    return {elements.data(), static_extents, static_strides};
+  }
+  [[nodiscard]] constexpr tensor_view<const T, rank> view() const {
+    return {elements.data(), static_extents, static_strides};
+  }
+
+  [[nodiscard]] static constexpr size_t size() { return static_extents[0]; }
+  [[nodiscard]] static constexpr size_t extent(size_t axis) { return static_extents[axis]; }
+  [[nodiscard]] static constexpr const std::array<size_t, rank>& extents() {
+    return static_extents;
+  }
+  [[nodiscard]] static constexpr const std::array<std::ptrdiff_t, rank>& strides() {
+    return static_strides;
+  }
+  [[nodiscard]] static constexpr size_t num_elements() { return count; }
+
+  [[nodiscard]] constexpr T* data() { return elements.data(); }
+  [[nodiscard]] constexpr const T* data() const { return elements.data(); }
+
+  template <typename F>
+  constexpr void for_each(F&& f) {
+    for (T& element : elements) f(element);
+  }
+  template <typename F>
+  constexpr void for_each(F&& f) const {
+    for (const T& element : elements) f(element);
+  }
+
+  friend constexpr bool operator==(const fixed_tensor&, const fixed_tensor&) = default;
+
+ private:
+  template <typename... Args>
+  static constexpr size_t offset(Args... indices) {
+    size_t result = 0;
+    size_t axis = 0;
+    ((result = result * static_extents[axis++] + static_cast<size_t>(indices)), ...);
+    return result;
+  }
+};
+
+namespace detail {
+template <typename E>
+struct is_fixed_tensor : std::false_type {};
+
+template <typename T, size_t... Extents>
+struct is_fixed_tensor<fixed_tensor<T, Extents...>> : std::true_type {};
+
+// Fixed tensor of element type V and the given extents
+template <typename V, auto Extents, size_t... Axes>
+constexpr auto fixed_of(std::index_sequence<Axes...>) -> fixed_tensor<V, Extents[Axes]...>;
+
+template <typename V, auto Extents>
+using fixed_t = decltype(fixed_of<V, Extents>(std::make_index_sequence<Extents.size()>()));
+
+template <typename Op, typename L, typename R>
+constexpr auto fixed_binary(const L& lhs, const R& rhs) {
+  constexpr bool left = is_fixed_tensor<L>::value;
+  constexpr bool right = is_fixed_tensor<R>::value;
+  using Tensor = std::conditional_t<left, L, R>;
+  auto element = [](const auto& operand, size_t i) {
+    if constexpr (is_fixed_tensor<std::remove_cvref_t<decltype(operand)>>::value)
+      return operand.elements[i];
+    else
+      return operand;
+  };
+  using V = std::remove_cvref_t<decltype(Op{}(element(lhs, 0), element(rhs, 0)))>;
+  if constexpr (left && right) {
+    static_assert(
+        std::is_same_v<fixed_t<char, L::static_extents>, fixed_t<char, R::static_extents>>,
+        "fixed tensors of different extents");
+  }
+  fixed_t<V, Tensor::static_extents> result;
+  [&]<size_t... I>(std::index_sequence<I...>) {
+    ((result.elements[I] = Op{}(element(lhs, I), element(rhs, I))), ...);
+  }(std::make_index_sequence<Tensor::count>());
+  return result;
+}
+
+template <typename L, typename R>
+concept fixed_operands = (is_fixed_tensor<L>::value && is_fixed_tensor<R>::value) ||
+                         (is_fixed_tensor<L>::value && std::is_arithmetic_v<R>) ||
+                         (std::is_arithmetic_v<L> && is_fixed_tensor<R>::value);
+
+// Offsets into the operands and the result of every term of a contraction, a term per index of
+// the label space
+template <const_string Spec, typename... In>
+struct fixed_contraction {
+  static constexpr const einsum_spec& spec = parsed_einsum<Spec>;
+  static constexpr size_t L = spec.n_labels;
+  static constexpr size_t n_inputs = sizeof...(In);
+
+  static constexpr std::array<size_t, L> label_extents = [] {
+    std::array<size_t, L> extents{};
+    size_t k = 0;
+    (
+        [&] {
+          for (size_t axis = 0; axis < spec.input_rank[k]; ++axis)
+            extents[spec.input_labels[k][axis]] = In::static_extents[axis];
+          ++k;
+        }(),
+        ...);
+    return extents;
+  }();
+
+  static constexpr size_t terms = count(label_extents);
+
+  struct term {
+    size_t out;
+    std::array<size_t, n_inputs> in;
+  };
+
+  static constexpr std::array<term, terms> table = [] {
+    std::array<term, terms> result{};
+    std::array<size_t, L> index{};
+    for (size_t t = 0; t < terms; ++t) {
+      size_t out = 0;
+      for (size_t axis = 0; axis < spec.output_rank; ++axis)
+        out = out * label_extents[spec.output_labels[axis]] + index[spec.output_labels[axis]];
+      result[t].out = out;
+      size_t k = 0;
+      (
+          [&] {
+            std::ptrdiff_t in = 0;
+            for (size_t axis = 0; axis < spec.input_rank[k]; ++axis)
+              in += static_cast<std::ptrdiff_t>(index[spec.input_labels[k][axis]]) *
+                    In::static_strides[axis];
+            result[t].in[k++] = static_cast<size_t>(in);
+          }(),
+          ...);
+      for (size_t axis = L; axis-- > 0;) {
+        if (++index[axis] < label_extents[axis]) break;
+        index[axis] = 0;
+      }
+    }
+    return result;
+  }();
+};
+
+// Terms above which a contraction loops over its offset table instead of being unrolled
+inline constexpr size_t unrolled_terms = 4096;
+}  // namespace detail
+
+template <typename L, typename R>
+  requires detail::fixed_operands<L, R>
+constexpr auto operator+(const L& lhs, const R& rhs) {
+  return detail::fixed_binary<std::plus<>>(lhs, rhs);
+}
+
+template <typename L, typename R>
+  requires detail::fixed_operands<L, R>
+constexpr auto operator-(const L& lhs, const R& rhs) {
+  return detail::fixed_binary<std::minus<>>(lhs, rhs);
+}
+
+template <typename L, typename R>
+  requires detail::fixed_operands<L, R>
+constexpr auto operator*(const L& lhs, const R& rhs) {
+  return detail::fixed_binary<std::multiplies<>>(lhs, rhs);
+}
+
+template <typename L, typename R>
+  requires detail::fixed_operands<L, R>
+constexpr auto operator/(const L& lhs, const R& rhs) {
+  return detail::fixed_binary<std::divides<>>(lhs, rhs);
+}
+
+template <typename T, size_t... Extents>
+constexpr fixed_tensor<T, Extents...> operator-(const fixed_tensor<T, Extents...>& operand) {
+  fixed_tensor<T, Extents...> result;
+  [&]<size_t... I>(std::index_sequence<I...>) {
+    ((result.elements[I] = static_cast<T>(-operand.elements[I])), ...);
+  }(std::make_index_sequence<fixed_tensor<T, Extents...>::count>());
+  return result;
+}
+
+/**
+ * Einstein summation over fixed tensors, a fixed tensor of the output labels
+ * or a scalar when there are none. The offsets of every term are computed at
+ * compile time and contractions of up to detail::unrolled_terms terms are
+ * emitted as straight-line code.
+ */
+template <const_string Spec, typename... Operands>
+  requires(detail::is_fixed_tensor<Operands>::value && ...)
+constexpr auto einsum(const Operands&... operands) {
+  using C = detail::fixed_contraction<Spec, Operands...>;
+  static_assert(C::spec.valid, "malformed einsum specification");
+  static_assert(C::spec.n_inputs == sizeof...(Operands),
+                "number of operands differs from the specification");
+  static_assert([] {
+    size_t k = 0;
+    return ((Operands::rank == C::spec.input_rank[k++]) && ...);
+  }(), "operand rank differs from the specification");
+  using V = std::common_type_t<typename Operands::value_type...>;
+  static_assert([] {
+    std::array<size_t, C::spec.n_labels> extents{};
+    size_t k = 0;
+    bool agree = true;
+    (
+        [&] {
+          for (size_t axis = 0; axis < C::spec.input_rank[k]; ++axis) {
+            size_t& extent = extents[C::spec.input_labels[k][axis]];
+            agree &= extent == 0 || extent == Operands::static_extents[axis];
+            extent = Operands::static_extents[axis];
+          }
+          ++k;
+        }(),
+        ...);
+    return agree;
+  }(), "extents of a label differ between operands");
+
+  constexpr size_t R = C::spec.output_rank;
+  auto term = [&](const auto& t) {
+    return [&]<size_t... K>(std::index_sequence<K...>) {
+      return (static_cast<V>(operands.elements[t.in[K]]) * ...);
+    }(std::index_sequence_for<Operands...>());
+  };
+
+  if constexpr (R == 0) {
+    V result{};
+    if constexpr (C::terms <= detail::unrolled_terms) {
+      [&]<size_t... I>(std::index_sequence<I...>) {
+        ((result += term(C::table[I])), ...);
+      }(std::make_index_sequence<C::terms>());
+    } else {
+      for (const auto& t : C::table) result += term(t);
+    }
+    return result;
+  } else {
+    constexpr auto extents = [] {
+      std::array<size_t, R> result{};
+      for (size_t axis = 0; axis < R; ++axis)
+        result[axis] = C::label_extents[C::spec.output_labels[axis]];
+      return result;
+    }();
+    detail::fixed_t<V, extents> result;
+    if constexpr (C::terms <= detail::unrolled_terms) {
+      [&]<size_t... I>(std::index_sequence<I...>) {
+        ((result.elements[C::table[I].out] += term(C::table[I])), ...);
+      }(std::make_index_sequence<C::terms>());
+    } else {
+      for (const auto& t : C::table) result.elements[t.out] += term(t);
+    }
+    return result;
+  }
+}
+}  // namespace tensor
+
+#endif
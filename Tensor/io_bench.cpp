@@ -0,0 +1,139 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#include "tensor_io.hpp"
+
+// Round trip and throughput check of tensor files. Saves a float tensor of the given size, a
+// permuted view and a reversed strided view of it, loads each back and compares every element,
+// saves a view over the very file it maps, and checks that truncated files, files of another
+// element type or rank and headers with wrapping or overflowing extents are rejected. Prints the
+// write throughput of dense saves and of chunked saves gathering strided views, fsync included, and
+// of loading and reading the file back, which comes from the page cache. Exits with 1 when a check
+// fails.
+// Build with optimizations, e.g.
+//   g++ -std=c++23 -O3 -march=native -DNDEBUG -pthread io_bench.cpp -o io_bench
+// and pass the tensor size in MiB and a scratch directory, several GiB to measure the disk:
+//   ./io_bench 4096 /scratch
+
+namespace {
+namespace fs = std::filesystem;
+using tensor::slice;
+
+int failures = 0;
+
+void check(bool condition, const char* what) {
+  if (condition) return;
+  ++failures;
+  std::printf("FAIL %s\n", what);
+}
+
+template <typename F>
+double seconds(F&& f) {
+  const auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+template <typename F>
+bool rejects(F&& f) {
+  try {
+    f();
+  } catch (const std::runtime_error&) {
+    return true;
+  }
+  return false;
+}
+
+// Overwrites the extents and strides stored after the header of a rank 2 tensor file
+void patch_layout(const fs::path& path, const std::array<std::uint64_t, 2>& extents,
+                  const std::array<std::int64_t, 2>& strides) {
+  std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+  file.seekp(sizeof(tensor::file_header));
+  file.write(reinterpret_cast<const char*>(extents.data()), sizeof extents);
+  file.write(reinterpret_cast<const char*>(strides.data()), sizeof strides);
+}
+
+// Element values telling the indices apart, exact in float
+float value_at(size_t index) { return static_cast<float>(index * 2654435761u % 16777216); }
+
+bool same_elements(const tensor::tensor_view<const float, 3>& a,
+                   const tensor::tensor_view<const float, 3>& b) {
+  if (a.extents() != b.extents()) return false;
+  for (size_t i = 0; i < a.extent(0); ++i)
+    for (size_t j = 0; j < a.extent(1); ++j)
+      for (size_t k = 0; k < a.extent(2); ++k)
+        if (a[i, j, k] != b[i, j, k]) return false;
+  return true;
+}
+
+void round_trip(const char* name, const tensor::tensor_view<const float, 3>& view,
+                const fs::path& path) {
+  const double bytes = static_cast<double>(view.num_elements() * sizeof(float));
+  const double write = seconds([&] { tensor::save(path, view); });
+  bool same = false;
+  const double read = seconds([&] {
+    const auto loaded = tensor::load<float, 3>(path);
+    same = same_elements(loaded.view(), view);
+  });
+  check(same, name);
+  std::printf("%-10s save %6.2f GB/s, load and read %6.2f GB/s\n", name, bytes / write * 1e-9,
+              bytes / read * 1e-9);
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  const size_t mebibytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1024;
+  const fs::path directory = argc > 2 ? fs::path(argv[2]) : fs::temp_directory_path();
+  const fs::path path = directory / "io_bench.tnsr";
+  const fs::path small = directory / "io_bench_small.tnsr";
+
+  // one MiB of floats per 4 x 256 x 256 block
+  tensor::tensor<float, 3> t(std::array<size_t, 3>{std::max<size_t>(mebibytes, 1) * 4, 256, 256});
+  for (size_t i = 0; i < t.num_elements(); ++i) t.data()[i] = value_at(i);
+  std::printf("%zu x %zu x %zu floats, %zu MiB\n", t.extent(0), t.extent(1), t.extent(2),
+              t.num_elements() * sizeof(float) >> 20);
+
+  round_trip("dense", t.view(), path);
+  round_trip("permuted", t.view().permuted({2, 0, 1}), path);
+  round_trip("reversed", t.view().sliced(slice{.step = -1}, slice{}, slice{.step = -2}), path);
+
+  // the saved view reads the mapping of the file it replaces
+  tensor::save(path, t);
+  {
+    const auto mapped = tensor::load<float, 3>(path);
+    tensor::save(path, mapped.view().transposed());
+  }
+  check(same_elements(tensor::load<float, 3>(path).view(), t.view().transposed()),
+        "save over the mapped file");
+  check(!fs::exists(directory / "io_bench.tnsr.tmp"), "temporary file removed");
+
+  tensor::tensor<float, 3> s(std::array<size_t, 3>{2, 3, 4});
+  for (size_t i = 0; i < s.num_elements(); ++i) s.data()[i] = value_at(i);
+  tensor::save(small, s);
+  check(rejects([&] { (void)tensor::load<double, 3>(small); }), "float file loaded as double");
+  check(rejects([&] { (void)tensor::load<std::int32_t, 3>(small); }),
+        "float file loaded as int32");
+  check(rejects([&] { (void)tensor::load<float, 2>(small); }), "rank 3 file loaded as rank 2");
+  fs::resize_file(small, tensor::detail::header_size(3) + s.num_elements() * sizeof(float) / 2);
+  check(rejects([&] { (void)tensor::load<float, 3>(small); }), "truncated payload");
+  fs::resize_file(small, sizeof(tensor::file_header) / 2);
+  check(rejects([&] { (void)tensor::load<float, 3>(small); }), "truncated header");
+
+  // crafted headers: an extent wrapping around as a ptrdiff_t, and extents whose product overflows
+  tensor::tensor<float, 2> square(std::array<size_t, 2>{2, 2});
+  tensor::save(small, square);
+  patch_layout(small, {~std::uint64_t{0}, 1}, {-1, 1});
+  check(rejects([&] { (void)tensor::load<float, 2>(small); }), "wrapping extent");
+  patch_layout(small, {std::uint64_t{1} << 33, std::uint64_t{1} << 31}, {0, 0});
+  check(rejects([&] { (void)tensor::load<float, 2>(small); }), "overflowing element count");
+
+  fs::remove(path);
+  fs::remove(small);
+  std::printf("%d check%s failed\n", failures, failures == 1 ? "" : "s");
+  return failures == 0 ? 0 : 1;
+}
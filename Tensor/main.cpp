@@ -1,7 +1,137 @@
+#include <array>
+#include <cmath>
 #include <print>
 
+#include "einsum.hpp"
+#include "fixed_tensor.hpp"
 #include "tensor.hpp"
 
+namespace {
+int failures = 0;
+
+void check(bool condition, const char* what) {
+  if (condition) return;
+  ++failures;
+  std::print("FAIL {}\n", what);
+}
+
+// Tensor of the given extents with distinct small values, exact in double
+template <size_t N>
+tensor::tensor<double, N> filled(const std::array<size_t, N>& extents, size_t seed) {
+  tensor::tensor<double, N> t(extents);
+  for (size_t i = 0; i < t.num_elements(); ++i)
+    t.data()[i] = static_cast<double>((i * 7 + seed * 13) % 17) - 8.0;
+  return t;
+}
+
+template <size_t N>
+bool same(const tensor::tensor<double, N>& lhs, const tensor::tensor<double, N>& rhs) {
+  if (lhs.extents() != rhs.extents()) return false;
+  for (size_t i = 0; i < lhs.num_elements(); ++i)
+    if (lhs.data()[i] != rhs.data()[i]) return false;
+  return true;
+}
+
+// einsum against naive loops over the labels, on shapes that are not multiples of the GEMM tiles
+void check_einsum() {
+  const size_t m = 37, k = 53, n = 29, b = 3;
+  const auto x = filled<2>({m, k}, 1);
+  const auto y = filled<2>({k, n}, 2);
+  tensor::tensor<double, 2> xy(std::array<size_t, 2>{m, n});
+  for (size_t i = 0; i < m; ++i)
+    for (size_t j = 0; j < n; ++j) {
+      double sum = 0;
+      for (size_t l = 0; l < k; ++l) sum += x[i, l] * y[l, j];
+      xy[i, j] = sum;
+    }
+  check(same(tensor::einsum<"ij,jk->ik">(x, y), xy), "ij,jk->ik");
+  const auto xt = filled<2>({k, m}, 1);
+  tensor::tensor<double, 2> xty(std::array<size_t, 2>{m, n});
+  for (size_t i = 0; i < m; ++i)
+    for (size_t j = 0; j < n; ++j) {
+      double sum = 0;
+      for (size_t l = 0; l < k; ++l) sum += xt[l, i] * y[l, j];
+      xty[i, j] = sum;
+    }
+  check(same(tensor::einsum<"ij,jk->ik">(xt.view().transposed(), y), xty),
+        "ij,jk->ik on a transposed view");
+
+  const auto p = filled<3>({b, m, k}, 3);
+  const auto q = filled<3>({b, k, n}, 4);
+  tensor::tensor<double, 3> pq(std::array<size_t, 3>{b, m, n});
+  for (size_t h = 0; h < b; ++h)
+    for (size_t i = 0; i < m; ++i)
+      for (size_t j = 0; j < n; ++j) {
+        double sum = 0;
+        for (size_t l = 0; l < k; ++l) sum += p[h, i, l] * q[h, l, j];
+        pq[h, i, j] = sum;
+      }
+  check(same(tensor::einsum<"bij,bjk->bik">(p, q), pq), "bij,bjk->bik");
+
+  const auto r = filled<4>({5, 4, 7, 3}, 5);
+  const auto s = filled<2>({7, 3}, 6);
+  tensor::tensor<double, 2> rs(std::array<size_t, 2>{5, 4});
+  for (size_t i = 0; i < 5; ++i)
+    for (size_t j = 0; j < 4; ++j) {
+      double sum = 0;
+      for (size_t c = 0; c < 7; ++c)
+        for (size_t d = 0; d < 3; ++d) sum += r[i, j, c, d] * s[c, d];
+      rs[i, j] = sum;
+    }
+  check(same(tensor::einsum<"abcd,cd->ab">(r, s), rs), "abcd,cd->ab");
+
+  const auto square = filled<2>({k, k}, 7);
+  double trace = 0;
+  for (size_t i = 0; i < k; ++i) trace += square[i, i];
+  check(tensor::einsum<"ii->">(square) == trace, "ii->");
+  double total = 0;
+  for (size_t i = 0; i < m; ++i)
+    for (size_t j = 0; j < n; ++j) total += xy[i, j];
+  check(tensor::einsum<"ij->">(xy) == total, "ij->");
+}
+
+// einsum on fixed tensors, worked out by the compiler
+constexpr auto fixed_a = [] {
+  tensor::fixed_tensor<int, 2, 3> t;
+  for (size_t i = 0; i < 2; ++i)
+    for (size_t j = 0; j < 3; ++j) t[i, j] = static_cast<int>(i * 3 + j + 1);
+  return t;
+}();
+constexpr auto fixed_b = [] {
+  tensor::fixed_tensor<int, 3, 2> t;
+  for (size_t i = 0; i < 3; ++i)
+    for (size_t j = 0; j < 2; ++j) t[i, j] = static_cast<int>(i) - static_cast<int>(j);
+  return t;
+}();
+// [1 2 3; 4 5 6] [0 -1; 1 0; 2 1] = [8 2; 17 2]
+constexpr auto fixed_ab = tensor::einsum<"ij,jk->ik">(fixed_a, fixed_b);
+static_assert(fixed_ab[0, 0] == 8 && fixed_ab[0, 1] == 2 && fixed_ab[1, 0] == 17 &&
+              fixed_ab[1, 1] == 2);
+static_assert(tensor::einsum<"ii->">(fixed_ab) == 10);
+static_assert(tensor::einsum<"ij->ji">(fixed_a)[2, 1] == 6);
+static_assert(tensor::einsum<"ij,ij->">(fixed_a, fixed_a) == 91);
+static_assert((fixed_a * 2 - fixed_a) == fixed_a);
+
+// The same contraction at run time, through the fixed and the runtime-sized paths
+void check_fixed_einsum() {
+  auto a = fixed_a;
+  a[1, 2] = 7;
+  const auto ab = tensor::einsum<"ij,jk->ik">(a, fixed_b);
+  check(ab[1, 0] == 19 && ab[1, 1] == 3, "fixed_tensor einsum at run time");
+  tensor::tensor<int, 2> dynamic_a(std::array<size_t, 2>{2, 3});
+  tensor::tensor<int, 2> dynamic_b(std::array<size_t, 2>{3, 2});
+  for (size_t i = 0; i < 6; ++i) {
+    dynamic_a.data()[i] = a.elements[i];
+    dynamic_b.data()[i] = fixed_b.elements[i];
+  }
+  const auto dynamic_ab = tensor::einsum<"ij,jk->ik">(dynamic_a, dynamic_b);
+  bool agree = true;
+  for (size_t i = 0; i < 2; ++i)
+    for (size_t j = 0; j < 2; ++j) agree &= dynamic_ab[i, j] == ab[i, j];
+  check(agree, "fixed_tensor einsum against tensor einsum");
+}
+}  // namespace
+
 int main() {
   tensor::tensor<int, 2> myTensor(3);
 
@@ -27,5 +157,8 @@ int main() {
     std::println(" ");
   }
 
-  return 0;
+  check_einsum();
+  check_fixed_einsum();
+  std::print("\n{} einsum check{} failed\n", failures, failures == 1 ? "" : "s");
+  return failures == 0 ? 0 : 1;
 }
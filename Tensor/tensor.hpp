@@ -4,88 +4,1318 @@
 #ifndef TENSOR_HPP
 #define TENSOR_HPP
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <concepts>
+#include <condition_variable>
 #include <cstddef>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace tensor {
 template <typename T, size_t N>
+  requires(N >= 1)
+class tensor;
+
+template <typename T, size_t N>
+  requires(N >= 1)
+class tensor_view;
+
+template <typename Op, typename E>
+class unary_expression;
+
+template <typename Op, typename L, typename R>
+class binary_expression;
+
+namespace detail {
+template <typename E>
+struct is_expression : std::false_type {};
+
+template <typename T, size_t N>
+struct is_expression<tensor_view<T, N>> : std::true_type {};
+
+template <typename Op, typename E>
+struct is_expression<unary_expression<Op, E>> : std::true_type {};
+
+template <typename Op, typename L, typename R>
+struct is_expression<binary_expression<Op, L, R>> : std::true_type {};
+
+template <typename E>
+struct is_tensor : std::false_type {};
+
+template <typename T, size_t N>
+struct is_tensor<tensor<T, N>> : std::true_type {};
+}  // namespace detail
+
+/**
+ * Lazily evaluated tensor valued expression: a view or an element-wise
+ * operation on expressions
+ */
+template <typename E>
+concept expression = detail::is_expression<std::remove_cvref_t<E>>::value;
+
+/**
+ * Tensor or tensor valued expression, what the element-wise operators and the
+ * reductions accept
+ */
+template <typename E>
+concept operand = expression<E> || detail::is_tensor<std::remove_cvref_t<E>>::value;
+
+/**
+ * Range of indices along one axis, as in NumPy: start is inclusive, stop
+ * exclusive, negative values count from the end and none selects the whole
+ * axis in the direction of step, which may be negative but not zero.
+ */
+struct slice {
+  static constexpr std::ptrdiff_t none = std::numeric_limits<std::ptrdiff_t>::min();
+
+  std::ptrdiff_t start = none;
+  std::ptrdiff_t stop = none;
+  std::ptrdiff_t step = 1;
+};
+
+namespace detail {
+// Extents or strides without the first M axes
+template <size_t M = 1, typename V, size_t N>
+constexpr std::array<V, N - M> drop_front(const std::array<V, N>& values) {
+  std::array<V, N - M> result{};
+  std::copy(values.begin() + M, values.end(), result.begin());
+  return result;
+}
+
+// Row-major strides of a contiguous buffer with the given extents, the last axis has stride 1
+template <size_t N>
+constexpr std::array<std::ptrdiff_t, N> contiguous_strides(const std::array<size_t, N>& extents) {
+  std::array<std::ptrdiff_t, N> strides{};
+  std::ptrdiff_t stride = 1;
+  for (size_t axis = N; axis-- > 0;) {
+    strides[axis] = stride;
+    stride *= static_cast<std::ptrdiff_t>(extents[axis]);
+  }
+  return strides;
+}
+
+// Number of elements of a buffer with the given extents
+template <size_t N>
+constexpr size_t count(const std::array<size_t, N>& extents) {
+  size_t result = 1;
+  for (size_t extent : extents) result *= extent;
+  return result;
+}
+
+// Offset i0 * s0 + i1 * s1 + ... of the element at the given leading indices, a single
+// multiply-add chain once inlined
+template <size_t N, typename... Args, size_t... Axes>
+constexpr std::ptrdiff_t strided_offset(const std::array<std::ptrdiff_t, N>& strides,
+                                        std::index_sequence<Axes...>, Args... indices) {
+  std::ptrdiff_t offset = 0;
+  ((offset += static_cast<std::ptrdiff_t>(indices) * strides[Axes]), ...);
+  return offset;
+}
+
+// Axes from outermost to innermost for a traversal touching memory in increasing stride order:
+// the axis with the smallest stride runs innermost, axes of extent 1 are moved outermost
+template <size_t N>
+constexpr std::array<size_t, N> traversal_order(const std::array<size_t, N>& extents,
+                                                const std::array<std::ptrdiff_t, N>& strides) {
+  std::array<size_t, N> order{};
+  for (size_t axis = 0; axis < N; ++axis) order[axis] = axis;
+  auto magnitude = [&](size_t axis) {
+    return extents[axis] == 1 ? std::numeric_limits<std::ptrdiff_t>::max()
+                              : (strides[axis] < 0 ? -strides[axis] : strides[axis]);
+  };
+  // insertion sort, stable and constexpr, N is small
+  for (size_t i = 1; i < N; ++i) {
+    for (size_t j = i; j > 0 && magnitude(order[j - 1]) < magnitude(order[j]); --j)
+      std::swap(order[j - 1], order[j]);
+  }
+  return order;
+}
+
+// Base pointer and strides of one operand of strided_for_each
+template <typename T, size_t N>
+struct strided {
+  T* data;
+  std::array<std::ptrdiff_t, N> strides;
+};
+
+// Calls f with the elements of every operand at each index of the given extents, looping over
+// the axes in the given order with the last one as the tight inner loop
+template <size_t N, typename F, typename... T>
+constexpr void strided_for_each(const std::array<size_t, N>& extents,
+                                const std::array<size_t, N>& order, F&& f,
+                                strided<T, N>... operands) {
+  if (count(extents) == 0) return;
+  const size_t inner = order[N - 1];
+  const size_t length = extents[inner];
+  std::array<size_t, N> index{};
+  auto base = [&](const auto& operand) {
+    std::ptrdiff_t offset = 0;
+    for (size_t axis = 0; axis < N; ++axis)
+      offset += static_cast<std::ptrdiff_t>(index[axis]) * operand.strides[axis];
+    return operand.data + offset;
+  };
+  auto run = [&](auto*... bases) {
+    for (size_t i = 0; i < length; ++i) {
+      const auto k = static_cast<std::ptrdiff_t>(i);
+      f(bases[k * operands.strides[inner]]...);
+    }
+  };
+  for (;;) {
+    run(base(operands)...);
+    size_t position = N - 1;
+    for (;;) {
+      if (position-- == 0) return;
+      const size_t axis = order[position];
+      if (++index[axis] < extents[axis]) break;
+      index[axis] = 0;
+    }
+  }
+}
+}  // namespace detail
+
+/**
+ * Dense rank N tensor in one contiguous row-major buffer.
+ *
+ * Construction performs exactly one allocation. Elements are reached with
+ * t[i, j, k], whose offset ((i * e1 + j) * e2 + k) compiles to a single
+ * multiply-add chain, or one axis at a time with t[i][j][k], where every
+ * step but the last returns a tensor_view sharing the buffer.
+ */
+template <typename T, size_t N>
+  requires(N >= 1)
 class tensor {
  public:
+  using value_type = T;
+  static constexpr size_t rank = N;
+
   constexpr explicit tensor(size_t size = 3);
+  constexpr explicit tensor(const std::array<size_t, N>& extents);
+
+  template <expression E>
+    requires(E::rank == N) && std::convertible_to<typename E::value_type, T>
+  constexpr explicit tensor(const E& expr);
 
-  constexpr tensor<T, N - 1>& operator[](size_t k);
-  constexpr const tensor<T, N - 1>& operator[](size_t k) const;
+  template <expression E>
+    requires(E::rank == N) && std::convertible_to<typename E::value_type, T>
+  constexpr tensor& operator=(const E& expr);
+
+  constexpr decltype(auto) operator[](size_t k);
+  constexpr decltype(auto) operator[](size_t k) const;
 
   template <typename... Args>
-    requires(sizeof...(Args) < N) && (sizeof...(Args) >= 1)
-  decltype(auto) operator[](size_t i, Args&&... args) {
-    return operator[](i).operator[](args...);
-  }
+    requires(sizeof...(Args) < N) && (sizeof...(Args) >= 1) &&
+            (std::convertible_to<Args, size_t> && ...)
+  constexpr decltype(auto) operator[](size_t i, Args... args);
+
+  template <typename... Args>
+    requires(sizeof...(Args) < N) && (sizeof...(Args) >= 1) &&
+            (std::convertible_to<Args, size_t> && ...)
+  constexpr decltype(auto) operator[](size_t i, Args... args) const;
 
   constexpr void resize(size_t size);
+  constexpr void resize(const std::array<size_t, N>& extents);
+
+  [[nodiscard]] constexpr tensor_view<T, N> view() {
+    return {elements.data(), extents_, strides()};
+  }
+  [[nodiscard]] constexpr tensor_view<const T, N> view() const {
+    return {elements.data(), extents_, strides()};
+  }
 
-  [[nodiscard]] constexpr size_t size() const { return elements.size(); }
+  template <typename F>
+  constexpr void for_each(F&& f) {
+    view().for_each(std::forward<F>(f));
+  }
+  template <typename F>
+  constexpr void for_each(F&& f) const {
+    view().for_each(std::forward<F>(f));
+  }
+
+  [[nodiscard]] constexpr size_t size() const { return extents_[0]; }
+  [[nodiscard]] constexpr size_t extent(size_t axis) const { return extents_[axis]; }
+  [[nodiscard]] constexpr const std::array<size_t, N>& extents() const { return extents_; }
+  [[nodiscard]] constexpr std::array<std::ptrdiff_t, N> strides() const {
+    return detail::contiguous_strides(extents_);
+  }
+  [[nodiscard]] constexpr size_t num_elements() const { return elements.size(); }
+
+  [[nodiscard]] constexpr T* data() { return elements.data(); }
+  [[nodiscard]] constexpr const T* data() const { return elements.data(); }
 
  private:
-  std::vector<tensor<T, N - 1>> elements;
+  template <typename... Args>
+  constexpr size_t offset(Args... indices) const;
+
+  template <typename U, typename... Args>
+  static constexpr decltype(auto) at(U* data, const std::array<size_t, N>& extents,
+                                     size_t offset, Args... indices);
+
+  std::array<size_t, N> extents_{};
+  std::vector<T> elements;
 };
 
-template <typename T>
-class tensor<T, 1> {
+/**
+ * Non-owning rank N window on strided storage, such as the sub-tensors, slices
+ * and permutations of a tensor. Copying a view never copies elements, strides
+ * may be negative.
+ */
+template <typename T, size_t N>
+  requires(N >= 1)
+class tensor_view {
  public:
-  constexpr explicit tensor(size_t size = 3);
+  using value_type = std::remove_const_t<T>;
+  static constexpr size_t rank = N;
 
-  constexpr T& operator[](size_t k);
-  constexpr const T& operator[](size_t k) const;
+  constexpr tensor_view(T* data, const std::array<size_t, N>& extents,
+                        const std::array<std::ptrdiff_t, N>& strides)
+      : data_(data), extents_(extents), strides_(strides) {}
 
-  constexpr void resize(size_t size);
+  template <typename U>
+    requires(!std::same_as<U, T>) && std::convertible_to<U*, T*>
+  constexpr tensor_view(const tensor_view<U, N>& other)
+      : data_(other.data()), extents_(other.extents()), strides_(other.strides()) {}
+
+  constexpr decltype(auto) operator[](size_t k) const;
+
+  template <typename... Args>
+    requires(sizeof...(Args) < N) && (sizeof...(Args) >= 1) &&
+            (std::convertible_to<Args, size_t> && ...)
+  constexpr decltype(auto) operator[](size_t i, Args... args) const;
+
+  [[nodiscard]] constexpr tensor_view sliced(size_t axis, const slice& range) const;
 
-  [[nodiscard]] constexpr size_t size() const { return elements.size(); }
+  template <typename... Slices>
+    requires(sizeof...(Slices) == N) && (std::same_as<Slices, slice> && ...)
+  [[nodiscard]] constexpr tensor_view sliced(const Slices&... ranges) const;
+
+  [[nodiscard]] constexpr tensor_view permuted(const std::array<size_t, N>& axes) const;
+  [[nodiscard]] constexpr tensor_view transposed() const;
+
+  template <expression E>
+    requires(!std::is_const_v<T>) && (E::rank <= N) &&
+            std::convertible_to<typename E::value_type, T>
+  constexpr const tensor_view& assign(const E& expr) const;
+
+  template <typename F>
+  constexpr void for_each(F&& f) const;
+
+  [[nodiscard]] constexpr size_t size() const { return extents_[0]; }
+  [[nodiscard]] constexpr size_t extent(size_t axis) const { return extents_[axis]; }
+  [[nodiscard]] constexpr const std::array<size_t, N>& extents() const { return extents_; }
+  [[nodiscard]] constexpr const std::array<std::ptrdiff_t, N>& strides() const {
+    return strides_;
+  }
+  [[nodiscard]] constexpr size_t num_elements() const { return detail::count(extents_); }
+
+  [[nodiscard]] constexpr T* data() const { return data_; }
 
  private:
-  std::vector<T> elements;
+  T* data_;
+  std::array<size_t, N> extents_;
+  std::array<std::ptrdiff_t, N> strides_;
 };
 
 template <typename T, size_t N>
+  requires(N >= 1)
 constexpr tensor<T, N>::tensor(size_t size) {
   resize(size);
 }
 
 template <typename T, size_t N>
+  requires(N >= 1)
+constexpr tensor<T, N>::tensor(const std::array<size_t, N>& extents) {
+  resize(extents);
+}
+
+template <typename T, size_t N>
+  requires(N >= 1)
 constexpr void tensor<T, N>::resize(size_t size) {
-  elements.resize(size);
+  std::array<size_t, N> extents{};
+  extents.fill(size);
+  resize(extents);
+}
 
-  for (auto& element : elements) element.resize(size);
+template <typename T, size_t N>
+  requires(N >= 1)
+constexpr void tensor<T, N>::resize(const std::array<size_t, N>& extents) {
+  if (extents == extents_) return;
+
+  // elements at indices valid in both shapes keep their values, the others are value-initialized
+  std::vector<T> resized(detail::count(extents));
+  std::array<size_t, N> common{};
+  for (size_t axis = 0; axis < N; ++axis) common[axis] = std::min(extents[axis], extents_[axis]);
+  const size_t rows = detail::count(common) / std::max<size_t>(common[N - 1], 1);
+  if (common[N - 1] != 0) {
+    const auto from = detail::contiguous_strides(extents_);
+    const auto to = detail::contiguous_strides(extents);
+    std::array<size_t, N> index{};
+    for (size_t row = 0; row < rows; ++row) {
+      std::ptrdiff_t source = 0;
+      std::ptrdiff_t target = 0;
+      for (size_t axis = 0; axis + 1 < N; ++axis) {
+        source += static_cast<std::ptrdiff_t>(index[axis]) * from[axis];
+        target += static_cast<std::ptrdiff_t>(index[axis]) * to[axis];
+      }
+      std::move(elements.begin() + source,
+                elements.begin() + source + static_cast<std::ptrdiff_t>(common[N - 1]),
+                resized.begin() + target);
+      for (size_t axis = N - 1; axis-- > 0;) {
+        if (++index[axis] < common[axis]) break;
+        index[axis] = 0;
+      }
+    }
+  }
+  elements = std::move(resized);
+  extents_ = extents;
 }
 
 template <typename T, size_t N>
-constexpr tensor<T, N - 1>& tensor<T, N>::operator[](size_t k) {
-  return elements[k];
+  requires(N >= 1)
+template <typename... Args>
+constexpr size_t tensor<T, N>::offset(Args... indices) const {
+  // Horner form over the extents, the innermost stride is 1 by construction
+  size_t result = 0;
+  size_t axis = 0;
+  ((result = result * extents_[axis++] + static_cast<size_t>(indices)), ...);
+  return result;
 }
 
 template <typename T, size_t N>
-constexpr const tensor<T, N - 1>& tensor<T, N>::operator[](size_t k) const {
-  return elements[k];
+  requires(N >= 1)
+template <typename U, typename... Args>
+constexpr decltype(auto) tensor<T, N>::at(U* data, const std::array<size_t, N>& extents,
+                                          size_t offset, Args...) {
+  constexpr size_t M = sizeof...(Args);
+  if constexpr (M == N) {
+    return static_cast<U&>(data[offset]);
+  } else {
+    // offset is in units of the leading M axes, scale it by the extents of the others
+    const auto rest = detail::drop_front<M>(extents);
+    return tensor_view<U, N - M>(data + offset * detail::count(rest), rest,
+                                 detail::contiguous_strides(rest));
+  }
 }
 
-template <typename T>
-constexpr tensor<T, 1>::tensor(size_t size) {
-  resize(size);
+template <typename T, size_t N>
+  requires(N >= 1)
+constexpr decltype(auto) tensor<T, N>::operator[](size_t k) {
+  return at(elements.data(), extents_, k, k);
 }
 
-template <typename T>
-constexpr void tensor<T, 1>::resize(size_t size) {
-  elements.resize(size);
+template <typename T, size_t N>
+  requires(N >= 1)
+constexpr decltype(auto) tensor<T, N>::operator[](size_t k) const {
+  return at(elements.data(), extents_, k, k);
+}
+
+template <typename T, size_t N>
+  requires(N >= 1)
+template <typename... Args>
+  requires(sizeof...(Args) < N) && (sizeof...(Args) >= 1) &&
+          (std::convertible_to<Args, size_t> && ...)
+constexpr decltype(auto) tensor<T, N>::operator[](size_t i, Args... args) {
+  return at(elements.data(), extents_, offset(i, args...), i, args...);
+}
+
+template <typename T, size_t N>
+  requires(N >= 1)
+template <typename... Args>
+  requires(sizeof...(Args) < N) && (sizeof...(Args) >= 1) &&
+          (std::convertible_to<Args, size_t> && ...)
+constexpr decltype(auto) tensor<T, N>::operator[](size_t i, Args... args) const {
+  return at(elements.data(), extents_, offset(i, args...), i, args...);
+}
+
+template <typename T, size_t N>
+  requires(N >= 1)
+constexpr decltype(auto) tensor_view<T, N>::operator[](size_t k) const {
+  const std::ptrdiff_t offset = static_cast<std::ptrdiff_t>(k) * strides_[0];
+  if constexpr (N == 1) {
+    return static_cast<T&>(data_[offset]);
+  } else {
+    return tensor_view<T, N - 1>(data_ + offset, detail::drop_front(extents_),
+                                 detail::drop_front(strides_));
+  }
+}
+
+template <typename T, size_t N>
+  requires(N >= 1)
+template <typename... Args>
+  requires(sizeof...(Args) < N) && (sizeof...(Args) >= 1) &&
+          (std::convertible_to<Args, size_t> && ...)
+constexpr decltype(auto) tensor_view<T, N>::operator[](size_t i, Args... args) const {
+  constexpr size_t M = sizeof...(Args) + 1;
+  T* const element = data_ + detail::strided_offset(strides_, std::make_index_sequence<M>(),
+                                                    i, args...);
+  if constexpr (M == N) {
+    return static_cast<T&>(*element);
+  } else {
+    return tensor_view<T, N - M>(element, detail::drop_front<M>(extents_),
+                                 detail::drop_front<M>(strides_));
+  }
+}
+
+template <typename T, size_t N>
+  requires(N >= 1)
+constexpr tensor_view<T, N> tensor_view<T, N>::sliced(size_t axis, const slice& range) const {
+  assert(axis < N);
+  assert(range.step != 0);
+  const auto extent = static_cast<std::ptrdiff_t>(extents_[axis]);
+  const std::ptrdiff_t step = range.step;
+  // resolve negative and missing bounds, then clamp them like Python does
+  auto bound = [&](std::ptrdiff_t value, std::ptrdiff_t missing) {
+    if (value == slice::none) return missing;
+    if (value < 0) value += extent;
+    return step > 0 ? std::clamp<std::ptrdiff_t>(value, 0, extent)
+                    : std::clamp<std::ptrdiff_t>(value, -1, extent - 1);
+  };
+  const std::ptrdiff_t start = bound(range.start, step > 0 ? 0 : extent - 1);
+  const std::ptrdiff_t stop = bound(range.stop, step > 0 ? extent : -1);
+  const std::ptrdiff_t length =
+      step > 0 ? (stop - start + step - 1) / step : (start - stop - step - 1) / -step;
+
+  tensor_view result = *this;
+  result.extents_[axis] = static_cast<size_t>(std::max<std::ptrdiff_t>(length, 0));
+  result.strides_[axis] = strides_[axis] * step;
+  if (result.extents_[axis] != 0) result.data_ += start * strides_[axis];
+  return result;
+}
+
+template <typename T, size_t N>
+  requires(N >= 1)
+template <typename... Slices>
+  requires(sizeof...(Slices) == N) && (std::same_as<Slices, slice> && ...)
+constexpr tensor_view<T, N> tensor_view<T, N>::sliced(const Slices&... ranges) const {
+  tensor_view result = *this;
+  size_t axis = 0;
+  ((result = result.sliced(axis++, ranges)), ...);
+  return result;
+}
+
+template <typename T, size_t N>
+  requires(N >= 1)
+constexpr tensor_view<T, N> tensor_view<T, N>::permuted(const std::array<size_t, N>& axes) const {
+  tensor_view result = *this;
+  for (size_t axis = 0; axis < N; ++axis) {
+    result.extents_[axis] = extents_[axes[axis]];
+    result.strides_[axis] = strides_[axes[axis]];
+  }
+  return result;
 }
 
+template <typename T, size_t N>
+  requires(N >= 1)
+constexpr tensor_view<T, N> tensor_view<T, N>::transposed() const {
+  std::array<size_t, N> axes{};
+  for (size_t axis = 0; axis < N; ++axis) axes[axis] = N - 1 - axis;
+  return permuted(axes);
+}
+
+template <typename T, size_t N>
+  requires(N >= 1)
+template <typename F>
+constexpr void tensor_view<T, N>::for_each(F&& f) const {
+  detail::strided_for_each(extents_, detail::traversal_order(extents_, strides_), f,
+                           detail::strided<T, N>{data_, strides_});
+}
+
+/**
+ * Scalar operand of an element-wise operation, broadcast to every index
+ */
 template <typename T>
-constexpr T& tensor<T, 1>::operator[](size_t k) {
-  return elements[k];
+  requires std::is_arithmetic_v<T>
+class scalar_operand {
+ public:
+  using value_type = T;
+  static constexpr size_t rank = 0;
+
+  constexpr explicit scalar_operand(T value) : value_(value) {}
+
+  [[nodiscard]] constexpr std::array<size_t, 0> extents() const { return {}; }
+  [[nodiscard]] constexpr T value() const { return value_; }
+
+ private:
+  T value_;
+};
+
+namespace detail {
+template <typename T, size_t N>
+constexpr tensor_view<const T, N> as_operand(const tensor<T, N>& t) {
+  return t.view();
+}
+
+template <typename T, size_t N>
+constexpr tensor_view<const T, N> as_operand(const tensor_view<T, N>& view) {
+  return view;
+}
+
+template <typename Op, typename E>
+constexpr unary_expression<Op, E> as_operand(const unary_expression<Op, E>& expr) {
+  return expr;
+}
+
+template <typename Op, typename L, typename R>
+constexpr binary_expression<Op, L, R> as_operand(const binary_expression<Op, L, R>& expr) {
+  return expr;
 }
 
 template <typename T>
-constexpr const T& tensor<T, 1>::operator[](size_t k) const {
-  return elements[k];
+  requires std::is_arithmetic_v<T>
+constexpr scalar_operand<T> as_operand(T value) {
+  return scalar_operand<T>(value);
+}
+
+// What an operand is stored as inside an expression: views for tensors, the nodes themselves
+template <typename X>
+using operand_t = decltype(as_operand(std::declval<const X&>()));
+
+// Extents of the NumPy broadcast of two shapes, aligned on their last axes
+template <size_t A, size_t B>
+constexpr std::array<size_t, std::max(A, B)> broadcast_extents(const std::array<size_t, A>& a,
+                                                               const std::array<size_t, B>& b) {
+  constexpr size_t R = std::max(A, B);
+  std::array<size_t, R> result{};
+  for (size_t axis = 0; axis < R; ++axis) {
+    const size_t ea = axis >= R - A ? a[axis - (R - A)] : 1;
+    const size_t eb = axis >= R - B ? b[axis - (R - B)] : 1;
+    assert(ea == eb || ea == 1 || eb == 1);
+    result[axis] = ea == 1 ? eb : ea;
+  }
+  return result;
+}
+
+// Number of views among the leaves of an expression
+template <typename E>
+struct leaf_count : std::integral_constant<size_t, 0> {};
+
+template <typename T, size_t N>
+struct leaf_count<tensor_view<T, N>> : std::integral_constant<size_t, 1> {};
+
+template <typename Op, typename E>
+struct leaf_count<unary_expression<Op, E>> : leaf_count<E> {};
+
+template <typename Op, typename L, typename R>
+struct leaf_count<binary_expression<Op, L, R>>
+    : std::integral_constant<size_t, leaf_count<L>::value + leaf_count<R>::value> {};
+
+/*
+ * Cursors walk an expression along the rows of a rank R index space. seek()
+ * moves them to the start of a row, value<Mask>(i) reads the i-th element of
+ * the row when every view has a stride of 0 or 1 along it, the K-th view being
+ * contiguous when bit K of Mask is set, and strided(i) reads it for any strides.
+ */
+
+template <typename T, size_t R, size_t K>
+struct leaf_cursor {
+  static constexpr size_t leaves = 1;
+
+  const T* data;
+  std::array<std::ptrdiff_t, R> strides;
+  const T* row = nullptr;
+  std::ptrdiff_t inner = 0;
+
+  constexpr void set_inner(size_t axis) { inner = strides[axis]; }
+  constexpr void add_strides(std::array<std::ptrdiff_t, R>& total) const {
+    for (size_t axis = 0; axis < R; ++axis)
+      total[axis] += strides[axis] < 0 ? -strides[axis] : strides[axis];
+  }
+  [[nodiscard]] constexpr bool unit_or_broadcast() const { return inner == 0 || inner == 1; }
+  [[nodiscard]] constexpr unsigned unit_mask() const {
+    if constexpr (K < 32) return inner == 1 ? 1u << K : 0u;
+    return 0u;
+  }
+  constexpr void seek(const std::array<size_t, R>& index) {
+    std::ptrdiff_t offset = 0;
+    for (size_t axis = 0; axis < R; ++axis)
+      offset += static_cast<std::ptrdiff_t>(index[axis]) * strides[axis];
+    row = data + offset;
+  }
+  template <unsigned Mask>
+  [[nodiscard]] constexpr std::remove_const_t<T> value(size_t i) const {
+    if constexpr (K < 32 && (Mask >> K & 1u))
+      return row[i];
+    else
+      return *row;
+  }
+  [[nodiscard]] constexpr std::remove_const_t<T> strided(size_t i) const {
+    return row[static_cast<std::ptrdiff_t>(i) * inner];
+  }
+};
+
+template <typename T, size_t R>
+struct scalar_cursor {
+  static constexpr size_t leaves = 0;
+
+  T scalar;
+
+  constexpr void set_inner(size_t) {}
+  constexpr void add_strides(std::array<std::ptrdiff_t, R>&) const {}
+  [[nodiscard]] constexpr bool unit_or_broadcast() const { return true; }
+  [[nodiscard]] constexpr unsigned unit_mask() const { return 0u; }
+  constexpr void seek(const std::array<size_t, R>&) {}
+  template <unsigned Mask>
+  [[nodiscard]] constexpr T value(size_t) const {
+    return scalar;
+  }
+  [[nodiscard]] constexpr T strided(size_t) const { return scalar; }
+};
+
+template <typename Op, typename C, size_t R>
+struct unary_cursor {
+  static constexpr size_t leaves = C::leaves;
+
+  [[no_unique_address]] Op op;
+  C operand;
+
+  constexpr void set_inner(size_t axis) { operand.set_inner(axis); }
+  constexpr void add_strides(std::array<std::ptrdiff_t, R>& total) const {
+    operand.add_strides(total);
+  }
+  [[nodiscard]] constexpr bool unit_or_broadcast() const { return operand.unit_or_broadcast(); }
+  [[nodiscard]] constexpr unsigned unit_mask() const { return operand.unit_mask(); }
+  constexpr void seek(const std::array<size_t, R>& index) { operand.seek(index); }
+  template <unsigned Mask>
+  [[nodiscard]] constexpr auto value(size_t i) const {
+    return op(operand.template value<Mask>(i));
+  }
+  [[nodiscard]] constexpr auto strided(size_t i) const { return op(operand.strided(i)); }
+};
+
+template <typename Op, typename L, typename Rhs, size_t R>
+struct binary_cursor {
+  static constexpr size_t leaves = L::leaves + Rhs::leaves;
+
+  [[no_unique_address]] Op op;
+  L lhs;
+  Rhs rhs;
+
+  constexpr void set_inner(size_t axis) {
+    lhs.set_inner(axis);
+    rhs.set_inner(axis);
+  }
+  constexpr void add_strides(std::array<std::ptrdiff_t, R>& total) const {
+    lhs.add_strides(total);
+    rhs.add_strides(total);
+  }
+  [[nodiscard]] constexpr bool unit_or_broadcast() const {
+    return lhs.unit_or_broadcast() && rhs.unit_or_broadcast();
+  }
+  [[nodiscard]] constexpr unsigned unit_mask() const { return lhs.unit_mask() | rhs.unit_mask(); }
+  constexpr void seek(const std::array<size_t, R>& index) {
+    lhs.seek(index);
+    rhs.seek(index);
+  }
+  template <unsigned Mask>
+  [[nodiscard]] constexpr auto value(size_t i) const {
+    return op(lhs.template value<Mask>(i), rhs.template value<Mask>(i));
+  }
+  [[nodiscard]] constexpr auto strided(size_t i) const {
+    return op(lhs.strided(i), rhs.strided(i));
+  }
+};
+
+// Cursor over a view broadcast to the target extents, its K-th leaf
+template <size_t R, size_t K, typename T, size_t N>
+constexpr auto make_cursor(const tensor_view<T, N>& view, const std::array<size_t, R>& target) {
+  static_assert(N <= R, "an operand cannot have more axes than the result");
+  std::array<std::ptrdiff_t, R> strides{};
+  for (size_t axis = R - N; axis < R; ++axis) {
+    const size_t extent = view.extent(axis - (R - N));
+    assert(extent == target[axis] || extent == 1);
+    strides[axis] = extent == 1 ? 0 : view.strides()[axis - (R - N)];
+  }
+  return leaf_cursor<T, R, K>{view.data(), strides};
+}
+
+template <size_t R, size_t K, typename T>
+constexpr auto make_cursor(const scalar_operand<T>& scalar, const std::array<size_t, R>&) {
+  return scalar_cursor<T, R>{scalar.value()};
+}
+
+template <size_t R, size_t K, typename Op, typename E>
+constexpr auto make_cursor(const unary_expression<Op, E>& expr,
+                           const std::array<size_t, R>& target) {
+  auto operand = make_cursor<R, K>(expr.operand(), target);
+  return unary_cursor<Op, decltype(operand), R>{expr.op(), operand};
+}
+
+template <size_t R, size_t K, typename Op, typename L, typename Rhs>
+constexpr auto make_cursor(const binary_expression<Op, L, Rhs>& expr,
+                           const std::array<size_t, R>& target) {
+  auto lhs = make_cursor<R, K>(expr.lhs(), target);
+  auto rhs = make_cursor<R, K + leaf_count<L>::value>(expr.rhs(), target);
+  return binary_cursor<Op, decltype(lhs), decltype(rhs), R>{expr.op(), lhs, rhs};
+}
+
+// Whether some view of expr, broadcast to the given extents, shares memory with the destination
+// other than by reading the very element being written, so that evaluating in place could read
+// elements already overwritten. Broadcast axes count as shifted, and at compile time, where
+// unrelated addresses cannot be ordered, so does every view not read at the written index
+template <size_t R, typename D, typename E>
+constexpr bool overlaps_shifted(const std::array<size_t, R>& extents, const D* dst,
+                                const std::array<std::ptrdiff_t, R>& dst_strides, const E& expr) {
+  if constexpr (requires { expr.lhs(); }) {
+    return overlaps_shifted(extents, dst, dst_strides, expr.lhs()) ||
+           overlaps_shifted(extents, dst, dst_strides, expr.rhs());
+  } else if constexpr (requires { expr.operand(); }) {
+    return overlaps_shifted(extents, dst, dst_strides, expr.operand());
+  } else if constexpr (leaf_count<E>::value == 0) {
+    return false;
+  } else {
+    constexpr size_t N = E::rank;
+    if (count(extents) == 0 || expr.num_elements() == 0) return false;
+    // strides of the view broadcast to the destination, as its cursor reads it
+    std::array<std::ptrdiff_t, R> strides{};
+    for (size_t axis = R - N; axis < R; ++axis) {
+      const size_t a = axis - (R - N);
+      strides[axis] = expr.extent(a) == 1 ? 0 : expr.strides()[a];
+    }
+    bool same_index = std::is_same_v<typename E::value_type, std::remove_const_t<D>> &&
+                      static_cast<const void*>(expr.data()) == static_cast<const void*>(dst);
+    for (size_t axis = 0; axis < R; ++axis)
+      same_index = same_index && (extents[axis] == 1 || strides[axis] == dst_strides[axis]);
+    if (same_index) return false;
+
+    if consteval {
+      return true;
+    } else {
+      // byte ranges [first, last) spanned by the view and the destination
+      auto span = [](const void* data, const auto& view_extents, const auto& view_strides,
+                     size_t size) {
+        std::ptrdiff_t low = 0;
+        std::ptrdiff_t high = 0;
+        for (size_t axis = 0; axis < view_extents.size(); ++axis) {
+          const std::ptrdiff_t reach =
+              static_cast<std::ptrdiff_t>(view_extents[axis] - 1) * view_strides[axis];
+          (reach < 0 ? low : high) += reach;
+        }
+        const auto* base = static_cast<const std::byte*>(data);
+        return std::pair(base + low * static_cast<std::ptrdiff_t>(size),
+                         base + (high + 1) * static_cast<std::ptrdiff_t>(size));
+      };
+      const auto [first, last] =
+          span(expr.data(), expr.extents(), expr.strides(), sizeof(typename E::value_type));
+      const auto [dst_first, dst_last] = span(dst, extents, dst_strides, sizeof(D));
+      const std::less<const std::byte*> less;
+      return less(first, dst_last) && less(dst_first, last);
+    }
+  }
+}
+
+// Views of an expression distinguished by the row kernels, 2^leaves kernels are instantiated
+inline constexpr size_t dispatched_leaves = 4;
+
+// Elements below which evaluation stays on the calling thread
+inline constexpr size_t parallel_grain = size_t{1} << 16;
+
+// Worker threads kept for the whole program, one per core with the calling thread taking part in
+// every job. Jobs from different threads run one after the other, a job started from inside a
+// task runs on the calling thread alone
+class thread_pool {
+ public:
+  explicit thread_pool(size_t threads) {
+    for (size_t t = 1; t < threads; ++t) workers_.emplace_back([this] { work(); });
+  }
+
+  ~thread_pool() {
+    {
+      std::lock_guard lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread& worker : workers_) worker.join();
+  }
+
+  thread_pool(const thread_pool&) = delete;
+  thread_pool& operator=(const thread_pool&) = delete;
+
+  [[nodiscard]] size_t size() const { return workers_.size() + 1; }
+
+  // Calls task(t) for every t in [0, n) and returns once all calls have finished. When a call
+  // throws, the calls not started yet are skipped and the first exception is rethrown here
+  void run(size_t n, const std::function<void(size_t)>& task) {
+    if (workers_.empty() || n <= 1 || in_task()) {
+      for (size_t t = 0; t < n; ++t) task(t);
+      return;
+    }
+    std::lock_guard run_lock(run_mutex_);
+    {
+      std::lock_guard lock(mutex_);
+      job_ = &task;
+      tasks_ = n;
+      next_ = 0;
+      active_ = workers_.size();
+      ++generation_;
+    }
+    wake_.notify_all();
+    drain(task, n);
+    std::exception_ptr error;
+    {
+      std::unique_lock lock(mutex_);
+      done_.wait(lock, [&] { return active_ == 0; });
+      error = std::exchange(error_, nullptr);
+    }
+    if (error) std::rethrow_exception(error);
+  }
+
+  static thread_pool& shared() {
+    static thread_pool pool(std::max<size_t>(std::thread::hardware_concurrency(), 1));
+    return pool;
+  }
+
+ private:
+  static bool& in_task() {
+    thread_local bool flag = false;
+    return flag;
+  }
+
+  // Keeps the first exception of the job and cancels the rest of it
+  void drain(const std::function<void(size_t)>& task, size_t n) {
+    struct task_scope {
+      bool nested = std::exchange(in_task(), true);
+      ~task_scope() { in_task() = nested; }
+    } scope;
+    for (size_t t = next_++; t < n; t = next_++) {
+      try {
+        task(t);
+      } catch (...) {
+        std::lock_guard lock(mutex_);
+        if (!error_) error_ = std::current_exception();
+        next_ = n;
+      }
+    }
+  }
+
+  void work() {
+    size_t seen = 0;
+    for (;;) {
+      const std::function<void(size_t)>* task;
+      size_t n;
+      {
+        std::unique_lock lock(mutex_);
+        wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+        if (stop_) return;
+        seen = generation_;
+        task = job_;
+        n = tasks_;
+      }
+      drain(*task, n);
+      std::lock_guard lock(mutex_);
+      if (--active_ == 0) done_.notify_one();
+    }
+  }
+
+  std::vector<std::thread> workers_;
+  std::mutex run_mutex_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  const std::function<void(size_t)>* job_ = nullptr;
+  size_t tasks_ = 0;
+  std::atomic<size_t> next_{0};
+  size_t active_ = 0;
+  size_t generation_ = 0;
+  std::exception_ptr error_;
+  bool stop_ = false;
+};
+
+// Runs f(begin, end) over a partition of [0, n) on up to one thread per core of the shared pool
+// when there is enough work, n items of work elements each
+template <typename F>
+constexpr void parallel_for(size_t n, size_t work, F&& f) {
+  if consteval {
+    f(size_t{0}, n);
+  } else {
+    thread_pool& pool = thread_pool::shared();
+    const size_t threads = std::min({pool.size(), n, n * work / parallel_grain});
+    if (threads <= 1) {
+      f(size_t{0}, n);
+      return;
+    }
+    pool.run(threads, [&](size_t t) { f(n * t / threads, n * (t + 1) / threads); });
+  }
+}
+
+// Combines every element of the cursor into the destination element at the same index, over the
+// indices whose split axis lies in [begin, end), with the last axis of order as the inner loop.
+// Destination strides of 0 reduce along their axis
+template <size_t R, typename D, typename C, typename Combine>
+constexpr void evaluate_rows(const std::array<size_t, R>& extents,
+                             const std::array<size_t, R>& order, size_t split, size_t begin,
+                             size_t end, D* dst, const std::array<std::ptrdiff_t, R>& dst_strides,
+                             C cursor, Combine combine) {
+  std::array<size_t, R> lower{};
+  std::array<size_t, R> upper = extents;
+  lower[split] = begin;
+  upper[split] = end;
+  for (size_t axis = 0; axis < R; ++axis)
+    if (lower[axis] >= upper[axis]) return;
+
+  const size_t inner = order[R - 1];
+  const size_t length = upper[inner] - lower[inner];
+  const std::ptrdiff_t dst_inner = dst_strides[inner];
+  cursor.set_inner(inner);
+
+  auto rows = [&](auto&& row_kernel) {
+    std::array<size_t, R> index = lower;
+    for (;;) {
+      cursor.seek(index);
+      std::ptrdiff_t offset = 0;
+      for (size_t axis = 0; axis < R; ++axis)
+        offset += static_cast<std::ptrdiff_t>(index[axis]) * dst_strides[axis];
+      row_kernel(dst + offset);
+      size_t position = R - 1;
+      for (;;) {
+        if (position-- == 0) return;
+        const size_t axis = order[position];
+        if (++index[axis] < upper[axis]) break;
+        index[axis] = lower[axis];
+      }
+    }
+  };
+  auto fast = [&]<bool Reduce, unsigned Mask>() {
+    rows([&](D* d) {
+      if constexpr (Reduce) {
+        D accumulator = *d;
+        for (size_t i = 0; i < length; ++i) combine(accumulator, cursor.template value<Mask>(i));
+        *d = accumulator;
+      } else {
+        for (size_t i = 0; i < length; ++i) combine(d[i], cursor.template value<Mask>(i));
+      }
+    });
+  };
+
+  if (cursor.unit_or_broadcast() && (dst_inner == 0 || dst_inner == 1)) {
+    const unsigned mask = cursor.unit_mask();
+    constexpr size_t leaves = C::leaves;
+    if constexpr (leaves <= dispatched_leaves) {
+      [&]<unsigned... Masks>(std::integer_sequence<unsigned, Masks...>) {
+        (void)((mask == Masks &&
+                (dst_inner == 0 ? fast.template operator()<true, Masks>()
+                                : fast.template operator()<false, Masks>(),
+                 true)) ||
+               ...);
+      }(std::make_integer_sequence<unsigned, 1u << leaves>());
+      return;
+    } else if (constexpr unsigned all = leaves < 32 ? (1u << leaves) - 1 : ~0u; mask == all) {
+      dst_inner == 0 ? fast.template operator()<true, all>()
+                     : fast.template operator()<false, all>();
+      return;
+    }
+  }
+  rows([&](D* d) {
+    for (size_t i = 0; i < length; ++i)
+      combine(d[static_cast<std::ptrdiff_t>(i) * dst_inner], cursor.strided(i));
+  });
+}
+
+// Fused single pass evaluation of expr broadcast to the given extents into the destination,
+// parallel over the outermost axis along which the destination does not reduce
+template <size_t R, typename D, typename E, typename Combine>
+constexpr void evaluate(const std::array<size_t, R>& extents, D* dst,
+                        const std::array<std::ptrdiff_t, R>& dst_strides, const E& expr,
+                        Combine combine) {
+  const auto cursor = make_cursor<R, 0>(expr, extents);
+  std::array<std::ptrdiff_t, R> total{};
+  cursor.add_strides(total);
+  for (size_t axis = 0; axis < R; ++axis)
+    total[axis] += dst_strides[axis] < 0 ? -dst_strides[axis] : dst_strides[axis];
+  const auto order = traversal_order(extents, total);
+
+  size_t split = order[0];
+  for (size_t position = 0; position < R; ++position) {
+    if (dst_strides[order[position]] != 0) {
+      split = order[position];
+      break;
+    }
+  }
+  if (dst_strides[split] == 0) {
+    evaluate_rows(extents, order, split, 0, extents[split], dst, dst_strides, cursor, combine);
+    return;
+  }
+  parallel_for(extents[split], count(extents) / std::max<size_t>(extents[split], 1),
+               [&](size_t begin, size_t end) {
+                 evaluate_rows(extents, order, split, begin, end, dst, dst_strides, cursor,
+                               combine);
+               });
+}
+
+// Value of expr reduced over all its elements, parallel over its outermost axis with one partial
+// result per thread
+template <typename V, typename E, typename Combine>
+constexpr V reduce_all(const E& expr, V init, Combine combine) {
+  constexpr size_t R = E::rank;
+  const auto extents = expr.extents();
+  const auto cursor = make_cursor<R, 0>(expr, extents);
+  std::array<std::ptrdiff_t, R> total{};
+  cursor.add_strides(total);
+  const auto order = traversal_order(extents, total);
+  const std::array<std::ptrdiff_t, R> none{};
+
+  const size_t split = order[0];
+  const size_t n = extents[split];
+  if consteval {
+    V result = init;
+    evaluate_rows(extents, order, split, 0, n, &result, none, cursor, combine);
+    return result;
+  } else {
+    std::vector<V> partial(std::max<size_t>(n, 1), init);
+    parallel_for(n, count(extents) / std::max<size_t>(n, 1), [&](size_t begin, size_t end) {
+      evaluate_rows(extents, order, split, begin, end, &partial[begin], none, cursor, combine);
+    });
+    // init is the identity of combine, so the untouched partials do not matter
+    V result = init;
+    for (const V& value : partial) combine(result, value);
+    return result;
+  }
+}
+
+// Tensor of expr reduced along one axis, every result element written by one thread
+template <typename V, typename E, typename Combine>
+constexpr tensor<V, E::rank - 1> reduce_axis(const E& expr, size_t axis, V init,
+                                             Combine combine) {
+  constexpr size_t R = E::rank;
+  static_assert(R >= 2, "reduce a rank 1 tensor without an axis");
+  assert(axis < R);
+  const auto extents = expr.extents();
+  std::array<size_t, R - 1> reduced{};
+  for (size_t a = 0, b = 0; a < R; ++a)
+    if (a != axis) reduced[b++] = extents[a];
+
+  tensor<V, R - 1> result(reduced);
+  std::fill(result.data(), result.data() + result.num_elements(), init);
+  const auto strides = result.strides();
+  std::array<std::ptrdiff_t, R> dst_strides{};
+  for (size_t a = 0, b = 0; a < R; ++a) dst_strides[a] = a == axis ? 0 : strides[b++];
+  evaluate(extents, result.data(), dst_strides, expr, combine);
+  return result;
+}
+
+struct assign_element {
+  template <typename D, typename V>
+  constexpr void operator()(D& d, const V& v) const {
+    d = static_cast<D>(v);
+  }
+};
+
+struct add_element {
+  template <typename D, typename V>
+  constexpr void operator()(D& d, const V& v) const {
+    d += static_cast<D>(v);
+  }
+};
+
+struct max_element {
+  template <typename D, typename V>
+  constexpr void operator()(D& d, const V& v) const {
+    d = d < static_cast<D>(v) ? static_cast<D>(v) : d;
+  }
+};
+
+// Element type of the mean of elements of type V, double for integers like NumPy
+template <typename V>
+using mean_t = std::conditional_t<std::is_integral_v<V>, double, V>;
+}  // namespace detail
+
+/**
+ * Element-wise operation on one operand
+ */
+template <typename Op, typename E>
+class unary_expression {
+ public:
+  using value_type = std::remove_cvref_t<std::invoke_result_t<Op, typename E::value_type>>;
+  static constexpr size_t rank = E::rank;
+
+  constexpr unary_expression(Op op, const E& operand) : op_(op), operand_(operand) {}
+
+  [[nodiscard]] constexpr std::array<size_t, rank> extents() const { return operand_.extents(); }
+  [[nodiscard]] constexpr const Op& op() const { return op_; }
+  [[nodiscard]] constexpr const E& operand() const { return operand_; }
+
+ private:
+  [[no_unique_address]] Op op_;
+  E operand_;
+};
+
+/**
+ * Element-wise operation on two operands broadcast against each other
+ */
+template <typename Op, typename L, typename R>
+class binary_expression {
+ public:
+  using value_type = std::remove_cvref_t<
+      std::invoke_result_t<Op, typename L::value_type, typename R::value_type>>;
+  static constexpr size_t rank = std::max(L::rank, R::rank);
+
+  constexpr binary_expression(Op op, const L& lhs, const R& rhs)
+      : op_(op), lhs_(lhs), rhs_(rhs) {
+    (void)extents();
+  }
+
+  [[nodiscard]] constexpr std::array<size_t, rank> extents() const {
+    return detail::broadcast_extents(lhs_.extents(), rhs_.extents());
+  }
+  [[nodiscard]] constexpr const Op& op() const { return op_; }
+  [[nodiscard]] constexpr const L& lhs() const { return lhs_; }
+  [[nodiscard]] constexpr const R& rhs() const { return rhs_; }
+
+ private:
+  [[no_unique_address]] Op op_;
+  L lhs_;
+  R rhs_;
+};
+
+namespace detail {
+template <typename L, typename R>
+concept binary_operands = (operand<L> || operand<R>) &&
+                          (operand<L> || std::is_arithmetic_v<L>) &&
+                          (operand<R> || std::is_arithmetic_v<R>);
+
+template <typename Op, typename L, typename R>
+constexpr auto make_binary(const L& lhs, const R& rhs) {
+  return binary_expression<Op, operand_t<L>, operand_t<R>>(Op{}, as_operand(lhs),
+                                                           as_operand(rhs));
+}
+}  // namespace detail
+
+template <typename L, typename R>
+  requires detail::binary_operands<L, R>
+constexpr auto operator+(const L& lhs, const R& rhs) {
+  return detail::make_binary<std::plus<>>(lhs, rhs);
+}
+
+template <typename L, typename R>
+  requires detail::binary_operands<L, R>
+constexpr auto operator-(const L& lhs, const R& rhs) {
+  return detail::make_binary<std::minus<>>(lhs, rhs);
+}
+
+template <typename L, typename R>
+  requires detail::binary_operands<L, R>
+constexpr auto operator*(const L& lhs, const R& rhs) {
+  return detail::make_binary<std::multiplies<>>(lhs, rhs);
+}
+
+template <typename L, typename R>
+  requires detail::binary_operands<L, R>
+constexpr auto operator/(const L& lhs, const R& rhs) {
+  return detail::make_binary<std::divides<>>(lhs, rhs);
+}
+
+template <operand E>
+constexpr auto operator-(const E& input) {
+  return unary_expression<std::negate<>, detail::operand_t<E>>(std::negate<>{},
+                                                               detail::as_operand(input));
+}
+
+/**
+ * Sum of all elements
+ */
+template <operand E>
+constexpr auto sum(const E& input) {
+  using V = typename detail::operand_t<E>::value_type;
+  return detail::reduce_all(detail::as_operand(input), V{}, detail::add_element{});
+}
+
+/**
+ * Largest element, the lowest value of the element type when there is none
+ */
+template <operand E>
+constexpr auto max(const E& input) {
+  using V = typename detail::operand_t<E>::value_type;
+  return detail::reduce_all(detail::as_operand(input), std::numeric_limits<V>::lowest(),
+                            detail::max_element{});
+}
+
+/**
+ * Mean of all elements
+ */
+template <operand E>
+constexpr auto mean(const E& input) {
+  const auto expr = detail::as_operand(input);
+  using M = detail::mean_t<typename decltype(expr)::value_type>;
+  return static_cast<M>(sum(expr)) / static_cast<M>(detail::count(expr.extents()));
+}
+
+/**
+ * Sums along an axis, a tensor of one rank less
+ */
+template <operand E>
+constexpr auto sum(const E& input, size_t axis) {
+  using V = typename detail::operand_t<E>::value_type;
+  return detail::reduce_axis(detail::as_operand(input), axis, V{}, detail::add_element{});
+}
+
+/**
+ * Largest elements along an axis, a tensor of one rank less
+ */
+template <operand E>
+constexpr auto max(const E& input, size_t axis) {
+  using V = typename detail::operand_t<E>::value_type;
+  return detail::reduce_axis(detail::as_operand(input), axis,
+                             std::numeric_limits<V>::lowest(), detail::max_element{});
+}
+
+/**
+ * Means along an axis, a tensor of one rank less
+ */
+template <operand E>
+constexpr auto mean(const E& input, size_t axis) {
+  const auto expr = detail::as_operand(input);
+  using M = detail::mean_t<typename decltype(expr)::value_type>;
+  auto result = detail::reduce_axis(expr, axis, M{}, detail::add_element{});
+  const auto n = static_cast<M>(expr.extents()[axis]);
+  for (M& element : std::span(result.data(), result.num_elements())) element /= n;
+  return result;
+}
+
+template <typename T, size_t N>
+  requires(N >= 1)
+template <expression E>
+  requires(E::rank == N) && std::convertible_to<typename E::value_type, T>
+constexpr tensor<T, N>::tensor(const E& expr)
+    : extents_(expr.extents()), elements(detail::count(expr.extents())) {
+  detail::evaluate(extents_, elements.data(), strides(), expr, detail::assign_element{});
+}
+
+template <typename T, size_t N>
+  requires(N >= 1)
+template <expression E>
+  requires(E::rank == N) && std::convertible_to<typename E::value_type, T>
+constexpr tensor<T, N>& tensor<T, N>::operator=(const E& expr) {
+  // evaluate in place when the shape is kept and the expression reads this tensor at most at the
+  // index being written, through a temporary otherwise
+  if (expr.extents() == extents_ &&
+      !detail::overlaps_shifted(extents_, elements.data(), strides(), expr))
+    detail::evaluate(extents_, elements.data(), strides(), expr, detail::assign_element{});
+  else
+    *this = tensor(expr);
+  return *this;
+}
+
+template <typename T, size_t N>
+  requires(N >= 1)
+template <expression E>
+  requires(!std::is_const_v<T>) && (E::rank <= N) &&
+          std::convertible_to<typename E::value_type, T>
+constexpr const tensor_view<T, N>& tensor_view<T, N>::assign(const E& expr) const {
+  if (detail::overlaps_shifted(extents_, data_, strides_, expr)) {
+    const tensor<typename E::value_type, E::rank> temporary(expr);
+    detail::evaluate(extents_, data_, strides_, temporary.view(), detail::assign_element{});
+  } else {
+    detail::evaluate(extents_, data_, strides_, expr, detail::assign_element{});
+  }
+  return *this;
 }
 }  // namespace tensor
 
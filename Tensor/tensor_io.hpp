@@ -0,0 +1,388 @@
+//
+// Created by cppshizoid on 4/14/24.
+//
+#ifndef TENSOR_IO_HPP
+#define TENSOR_IO_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "tensor.hpp"
+
+namespace tensor {
+/**
+ * Element type recorded in a tensor file
+ */
+enum class dtype : std::uint32_t {
+  none,
+  int8,
+  uint8,
+  int16,
+  uint16,
+  int32,
+  uint32,
+  int64,
+  uint64,
+  float32,
+  float64,
+};
+
+namespace detail {
+template <typename T>
+constexpr dtype dtype_of() {
+  if constexpr (std::is_same_v<T, float>) {
+    return dtype::float32;
+  } else if constexpr (std::is_same_v<T, double>) {
+    return dtype::float64;
+  } else if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool>) {
+    constexpr bool is_signed = std::is_signed_v<T>;
+    switch (sizeof(T)) {
+      case 1: return is_signed ? dtype::int8 : dtype::uint8;
+      case 2: return is_signed ? dtype::int16 : dtype::uint16;
+      case 4: return is_signed ? dtype::int32 : dtype::uint32;
+      case 8: return is_signed ? dtype::int64 : dtype::uint64;
+    }
+  }
+  return dtype::none;
+}
+}  // namespace detail
+
+/**
+ * Element type a tensor file can hold: fixed width integers and IEEE floats
+ */
+template <typename T>
+concept storable = detail::dtype_of<std::remove_const_t<T>>() != dtype::none;
+
+/**
+ * Layout of a tensor file, all fields in the byte order of the writer:
+ *
+ *   file_header
+ *   uint64_t extents[rank]
+ *   int64_t  strides[rank]      in elements
+ *   zero padding up to payload_offset, a multiple of payload_alignment
+ *   payload_size bytes of elements
+ *
+ * save() always writes row-major contiguous strides, load() accepts any
+ * strides that stay within the payload.
+ */
+struct file_header {
+  std::array<char, 8> magic;
+  std::uint32_t version;
+  std::uint32_t byte_order;
+  dtype type;
+  std::uint32_t element_size;
+  std::uint32_t rank;
+  std::uint32_t reserved;
+  std::uint64_t payload_offset;
+  std::uint64_t payload_size;
+};
+
+inline constexpr std::array<char, 8> file_magic{'\x89', 'T', 'N', 'S', 'R', '\r', '\n', '\x1a'};
+inline constexpr std::uint32_t file_version = 1;
+inline constexpr std::uint32_t file_byte_order = 0x01020304;
+
+// Alignment of the payload in the file, a page, so that a mapping of the file hands out the
+// elements page aligned and every chunk written by save() starts on a page boundary
+inline constexpr size_t payload_alignment = 4096;
+
+// Bytes handed to a single write() by save()
+inline constexpr size_t save_chunk = size_t{1} << 24;
+
+namespace detail {
+[[noreturn]] inline void throw_errno(const std::string& what, const std::filesystem::path& path) {
+  throw std::system_error(errno, std::generic_category(), what + " " + path.string());
+}
+
+[[noreturn]] inline void throw_format(const std::string& what, const std::filesystem::path& path) {
+  throw std::runtime_error("tensor file " + path.string() + ": " + what);
+}
+
+// Closes the descriptor when the scope is left by an exception
+class file_descriptor {
+ public:
+  explicit file_descriptor(int fd) : fd_(fd) {}
+  file_descriptor(const file_descriptor&) = delete;
+  file_descriptor& operator=(const file_descriptor&) = delete;
+  ~file_descriptor() {
+    if (fd_ >= 0) ::close(fd_);
+  }
+
+  [[nodiscard]] int get() const { return fd_; }
+  int release() { return std::exchange(fd_, -1); }
+
+ private:
+  int fd_;
+};
+
+inline void write_all(int fd, const std::byte* data, size_t size,
+                      const std::filesystem::path& path) {
+  while (size > 0) {
+    const ssize_t written = ::write(fd, data, std::min(size, save_chunk));
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      throw_errno("write", path);
+    }
+    data += written;
+    size -= static_cast<size_t>(written);
+  }
+}
+
+inline size_t header_size(size_t rank) {
+  const size_t size = sizeof(file_header) + rank * (sizeof(std::uint64_t) + sizeof(std::int64_t));
+  return (size + payload_alignment - 1) / payload_alignment * payload_alignment;
+}
+
+struct aligned_delete {
+  void operator()(std::byte* p) const { ::operator delete(p, std::align_val_t{payload_alignment}); }
+};
+}  // namespace detail
+
+/**
+ * Tensor backed by a read-only shared mapping of a tensor file.
+ *
+ * Opening a file maps it and checks its header, no element is read or copied:
+ * pages are faulted in from the page cache as the view touches them. The
+ * mapping lives as long as the mapped_tensor, views must not outlive it.
+ */
+template <storable T, size_t N>
+  requires(N >= 1)
+class mapped_tensor {
+ public:
+  using value_type = T;
+  static constexpr size_t rank = N;
+
+  explicit mapped_tensor(const std::filesystem::path& path);
+  mapped_tensor(mapped_tensor&& other) noexcept
+      : mapping_(std::exchange(other.mapping_, nullptr)),
+        mapping_size_(std::exchange(other.mapping_size_, 0)),
+        view_(other.view_) {}
+  mapped_tensor& operator=(mapped_tensor&& other) noexcept {
+    std::swap(mapping_, other.mapping_);
+    std::swap(mapping_size_, other.mapping_size_);
+    std::swap(view_, other.view_);
+    return *this;
+  }
+  ~mapped_tensor() {
+    if (mapping_ != nullptr) ::munmap(mapping_, mapping_size_);
+  }
+
+  [[nodiscard]] tensor_view<const T, N> view() const { return view_; }
+
+  [[nodiscard]] size_t size() const { return view_.size(); }
+  [[nodiscard]] size_t extent(size_t axis) const { return view_.extent(axis); }
+  [[nodiscard]] const std::array<size_t, N>& extents() const { return view_.extents(); }
+  [[nodiscard]] const std::array<std::ptrdiff_t, N>& strides() const { return view_.strides(); }
+  [[nodiscard]] size_t num_elements() const { return view_.num_elements(); }
+  [[nodiscard]] const T* data() const { return view_.data(); }
+
+ private:
+  void* mapping_ = nullptr;
+  size_t mapping_size_ = 0;
+  tensor_view<const T, N> view_{nullptr, {}, {}};
+};
+
+template <storable T, size_t N>
+  requires(N >= 1)
+mapped_tensor<T, N>::mapped_tensor(const std::filesystem::path& path) {
+  detail::file_descriptor fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd.get() < 0) detail::throw_errno("open", path);
+  struct stat status {};
+  if (::fstat(fd.get(), &status) != 0) detail::throw_errno("stat", path);
+  const auto file_size = static_cast<size_t>(status.st_size);
+  if (file_size < sizeof(file_header)) detail::throw_format("truncated header", path);
+
+  void* mapping = ::mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd.get(), 0);
+  if (mapping == MAP_FAILED) detail::throw_errno("mmap", path);
+  mapping_ = mapping;
+  mapping_size_ = file_size;
+  // the mapping stays valid once the descriptor is closed; on a throw below the destructor does
+  // not run, so unmap here
+  struct unmap_on_throw {
+    mapped_tensor& self;
+    bool armed = true;
+    ~unmap_on_throw() {
+      if (armed) ::munmap(std::exchange(self.mapping_, nullptr), self.mapping_size_);
+    }
+  } guard{*this};
+
+  const auto* bytes = static_cast<const std::byte*>(mapping);
+  file_header header;
+  std::memcpy(&header, bytes, sizeof header);
+  if (header.magic != file_magic) detail::throw_format("not a tensor file", path);
+  if (header.version != file_version) detail::throw_format("unsupported version", path);
+  if (header.byte_order != file_byte_order) detail::throw_format("foreign byte order", path);
+  if (header.type != detail::dtype_of<T>() || header.element_size != sizeof(T))
+    detail::throw_format("element type differs", path);
+  if (header.rank != N) detail::throw_format("rank differs", path);
+  if (header.payload_offset < detail::header_size(N) ||
+      header.payload_offset % alignof(T) != 0 || header.payload_offset > file_size ||
+      header.payload_size > file_size - header.payload_offset)
+    detail::throw_format("payload out of bounds", path);
+
+  std::array<std::uint64_t, N> extents{};
+  std::array<std::int64_t, N> strides{};
+  std::memcpy(extents.data(), bytes + sizeof header, sizeof extents);
+  std::memcpy(strides.data(), bytes + sizeof header + sizeof extents, sizeof strides);
+
+  // every extent, and the element count, must fit a ptrdiff_t, and every element addressed by the
+  // extents and strides must lie within the payload
+  std::array<size_t, N> view_extents{};
+  std::array<std::ptrdiff_t, N> view_strides{};
+  bool empty = false;
+  size_t count = 1;
+  std::ptrdiff_t low = 0;
+  std::ptrdiff_t high = 0;
+  for (size_t axis = 0; axis < N; ++axis) {
+    if (extents[axis] > static_cast<std::uint64_t>(PTRDIFF_MAX) ||
+        __builtin_mul_overflow(count, static_cast<size_t>(extents[axis]), &count) ||
+        count > static_cast<size_t>(PTRDIFF_MAX))
+      detail::throw_format("extents overflow", path);
+    view_extents[axis] = static_cast<size_t>(extents[axis]);
+    view_strides[axis] = static_cast<std::ptrdiff_t>(strides[axis]);
+    empty |= extents[axis] == 0;
+  }
+  const size_t capacity = static_cast<size_t>(header.payload_size) / sizeof(T);
+  if (!empty) {
+    for (size_t axis = 0; axis < N; ++axis) {
+      std::ptrdiff_t reach = 0;
+      if (__builtin_mul_overflow(static_cast<std::ptrdiff_t>(extents[axis] - 1), view_strides[axis],
+                                 &reach) ||
+          __builtin_add_overflow(reach < 0 ? low : high, reach, reach < 0 ? &low : &high))
+        detail::throw_format("extents overflow", path);
+    }
+    if (low < 0 || static_cast<size_t>(high) >= capacity)
+      detail::throw_format("extents exceed the payload", path);
+  }
+
+  view_ = tensor_view<const T, N>(reinterpret_cast<const T*>(bytes + header.payload_offset),
+                                  view_extents, view_strides);
+  guard.armed = false;
+}
+
+/**
+ * Maps a tensor file written by save() with element type T and rank N
+ */
+template <storable T, size_t N>
+  requires(N >= 1)
+[[nodiscard]] mapped_tensor<T, N> load(const std::filesystem::path& path) {
+  return mapped_tensor<T, N>(path);
+}
+
+/**
+ * Writes the elements of a view to a tensor file in row-major order.
+ *
+ * Contiguous row-major views are written straight from their buffer, other
+ * views are gathered into a page aligned buffer of save_chunk bytes first, so
+ * the payload goes out in chunks of save_chunk bytes at page aligned offsets
+ * and no copy of the whole tensor is ever made.
+ *
+ * The file is written as path + ".tmp", synced and renamed over path, so the
+ * view may be a mapping of the file it replaces and a failed or interrupted
+ * save leaves the previous file intact.
+ */
+template <storable T, size_t N>
+  requires(N >= 1)
+void save(const std::filesystem::path& path, const tensor_view<T, N>& view) {
+  using V = std::remove_const_t<T>;
+  const std::array<size_t, N>& extents = view.extents();
+  const size_t elements = detail::count(extents);
+  const auto contiguous = detail::contiguous_strides(extents);
+
+  const size_t offset = detail::header_size(N);
+  std::vector<std::byte> head(offset);
+  const file_header header{
+      .magic = file_magic,
+      .version = file_version,
+      .byte_order = file_byte_order,
+      .type = detail::dtype_of<V>(),
+      .element_size = sizeof(V),
+      .rank = N,
+      .reserved = 0,
+      .payload_offset = offset,
+      .payload_size = elements * sizeof(V),
+  };
+  std::array<std::uint64_t, N> file_extents{};
+  std::array<std::int64_t, N> file_strides{};
+  for (size_t axis = 0; axis < N; ++axis) {
+    file_extents[axis] = extents[axis];
+    file_strides[axis] = contiguous[axis];
+  }
+  std::memcpy(head.data(), &header, sizeof header);
+  std::memcpy(head.data() + sizeof header, file_extents.data(), sizeof file_extents);
+  std::memcpy(head.data() + sizeof header + sizeof file_extents, file_strides.data(),
+              sizeof file_strides);
+
+  std::filesystem::path temporary = path;
+  temporary += ".tmp";
+  // declared before the descriptor, so the file is closed before it is removed
+  struct remove_on_throw {
+    const std::filesystem::path& path;
+    bool armed = true;
+    ~remove_on_throw() {
+      if (armed) ::unlink(path.c_str());
+    }
+  } guard{temporary};
+  detail::file_descriptor fd(
+      ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+  if (fd.get() < 0) detail::throw_errno("open", temporary);
+  detail::write_all(fd.get(), head.data(), head.size(), temporary);
+
+  bool dense = true;
+  for (size_t axis = 0; axis < N; ++axis)
+    dense &= extents[axis] == 1 || view.strides()[axis] == contiguous[axis];
+  if (dense) {
+    detail::write_all(fd.get(), reinterpret_cast<const std::byte*>(view.data()),
+                      elements * sizeof(V), temporary);
+  } else if (elements > 0) {
+    constexpr size_t capacity = save_chunk / sizeof(V);
+    std::unique_ptr<std::byte, detail::aligned_delete> buffer(static_cast<std::byte*>(
+        ::operator new(capacity * sizeof(V), std::align_val_t{payload_alignment})));
+    V* chunk = reinterpret_cast<V*>(buffer.get());
+    size_t filled = 0;
+    std::array<size_t, N> order{};
+    for (size_t axis = 0; axis < N; ++axis) order[axis] = axis;
+    detail::strided_for_each(
+        extents, order,
+        [&](const V& element) {
+          chunk[filled++] = element;
+          if (filled == capacity) {
+            detail::write_all(fd.get(), buffer.get(), filled * sizeof(V), temporary);
+            filled = 0;
+          }
+        },
+        detail::strided<const V, N>{view.data(), view.strides()});
+    detail::write_all(fd.get(), buffer.get(), filled * sizeof(V), temporary);
+  }
+  if (::fsync(fd.get()) != 0) detail::throw_errno("fsync", temporary);
+  if (::close(fd.release()) != 0) detail::throw_errno("close", temporary);
+  if (::rename(temporary.c_str(), path.c_str()) != 0) detail::throw_errno("rename", path);
+  guard.armed = false;
+}
+
+template <storable T, size_t N>
+  requires(N >= 1)
+void save(const std::filesystem::path& path, const tensor<T, N>& t) {
+  save(path, t.view());
+}
+}  // namespace tensor
+
+#endif
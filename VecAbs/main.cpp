@@ -1,6 +1,125 @@
+#include <algorithm>
+#include <cmath>
 #include <print>
+#include <vector>
 
 #include "vec_abs.hpp"
+#include "vec_abs_soa.hpp"
+
+namespace {
+int failures = 0;
+
+void check(bool condition, const char *what) {
+  if (condition) return;
+  ++failures;
+  std::print("FAIL {}\n", what);
+}
+
+// Whether two vectors agree up to the rounding of a few operations
+template <size_t N, bool P, bool Q>
+bool close(const vec::vec_abs<float, N, P> &lhs,
+           const vec::vec_abs<float, N, Q> &rhs, float tolerance = 1e-6f) {
+  for (size_t k = 0; k < N; ++k) {
+    const float scale = std::max(1.0f, std::abs(rhs.data[k]));
+    if (!(std::abs(lhs.data[k] - rhs.data[k]) <= tolerance * scale)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The vec_abs_soa kernels against the same operations on single vectors, on a
+// size that leaves a remainder after every vector width
+void check_soa() {
+  using vec3 = vec::vec_abs<float, 3>;
+  // the kernels pass their functions vectors operating component by component
+  using lane3 = vec::vec_abs<float, 3, false>;
+  constexpr size_t size = 1003;
+  const vec3 axis(0.0f, 0.6f, 0.8f);
+  const lane3 lane_axis(axis);
+  std::vector<vec3> vectors;
+  vec::vec_abs_soa<float, 3> soa;
+  for (size_t i = 0; i < size; ++i) {
+    const float t = static_cast<float>(i);
+    vectors.emplace_back(std::sin(t), std::cos(0.5f * t) - 0.25f, 0.001f * t);
+    soa.push_back(vectors.back());
+  }
+
+  bool same = soa.size() == size;
+  for (size_t i = 0; same && i < size; ++i) {
+    same = vec3(soa[i]) == vectors[i];
+  }
+  check(same, "push_back and proxy read");
+
+  vec::vec_abs_soa<float, 3> copy(soa);
+  copy[7] = copy[3];
+  copy[8] = axis;
+  check(vec3(copy[7]) == vectors[3] && vec3(copy[8]) == axis &&
+            vec3(soa[7]) == vectors[7],
+        "proxy assignment into a copy");
+
+  vec::vec_abs_soa<float, 3> out;
+  vec::transform(soa, out, [&](const lane3 &v) {
+    return cross(v, lane_axis) + abs(v) * 2.0f;
+  });
+  same = out.size() == size;
+  for (size_t i = 0; same && i < size; ++i) {
+    same = close(vec3(out[i]),
+                 cross(vectors[i], axis) + abs(vectors[i]) * 2.0f);
+  }
+  check(same, "transform with cross and abs");
+
+  vec::transform(soa, out, [](const lane3 &v) { return normalize(v); });
+  same = true;
+  for (size_t i = 0; same && i < size; ++i) {
+    same = close(vec3(out[i]), normalize(vectors[i]));
+  }
+  check(same, "transform with normalize");
+
+  double dots = 0;
+  vec::vec_abs<double, 3> total;
+  for (const vec3 &v : vectors) {
+    dots += dot(v, axis);
+    total += vec::vec_abs<double, 3>(v.data[0], v.data[1], v.data[2]);
+  }
+  const float reduced = vec::reduce(
+      soa, 0.0f, [&](const lane3 &v) { return dot(v, lane_axis); });
+  check(std::abs(reduced - dots) <= 1e-4 * std::max(1.0, std::abs(dots)),
+        "reduce of dot products");
+  const vec3 sum = vec::reduce(soa);
+  const vec3 expected(static_cast<float>(total.data[0]),
+                      static_cast<float>(total.data[1]),
+                      static_cast<float>(total.data[2]));
+  check(close(sum, expected, 1e-4f), "reduce of the vectors");
+
+  vec::axpy(0.5f, soa, copy);
+  same = true;
+  for (size_t i = 0; same && i < size; ++i) {
+    const vec3 before = i == 7 ? vectors[3] : i == 8 ? axis : vectors[i];
+    same = close(vec3(copy[i]), before + vectors[i] * 0.5f);
+  }
+  check(same, "axpy");
+
+  soa.resize(5);
+  check(soa.size() == 5 && vec3(soa[4]) == vectors[4], "resize keeps elements");
+}
+
+// Unary minus against scalar negation, including the sign of zero
+template <typename T, size_t N, bool Packed>
+void check_negate(const char *what) {
+  vec::vec_abs<T, N, Packed> v;
+  for (size_t k = 0; k < N; ++k) {
+    v.data[k] = k % 3 == 0 ? T(0) : k % 3 == 1 ? T(-0.0) : T(k) - T(2.5);
+  }
+  const vec::vec_abs<T, N, Packed> negated = -v;
+  bool same = true;
+  for (size_t k = 0; k < N; ++k) {
+    same &= negated.data[k] == -v.data[k] &&
+            std::signbit(negated.data[k]) != std::signbit(v.data[k]);
+  }
+  check(same, what);
+}
+}  // namespace
 
 int main() {
   vec::vec_abs<double, 3> vec1;
@@ -29,5 +148,13 @@ int main() {
   std::print("\n");
 
   std::print("Are all types convertible to double? {}\n", convertible);
-  return 0;
+
+  check_negate<float, 3, true>("unary minus, float x3 packed");
+  check_negate<float, 4, true>("unary minus, float x4 packed");
+  check_negate<double, 2, true>("unary minus, double x2 packed");
+  check_negate<double, 3, false>("unary minus, double x3");
+  check_soa();
+  std::print("{} vec_abs check{} failed\n", failures,
+             failures == 1 ? "" : "s");
+  return failures == 0 ? 0 : 1;
 }
@@ -2,7 +2,13 @@
 #define VEC_ABS
 
 #include <array>
+#include <bit>
+#include <cmath>
+#include <concepts>
 #include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
 #include <print>
 #include <type_traits>
 #include <utility>
@@ -13,10 +19,136 @@ constexpr bool all_convertible_to() {
   return (std::is_convertible_v<T, Ts> && ...);
 }
 
+namespace detail {
+// Whether a vec_abs<T, N> is worked on in a GCC/Clang vector register of
+// bit_ceil(N) lanes: N = 2, 4, 8, 16 fill whole registers, N = 3 gets one
+// padding lane so that an operation is a single packed instruction instead of
+// two plus one scalar. The padding only lives in registers, vec_abs<float, 3>
+// stays 12 bytes in memory. Only integers, float and double are packed; long
+// double has no vector type.
 template <typename T, size_t N>
+constexpr bool packed() {
+#if defined(__GNUC__)
+  return ((std::is_integral_v<T> && !std::is_same_v<T, bool>) ||
+          std::is_same_v<T, float> || std::is_same_v<T, double>) &&
+         N >= 2 && std::bit_ceil(N) * sizeof(T) <= 64;
+#else
+  return false;
+#endif
+}
+
+template <typename T, size_t N>
+struct lanes_of {
+  static constexpr size_t bytes = std::bit_ceil(N) * sizeof(T);
+  typedef T type __attribute__((vector_size(bytes)));
+};
+
+template <typename T, size_t N>
+using lanes = typename lanes_of<T, N>::type;
+
+// Unsigned integer of the same width as float or double, for sign bit masking
+template <typename T>
+  requires(sizeof(T) == 4 || sizeof(T) == 8)
+using bits_t = std::conditional_t<sizeof(T) == 4, std::uint32_t, std::uint64_t>;
+
+template <typename T, size_t N, typename U>
+constexpr T component(const U &operand, size_t i) {
+  if constexpr (std::is_same_v<U, std::array<T, N>>) {
+    return operand[i];
+  } else {
+    return operand;
+  }
+}
+
+// Applies Op to lhs and rhs, an array or a scalar, component by component.
+// Op is one of std::plus, minus, multiplies and divides; it is spelled as an
+// operator on the vectors rather than called, a call would pass vectors wider
+// than 16 bytes by value, whose ABI depends on the enabled instruction set.
+template <typename Op, bool Packed, typename T, size_t N, typename U>
+constexpr std::array<T, N> zip(const std::array<T, N> &lhs, const U &rhs) {
+  if !consteval {
+    if constexpr (Packed && packed<T, N>()) {
+      return [&]<size_t... I, size_t... P>(std::index_sequence<I...>,
+                                           std::index_sequence<P...>) {
+        lanes<T, N> x{lhs[I]...};
+        // padding lanes of a divisor are one, never zero
+        constexpr T fill = std::is_same_v<Op, std::divides<>> ? T{1} : T{};
+        // y is taken by reference, see above
+        auto apply = [&x](const auto &y) {
+          if constexpr (std::is_same_v<Op, std::plus<>>) {
+            x += y;
+          } else if constexpr (std::is_same_v<Op, std::minus<>>) {
+            x -= y;
+          } else if constexpr (std::is_same_v<Op, std::multiplies<>>) {
+            x *= y;
+          } else {
+            x /= y;
+          }
+        };
+        if constexpr (std::is_same_v<U, std::array<T, N>>) {
+          apply(lanes<T, N>{rhs[I]..., (void(P), fill)...});
+        } else {
+          apply(rhs);
+        }
+        return std::array<T, N>{x[I]...};
+      }(std::make_index_sequence<N>(),
+             std::make_index_sequence<std::bit_ceil(N) - N>());
+    }
+  }
+  std::array<T, N> result{};
+  for (size_t i = 0; i < N; ++i) {
+    result[i] = Op{}(lhs[i], component<T, N>(rhs, i));
+  }
+  return result;
+}
+
+template <typename T>
+constexpr T magnitude(const T &x) {
+  if constexpr (std::is_unsigned_v<T>) {
+    return x;
+  } else {
+    // -0.0 compares equal to zero and maps to +0.0, like std::abs
+    return x < T{} ? -x : (x == T{} ? T{} : x);
+  }
+}
+
+// Square root usable in constant expressions, Newton's iteration from above
+// at compile time and std::sqrt at run time
+template <std::floating_point R>
+constexpr R sqrt(R x) {
+  if consteval {
+    if (!(x > R{}) || x == std::numeric_limits<R>::infinity()) {
+      return x == R{} || x == std::numeric_limits<R>::infinity()
+                 ? x
+                 : std::numeric_limits<R>::quiet_NaN();
+    }
+    R root = x > R{1} ? x : R{1};
+    for (;;) {
+      const R next = (root + x / root) / 2;
+      if (next >= root) {
+        return root;
+      }
+      root = next;
+    }
+  } else {
+    return std::sqrt(x);
+  }
+}
+}  // namespace detail
+
+/**
+ * Vector of N components of type T.
+ *
+ * With Packed, the default, an operation on one vector runs on SIMD registers
+ * as a whole, see detail::packed. Without it operations are plain loops over
+ * the components, which the compiler vectorizes across the iterations of an
+ * enclosing loop instead; the bulk kernels of vec_abs_soa hand their functions
+ * vectors of that kind.
+ */
+template <typename T, size_t N, bool Packed = true>
 class vec_abs {
  public:
-  consteval vec_abs();
+  constexpr vec_abs();
 
   [[maybe_unused]] constexpr vec_abs(const vec_abs &vec);
 
@@ -27,51 +159,265 @@ class vec_abs {
   template <typename... Ts>
     requires std::conjunction_v<std::is_convertible<Ts, T>...> &&
              (sizeof...(Ts) == N)
-  explicit consteval vec_abs(Ts &&...values);
+  explicit constexpr vec_abs(Ts &&...values);
+
+  template <bool Other>
+    requires(Other != Packed)
+  explicit constexpr vec_abs(const vec_abs<T, N, Other> &vec);
 
   constexpr vec_abs &operator=(const vec_abs &other);
 
   constexpr vec_abs &operator=(vec_abs &&other) noexcept;
 
+  constexpr vec_abs &operator+=(const vec_abs &other);
+  constexpr vec_abs &operator-=(const vec_abs &other);
+  constexpr vec_abs &operator*=(const vec_abs &other);
+  constexpr vec_abs &operator/=(const vec_abs &other);
+  constexpr vec_abs &operator*=(const T &scalar);
+  constexpr vec_abs &operator/=(const T &scalar);
+
+  constexpr bool operator==(const vec_abs &other) const = default;
+
   std::array<T, N> data;
 };
 
-template <typename T, size_t N>
-consteval vec_abs<T, N>::vec_abs() : data{} {}
+template <typename T, size_t N, bool Packed>
+constexpr vec_abs<T, N, Packed>::vec_abs() : data{} {}
 
-template <typename T, size_t N>
-[[maybe_unused]] constexpr vec_abs<T, N>::vec_abs(const vec_abs &vec)
+template <typename T, size_t N, bool Packed>
+[[maybe_unused]] constexpr vec_abs<T, N, Packed>::vec_abs(const vec_abs &vec)
     : data(vec.data) {}
 
-template <typename T, size_t N>
-[[maybe_unused]] constexpr vec_abs<T, N>::vec_abs(vec_abs &&vec) noexcept
+template <typename T, size_t N, bool Packed>
+[[maybe_unused]] constexpr vec_abs<T, N, Packed>::vec_abs(
+    vec_abs &&vec) noexcept
     : data(std::move(vec.data)) {}
 
-template <typename T, size_t N>
-[[maybe_unused]] constexpr vec_abs<T, N>::vec_abs(const std::array<T, N> &arr)
+template <typename T, size_t N, bool Packed>
+[[maybe_unused]] constexpr vec_abs<T, N, Packed>::vec_abs(
+    const std::array<T, N> &arr)
     : data(arr) {}
 
-template <typename T, size_t N>
+template <typename T, size_t N, bool Packed>
 template <typename... Ts>
   requires std::conjunction_v<std::is_convertible<Ts, T>...> &&
            (sizeof...(Ts) == N)
-consteval vec_abs<T, N>::vec_abs(Ts &&...values)
-    : data{std::forward<Ts>(values)...} {}
+constexpr vec_abs<T, N, Packed>::vec_abs(Ts &&...values)
+    : data{static_cast<T>(std::forward<Ts>(values))...} {}
 
-template <typename T, size_t N>
-constexpr vec_abs<T, N> &vec_abs<T, N>::operator=(const vec_abs &other) {
+template <typename T, size_t N, bool Packed>
+template <bool Other>
+  requires(Other != Packed)
+constexpr vec_abs<T, N, Packed>::vec_abs(const vec_abs<T, N, Other> &vec)
+    : data(vec.data) {}
+
+template <typename T, size_t N, bool Packed>
+constexpr vec_abs<T, N, Packed> &vec_abs<T, N, Packed>::operator=(
+    const vec_abs &other) {
   if (this != &other) {
     data = other.data;
   }
   return *this;
 }
 
-template <typename T, size_t N>
-constexpr vec_abs<T, N> &vec_abs<T, N>::operator=(vec_abs &&other) noexcept {
+template <typename T, size_t N, bool Packed>
+constexpr vec_abs<T, N, Packed> &vec_abs<T, N, Packed>::operator=(
+    vec_abs &&other) noexcept {
   if (this != &other) {
     data = std::move(other.data);
   }
   return *this;
 }
+
+template <typename T, size_t N, bool Packed>
+constexpr vec_abs<T, N, Packed> &vec_abs<T, N, Packed>::operator+=(
+    const vec_abs &other) {
+  data = detail::zip<std::plus<>, Packed>(data, other.data);
+  return *this;
+}
+
+template <typename T, size_t N, bool Packed>
+constexpr vec_abs<T, N, Packed> &vec_abs<T, N, Packed>::operator-=(
+    const vec_abs &other) {
+  data = detail::zip<std::minus<>, Packed>(data, other.data);
+  return *this;
+}
+
+template <typename T, size_t N, bool Packed>
+constexpr vec_abs<T, N, Packed> &vec_abs<T, N, Packed>::operator*=(
+    const vec_abs &other) {
+  data = detail::zip<std::multiplies<>, Packed>(data, other.data);
+  return *this;
+}
+
+template <typename T, size_t N, bool Packed>
+constexpr vec_abs<T, N, Packed> &vec_abs<T, N, Packed>::operator/=(
+    const vec_abs &other) {
+  data = detail::zip<std::divides<>, Packed>(data, other.data);
+  return *this;
+}
+
+template <typename T, size_t N, bool Packed>
+constexpr vec_abs<T, N, Packed> &vec_abs<T, N, Packed>::operator*=(
+    const T &scalar) {
+  data = detail::zip<std::multiplies<>, Packed>(data, scalar);
+  return *this;
+}
+
+template <typename T, size_t N, bool Packed>
+constexpr vec_abs<T, N, Packed> &vec_abs<T, N, Packed>::operator/=(
+    const T &scalar) {
+  data = detail::zip<std::divides<>, Packed>(data, scalar);
+  return *this;
+}
+
+template <typename T, size_t N, bool Packed>
+constexpr vec_abs<T, N, Packed> operator+(const vec_abs<T, N, Packed> &lhs,
+                                          const vec_abs<T, N, Packed> &rhs) {
+  return vec_abs<T, N, Packed>(
+      detail::zip<std::plus<>, Packed>(lhs.data, rhs.data));
+}
+
+template <typename T, size_t N, bool Packed>
+constexpr vec_abs<T, N, Packed> operator-(const vec_abs<T, N, Packed> &lhs,
+                                          const vec_abs<T, N, Packed> &rhs) {
+  return vec_abs<T, N, Packed>(
+      detail::zip<std::minus<>, Packed>(lhs.data, rhs.data));
+}
+
+// Component-wise product
+template <typename T, size_t N, bool Packed>
+constexpr vec_abs<T, N, Packed> operator*(const vec_abs<T, N, Packed> &lhs,
+                                          const vec_abs<T, N, Packed> &rhs) {
+  return vec_abs<T, N, Packed>(
+      detail::zip<std::multiplies<>, Packed>(lhs.data, rhs.data));
+}
+
+// Component-wise quotient
+template <typename T, size_t N, bool Packed>
+constexpr vec_abs<T, N, Packed> operator/(const vec_abs<T, N, Packed> &lhs,
+                                          const vec_abs<T, N, Packed> &rhs) {
+  return vec_abs<T, N, Packed>(
+      detail::zip<std::divides<>, Packed>(lhs.data, rhs.data));
+}
+
+template <typename T, size_t N, bool Packed>
+constexpr vec_abs<T, N, Packed> operator*(
+    const vec_abs<T, N, Packed> &lhs, const std::type_identity_t<T> &scalar) {
+  return vec_abs<T, N, Packed>(
+      detail::zip<std::multiplies<>, Packed>(lhs.data, scalar));
+}
+
+template <typename T, size_t N, bool Packed>
+constexpr vec_abs<T, N, Packed> operator*(const std::type_identity_t<T> &scalar,
+                                          const vec_abs<T, N, Packed> &rhs) {
+  return vec_abs<T, N, Packed>(
+      detail::zip<std::multiplies<>, Packed>(rhs.data, scalar));
+}
+
+template <typename T, size_t N, bool Packed>
+constexpr vec_abs<T, N, Packed> operator/(
+    const vec_abs<T, N, Packed> &lhs, const std::type_identity_t<T> &scalar) {
+  return vec_abs<T, N, Packed>(
+      detail::zip<std::divides<>, Packed>(lhs.data, scalar));
+}
+
+// Component-wise negation; flips the sign of zeros too, which 0 - v does not
+template <typename T, size_t N, bool Packed>
+constexpr vec_abs<T, N, Packed> operator-(const vec_abs<T, N, Packed> &vec) {
+  if !consteval {
+    if constexpr (Packed && detail::packed<T, N>()) {
+      return [&]<size_t... I>(std::index_sequence<I...>) {
+        const detail::lanes<T, N> x{vec.data[I]...};
+        const detail::lanes<T, N> negated = -x;
+        return vec_abs<T, N, Packed>(std::array<T, N>{negated[I]...});
+      }(std::make_index_sequence<N>());
+    }
+  }
+  std::array<T, N> result{};
+  for (size_t i = 0; i < N; ++i) {
+    result[i] = static_cast<T>(-vec.data[i]);
+  }
+  return vec_abs<T, N, Packed>(result);
+}
+
+// Sum of the component-wise product, accumulated from the first component to
+// the last both at compile time and at run time
+template <typename T, size_t N, bool Packed>
+constexpr T dot(const vec_abs<T, N, Packed> &lhs,
+                const vec_abs<T, N, Packed> &rhs) {
+  const std::array<T, N> product =
+      detail::zip<std::multiplies<>, Packed>(lhs.data, rhs.data);
+  T result{};
+  for (const T &component : product) {
+    result += component;
+  }
+  return result;
+}
+
+template <typename T, bool Packed>
+constexpr vec_abs<T, 3, Packed> cross(const vec_abs<T, 3, Packed> &lhs,
+                                      const vec_abs<T, 3, Packed> &rhs) {
+  const std::array<T, 3> &a = lhs.data;
+  const std::array<T, 3> &b = rhs.data;
+  if !consteval {
+    if constexpr (Packed && detail::packed<T, 3>()) {
+      // a.yzx * b.zxy - a.zxy * b.yzx on the padded vectors
+      const detail::lanes<T, 3> x{a[0], a[1], a[2]};
+      const detail::lanes<T, 3> y{b[0], b[1], b[2]};
+      const detail::lanes<T, 3> result =
+          __builtin_shufflevector(x, x, 1, 2, 0, 3) *
+              __builtin_shufflevector(y, y, 2, 0, 1, 3) -
+          __builtin_shufflevector(x, x, 2, 0, 1, 3) *
+              __builtin_shufflevector(y, y, 1, 2, 0, 3);
+      return vec_abs<T, 3, Packed>(
+          std::array<T, 3>{result[0], result[1], result[2]});
+    }
+  }
+  return vec_abs<T, 3, Packed>(std::array<T, 3>{a[1] * b[2] - a[2] * b[1],
+                                                a[2] * b[0] - a[0] * b[2],
+                                                a[0] * b[1] - a[1] * b[0]});
+}
+
+// Euclidean length, double for integral components
+template <typename T, size_t N, bool Packed>
+constexpr auto norm(const vec_abs<T, N, Packed> &vec) {
+  using R = std::conditional_t<std::is_floating_point_v<T>, T, double>;
+  return detail::sqrt(static_cast<R>(dot(vec, vec)));
+}
+
+// Component-wise absolute value
+template <typename T, size_t N, bool Packed>
+constexpr vec_abs<T, N, Packed> abs(const vec_abs<T, N, Packed> &vec) {
+  if !consteval {
+    if constexpr (Packed && detail::packed<T, N>() && std::is_signed_v<T>) {
+      return [&]<size_t... I>(std::index_sequence<I...>) {
+        detail::lanes<T, N> x{vec.data[I]...};
+        if constexpr (std::is_floating_point_v<T>) {
+          // clear the sign bits
+          using bits = detail::lanes<detail::bits_t<T>, N>;
+          constexpr auto magnitude_bits = ~detail::bits_t<T>{} >> 1;
+          x = reinterpret_cast<detail::lanes<T, N>>(reinterpret_cast<bits>(x) &
+                                                    magnitude_bits);
+        } else {
+          x = x < 0 ? -x : x;
+        }
+        return vec_abs<T, N, Packed>(std::array<T, N>{x[I]...});
+      }(std::make_index_sequence<N>());
+    }
+  }
+  std::array<T, N> result{};
+  for (size_t i = 0; i < N; ++i) {
+    result[i] = detail::magnitude(vec.data[i]);
+  }
+  return vec_abs<T, N, Packed>(result);
+}
+
+// vec scaled to unit length; the zero vector has no direction and yields NaN
+// components
+template <std::floating_point T, size_t N, bool Packed>
+constexpr vec_abs<T, N, Packed> normalize(const vec_abs<T, N, Packed> &vec) {
+  return vec / norm(vec);
+}
 }  // namespace vec
 #endif  // VEC_ABS
@@ -0,0 +1,387 @@
+#ifndef VEC_ABS_SOA
+#define VEC_ABS_SOA
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+#include "vec_abs.hpp"
+
+// Asserts that the iterations of the following loop are independent, so that
+// it is vectorized without runtime checks for overlap between the streams
+#if defined(__clang__)
+#define VEC_ABS_INDEPENDENT _Pragma("clang loop vectorize(assume_safety)")
+#elif defined(__GNUC__)
+#define VEC_ABS_INDEPENDENT _Pragma("GCC ivdep")
+#else
+#define VEC_ABS_INDEPENDENT
+#endif
+
+namespace vec {
+/**
+ * Sequence of vec_abs<T, N> stored as structure of arrays: component k of
+ * every vector lies in stream k, and every stream starts on an alignment
+ * boundary. A loop over the vectors then reads and writes N unit-stride
+ * streams, which the compiler vectorizes across the vectors.
+ *
+ * Element access goes through a proxy reference that gathers the components
+ * into a vec_abs and scatters assignments back.
+ */
+template <typename T, size_t N>
+  requires std::is_trivially_copyable_v<T> && (N >= 1)
+class vec_abs_soa {
+ public:
+  using value_type = vec_abs<T, N>;
+
+  // Alignment of every stream in bytes, a cache line and an AVX-512 register
+  static constexpr size_t alignment = 64;
+
+  class reference;
+
+  explicit vec_abs_soa(size_t size = 0);
+
+  vec_abs_soa(const vec_abs_soa &other);
+
+  vec_abs_soa(vec_abs_soa &&other) noexcept;
+
+  vec_abs_soa &operator=(const vec_abs_soa &other);
+
+  vec_abs_soa &operator=(vec_abs_soa &&other) noexcept;
+
+  ~vec_abs_soa();
+
+  reference operator[](size_t i);
+  value_type operator[](size_t i) const;
+
+  std::span<T> component(size_t k);
+  std::span<const T> component(size_t k) const;
+
+  void push_back(const value_type &vec);
+  void resize(size_t size);
+  void reserve(size_t capacity);
+  void clear();
+
+  [[nodiscard]] size_t size() const { return size_; }
+  [[nodiscard]] size_t capacity() const { return capacity_; }
+  [[nodiscard]] bool empty() const { return size_ == 0; }
+
+ private:
+  // Stream k starts at data_ + k * capacity_
+  T *data_ = nullptr;
+  size_t size_ = 0;
+  size_t capacity_ = 0;
+
+  void reallocate(size_t capacity);
+};
+
+/**
+ * Proxy for the vector at one index of a vec_abs_soa
+ */
+template <typename T, size_t N>
+  requires std::is_trivially_copyable_v<T> && (N >= 1)
+class vec_abs_soa<T, N>::reference {
+ public:
+  operator value_type() const {
+    std::array<T, N> components;
+    for (size_t k = 0; k < N; ++k) {
+      components[k] = element_[k * stride_];
+    }
+    return value_type(components);
+  }
+
+  const reference &operator=(const value_type &vec) const {
+    for (size_t k = 0; k < N; ++k) {
+      element_[k * stride_] = vec.data[k];
+    }
+    return *this;
+  }
+
+  const reference &operator=(const reference &other) const {
+    return *this = static_cast<value_type>(other);
+  }
+
+  // Component k of the vector
+  T &operator[](size_t k) const { return element_[k * stride_]; }
+
+ private:
+  friend class vec_abs_soa;
+
+  reference(T *element, size_t stride) : element_(element), stride_(stride) {}
+
+  T *element_;
+  size_t stride_;
+};
+
+template <typename T, size_t N>
+  requires std::is_trivially_copyable_v<T> && (N >= 1)
+vec_abs_soa<T, N>::vec_abs_soa(size_t size) {
+  resize(size);
+}
+
+template <typename T, size_t N>
+  requires std::is_trivially_copyable_v<T> && (N >= 1)
+vec_abs_soa<T, N>::vec_abs_soa(const vec_abs_soa &other) {
+  reallocate(other.size_);
+  size_ = other.size_;
+  for (size_t k = 0; k < N; ++k) {
+    std::copy_n(other.data_ + k * other.capacity_, size_,
+                data_ + k * capacity_);
+  }
+}
+
+template <typename T, size_t N>
+  requires std::is_trivially_copyable_v<T> && (N >= 1)
+vec_abs_soa<T, N>::vec_abs_soa(vec_abs_soa &&other) noexcept
+    : data_(std::exchange(other.data_, nullptr)),
+      size_(std::exchange(other.size_, 0)),
+      capacity_(std::exchange(other.capacity_, 0)) {}
+
+template <typename T, size_t N>
+  requires std::is_trivially_copyable_v<T> && (N >= 1)
+vec_abs_soa<T, N> &vec_abs_soa<T, N>::operator=(const vec_abs_soa &other) {
+  if (this != &other) {
+    vec_abs_soa copy(other);
+    *this = std::move(copy);
+  }
+  return *this;
+}
+
+template <typename T, size_t N>
+  requires std::is_trivially_copyable_v<T> && (N >= 1)
+vec_abs_soa<T, N> &vec_abs_soa<T, N>::operator=(vec_abs_soa &&other) noexcept {
+  std::swap(data_, other.data_);
+  std::swap(size_, other.size_);
+  std::swap(capacity_, other.capacity_);
+  return *this;
+}
+
+template <typename T, size_t N>
+  requires std::is_trivially_copyable_v<T> && (N >= 1)
+vec_abs_soa<T, N>::~vec_abs_soa() {
+  ::operator delete(data_, std::align_val_t{alignment});
+}
+
+template <typename T, size_t N>
+  requires std::is_trivially_copyable_v<T> && (N >= 1)
+typename vec_abs_soa<T, N>::reference vec_abs_soa<T, N>::operator[](size_t i) {
+  assert(i < size_);
+  return reference(data_ + i, capacity_);
+}
+
+template <typename T, size_t N>
+  requires std::is_trivially_copyable_v<T> && (N >= 1)
+typename vec_abs_soa<T, N>::value_type vec_abs_soa<T, N>::operator[](
+    size_t i) const {
+  assert(i < size_);
+  std::array<T, N> components;
+  for (size_t k = 0; k < N; ++k) {
+    components[k] = data_[k * capacity_ + i];
+  }
+  return value_type(components);
+}
+
+template <typename T, size_t N>
+  requires std::is_trivially_copyable_v<T> && (N >= 1)
+std::span<T> vec_abs_soa<T, N>::component(size_t k) {
+  assert(k < N);
+  return {data_ + k * capacity_, size_};
+}
+
+template <typename T, size_t N>
+  requires std::is_trivially_copyable_v<T> && (N >= 1)
+std::span<const T> vec_abs_soa<T, N>::component(size_t k) const {
+  assert(k < N);
+  return {data_ + k * capacity_, size_};
+}
+
+template <typename T, size_t N>
+  requires std::is_trivially_copyable_v<T> && (N >= 1)
+void vec_abs_soa<T, N>::push_back(const value_type &vec) {
+  if (size_ == capacity_) {
+    reallocate(std::max<size_t>(2 * capacity_, 1));
+  }
+  ++size_;
+  (*this)[size_ - 1] = vec;
+}
+
+template <typename T, size_t N>
+  requires std::is_trivially_copyable_v<T> && (N >= 1)
+void vec_abs_soa<T, N>::resize(size_t size) {
+  if (size > capacity_) {
+    reallocate(size);
+  }
+  for (size_t k = 0; size > size_ && k < N; ++k) {
+    std::fill(data_ + k * capacity_ + size_, data_ + k * capacity_ + size,
+              T{});
+  }
+  size_ = size;
+}
+
+template <typename T, size_t N>
+  requires std::is_trivially_copyable_v<T> && (N >= 1)
+void vec_abs_soa<T, N>::reserve(size_t capacity) {
+  if (capacity > capacity_) {
+    reallocate(capacity);
+  }
+}
+
+template <typename T, size_t N>
+  requires std::is_trivially_copyable_v<T> && (N >= 1)
+void vec_abs_soa<T, N>::clear() {
+  size_ = 0;
+}
+
+template <typename T, size_t N>
+  requires std::is_trivially_copyable_v<T> && (N >= 1)
+void vec_abs_soa<T, N>::reallocate(size_t capacity) {
+  // a whole number of alignment blocks per stream keeps every stream aligned
+  constexpr size_t block = std::max<size_t>(alignment / sizeof(T), 1);
+  capacity = (capacity + block - 1) / block * block;
+  T *data = static_cast<T *>(::operator new(N * capacity * sizeof(T),
+                                            std::align_val_t{alignment}));
+  for (size_t k = 0; k < N && data_ != nullptr; ++k) {
+    std::copy_n(data_ + k * capacity_, size_, data + k * capacity);
+  }
+  ::operator delete(data_, std::align_val_t{alignment});
+  data_ = data;
+  capacity_ = capacity;
+}
+
+namespace detail {
+// Components of vector i of the streams at data, capacity elements apart, as
+// a vector that operates component by component
+template <typename T, size_t N>
+vec_abs<T, N, false> gather(const T *data, size_t capacity, size_t i) {
+  return [&]<size_t... K>(std::index_sequence<K...>) {
+    return vec_abs<T, N, false>(std::array<T, N>{data[K * capacity + i]...});
+  }(std::make_index_sequence<N>());
+}
+
+// Per-lane partial sums of a reduce; lanes are independent so the loop adding
+// to them vectorizes without reassociating a single running sum
+template <typename R, size_t W>
+struct partial_sums {
+  std::array<R, W> lanes{};
+
+  void add(size_t j, const R &value) { lanes[j] += value; }
+
+  R total(R init) const {
+    for (const R &lane : lanes) {
+      init += lane;
+    }
+    return init;
+  }
+};
+
+template <typename U, size_t M, bool Packed, size_t W>
+struct partial_sums<vec_abs<U, M, Packed>, W> {
+  // component-major so that lane j of every component is a unit-stride store
+  std::array<std::array<U, W>, M> lanes{};
+
+  void add(size_t j, const vec_abs<U, M, Packed> &value) {
+    for (size_t k = 0; k < M; ++k) {
+      lanes[k][j] += value.data[k];
+    }
+  }
+
+  vec_abs<U, M, Packed> total(vec_abs<U, M, Packed> init) const {
+    for (size_t k = 0; k < M; ++k) {
+      for (const U &lane : lanes[k]) {
+        init.data[k] += lane;
+      }
+    }
+    return init;
+  }
+};
+}  // namespace detail
+
+/**
+ * Writes f(in[i]) to out[i] for every vector of in, resizing out to match.
+ * f is called with a vec_abs<T, N, false>, whose operations compile to scalar
+ * code per component that vectorizes across the vectors; it must return a
+ * vec_abs<T, N> of either kind. in and out may be the same container.
+ *
+ * Square roots, as in norm and normalize, only vectorize under
+ * -fno-math-errno; otherwise the errno side effect keeps them scalar calls.
+ */
+template <typename T, size_t N, typename F>
+void transform(const vec_abs_soa<T, N> &in, vec_abs_soa<T, N> &out, F f) {
+  out.resize(in.size());
+  const T *source = in.component(0).data();
+  T *destination = out.component(0).data();
+  const size_t source_capacity = in.capacity();
+  const size_t destination_capacity = out.capacity();
+  const size_t size = in.size();
+  VEC_ABS_INDEPENDENT
+  for (size_t i = 0; i < size; ++i) {
+    const auto result =
+        f(detail::gather<T, N>(source, source_capacity, i));
+    for (size_t k = 0; k < N; ++k) {
+      destination[k * destination_capacity + i] = result.data[k];
+    }
+  }
+}
+
+/**
+ * init plus the sum of f(in[i]) over every vector of in, f as in transform
+ * and returning a scalar or a vec_abs. The sum is accumulated in independent
+ * lanes that are added up at the end, so floating point results may differ in
+ * the last bits from a sum in index order.
+ */
+template <typename T, size_t N, typename R, typename F>
+R reduce(const vec_abs_soa<T, N> &in, R init, F f) {
+  // lanes of one vector register of the widest supported instruction set
+  constexpr size_t width = vec_abs_soa<T, N>::alignment / sizeof(T);
+  const T *source = in.component(0).data();
+  const size_t capacity = in.capacity();
+  const size_t size = in.size();
+  detail::partial_sums<R, width> sums;
+  size_t i = 0;
+  for (; i + width <= size; i += width) {
+    for (size_t j = 0; j < width; ++j) {
+      sums.add(j, f(detail::gather<T, N>(source, capacity, i + j)));
+    }
+  }
+  for (size_t j = 0; i < size; ++i, ++j) {
+    sums.add(j, f(detail::gather<T, N>(source, capacity, i)));
+  }
+  return sums.total(init);
+}
+
+/**
+ * Sum of the vectors of in
+ */
+template <typename T, size_t N>
+vec_abs<T, N> reduce(const vec_abs_soa<T, N> &in) {
+  return vec_abs<T, N>(reduce(in, vec_abs<T, N, false>(),
+                              [](const vec_abs<T, N, false> &vec) {
+                                return vec;
+                              }));
+}
+
+/**
+ * y[i] += a * x[i] for every vector, x and y of the same size
+ */
+template <typename T, size_t N>
+void axpy(const T &a, const vec_abs_soa<T, N> &x, vec_abs_soa<T, N> &y) {
+  assert(x.size() == y.size());
+  for (size_t k = 0; k < N; ++k) {
+    const T *source = x.component(k).data();
+    T *destination = y.component(k).data();
+    const size_t size = x.size();
+    VEC_ABS_INDEPENDENT
+    for (size_t i = 0; i < size; ++i) {
+      destination[i] += a * source[i];
+    }
+  }
+}
+}  // namespace vec
+
+#undef VEC_ABS_INDEPENDENT
+
+#endif  // VEC_ABS_SOA